@@ -0,0 +1,76 @@
+#include "FrameScheduler.h"
+
+#include <algorithm>
+
+FrameScheduler::FrameScheduler()
+	: bRedrawRequested(true)
+	, mainThreadID(std::this_thread::get_id())
+	, trailingFramesLeft(0)
+	, lastFrameTime(glfwGetTime())
+	, waitStartTime(lastFrameTime)
+	, windowStartTime(lastFrameTime)
+	, idleTime(0.0)
+	, frameCount(0)
+{}
+
+bool FrameScheduler::waitForNextFrame() {
+	const double period = 1.0 / this->settings.maxFPS;
+	this->beginWait();
+
+	if (this->bRedrawRequested.exchange(false)) this->trailingFramesLeft = this->settings.trailingFrames + 1;
+
+	// Nothing to draw: sleep until an event (or a worker) wakes us up.
+	if (this->trailingFramesLeft <= 0 && this->settings.bOnDemand) {
+		glfwWaitEventsTimeout(this->settings.idleTimeout);
+		if (this->bRedrawRequested.exchange(false)) this->trailingFramesLeft = this->settings.trailingFrames + 1;
+		if (this->trailingFramesLeft <= 0) {
+			this->endWait();
+			return false;
+		}
+	}
+
+	// A frame is due. Keep handling events while sleeping until its deadline.
+	double now = glfwGetTime();
+	while (now < this->lastFrameTime + period) {
+		glfwWaitEventsTimeout(this->lastFrameTime + period - now);
+		now = glfwGetTime();
+	}
+	glfwPollEvents();
+
+	if (this->bRedrawRequested.exchange(false)) this->trailingFramesLeft = this->settings.trailingFrames + 1;
+	this->trailingFramesLeft = std::max(0, this->trailingFramesLeft - 1);
+	this->lastFrameTime = now;
+	this->endWait();
+	return true;
+}
+
+void FrameScheduler::endFrame() {
+	this->frameCount++;
+	this->updateStats(glfwGetTime());
+}
+
+void FrameScheduler::requestRedraw() {
+	bool bWasRequested = this->bRedrawRequested.exchange(true);
+	if (!bWasRequested && std::this_thread::get_id() != this->mainThreadID) glfwPostEmptyEvent();
+}
+
+void FrameScheduler::beginWait() {
+	this->waitStartTime = glfwGetTime();
+}
+
+void FrameScheduler::endWait() {
+	double now = glfwGetTime();
+	this->idleTime += now - this->waitStartTime;
+	this->updateStats(now);
+}
+
+void FrameScheduler::updateStats(double now) {
+	double elapsed = now - this->windowStartTime;
+	if (elapsed < 1.0) return;
+	this->stats.idlePercent = std::min(100.0, 100.0 * this->idleTime / elapsed);
+	this->stats.busyPercent = 100.0 - this->stats.idlePercent;
+	this->stats.framesPerSecond = this->frameCount / elapsed;
+	this->windowStartTime = now;
+	this->idleTime = 0.0;
+	this->frameCount = 0;
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+//------------------------------------------------------------------------------
+// Paces the main loop. Instead of spinning until the frame period has elapsed,
+// the scheduler blocks inside glfwWaitEventsTimeout() and only lets a frame
+// through when something asked for one: input, a settings change, a finished
+// background job or an ongoing animation (held keys, active brush stroke...).
+//
+// Any thread may call requestRedraw(); calls from other threads also post an
+// empty event so the main thread wakes up from its wait.
+//------------------------------------------------------------------------------
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+
+#include <atomic>
+#include <thread>
+
+struct FrameSchedulerSettings {
+	double maxFPS = 120.0;
+	// Longest single wait while nothing is pending, so shouldClose() keeps being polled.
+	double idleTimeout = 0.5;
+	// Extra frames drawn after the last request so ImGui can settle hover/active states.
+	int trailingFrames = 3;
+	// When false the scheduler only limits the frame rate and never idles.
+	bool bOnDemand = true;
+};
+
+struct FrameSchedulerStats {
+	double busyPercent = 0.0;
+	double idlePercent = 0.0;
+	double framesPerSecond = 0.0;
+};
+
+class FrameScheduler {
+
+public:
+
+	FrameScheduler();
+
+	// Blocks until the next frame is due. Returns false if the wait ended
+	// without anything to draw (the caller should re-check shouldClose()).
+	bool waitForNextFrame();
+	void endFrame();
+
+	void requestRedraw();
+
+	FrameSchedulerSettings& getSettings() { return this->settings; }
+	const FrameSchedulerStats& getStats() const { return this->stats; }
+
+private:
+
+	void beginWait();
+	void endWait();
+	void updateStats(double now);
+
+private:
+
+	FrameSchedulerSettings settings;
+	FrameSchedulerStats stats;
+
+	std::atomic<bool> bRedrawRequested;
+	std::thread::id mainThreadID;
+	int trailingFramesLeft;
+
+	double lastFrameTime;
+	double waitStartTime;
+
+	// Accumulators for the current statistics window
+	double windowStartTime;
+	double idleTime;
+	int frameCount;
+
+};
@@ -3,6 +3,7 @@
 #include "GeomLoaderForOBJ.h"
 
 #include "Log.h";
+#include "JobSystem.h"
 
 #include "tiny_obj_loader.h"
 
@@ -21,66 +22,79 @@ CPU_Geometry GeomLoaderForOBJ::loadIntoCPUGeometry(std::string filename) {
 		throw std::runtime_error(warn + "\n" + err);
 	}
 
-	// Loop over "shapes" (described further down).
-	for (const auto& shape : shapes) {
-		size_t vertIndexOffset = 0;
+	// Every face vertex becomes one output vertex, so the flattened layout is known up front:
+	// shape k starts at the sum of the index counts of the shapes before it.
+	// Validation happens here on the calling thread so exceptions are thrown from the usual place.
+	std::vector<size_t> shapeOffsets(shapes.size() + 1, 0);
+	size_t numTexcoords = 0;
+	for (size_t s = 0; s < shapes.size(); s++) {
+		for (const tinyobj::index_t& idx : shapes[s].mesh.indices) {
+			// The skeleton is set up so that normals are required.
+			// So right now, we throw an exception if the .obj file
+			// does not have any normals.
+			if (idx.normal_index < 0) {
+				Log::error("Missing normals in OBJ file {}!", filename);
+				throw std::runtime_error("No normal data supplied!");
+			}
+			// The skeleton can tolerate missing texture coordinates.
+			if (idx.texcoord_index >= 0) numTexcoords++;
+		}
+		shapeOffsets[s + 1] = shapeOffsets[s] + shapes[s].mesh.indices.size();
+	}
+	const size_t numVerts = shapeOffsets.back();
+	const bool bAllTexcoords = numTexcoords == numVerts;
 
-		// Each shape has multiple faces.
-		// These should be triangulated by default by the loader, but we might as
-		// well still read in the size from the list. You may want to change this
-		// to check if the number is 3 and throw an exception if not. Up to you.
-		for (size_t face = 0; face < shape.mesh.num_face_vertices.size(); face++) {
-			size_t numFaceVerts = size_t(shape.mesh.num_face_vertices[face]);
+	geom.verts.resize(numVerts);
+	geom.normals.resize(numVerts);
+	if (bAllTexcoords) geom.uvs.resize(numVerts);
 
-			// Loop over vertices in the face. Again, unless there's a bug with
-			// the obj loader library or something, this *should* be 3 verts.
-			for (size_t v = 0; v < numFaceVerts; v++) {
+	// Loop over "shapes" (described further down). Faces of the loaded file are
+	// triangulated by default, so each index simply maps to the next output vertex.
+	for (size_t s = 0; s < shapes.size(); s++) {
+		const tinyobj::shape_t& shape = shapes[s];
+		const size_t offset = shapeOffsets[s];
+		JobSystem::get().parallelFor(0, int(shape.mesh.indices.size()), 4096, [&](int begin, int end) {
+			for (size_t v = begin; v < size_t(end); v++) {
 				// Get the vertex by its index. Get the x, y, & z components.
-				tinyobj::index_t idx = shape.mesh.indices[vertIndexOffset + v];
+				tinyobj::index_t idx = shape.mesh.indices[v];
 				tinyobj::real_t vx = attrib.vertices[3 * size_t(idx.vertex_index) + 0];
 				tinyobj::real_t vy = attrib.vertices[3 * size_t(idx.vertex_index) + 1];
 				tinyobj::real_t vz = attrib.vertices[3 * size_t(idx.vertex_index) + 2];
+				geom.verts[offset + v] = glm::vec3(vx, vy, vz);
 
-				geom.verts.push_back(glm::vec3(vx, vy, vz));
-
-				// You could have a .obj file without normal data.
-				// In this case, `normal_index` would be negative.
-				if (idx.normal_index >= 0) {
-					// If there is normal data, we add it to our CPU_Geometry object.
-					tinyobj::real_t nx = attrib.normals[3 * size_t(idx.normal_index) + 0];
-					tinyobj::real_t ny = attrib.normals[3 * size_t(idx.normal_index) + 1];
-					tinyobj::real_t nz = attrib.normals[3 * size_t(idx.normal_index) + 2];
-					geom.normals.push_back(glm::vec3(nx, ny, nz));
-				}
-				else {
-					// The skeleton is set up so that normals are required.
-					// So right now, we throw an exception if the .obj file
-					// does not have any normals.
-					// You could change this if you want. E.g., you could have
-					// a shader not relying on normals, or you could
-					// auto-generate the normals here.
-					Log::error("Missing normals in OBJ file {}!", filename);
-					throw std::runtime_error("No normal data supplied!");
-				}
+				tinyobj::real_t nx = attrib.normals[3 * size_t(idx.normal_index) + 0];
+				tinyobj::real_t ny = attrib.normals[3 * size_t(idx.normal_index) + 1];
+				tinyobj::real_t nz = attrib.normals[3 * size_t(idx.normal_index) + 2];
+				geom.normals[offset + v] = glm::vec3(nx, ny, nz);
 
-				// The skeleton can tolerate missing texture coordinates.
-				// So we simply check if they exist and add them if so.
-				if (idx.texcoord_index >= 0) {
+				if (bAllTexcoords) {
 					tinyobj::real_t tx = attrib.texcoords[2 * size_t(idx.texcoord_index) + 0];
 					tinyobj::real_t ty = attrib.texcoords[2 * size_t(idx.texcoord_index) + 1];
-					geom.uvs.push_back(glm::vec2(tx, ty));
+					geom.uvs[offset + v] = glm::vec2(tx, ty);
 				}
-
 			}
-			vertIndexOffset += numFaceVerts;
+		}, "obj import");
 
-			// If your .obj comes with a material, here is where you'd access
-			// it and do something with it. To see how to use this
-			// tinyobj::material_t, you can see the source code at:
-			// https://github.com/tinyobjloader/tinyobjloader/blob/v2.0.0rc10/tiny_obj_loader.h#L181
-			// Currently, the skeleton does not use them, but you may change that.
-			//
-			// shape.mesh.material_ids[face]; // Materials are per-face. 
+		// If your .obj comes with a material, here is where you'd access
+		// it and do something with it. To see how to use this
+		// tinyobj::material_t, you can see the source code at:
+		// https://github.com/tinyobjloader/tinyobjloader/blob/v2.0.0rc10/tiny_obj_loader.h#L181
+		// Currently, the skeleton does not use them, but you may change that.
+		//
+		// shape.mesh.material_ids[face]; // Materials are per-face. 
+	}
+
+	// Files that only have texture coordinates on some faces keep the sparse
+	// layout they always had; this is rare enough to stay serial.
+	if (!bAllTexcoords && numTexcoords > 0) {
+		geom.uvs.reserve(numTexcoords);
+		for (const auto& shape : shapes) {
+			for (const tinyobj::index_t& idx : shape.mesh.indices) {
+				if (idx.texcoord_index < 0) continue;
+				tinyobj::real_t tx = attrib.texcoords[2 * size_t(idx.texcoord_index) + 0];
+				tinyobj::real_t ty = attrib.texcoords[2 * size_t(idx.texcoord_index) + 1];
+				geom.uvs.push_back(glm::vec2(tx, ty));
+			}
 		}
 	}
 	return geom;
@@ -27,3 +27,15 @@ void GPU_Geometry::setUVs(const std::vector<glm::vec2>& uvs) {
 void GPU_Geometry::setNormals(const std::vector<glm::vec3>& norms) {
 	normalsBuffer.uploadData(sizeof(glm::vec3) * norms.size(), norms.data(), GL_STATIC_DRAW);
 }
+
+void GPU_Geometry::updateVerts(const std::vector<glm::vec3>& verts, size_t first, size_t count) {
+	vertBuffer.updateData(sizeof(glm::vec3) * first, sizeof(glm::vec3) * count, verts.data() + first);
+}
+
+void GPU_Geometry::updateNormals(const std::vector<glm::vec3>& norms, size_t first, size_t count) {
+	normalsBuffer.updateData(sizeof(glm::vec3) * first, sizeof(glm::vec3) * count, norms.data() + first);
+}
+
+void GPU_Geometry::updateCols(const std::vector<glm::vec3>& cols, size_t first, size_t count) {
+	colBuffer.updateData(sizeof(glm::vec3) * first, sizeof(glm::vec3) * count, cols.data() + first);
+}
@@ -38,6 +38,11 @@ public:
 	void setUVs(const std::vector<glm::vec2>& uvs);
 	void setNormals(const std::vector<glm::vec3>& norms);
 
+	// Re-upload `count` elements starting at `first` without reallocating the buffers
+	void updateVerts(const std::vector<glm::vec3>& verts, size_t first, size_t count);
+	void updateNormals(const std::vector<glm::vec3>& norms, size_t first, size_t count);
+	void updateCols(const std::vector<glm::vec3>& cols, size_t first, size_t count);
+
 private:
 	// note: due to how OpenGL works, vao needs to be
 	// defined and initialized before the vertex buffers
@@ -0,0 +1,84 @@
+#pragma once
+
+//------------------------------------------------------------------------------
+// Fixed-size single-producer/single-consumer ring buffer for input events.
+//
+// The GLFW callbacks are the only producer: they stamp each event with
+// glfwGetTime() and push it without allocating or locking. The consumer drains
+// everything once per frame, so no intermediate cursor position is lost even
+// when several arrive between two frames. Head and tail are atomics, so the
+// consumer does not have to be the thread that polls events; a simulation
+// thread may drain the ring as long as it is the only one doing so.
+//------------------------------------------------------------------------------
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+enum class InputEventType : uint8_t { Key, MouseButton, CursorPos, Scroll };
+
+struct InputEvent {
+	InputEventType type = InputEventType::Key;
+	// Key / button code, action and modifiers (Key, MouseButton)
+	int code = 0;
+	int action = 0;
+	int mods = 0;
+	// Cursor position (CursorPos) or scroll offsets (Scroll)
+	double x = 0.0;
+	double y = 0.0;
+	// glfwGetTime() when the callback fired
+	double time = 0.0;
+	// ImGui wanted the mouse when the event arrived
+	bool bOverUI = false;
+};
+
+template <typename T, size_t Capacity>
+class SPSCRing {
+
+	static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "SPSCRing capacity must be a power of two");
+
+public:
+
+	SPSCRing() : head(0), tail(0), dropped(0) {}
+
+	SPSCRing(const SPSCRing&) = delete;
+	SPSCRing& operator=(const SPSCRing&) = delete;
+
+	// Producer side. Returns false (and counts the event as dropped) when the ring is full.
+	bool push(const T& item) {
+		const size_t currentTail = this->tail.load(std::memory_order_relaxed);
+		if (currentTail - this->head.load(std::memory_order_acquire) >= Capacity) {
+			this->dropped.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+		this->items[currentTail & (Capacity - 1)] = item;
+		this->tail.store(currentTail + 1, std::memory_order_release);
+		return true;
+	}
+
+	// Consumer side.
+	bool pop(T& item) {
+		const size_t currentHead = this->head.load(std::memory_order_relaxed);
+		if (currentHead == this->tail.load(std::memory_order_acquire)) return false;
+		item = this->items[currentHead & (Capacity - 1)];
+		this->head.store(currentHead + 1, std::memory_order_release);
+		return true;
+	}
+
+	size_t size() const { return this->tail.load(std::memory_order_acquire) - this->head.load(std::memory_order_acquire); }
+	bool empty() const { return this->size() == 0; }
+	static constexpr size_t capacity() { return Capacity; }
+	uint64_t getDroppedCount() const { return this->dropped.load(std::memory_order_relaxed); }
+
+private:
+
+	// Producer and consumer indices live on separate cache lines
+	alignas(64) std::atomic<size_t> head;
+	alignas(64) std::atomic<size_t> tail;
+	alignas(64) std::atomic<uint64_t> dropped;
+	std::array<T, Capacity> items;
+
+};
+
+using InputEventRing = SPSCRing<InputEvent, 1024>;
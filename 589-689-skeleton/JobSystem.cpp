@@ -0,0 +1,347 @@
+#include "JobSystem.h"
+
+#include <algorithm>
+#include <chrono>
+
+#if defined(_WIN32)
+#include <Windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "Log.h"
+
+namespace {
+	// Owned by the unique_ptr (torn down after main returns), read lock-free through the raw pointer
+	std::mutex globalJobSystemMutex;
+	std::unique_ptr<JobSystem> globalJobSystem;
+	std::atomic<JobSystem*> globalJobSystemPtr(nullptr);
+
+	thread_local int workerIndexTLS = -1;
+}
+
+// MARK: - JobSystem
+
+void JobSystem::initialize(const JobSystemSettings& settings) {
+	std::lock_guard<std::mutex> lock(globalJobSystemMutex);
+	if (globalJobSystem) {
+		Log::warn("Job system is already running, keeping the existing workers");
+		return;
+	}
+	globalJobSystem.reset(new JobSystem(settings));
+	globalJobSystemPtr = globalJobSystem.get();
+}
+
+JobSystem& JobSystem::get() {
+	JobSystem* jobSystem = globalJobSystemPtr.load(std::memory_order_acquire);
+	if (jobSystem) return *jobSystem;
+	std::lock_guard<std::mutex> lock(globalJobSystemMutex);
+	if (!globalJobSystem) {
+		globalJobSystem.reset(new JobSystem(JobSystemSettings()));
+		globalJobSystemPtr = globalJobSystem.get();
+	}
+	return *globalJobSystem;
+}
+
+JobSystem::JobSystem(const JobSystemSettings& settings)
+	: settings(settings)
+	, queuedTasks(0)
+	, bStop(false)
+	, tasksExecuted(0)
+	, tasksStolen(0)
+{
+	int workerCount = settings.workerCount;
+	if (workerCount <= 0) workerCount = std::max(1, int(std::thread::hardware_concurrency()) - 1);
+	this->queues.reserve(workerCount);
+	for (int i = 0; i < workerCount; i++) this->queues.push_back(std::make_unique<WorkQueue>());
+	this->workers.reserve(workerCount);
+	for (int i = 0; i < workerCount; i++) {
+		this->workers.emplace_back(&JobSystem::workerLoop, this, i);
+		if (settings.bPinThreads) this->pinThread(this->workers.back(), settings.firstPinnedCore + i);
+	}
+	Log::info("Job system started with {} workers", workerCount);
+}
+
+JobSystem::~JobSystem() {
+	// Finish whatever is still queued (e.g. detached continuations) before stopping
+	while (this->executeOne()) {}
+	{
+		std::lock_guard<std::mutex> lock(this->sleepMutex);
+		this->bStop = true;
+	}
+	this->sleepCondition.notify_all();
+	for (std::thread& worker : this->workers) {
+		if (worker.joinable()) worker.join();
+	}
+}
+
+void JobSystem::parallelFor(int begin, int end, int grain, const std::function<void(int, int)>& body, const char* name) {
+	if (end <= begin) return;
+	grain = std::max(1, grain);
+	if (end - begin <= grain) {
+		body(begin, end);
+		return;
+	}
+	TaskGroup group;
+	for (int i = begin; i < end; i += grain) {
+		int chunkEnd = std::min(end, i + grain);
+		group.run([&body, i, chunkEnd]() { body(i, chunkEnd); }, name);
+	}
+	group.wait();
+}
+
+void JobSystem::parallelFor2D(const Range2D& range, int rowGrain, int colGrain, const std::function<void(const Range2D&)>& body, const char* name) {
+	if (range.rowEnd <= range.rowBegin || range.colEnd <= range.colBegin) return;
+	rowGrain = std::max(1, rowGrain);
+	colGrain = std::max(1, colGrain);
+	if (range.rowEnd - range.rowBegin <= rowGrain && range.colEnd - range.colBegin <= colGrain) {
+		body(range);
+		return;
+	}
+	TaskGroup group;
+	for (int i = range.rowBegin; i < range.rowEnd; i += rowGrain) {
+		for (int j = range.colBegin; j < range.colEnd; j += colGrain) {
+			Range2D tile = { i, std::min(range.rowEnd, i + rowGrain), j, std::min(range.colEnd, j + colGrain) };
+			group.run([&body, tile]() { body(tile); }, name);
+		}
+	}
+	group.wait();
+}
+
+int JobSystem::currentWorkerIndex() {
+	return workerIndexTLS;
+}
+
+void JobSystem::setInstrumentation(const JobInstrumentation& instrumentation) {
+	std::lock_guard<std::mutex> lock(this->instrumentationMutex);
+	if (!instrumentation.onTaskBegin && !instrumentation.onTaskEnd) {
+		this->instrumentation.reset();
+		return;
+	}
+	this->instrumentation = std::make_shared<const JobInstrumentation>(instrumentation);
+}
+
+JobSystemStats JobSystem::getStats() const {
+	JobSystemStats stats;
+	stats.tasksExecuted = this->tasksExecuted.load();
+	stats.tasksStolen = this->tasksStolen.load();
+	return stats;
+}
+
+void JobSystem::submit(Task task) {
+	int index = workerIndexTLS;
+	WorkQueue& queue = (index >= 0 && index < int(this->queues.size())) ? *this->queues[index] : this->injectionQueue;
+	{
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		queue.tasks.push_back(std::move(task));
+	}
+	this->queuedTasks++;
+	{
+		// Taking the lock orders this notify after a worker's predicate check
+		std::lock_guard<std::mutex> lock(this->sleepMutex);
+	}
+	this->sleepCondition.notify_one();
+}
+
+bool JobSystem::takeTask(Task& task, TaskGroup* group) {
+	int index = workerIndexTLS;
+
+	// Own deque first, newest task (LIFO) for cache locality
+	if (index >= 0 && index < int(this->queues.size())) {
+		if (this->takeFrom(*this->queues[index], true, group, task)) return true;
+	}
+
+	// Then the injection queue fed by non-worker threads
+	if (this->takeFrom(this->injectionQueue, false, group, task)) return true;
+
+	// Finally steal the oldest task of another worker
+	int queueCount = int(this->queues.size());
+	int start = (index >= 0) ? index + 1 : 0;
+	for (int n = 0; n < queueCount; n++) {
+		int victim = (start + n) % queueCount;
+		if (victim == index) continue;
+		if (this->takeFrom(*this->queues[victim], false, group, task)) {
+			this->tasksStolen++;
+			return true;
+		}
+	}
+	return false;
+}
+
+bool JobSystem::takeFrom(WorkQueue& queue, bool bNewest, TaskGroup* group, Task& task) {
+	std::lock_guard<std::mutex> lock(queue.mutex);
+	if (queue.tasks.empty()) return false;
+	if (!group) {
+		if (bNewest) {
+			task = std::move(queue.tasks.back());
+			queue.tasks.pop_back();
+		} else {
+			task = std::move(queue.tasks.front());
+			queue.tasks.pop_front();
+		}
+		return true;
+	}
+	// A waiter skips everything that is not its own, the deques stay short so the scan is cheap
+	const int count = int(queue.tasks.size());
+	for (int n = 0; n < count; n++) {
+		auto it = bNewest ? queue.tasks.begin() + (count - 1 - n) : queue.tasks.begin() + n;
+		if (it->group != group) continue;
+		task = std::move(*it);
+		queue.tasks.erase(it);
+		return true;
+	}
+	return false;
+}
+
+bool JobSystem::executeOne(TaskGroup* group) {
+	Task task;
+	if (!this->takeTask(task, group)) return false;
+	this->queuedTasks--;
+	this->execute(task);
+	return true;
+}
+
+void JobSystem::execute(Task& task) {
+	std::shared_ptr<const JobInstrumentation> hooks;
+	{
+		std::lock_guard<std::mutex> lock(this->instrumentationMutex);
+		hooks = this->instrumentation;
+	}
+
+	JobTaskInfo info;
+	info.name = task.name;
+	info.workerIndex = workerIndexTLS;
+	std::chrono::steady_clock::time_point start;
+	if (hooks) {
+		if (hooks->onTaskBegin) hooks->onTaskBegin(info);
+		start = std::chrono::steady_clock::now();
+	}
+
+	std::exception_ptr exception;
+	try {
+		task.function();
+	} catch (...) {
+		exception = std::current_exception();
+		if (!task.group) Log::error("Unhandled exception in detached task '{}'", task.name);
+	}
+
+	if (hooks) {
+		info.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		if (hooks->onTaskEnd) hooks->onTaskEnd(info);
+	}
+
+	this->tasksExecuted++;
+	if (task.group) task.group->finish(exception);
+}
+
+void JobSystem::workerLoop(int workerIndex) {
+	workerIndexTLS = workerIndex;
+	while (true) {
+		if (this->executeOne()) continue;
+		std::unique_lock<std::mutex> lock(this->sleepMutex);
+		this->sleepCondition.wait(lock, [this]() { return this->bStop.load() || this->queuedTasks.load() > 0; });
+		if (this->bStop) return;
+	}
+}
+
+void JobSystem::pinThread(std::thread& thread, int core) {
+	if (core < 0 || core >= int(std::thread::hardware_concurrency())) {
+		Log::warn("Cannot pin job worker to core {}", core);
+		return;
+	}
+#if defined(_WIN32)
+	SetThreadAffinityMask(thread.native_handle(), DWORD_PTR(1) << core);
+#elif defined(__linux__)
+	cpu_set_t cpuSet;
+	CPU_ZERO(&cpuSet);
+	CPU_SET(core, &cpuSet);
+	pthread_setaffinity_np(thread.native_handle(), sizeof(cpu_set_t), &cpuSet);
+#else
+	Log::warn("Thread pinning is not supported on this platform");
+#endif
+}
+
+// MARK: - TaskGroup
+
+TaskGroup::TaskGroup()
+	: pending(0)
+{}
+
+TaskGroup::~TaskGroup() {
+	// Tasks reference the group, it cannot go away before they are done
+	this->waitUntilDone();
+}
+
+void TaskGroup::run(std::function<void()> task, const char* name) {
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		this->pending++;
+	}
+	JobSystem::Task entry;
+	entry.function = std::move(task);
+	entry.group = this;
+	entry.name = name;
+	JobSystem::get().submit(std::move(entry));
+}
+
+void TaskGroup::then(std::function<void()> continuation, const char* name) {
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		if (this->pending > 0) {
+			this->continuations.emplace_back(std::move(continuation), name);
+			return;
+		}
+	}
+	JobSystem::Task entry;
+	entry.function = std::move(continuation);
+	entry.name = name;
+	JobSystem::get().submit(std::move(entry));
+}
+
+void TaskGroup::wait() {
+	this->waitUntilDone();
+	std::exception_ptr exception;
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		std::swap(exception, this->firstException);
+	}
+	if (exception) std::rethrow_exception(exception);
+}
+
+void TaskGroup::waitUntilDone() {
+	JobSystem& jobSystem = JobSystem::get();
+	while (!this->isDone()) {
+		if (jobSystem.executeOne(this)) continue;
+		// Nothing of this group is queued, the rest is running on other threads. The timeout
+		// picks up tasks those threads add to the group in the meantime.
+		std::unique_lock<std::mutex> lock(this->mutex);
+		this->doneCondition.wait_for(lock, std::chrono::milliseconds(1), [this]() { return this->pending == 0; });
+	}
+}
+
+bool TaskGroup::isDone() const {
+	std::lock_guard<std::mutex> lock(this->mutex);
+	return this->pending == 0;
+}
+
+void TaskGroup::finish(std::exception_ptr exception) {
+	std::vector<std::pair<std::function<void()>, const char*>> ready;
+	{
+		// The counter only changes under the lock, so a waiter that sees zero
+		// can safely destroy the group once it has taken the lock itself.
+		std::lock_guard<std::mutex> lock(this->mutex);
+		if (exception && !this->firstException) this->firstException = exception;
+		if (--this->pending == 0) {
+			std::swap(ready, this->continuations);
+			// Notified under the lock, the waiter may destroy the group as soon as it wakes
+			this->doneCondition.notify_all();
+		}
+	}
+	for (auto& continuation : ready) {
+		JobSystem::Task entry;
+		entry.function = std::move(continuation.first);
+		entry.name = continuation.second;
+		JobSystem::get().submit(std::move(entry));
+	}
+}
@@ -0,0 +1,175 @@
+#pragma once
+
+//------------------------------------------------------------------------------
+// A small work-stealing task scheduler shared by the whole application.
+//
+// Every worker owns a deque: it pushes and pops its own tasks at the back and
+// steals from the front of other workers' deques when it runs dry. Threads
+// that are not workers (e.g. the main thread) submit through a shared
+// injection queue. A thread waiting on a TaskGroup only helps with that
+// group's own tasks, so nested parallelFor calls from inside tasks never
+// deadlock and a wait never picks up some unrelated long job, and sleeps once
+// nothing of its group is left to take.
+//
+// Example:
+//		TaskGroup group;
+//		group.run([&]() { ... }, "load");
+//		group.then([&]() { ... });	// runs once everything in the group is done
+//		group.wait();
+//
+//		JobSystem::get().parallelFor2D(Range2D{ 0, rows, 0, cols }, 16, 16, [&](const Range2D& r) { ... }, "evaluate");
+//------------------------------------------------------------------------------
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <vector>
+
+struct JobSystemSettings {
+	// 0 uses one worker per hardware thread, minus the main thread.
+	int workerCount = 0;
+	// Pin worker i to logical core (firstPinnedCore + i).
+	bool bPinThreads = false;
+	int firstPinnedCore = 1;
+};
+
+// Passed to the instrumentation hooks for every executed task.
+struct JobTaskInfo {
+	const char* name = "task";
+	int workerIndex = -1;
+	double seconds = 0.0;
+};
+
+struct JobInstrumentation {
+	std::function<void(const JobTaskInfo&)> onTaskBegin;
+	std::function<void(const JobTaskInfo&)> onTaskEnd;
+};
+
+struct JobSystemStats {
+	uint64_t tasksExecuted = 0;
+	uint64_t tasksStolen = 0;
+};
+
+// Half-open index rectangle [rowBegin, rowEnd) x [colBegin, colEnd).
+struct Range2D {
+	int rowBegin = 0;
+	int rowEnd = 0;
+	int colBegin = 0;
+	int colEnd = 0;
+};
+
+class TaskGroup;
+
+class JobSystem {
+
+public:
+
+	// Call once at startup. get() falls back to default settings if initialize() was never called.
+	static void initialize(const JobSystemSettings& settings = JobSystemSettings());
+	static JobSystem& get();
+
+	~JobSystem();
+
+	JobSystem(const JobSystem&) = delete;
+	JobSystem& operator=(const JobSystem&) = delete;
+
+	void parallelFor(int begin, int end, int grain, const std::function<void(int, int)>& body, const char* name = "parallelFor");
+	void parallelFor2D(const Range2D& range, int rowGrain, int colGrain, const std::function<void(const Range2D&)>& body, const char* name = "parallelFor2D");
+
+	int getWorkerCount() const { return int(this->workers.size()); }
+	// Number of threads that may execute tasks concurrently (workers plus one helping caller).
+	int getConcurrency() const { return this->getWorkerCount() + 1; }
+	// Index of the calling worker, or -1 when called from a thread outside the pool.
+	static int currentWorkerIndex();
+
+	void setInstrumentation(const JobInstrumentation& instrumentation);
+	JobSystemStats getStats() const;
+	const JobSystemSettings& getSettings() const { return this->settings; }
+
+private:
+
+	friend class TaskGroup;
+
+	struct Task {
+		std::function<void()> function;
+		TaskGroup* group = nullptr;
+		const char* name = "task";
+	};
+
+	struct WorkQueue {
+		std::mutex mutex;
+		std::deque<Task> tasks;
+	};
+
+	explicit JobSystem(const JobSystemSettings& settings);
+
+	void submit(Task task);
+	// Runs one queued task, only one of `group` when it is given
+	bool executeOne(TaskGroup* group = nullptr);
+	bool takeTask(Task& task, TaskGroup* group);
+	bool takeFrom(WorkQueue& queue, bool bNewest, TaskGroup* group, Task& task);
+	void execute(Task& task);
+	void workerLoop(int workerIndex);
+	void pinThread(std::thread& thread, int core);
+
+private:
+
+	JobSystemSettings settings;
+
+	std::vector<std::thread> workers;
+	std::vector<std::unique_ptr<WorkQueue>> queues;
+	WorkQueue injectionQueue;
+
+	std::atomic<int> queuedTasks;
+	std::atomic<bool> bStop;
+	std::mutex sleepMutex;
+	std::condition_variable sleepCondition;
+
+	std::mutex instrumentationMutex;
+	std::shared_ptr<const JobInstrumentation> instrumentation;
+
+	std::atomic<uint64_t> tasksExecuted;
+	std::atomic<uint64_t> tasksStolen;
+
+};
+
+// Tracks a set of tasks. wait() helps executing the group's queued tasks, sleeps while the
+// rest run elsewhere, and rethrows the first exception a task threw.
+class TaskGroup {
+
+public:
+
+	TaskGroup();
+	~TaskGroup();
+
+	TaskGroup(const TaskGroup&) = delete;
+	TaskGroup& operator=(const TaskGroup&) = delete;
+
+	void run(std::function<void()> task, const char* name = "task");
+	// Schedules `continuation` as a new task once the group becomes idle.
+	void then(std::function<void()> continuation, const char* name = "continuation");
+	void wait();
+	bool isDone() const;
+
+private:
+
+	friend class JobSystem;
+
+	void finish(std::exception_ptr exception);
+	void waitUntilDone();
+
+private:
+
+	mutable std::mutex mutex;
+	std::condition_variable doneCondition;
+	int pending;
+	std::exception_ptr firstException;
+	std::vector<std::pair<std::function<void()>, const char*>> continuations;
+
+};
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+// Cholesky factorisation of a symmetric positive definite band matrix. Only the lower band is
+// stored, `bandwidth + 1` entries per row, so factoring costs O(n * bandwidth^2) and every
+// solve O(n * bandwidth). A factored instance is read-only and can be shared by threads solving
+// different right-hand sides.
+class BandedCholesky {
+
+public:
+
+	void resize(int n, int bandwidth) {
+		this->n = n;
+		this->bandwidth = bandwidth;
+		this->band.assign(size_t(n) * (bandwidth + 1), 0.0);
+	}
+
+	int size() const { return this->n; }
+
+	// Entry (i, j) of the lower band, i - bandwidth <= j <= i
+	double& at(int i, int j) { return this->band[size_t(i) * (this->bandwidth + 1) + (i - j)]; }
+	double at(int i, int j) const { return this->band[size_t(i) * (this->bandwidth + 1) + (i - j)]; }
+
+	// Replaces the matrix with its factor L, A = L L^T. Returns false if A is not positive definite.
+	bool factor() {
+		for (int i = 0; i < this->n; i++) {
+			for (int j = std::max(0, i - this->bandwidth); j <= i; j++) {
+				double sum = this->at(i, j);
+				for (int p = std::max(0, i - this->bandwidth); p < j; p++) sum -= this->at(i, p) * this->at(j, p);
+				if (j < i) {
+					this->at(i, j) = sum / this->at(j, j);
+				} else {
+					if (sum <= 0.0) return false;
+					this->at(i, i) = std::sqrt(sum);
+				}
+			}
+		}
+		return true;
+	}
+
+	// Solves A x = b in place with the factored matrix
+	void solve(double* x) const {
+		for (int i = 0; i < this->n; i++) {
+			double sum = x[i];
+			for (int p = std::max(0, i - this->bandwidth); p < i; p++) sum -= this->at(i, p) * x[p];
+			x[i] = sum / this->at(i, i);
+		}
+		for (int i = this->n - 1; i >= 0; i--) {
+			double sum = x[i];
+			for (int q = i + 1; q <= std::min(this->n - 1, i + this->bandwidth); q++) sum -= this->at(q, i) * x[q];
+			x[i] = sum / this->at(i, i);
+		}
+	}
+
+private:
+
+	int n = 0;
+	int bandwidth = 0;
+	std::vector<double> band;
+
+};
@@ -0,0 +1,189 @@
+#include "BrushKernels.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define BRUSH_KERNELS_SSE 1
+#include <emmintrin.h>
+#endif
+
+// exp(-GAUSSIAN_FALLOFF * t^2) puts the brush radius at three standard deviations
+static const float GAUSSIAN_FALLOFF = 4.5f;
+
+namespace {
+
+	// MARK: - Scalar
+
+	float customFalloff(const BrushFalloffParams& params, float t) {
+		if (!params.lut || params.lutSize <= 0) return 1.0f;
+		if (params.lutSize == 1) return params.lut[0];
+		const float x = t * float(params.lutSize - 1);
+		const int i = std::min(int(x), params.lutSize - 2);
+		const float f = x - float(i);
+		return params.lut[i] + f * (params.lut[i + 1] - params.lut[i]);
+	}
+
+	template <BrushFalloff F>
+	float falloff(const BrushFalloffParams& params, float distance) {
+		float blend = 1.0f;
+		if (F == BrushFalloff::Constant || F == BrushFalloff::InverseSquare || F == BrushFalloff::Square) {
+			if (distance >= params.blendRadius) return 1.0f;
+			if (F == BrushFalloff::InverseSquare) blend = 1.0f / (distance * distance);
+			else if (F == BrushFalloff::Square) blend = distance * distance;
+		} else {
+			const float t = std::min(distance / params.brushRadius, 1.0f);
+			if (F == BrushFalloff::Smoothstep) blend = 1.0f - t * t * (3.0f - 2.0f * t);
+			else if (F == BrushFalloff::Gaussian) blend = std::exp(-GAUSSIAN_FALLOFF * t * t);
+			else blend = customFalloff(params, t);
+		}
+		return std::min(blend, params.maxBlendValue);
+	}
+
+#ifdef BRUSH_KERNELS_SSE
+
+	// MARK: - SSE
+
+	// 2^y for y <= 0: split into integer and fraction, polynomial for 2^f, integer into the exponent bits
+	__m128 exp2Negative(__m128 y) {
+		y = _mm_max_ps(y, _mm_set1_ps(-126.0f));
+		const __m128i truncated = _mm_cvttps_epi32(y);
+		// Truncation rounds towards zero, so step down one for negative non-integers
+		__m128 n = _mm_cvtepi32_ps(truncated);
+		n = _mm_sub_ps(n, _mm_and_ps(_mm_cmpgt_ps(n, y), _mm_set1_ps(1.0f)));
+		const __m128 f = _mm_sub_ps(y, n);
+		__m128 p = _mm_set1_ps(1.8775767e-3f);
+		p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(8.9893397e-3f));
+		p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(5.5826318e-2f));
+		p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(2.4015361e-1f));
+		p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(6.9315308e-1f));
+		p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(9.9999994e-1f));
+		const __m128i exponent = _mm_slli_epi32(_mm_add_epi32(_mm_cvttps_epi32(n), _mm_set1_epi32(127)), 23);
+		return _mm_mul_ps(p, _mm_castsi128_ps(exponent));
+	}
+
+	template <BrushFalloff F>
+	__m128 falloff(const BrushFalloffParams& params, __m128 distance) {
+		const __m128 one = _mm_set1_ps(1.0f);
+		__m128 blend = one;
+		if (F == BrushFalloff::Constant || F == BrushFalloff::InverseSquare || F == BrushFalloff::Square) {
+			if (F == BrushFalloff::InverseSquare) blend = _mm_div_ps(one, _mm_mul_ps(distance, distance));
+			else if (F == BrushFalloff::Square) blend = _mm_mul_ps(distance, distance);
+			blend = _mm_min_ps(blend, _mm_set1_ps(params.maxBlendValue));
+			// 1 from the blend radius outwards
+			const __m128 outside = _mm_cmpge_ps(distance, _mm_set1_ps(params.blendRadius));
+			return _mm_or_ps(_mm_and_ps(outside, one), _mm_andnot_ps(outside, blend));
+		}
+		const __m128 t = _mm_min_ps(_mm_div_ps(distance, _mm_set1_ps(params.brushRadius)), one);
+		if (F == BrushFalloff::Smoothstep) {
+			const __m128 t2 = _mm_mul_ps(t, t);
+			blend = _mm_sub_ps(one, _mm_mul_ps(t2, _mm_sub_ps(_mm_set1_ps(3.0f), _mm_add_ps(t, t))));
+		} else if (F == BrushFalloff::Gaussian) {
+			// exp(x) = 2^(x * log2(e))
+			blend = exp2Negative(_mm_mul_ps(_mm_mul_ps(t, t), _mm_set1_ps(-GAUSSIAN_FALLOFF * 1.44269504f)));
+		} else {
+			// No gather in SSE2: look the four lanes up one by one
+			alignas(16) float lanes[4];
+			_mm_store_ps(lanes, t);
+			for (int k = 0; k < 4; k++) lanes[k] = customFalloff(params, lanes[k]);
+			blend = _mm_load_ps(lanes);
+		}
+		return _mm_min_ps(blend, _mm_set1_ps(params.maxBlendValue));
+	}
+
+#endif
+
+	template <BrushFalloff F>
+	void evaluate(const BrushFalloffParams& params, const float* dx, const float* dz, float* blend, int count) {
+		int n = 0;
+#ifdef BRUSH_KERNELS_SSE
+		for (; n + 4 <= count; n += 4) {
+			const __m128 x = _mm_loadu_ps(dx + n);
+			const __m128 z = _mm_loadu_ps(dz + n);
+			const __m128 distance = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(z, z)));
+			_mm_storeu_ps(blend + n, falloff<F>(params, distance));
+		}
+#endif
+		for (; n < count; n++) blend[n] = falloff<F>(params, std::sqrt(dx[n] * dx[n] + dz[n] * dz[n]));
+	}
+
+}
+
+const char* BrushKernels::falloffName(BrushFalloff falloff) {
+	switch (falloff) {
+	case BrushFalloff::Constant: return "None";
+	case BrushFalloff::InverseSquare: return "Inverse Distance Squared";
+	case BrushFalloff::Square: return "Distance Squared";
+	case BrushFalloff::Smoothstep: return "Smoothstep";
+	case BrushFalloff::Gaussian: return "Gaussian";
+	case BrushFalloff::Custom: return "Custom";
+	}
+	return "";
+}
+
+void BrushKernels::evaluateFalloff(const BrushFalloffParams& params, const float* dx, const float* dz, float* blend, int count) {
+	switch (params.falloff) {
+	case BrushFalloff::Constant: evaluate<BrushFalloff::Constant>(params, dx, dz, blend, count); break;
+	case BrushFalloff::InverseSquare: evaluate<BrushFalloff::InverseSquare>(params, dx, dz, blend, count); break;
+	case BrushFalloff::Square: evaluate<BrushFalloff::Square>(params, dx, dz, blend, count); break;
+	case BrushFalloff::Smoothstep: evaluate<BrushFalloff::Smoothstep>(params, dx, dz, blend, count); break;
+	case BrushFalloff::Gaussian: evaluate<BrushFalloff::Gaussian>(params, dx, dz, blend, count); break;
+	case BrushFalloff::Custom: evaluate<BrushFalloff::Custom>(params, dx, dz, blend, count); break;
+	}
+}
+
+void BrushKernels::evaluateFalloff(const BrushFalloffParams& params, BrushPoints& points) {
+	points.blend.resize(points.rows.size());
+	if (points.blend.empty()) return;
+	BrushKernels::evaluateFalloff(params, points.dx.data(), points.dz.data(), points.blend.data(), points.size());
+}
+
+void BrushKernels::addScaled(float* values, const float* scale, float amount, int count) {
+	int n = 0;
+#ifdef BRUSH_KERNELS_SSE
+	const __m128 a = _mm_set1_ps(amount);
+	for (; n + 4 <= count; n += 4) {
+		_mm_storeu_ps(values + n, _mm_add_ps(_mm_loadu_ps(values + n), _mm_mul_ps(a, _mm_loadu_ps(scale + n))));
+	}
+#endif
+	for (; n < count; n++) values[n] += amount * scale[n];
+}
+
+void BrushKernels::scale(float* values, float amount, int count) {
+	int n = 0;
+#ifdef BRUSH_KERNELS_SSE
+	const __m128 a = _mm_set1_ps(amount);
+	for (; n + 4 <= count; n += 4) _mm_storeu_ps(values + n, _mm_mul_ps(_mm_loadu_ps(values + n), a));
+#endif
+	for (; n < count; n++) values[n] *= amount;
+}
+
+void BrushKernels::reweight(float* weights, float amount, int count) {
+	const float slowAmount = amount / 20.0f;
+	int n = 0;
+#ifdef BRUSH_KERNELS_SSE
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 floor = _mm_set1_ps(0.01f);
+	const __m128 fast = _mm_set1_ps(amount);
+	const __m128 slow = _mm_set1_ps(slowAmount);
+	for (; n + 4 <= count; n += 4) {
+		const __m128 w = _mm_loadu_ps(weights + n);
+		const __m128 below = _mm_cmple_ps(w, one);
+		__m128 result = _mm_add_ps(w, _mm_or_ps(_mm_and_ps(below, slow), _mm_andnot_ps(below, fast)));
+		if (amount < 0.0f) {
+			const __m128 clamp = _mm_and_ps(below, _mm_cmple_ps(result, floor));
+			result = _mm_or_ps(_mm_and_ps(clamp, floor), _mm_andnot_ps(clamp, result));
+		}
+		_mm_storeu_ps(weights + n, result);
+	}
+#endif
+	for (; n < count; n++) {
+		float& w = weights[n];
+		if (w <= 1.0f) {
+			w += slowAmount;
+			if (amount < 0.0f && w <= 0.01f) w = 0.01f;
+		} else {
+			w += amount;
+		}
+	}
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <vector>
+
+// How a control point's blend factor falls off with its XZ distance from the brush centre.
+// Constant, InverseSquare and Square are the original blend functions: inside the blend
+// radius the factor is 1, 1/d^2 or d^2 capped at the max blend value, 1 outside it.
+// Smoothstep, Gaussian and Custom fade from 1 at the centre to 0 at the brush radius.
+enum class BrushFalloff { Constant, InverseSquare, Square, Smoothstep, Gaussian, Custom };
+
+static const int BRUSH_FALLOFF_COUNT = 6;
+static const int BRUSH_CUSTOM_LUT_SIZE = 8;
+
+struct BrushFalloffParams {
+	BrushFalloff falloff = BrushFalloff::Constant;
+	float brushRadius = 1.0f;
+	float blendRadius = 1.0f;
+	float maxBlendValue = 1.0f;
+	// Custom only: falloff sampled uniformly from the centre (first) to the brush radius (last)
+	const float* lut = nullptr;
+	int lutSize = 0;
+};
+
+// The control points under a brush as structure-of-arrays, so the kernels can work on
+// four points at a time. Offsets are from the brush centre.
+struct BrushPoints {
+	std::vector<int> rows;
+	std::vector<int> cols;
+	std::vector<float> dx;
+	std::vector<float> dz;
+	std::vector<float> blend;
+
+	void clear() { rows.clear(); cols.clear(); dx.clear(); dz.clear(); blend.clear(); }
+	void push(int row, int col, float offsetX, float offsetZ) { rows.push_back(row); cols.push_back(col); dx.push_back(offsetX); dz.push_back(offsetZ); }
+	int size() const { return int(rows.size()); }
+};
+
+// SSE kernels with a scalar fallback. The falloff is switched on once per call, not per point.
+namespace BrushKernels {
+
+	const char* falloffName(BrushFalloff falloff);
+
+	// blend[n] = falloff(|(dx[n], dz[n])|)
+	void evaluateFalloff(const BrushFalloffParams& params, const float* dx, const float* dz, float* blend, int count);
+	void evaluateFalloff(const BrushFalloffParams& params, BrushPoints& points);
+
+	// values[n] += amount * scale[n]
+	void addScaled(float* values, const float* scale, float amount, int count);
+	// values[n] *= amount
+	void scale(float* values, float amount, int count);
+	// The scroll-wheel weight update: below 1 the weight moves 20 times slower and can't drop under 0.01
+	void reweight(float* weights, float amount, int count);
+
+};
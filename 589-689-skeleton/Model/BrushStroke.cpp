@@ -0,0 +1,50 @@
+#include "BrushStroke.h"
+
+#include <algorithm>
+
+void BrushStroke::moveTo(const glm::vec3& position, double time, std::vector<BrushStamp>& stamps) {
+	if (!this->bActive) {
+		this->bActive = true;
+		this->lastPosition = position;
+		this->lastTime = time;
+		this->lastStampTime = time;
+		this->travelled = 0.0f;
+		return;
+	}
+	time = std::max(time, this->lastTime);
+
+	// Walk the segment, dropping a stamp every `spacing` units of path
+	const glm::vec3 segment = position - this->lastPosition;
+	const float length = glm::length(segment);
+	float consumed = 0.0f;
+	while (length - consumed >= this->spacing - this->travelled) {
+		consumed += this->spacing - this->travelled;
+		this->travelled = 0.0f;
+		const float t = consumed / length;
+		this->stamp(this->lastPosition + t * segment, this->lastTime + t * (time - this->lastTime), stamps);
+	}
+	this->travelled += length - consumed;
+
+	// A resting brush keeps depositing over time
+	if (time - this->lastStampTime >= this->maxInterval) {
+		this->stamp(position, time, stamps);
+		this->travelled = 0.0f;
+	}
+
+	this->lastPosition = position;
+	this->lastTime = time;
+}
+
+void BrushStroke::end(std::vector<BrushStamp>& stamps) {
+	if (!this->bActive) return;
+	if (this->lastTime > this->lastStampTime) this->stamp(this->lastPosition, this->lastTime, stamps);
+	this->bActive = false;
+}
+
+void BrushStroke::stamp(const glm::vec3& position, double time, std::vector<BrushStamp>& stamps) {
+	BrushStamp stamp;
+	stamp.position = position;
+	stamp.seconds = float(std::min(time - this->lastStampTime, MAX_STAMP_SECONDS));
+	this->lastStampTime = time;
+	stamps.push_back(stamp);
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <vector>
+
+#include <glm/glm.hpp>
+
+// One dab of the brush along a stroke. `seconds` is the share of the stroke's duration
+// the stamp stands for, so the total deposit depends on how long the brush was held,
+// not on how many frames were drawn meanwhile.
+struct BrushStamp {
+	glm::vec3 position;
+	float seconds;
+};
+
+// Resamples the cursor path of a stroke into evenly spaced stamps. A stamp is placed every
+// `spacing` world units along the path and, while the brush rests, every `maxInterval` seconds.
+class BrushStroke {
+
+public:
+
+	void setSpacing(float spacing) { this->spacing = glm::max(spacing, 1e-3f); }
+	void setMaxInterval(double maxInterval) { this->maxInterval = maxInterval; }
+
+	// Extends the stroke to `position` at `time` (starting it if needed) and appends the new stamps.
+	void moveTo(const glm::vec3& position, double time, std::vector<BrushStamp>& stamps);
+	// Finishes the stroke, flushing the time since the last stamp.
+	void end(std::vector<BrushStamp>& stamps);
+	bool isActive() const { return this->bActive; }
+
+private:
+
+	void stamp(const glm::vec3& position, double time, std::vector<BrushStamp>& stamps);
+
+private:
+
+	// Longest time a single stamp may stand for, so a stall doesn't dump it all in one place
+	static constexpr double MAX_STAMP_SECONDS = 0.1;
+
+	float spacing = 0.25f;
+	double maxInterval = 1.0 / 120.0;
+
+	bool bActive = false;
+	glm::vec3 lastPosition = glm::vec3(0.0f);
+	double lastTime = 0.0;
+	double lastStampTime = 0.0;
+	// Path length covered since the last stamp
+	float travelled = 0.0f;
+
+};
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "../JobSystem.h"
+
+struct ConjugateGradientResult {
+	int iterations = 0;
+	// Final residual norm relative to the right-hand side
+	double relativeResidual = 0.0;
+	bool bConverged = false;
+};
+
+// Matrix-free preconditioned conjugate gradient for symmetric positive definite systems.
+// The caller supplies the operator and the preconditioner as callbacks, so any stencil can be
+// solved without assembling a matrix; the vector updates and dot products run on the JobSystem
+// in fixed blocks, which keeps the sums deterministic from run to run.
+class ConjugateGradient {
+
+public:
+
+	// Solves A x = b starting from the x passed in (warm start).
+	// applyOperator(in, out) computes out = A in, precondition(in, out) computes out = M^-1 in.
+	template <typename Operator, typename Preconditioner>
+	ConjugateGradientResult solve(Operator&& applyOperator, Preconditioner&& precondition, const std::vector<double>& b, std::vector<double>& x, int maxIterations, double tolerance) {
+		ConjugateGradientResult result;
+		const int n = int(b.size());
+		x.resize(n, 0.0);
+		this->r.resize(n);
+		this->z.resize(n);
+		this->p.resize(n);
+		this->q.resize(n);
+
+		const double bNorm = std::sqrt(this->dot(b, b));
+		if (bNorm == 0.0) {
+			// The solution of A x = 0 is zero
+			std::fill(x.begin(), x.end(), 0.0);
+			result.bConverged = true;
+			return result;
+		}
+
+		applyOperator(x, this->q);
+		this->forEach(n, [&](int i) { this->r[i] = b[i] - this->q[i]; });
+		precondition(this->r, this->z);
+		this->p = this->z;
+		double rz = this->dot(this->r, this->z);
+
+		for (result.iterations = 0; result.iterations < maxIterations; result.iterations++) {
+			result.relativeResidual = std::sqrt(this->dot(this->r, this->r)) / bNorm;
+			if (result.relativeResidual <= tolerance) {
+				result.bConverged = true;
+				break;
+			}
+			applyOperator(this->p, this->q);
+			const double pq = this->dot(this->p, this->q);
+			if (pq <= 0.0) break;
+			const double alpha = rz / pq;
+			this->forEach(n, [&](int i) {
+				x[i] += alpha * this->p[i];
+				this->r[i] -= alpha * this->q[i];
+			});
+			precondition(this->r, this->z);
+			const double rzNext = this->dot(this->r, this->z);
+			const double beta = rzNext / rz;
+			rz = rzNext;
+			this->forEach(n, [&](int i) { this->p[i] = this->z[i] + beta * this->p[i]; });
+		}
+		return result;
+	}
+
+private:
+
+	static const int BLOCK_SIZE = 4096;
+
+	template <typename Body>
+	void forEach(int n, Body&& body) {
+		JobSystem::get().parallelFor(0, (n + BLOCK_SIZE - 1) / BLOCK_SIZE, 1, [&](int begin, int end) {
+			for (int i = begin * BLOCK_SIZE; i < std::min(n, end * BLOCK_SIZE); i++) body(i);
+		}, "cg update");
+	}
+
+	double dot(const std::vector<double>& a, const std::vector<double>& b) {
+		const int n = int(a.size());
+		const int blocks = (n + BLOCK_SIZE - 1) / BLOCK_SIZE;
+		this->partialSums.assign(blocks, 0.0);
+		JobSystem::get().parallelFor(0, blocks, 1, [&](int begin, int end) {
+			for (int block = begin; block < end; block++) {
+				double sum = 0.0;
+				for (int i = block * BLOCK_SIZE; i < std::min(n, (block + 1) * BLOCK_SIZE); i++) sum += a[i] * b[i];
+				this->partialSums[block] = sum;
+			}
+		}, "cg dot");
+		double sum = 0.0;
+		for (double partial : this->partialSums) sum += partial;
+		return sum;
+	}
+
+private:
+
+	std::vector<double> r;
+	std::vector<double> z;
+	std::vector<double> p;
+	std::vector<double> q;
+	std::vector<double> partialSums;
+
+};
@@ -0,0 +1,57 @@
+#include "ControlNetIndex.h"
+
+void ControlNetIndex::build(const std::vector<std::vector<glm::vec3>>& P) {
+	this->clear();
+	if (P.empty() || P[0].empty()) return;
+
+	glm::vec2 minXZ(P[0][0].x, P[0][0].z);
+	glm::vec2 maxXZ = minXZ;
+	size_t count = 0;
+	for (const std::vector<glm::vec3>& row : P) {
+		for (const glm::vec3& point : row) {
+			minXZ = glm::min(minXZ, glm::vec2(point.x, point.z));
+			maxXZ = glm::max(maxXZ, glm::vec2(point.x, point.z));
+		}
+		count += row.size();
+	}
+
+	// Aim for about one control point per cell
+	const glm::vec2 extent = glm::max(maxXZ - minXZ, glm::vec2(1e-4f));
+	this->cellSize = std::sqrt(extent.x * extent.y / float(count));
+	this->origin = minXZ;
+	this->gridRows = int(extent.x / this->cellSize) + 1;
+	this->gridCols = int(extent.y / this->cellSize) + 1;
+
+	// Counting sort of the points into their cells
+	std::vector<int> cells(count);
+	this->cellStart.assign(size_t(this->gridRows) * this->gridCols + 1, 0);
+	size_t n = 0;
+	for (size_t i = 0; i < P.size(); i++) {
+		for (size_t j = 0; j < P[i].size(); j++, n++) {
+			const int r = std::min(this->gridRows - 1, this->cellOf(P[i][j].x, this->origin.x));
+			const int c = std::min(this->gridCols - 1, this->cellOf(P[i][j].z, this->origin.y));
+			cells[n] = r * this->gridCols + c;
+			this->cellStart[cells[n] + 1]++;
+		}
+	}
+	for (size_t k = 1; k < this->cellStart.size(); k++) this->cellStart[k] += this->cellStart[k - 1];
+
+	std::vector<int> cursor(this->cellStart.begin(), this->cellStart.end() - 1);
+	this->entries.resize(count);
+	n = 0;
+	for (size_t i = 0; i < P.size(); i++) {
+		for (size_t j = 0; j < P[i].size(); j++, n++) {
+			Entry& entry = this->entries[cursor[cells[n]]++];
+			entry.positionXZ = glm::vec2(P[i][j].x, P[i][j].z);
+			entry.row = int(i);
+			entry.col = int(j);
+		}
+	}
+}
+
+void ControlNetIndex::clear() {
+	this->gridRows = 0;
+	this->gridCols = 0;
+	this->cellStart.clear();
+	this->entries.clear();
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+#include <glm/glm.hpp>
+
+// Uniform grid over the XZ footprint of the control net. Edits only move points along y,
+// so the index only has to be rebuilt when the net itself is replaced. A brush query then
+// visits the grid cells under the brush disc instead of every control point.
+class ControlNetIndex {
+
+public:
+
+	void build(const std::vector<std::vector<glm::vec3>>& P);
+	void clear();
+	bool isEmpty() const { return this->entries.empty(); }
+
+	// Calls visit(row, col, distanceXZ) for every control point within `radius` of `center` (XZ).
+	template <typename Visitor>
+	void query(const glm::vec2& center, float radius, Visitor&& visit) const {
+		if (this->entries.empty() || radius < 0.0f) return;
+		const int cellRowBegin = std::max(0, this->cellOf(center.x - radius, this->origin.x));
+		const int cellRowEnd = std::min(this->gridRows - 1, this->cellOf(center.x + radius, this->origin.x));
+		const int cellColBegin = std::max(0, this->cellOf(center.y - radius, this->origin.y));
+		const int cellColEnd = std::min(this->gridCols - 1, this->cellOf(center.y + radius, this->origin.y));
+		const float radiusSquared = radius * radius;
+		for (int r = cellRowBegin; r <= cellRowEnd; r++) {
+			for (int c = cellColBegin; c <= cellColEnd; c++) {
+				const int cell = r * this->gridCols + c;
+				for (int e = this->cellStart[cell]; e < this->cellStart[cell + 1]; e++) {
+					const Entry& entry = this->entries[e];
+					const glm::vec2 offset = entry.positionXZ - center;
+					const float distanceSquared = glm::dot(offset, offset);
+					if (distanceSquared <= radiusSquared) visit(entry.row, entry.col, std::sqrt(distanceSquared));
+				}
+			}
+		}
+	}
+
+private:
+
+	struct Entry {
+		glm::vec2 positionXZ;
+		int row;
+		int col;
+	};
+
+	int cellOf(float coordinate, float start) const {
+		// Clamp in float first so far-away queries can't overflow the int conversion
+		float cell = std::floor((coordinate - start) / this->cellSize);
+		return int(std::max(-1.0f, std::min(cell, float(std::max(this->gridRows, this->gridCols)))));
+	}
+
+private:
+
+	// World XZ of the grid corner (x maps to grid rows, z to grid columns)
+	glm::vec2 origin = glm::vec2(0.0f);
+	float cellSize = 1.0f;
+	int gridRows = 0;
+	int gridCols = 0;
+	// Entries sorted by cell; cell k owns entries [cellStart[k], cellStart[k + 1])
+	std::vector<int> cellStart;
+	std::vector<Entry> entries;
+
+};
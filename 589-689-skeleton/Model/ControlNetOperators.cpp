@@ -0,0 +1,163 @@
+#include "ControlNetOperators.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+const char* ControlNetOperators::operatorName(NetOperatorType type) {
+	switch (type) {
+	case NetOperatorType::LaplacianSmooth: return "Laplacian Smooth";
+	case NetOperatorType::TaubinSmooth: return "Taubin Smooth";
+	case NetOperatorType::FlattenToPlane: return "Flatten to Plane";
+	case NetOperatorType::Terrace: return "Terrace";
+	}
+	return "";
+}
+
+bool ControlNetOperators::apply(const NetOperatorSettings& settings, const SelectionSet& selection, std::vector<std::vector<glm::vec3>>& P, const std::vector<std::vector<float>>& W,
+	Range2D& dirtyRegion, UndoJournal* journal) {
+	if (P.empty() || P[0].empty()) return false;
+	this->rows = int(P.size());
+	this->cols = int(P[0].size());
+	const bool bWholeNet = selection.empty();
+	if (!bWholeNet && (selection.getRows() != this->rows || selection.getCols() != this->cols)) return false;
+
+	// Load the heights and the mask, and find the region the operator may touch
+	const size_t count = size_t(this->rows) * this->cols;
+	this->front.resize(count);
+	this->back.resize(count);
+	this->mask.assign(count, bWholeNet ? 1 : 0);
+	dirtyRegion = bWholeNet ? Range2D{ 0, this->rows, 0, this->cols } : Range2D{ std::numeric_limits<int>::max(), 0, std::numeric_limits<int>::max(), 0 };
+	for (int i = 0; i < this->rows; i++) {
+		for (int j = 0; j < this->cols; j++) this->front[size_t(i) * this->cols + j] = P[i][j].y;
+	}
+	if (!bWholeNet) {
+		for (int index : selection.getIndices()) {
+			const int row = selection.rowOf(index);
+			const int col = selection.colOf(index);
+			this->mask[index] = 1;
+			dirtyRegion.rowBegin = std::min(dirtyRegion.rowBegin, row);
+			dirtyRegion.rowEnd = std::max(dirtyRegion.rowEnd, row + 1);
+			dirtyRegion.colBegin = std::min(dirtyRegion.colBegin, col);
+			dirtyRegion.colEnd = std::max(dirtyRegion.colEnd, col + 1);
+		}
+	}
+	if (journal) {
+		for (int i = dirtyRegion.rowBegin; i < dirtyRegion.rowEnd; i++) {
+			for (int j = dirtyRegion.colBegin; j < dirtyRegion.colEnd; j++) {
+				if (this->mask[size_t(i) * this->cols + j]) journal->touch(this->rows, this->cols, i, j, P[i][j], W[i][j]);
+			}
+		}
+	}
+
+	const int iterations = std::max(1, settings.iterations);
+	switch (settings.type) {
+	case NetOperatorType::LaplacianSmooth:
+		for (int n = 0; n < iterations; n++) this->relax(settings.lambda);
+		break;
+	case NetOperatorType::TaubinSmooth:
+		// A shrinking step followed by an inflating one smooths without losing volume
+		for (int n = 0; n < iterations; n++) {
+			this->relax(settings.lambda);
+			this->relax(settings.mu);
+		}
+		break;
+	case NetOperatorType::FlattenToPlane:
+		this->flattenToPlane(P, settings.strength);
+		break;
+	case NetOperatorType::Terrace:
+		this->terrace(settings.terraceHeight, settings.strength);
+		break;
+	}
+
+	for (int i = dirtyRegion.rowBegin; i < dirtyRegion.rowEnd; i++) {
+		for (int j = dirtyRegion.colBegin; j < dirtyRegion.colEnd; j++) P[i][j].y = this->front[size_t(i) * this->cols + j];
+	}
+	return true;
+}
+
+void ControlNetOperators::relax(float factor) {
+	const int rows = this->rows;
+	const int cols = this->cols;
+	const float* source = this->front.data();
+	float* target = this->back.data();
+	const uint8_t* mask = this->mask.data();
+	JobSystem::get().parallelFor(0, rows, 8, [=](int begin, int end) {
+		for (int i = begin; i < end; i++) {
+			for (int j = 0; j < cols; j++) {
+				const size_t index = size_t(i) * cols + j;
+				const float y = source[index];
+				if (!mask[index]) {
+					target[index] = y;
+					continue;
+				}
+				// Umbrella operator over the 4-neighbourhood; border points average the neighbours they have
+				float sum = 0.0f;
+				int neighbours = 0;
+				if (i > 0) { sum += source[index - cols]; neighbours++; }
+				if (i + 1 < rows) { sum += source[index + cols]; neighbours++; }
+				if (j > 0) { sum += source[index - 1]; neighbours++; }
+				if (j + 1 < cols) { sum += source[index + 1]; neighbours++; }
+				target[index] = neighbours > 0 ? y + factor * (sum / float(neighbours) - y) : y;
+			}
+		}
+	}, "net relax");
+	std::swap(this->front, this->back);
+}
+
+void ControlNetOperators::flattenToPlane(const std::vector<std::vector<glm::vec3>>& P, float strength) {
+	// Least squares plane y = a x + b z + c through the masked points
+	glm::dmat3 normal(0.0);
+	glm::dvec3 rhs(0.0);
+	double meanHeight = 0.0;
+	int count = 0;
+	for (int i = 0; i < this->rows; i++) {
+		for (int j = 0; j < this->cols; j++) {
+			const size_t index = size_t(i) * this->cols + j;
+			if (!this->mask[index]) continue;
+			const glm::dvec3 basis(P[i][j].x, P[i][j].z, 1.0);
+			normal += glm::outerProduct(basis, basis);
+			rhs += basis * double(this->front[index]);
+			meanHeight += this->front[index];
+			count++;
+		}
+	}
+	if (count == 0) return;
+	// Collinear or single points don't define a plane; use a level one at their mean height
+	glm::dvec3 plane(0.0, 0.0, meanHeight / count);
+	if (std::abs(glm::determinant(normal)) > 1e-9) plane = glm::inverse(normal) * rhs;
+
+	const int cols = this->cols;
+	const float* source = this->front.data();
+	float* target = this->back.data();
+	const uint8_t* mask = this->mask.data();
+	JobSystem::get().parallelFor(0, this->rows, 8, [&, cols, source, target, mask](int begin, int end) {
+		for (int i = begin; i < end; i++) {
+			for (int j = 0; j < cols; j++) {
+				const size_t index = size_t(i) * cols + j;
+				const float y = source[index];
+				const float planeHeight = float(plane.x * P[i][j].x + plane.y * P[i][j].z + plane.z);
+				target[index] = mask[index] ? y + strength * (planeHeight - y) : y;
+			}
+		}
+	}, "net flatten");
+	std::swap(this->front, this->back);
+}
+
+void ControlNetOperators::terrace(float height, float strength) {
+	if (height <= 0.0f) return;
+	const int cols = this->cols;
+	const float* source = this->front.data();
+	float* target = this->back.data();
+	const uint8_t* mask = this->mask.data();
+	JobSystem::get().parallelFor(0, this->rows, 8, [=](int begin, int end) {
+		for (int i = begin; i < end; i++) {
+			for (int j = 0; j < cols; j++) {
+				const size_t index = size_t(i) * cols + j;
+				const float y = source[index];
+				target[index] = mask[index] ? y + strength * (height * std::round(y / height) - y) : y;
+			}
+		}
+	}, "net terrace");
+	std::swap(this->front, this->back);
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "../JobSystem.h"
+#include "SelectionSet.h"
+#include "UndoJournal.h"
+
+enum class NetOperatorType { LaplacianSmooth, TaubinSmooth, FlattenToPlane, Terrace };
+
+static const int NET_OPERATOR_COUNT = 4;
+
+struct NetOperatorSettings {
+	NetOperatorType type = NetOperatorType::LaplacianSmooth;
+	int iterations = 1;
+	// Laplacian step towards the neighbour average, and Taubin's inflating step (negative, |mu| > lambda)
+	float lambda = 0.5f;
+	float mu = -0.53f;
+	// How far flatten and terrace move a point towards their target, 0 to 1
+	float strength = 1.0f;
+	float terraceHeight = 0.5f;
+};
+
+// Bulk operators on the heights of the control net. Like the brush they only move points
+// along y. Every iteration reads one height buffer and writes the other, so the rows can be
+// processed in parallel without seeing half-updated neighbours.
+class ControlNetOperators {
+
+public:
+
+	static const char* operatorName(NetOperatorType type);
+
+	// Runs the operator over the members of `selection`, or over the whole net if it is empty.
+	// Unselected points are left alone but still act as neighbours. `dirtyRegion` receives the
+	// bounding rectangle of the points that may have moved. If `journal` is given they are
+	// touched in its open step first. Returns false if there was nothing to operate on.
+	bool apply(const NetOperatorSettings& settings, const SelectionSet& selection, std::vector<std::vector<glm::vec3>>& P, const std::vector<std::vector<float>>& W,
+		Range2D& dirtyRegion, UndoJournal* journal = nullptr);
+
+private:
+
+	void relax(float factor);
+	void flattenToPlane(const std::vector<std::vector<glm::vec3>>& P, float strength);
+	void terrace(float height, float strength);
+
+private:
+
+	int rows = 0;
+	int cols = 0;
+	// Heights row by row; the current state is always in `front`
+	std::vector<float> front;
+	std::vector<float> back;
+	// 1 for the points the operator may move
+	std::vector<uint8_t> mask;
+
+};
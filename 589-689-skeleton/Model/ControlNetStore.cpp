@@ -0,0 +1,404 @@
+#include "ControlNetStore.h"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(_WIN32)
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "../Log.h"
+
+namespace {
+
+	const char STORE_MAGIC[8] = { 'N', 'U', 'R', 'B', 'S', 'N', 'E', 'T' };
+	const uint32_t STORE_VERSION = 1;
+	// Views start at multiples of this on every platform (the Windows allocation granularity)
+	const uint64_t MAPPING_ALIGNMENT = 65536;
+	const size_t TILE_BYTES = size_t(ControlNetStore::TILE_SIZE) * ControlNetStore::TILE_SIZE * 4 * sizeof(float);
+	// The file grows by this many tiles at a time
+	const uint64_t GROWTH_TILES = 16;
+
+	struct FileHeader {
+		char magic[8];
+		uint32_t version;
+		int32_t rows;
+		int32_t cols;
+		int32_t tileSize;
+		float originX;
+		float originZ;
+		float spacing;
+		uint32_t reserved;
+		// End of the last allocated tile, where the next one goes
+		uint64_t usedBytes;
+	};
+
+	// Header and tile index, padded so the first tile starts on a mapping boundary
+	uint64_t headerBytesFor(int tileCount) {
+		const uint64_t bytes = sizeof(FileHeader) + uint64_t(tileCount) * sizeof(uint64_t);
+		return (bytes + MAPPING_ALIGNMENT - 1) / MAPPING_ALIGNMENT * MAPPING_ALIGNMENT;
+	}
+
+}
+
+// MARK: - Mapped File
+
+struct ControlNetStore::MappedFile {
+
+#if defined(_WIN32)
+	HANDLE handle = INVALID_HANDLE_VALUE;
+	HANDLE mapping = NULL;
+#else
+	int descriptor = -1;
+#endif
+	uint64_t size = 0;
+
+	~MappedFile() {
+#if defined(_WIN32)
+		if (this->mapping != NULL) CloseHandle(this->mapping);
+		if (this->handle != INVALID_HANDLE_VALUE) CloseHandle(this->handle);
+#else
+		if (this->descriptor >= 0) ::close(this->descriptor);
+#endif
+	}
+
+	bool open(const std::string& path, bool bCreate) {
+#if defined(_WIN32)
+		this->handle = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, bCreate ? CREATE_ALWAYS : OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (this->handle == INVALID_HANDLE_VALUE) return false;
+		LARGE_INTEGER fileSize;
+		if (!GetFileSizeEx(this->handle, &fileSize)) return false;
+		// An empty file cannot be mapped, a new one gets its mapping when it is first sized
+		return fileSize.QuadPart == 0 || this->resize(uint64_t(fileSize.QuadPart));
+#else
+		this->descriptor = ::open(path.c_str(), O_RDWR | (bCreate ? O_CREAT | O_TRUNC : 0), 0644);
+		if (this->descriptor < 0) return false;
+		struct stat status;
+		if (fstat(this->descriptor, &status) != 0) return false;
+		this->size = uint64_t(status.st_size);
+		return true;
+#endif
+	}
+
+	// Grows the file to `bytes`; views mapped so far stay valid
+	bool resize(uint64_t bytes) {
+#if defined(_WIN32)
+		// A mapping larger than the file extends the file
+		HANDLE grown = CreateFileMappingA(this->handle, NULL, PAGE_READWRITE, DWORD(bytes >> 32), DWORD(bytes & 0xFFFFFFFF), NULL);
+		if (grown == NULL) return false;
+		if (this->mapping != NULL) CloseHandle(this->mapping);
+		this->mapping = grown;
+#else
+		if (ftruncate(this->descriptor, off_t(bytes)) != 0) return false;
+#endif
+		this->size = bytes;
+		return true;
+	}
+
+	void* map(uint64_t offset, size_t bytes) {
+#if defined(_WIN32)
+		return MapViewOfFile(this->mapping, FILE_MAP_READ | FILE_MAP_WRITE, DWORD(offset >> 32), DWORD(offset & 0xFFFFFFFF), bytes);
+#else
+		void* view = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, this->descriptor, off_t(offset));
+		return view == MAP_FAILED ? nullptr : view;
+#endif
+	}
+
+	static void unmap(void* view, size_t bytes) {
+#if defined(_WIN32)
+		UnmapViewOfFile(view);
+#else
+		munmap(view, bytes);
+#endif
+	}
+
+	// Hands the view's modified pages to the OS to be written to the file
+	static void flush(void* view, size_t bytes) {
+#if defined(_WIN32)
+		FlushViewOfFile(view, bytes);
+#else
+		msync(view, bytes, MS_ASYNC);
+#endif
+	}
+
+};
+
+// MARK: - Store
+
+ControlNetStore::ControlNetStore() = default;
+
+ControlNetStore::~ControlNetStore() {
+	this->close();
+}
+
+bool ControlNetStore::create(const std::string& path, int rows, int cols, const glm::vec2& origin, float spacing) {
+	this->close();
+	if (rows < 2 || cols < 2 || !(spacing > 0.0f)) {
+		Log::error("Control net store needs at least 2 x 2 control points and a positive spacing");
+		return false;
+	}
+	const int tileCount = ((rows + TILE_SIZE - 1) / TILE_SIZE) * ((cols + TILE_SIZE - 1) / TILE_SIZE);
+	const uint64_t headerBytes = headerBytesFor(tileCount);
+	this->file = std::make_unique<MappedFile>();
+	void* view = nullptr;
+	if (!this->file->open(path, true) || !this->file->resize(headerBytes) || (view = this->file->map(0, size_t(headerBytes))) == nullptr) {
+		Log::error("Cannot create control net store {}", path);
+		this->file.reset();
+		return false;
+	}
+	// A new file reads as zeros, so every tile starts out unallocated
+	FileHeader* header = static_cast<FileHeader*>(view);
+	std::memcpy(header->magic, STORE_MAGIC, sizeof(STORE_MAGIC));
+	header->version = STORE_VERSION;
+	header->rows = rows;
+	header->cols = cols;
+	header->tileSize = TILE_SIZE;
+	header->originX = origin.x;
+	header->originZ = origin.y;
+	header->spacing = spacing;
+	header->usedBytes = headerBytes;
+	MappedFile::flush(view, size_t(headerBytes));
+	MappedFile::unmap(view, size_t(headerBytes));
+	if (!this->mapHeader()) {
+		Log::error("Cannot map control net store {}", path);
+		this->file.reset();
+		return false;
+	}
+	this->path = path;
+	return true;
+}
+
+bool ControlNetStore::open(const std::string& path) {
+	this->close();
+	this->file = std::make_unique<MappedFile>();
+	if (!this->file->open(path, false)) {
+		Log::error("Cannot open control net store {}", path);
+		this->file.reset();
+		return false;
+	}
+	if (!this->mapHeader()) {
+		Log::error("{} is not a control net store", path);
+		this->file.reset();
+		return false;
+	}
+	this->path = path;
+	return true;
+}
+
+bool ControlNetStore::mapHeader() {
+	if (this->file->size < sizeof(FileHeader)) return false;
+	// The header alone first, it says how large the index is
+	void* view = this->file->map(0, sizeof(FileHeader));
+	if (view == nullptr) return false;
+	const FileHeader header = *static_cast<const FileHeader*>(view);
+	MappedFile::unmap(view, sizeof(FileHeader));
+	if (std::memcmp(header.magic, STORE_MAGIC, sizeof(STORE_MAGIC)) != 0 || header.version != STORE_VERSION || header.tileSize != TILE_SIZE) return false;
+	if (header.rows < 2 || header.cols < 2 || !(header.spacing > 0.0f)) return false;
+	const int tileRows = (header.rows + TILE_SIZE - 1) / TILE_SIZE;
+	const int tileCols = (header.cols + TILE_SIZE - 1) / TILE_SIZE;
+	const uint64_t headerBytes = headerBytesFor(tileRows * tileCols);
+	if (header.usedBytes < headerBytes || header.usedBytes > this->file->size) return false;
+	this->headerView = this->file->map(0, size_t(headerBytes));
+	if (this->headerView == nullptr) return false;
+	this->headerBytes = size_t(headerBytes);
+	this->tileIndex = reinterpret_cast<uint64_t*>(static_cast<char*>(this->headerView) + sizeof(FileHeader));
+
+	this->rows = header.rows;
+	this->cols = header.cols;
+	this->origin = glm::vec2(header.originX, header.originZ);
+	this->spacing = header.spacing;
+	this->tileRows = tileRows;
+	this->tileCols = tileCols;
+	this->stats = ControlNetStoreStats();
+	this->stats.tileCount = tileRows * tileCols;
+	for (int index = 0; index < this->stats.tileCount; index++) {
+		if (this->tileIndex[index] != 0) this->stats.allocatedTiles++;
+	}
+	return true;
+}
+
+void ControlNetStore::close() {
+	if (!this->file) return;
+	while (!this->lru.empty()) this->pageOut(this->lru.back());
+	if (this->headerView != nullptr) {
+		MappedFile::flush(this->headerView, this->headerBytes);
+		MappedFile::unmap(this->headerView, this->headerBytes);
+	}
+	this->headerView = nullptr;
+	this->headerBytes = 0;
+	this->tileIndex = nullptr;
+	this->file.reset();
+	this->path.clear();
+	this->rows = 0;
+	this->cols = 0;
+	this->stats = ControlNetStoreStats();
+}
+
+glm::vec3 ControlNetStore::flatPosition(int row, int col) const {
+	return glm::vec3(this->origin.x + float(row) * this->spacing, 0.0f, this->origin.y + float(col) * this->spacing);
+}
+
+ControlNetStore::ControlPoint ControlNetStore::flatPoint(int row, int col) const {
+	const glm::vec3 position = this->flatPosition(row, col);
+	return { position.x, position.y, position.z, 1.0f };
+}
+
+// MARK: - Tiles
+
+ControlNetStore::Tile* ControlNetStore::pageIn(int index, bool bAllocate) {
+	auto found = this->resident.find(index);
+	if (found != this->resident.end()) {
+		this->lru.splice(this->lru.begin(), this->lru, found->second.lruEntry);
+		return &found->second;
+	}
+
+	Tile tile;
+	uint64_t offset = this->tileIndex[index];
+	if (offset == 0) {
+		if (!bAllocate) return nullptr;
+		FileHeader* header = static_cast<FileHeader*>(this->headerView);
+		offset = header->usedBytes;
+		if (offset + TILE_BYTES > this->file->size && !this->file->resize(offset + GROWTH_TILES * TILE_BYTES)) {
+			Log::error("Cannot grow control net store {}", this->path);
+			return nullptr;
+		}
+		tile.points = static_cast<ControlPoint*>(this->file->map(offset, TILE_BYTES));
+		if (tile.points == nullptr) return nullptr;
+		// A new tile starts as the flat net; the edge tiles are padded past the last row and column
+		const int firstRow = (index / this->tileCols) * TILE_SIZE;
+		const int firstCol = (index % this->tileCols) * TILE_SIZE;
+		for (int r = 0; r < TILE_SIZE; r++) {
+			for (int c = 0; c < TILE_SIZE; c++) tile.points[r * TILE_SIZE + c] = this->flatPoint(firstRow + r, firstCol + c);
+		}
+		header->usedBytes = offset + TILE_BYTES;
+		this->tileIndex[index] = offset;
+		tile.bDirty = true;
+		this->stats.allocatedTiles++;
+		this->stats.dirtyTiles++;
+	} else {
+		tile.points = static_cast<ControlPoint*>(this->file->map(offset, TILE_BYTES));
+		if (tile.points == nullptr) {
+			Log::error("Cannot map tile {} of control net store {}", index, this->path);
+			return nullptr;
+		}
+	}
+	this->stats.pageIns++;
+	this->lru.push_front(index);
+	tile.lruEntry = this->lru.begin();
+	Tile& inserted = this->resident.emplace(index, tile).first->second;
+	this->stats.residentTiles = int(this->resident.size());
+	return &inserted;
+}
+
+void ControlNetStore::pageOut(int index) {
+	auto found = this->resident.find(index);
+	if (found == this->resident.end()) return;
+	Tile& tile = found->second;
+	if (tile.bDirty) {
+		MappedFile::flush(tile.points, TILE_BYTES);
+		this->stats.writeBacks++;
+		this->stats.dirtyTiles--;
+	}
+	MappedFile::unmap(tile.points, TILE_BYTES);
+	this->lru.erase(tile.lruEntry);
+	this->resident.erase(found);
+	this->stats.residentTiles = int(this->resident.size());
+}
+
+void ControlNetStore::trim() {
+	while (int(this->resident.size()) > this->residentLimit) this->pageOut(this->lru.back());
+}
+
+void ControlNetStore::setResidentLimit(int tiles) {
+	this->residentLimit = std::max(1, tiles);
+	if (this->isOpen()) this->trim();
+}
+
+void ControlNetStore::flush() {
+	if (!this->isOpen()) return;
+	for (auto& entry : this->resident) {
+		Tile& tile = entry.second;
+		if (!tile.bDirty) continue;
+		MappedFile::flush(tile.points, TILE_BYTES);
+		tile.bDirty = false;
+		this->stats.writeBacks++;
+	}
+	this->stats.dirtyTiles = 0;
+	MappedFile::flush(this->headerView, this->headerBytes);
+}
+
+// MARK: - Read & Write
+
+bool ControlNetStore::read(int rowOrigin, int colOrigin, std::vector<std::vector<glm::vec3>>& P, std::vector<std::vector<float>>& W) {
+	if (!this->isOpen() || P.empty() || P.size() != W.size()) return false;
+	const int numRows = P.size();
+	const int numCols = P[0].size();
+	if (rowOrigin < 0 || colOrigin < 0 || rowOrigin + numRows > this->rows || colOrigin + numCols > this->cols) return false;
+	for (int tileRow = rowOrigin / TILE_SIZE; tileRow <= (rowOrigin + numRows - 1) / TILE_SIZE; tileRow++) {
+		for (int tileCol = colOrigin / TILE_SIZE; tileCol <= (colOrigin + numCols - 1) / TILE_SIZE; tileCol++) {
+			// Tiles never written are the flat net and are not mapped at all
+			const Tile* tile = this->pageIn(tileRow * this->tileCols + tileCol, false);
+			const int rowBegin = std::max(rowOrigin, tileRow * TILE_SIZE), rowEnd = std::min(rowOrigin + numRows, (tileRow + 1) * TILE_SIZE);
+			const int colBegin = std::max(colOrigin, tileCol * TILE_SIZE), colEnd = std::min(colOrigin + numCols, (tileCol + 1) * TILE_SIZE);
+			for (int row = rowBegin; row < rowEnd; row++) {
+				for (int col = colBegin; col < colEnd; col++) {
+					const ControlPoint point = tile ? tile->points[(row - tileRow * TILE_SIZE) * TILE_SIZE + (col - tileCol * TILE_SIZE)] : this->flatPoint(row, col);
+					P[row - rowOrigin][col - colOrigin] = glm::vec3(point.x, point.y, point.z);
+					W[row - rowOrigin][col - colOrigin] = point.w;
+				}
+			}
+		}
+	}
+	this->trim();
+	return true;
+}
+
+bool ControlNetStore::write(int rowOrigin, int colOrigin, const Range2D& region, const std::vector<std::vector<glm::vec3>>& P, const std::vector<std::vector<float>>& W) {
+	if (!this->isOpen() || P.empty() || P.size() != W.size()) return false;
+	const int rowBegin = rowOrigin + std::max(0, region.rowBegin);
+	const int rowEnd = rowOrigin + std::min(int(P.size()), region.rowEnd);
+	const int colBegin = colOrigin + std::max(0, region.colBegin);
+	const int colEnd = colOrigin + std::min(int(P[0].size()), region.colEnd);
+	if (rowBegin >= rowEnd || colBegin >= colEnd) return true;
+	if (rowBegin < 0 || colBegin < 0 || rowEnd > this->rows || colEnd > this->cols) return false;
+	for (int tileRow = rowBegin / TILE_SIZE; tileRow <= (rowEnd - 1) / TILE_SIZE; tileRow++) {
+		for (int tileCol = colBegin / TILE_SIZE; tileCol <= (colEnd - 1) / TILE_SIZE; tileCol++) {
+			const int index = tileRow * this->tileCols + tileCol;
+			const int firstRow = tileRow * TILE_SIZE, firstCol = tileCol * TILE_SIZE;
+			const int r0 = std::max(rowBegin, firstRow), r1 = std::min(rowEnd, firstRow + TILE_SIZE);
+			const int c0 = std::max(colBegin, firstCol), c1 = std::min(colEnd, firstCol + TILE_SIZE);
+			auto pointAt = [&](int row, int col) {
+				const glm::vec3& position = P[row - rowOrigin][col - colOrigin];
+				return ControlPoint{ position.x, position.y, position.z, W[row - rowOrigin][col - colOrigin] };
+			};
+
+			// Only a tile that changes is dirtied, and a tile that would stay flat is never allocated
+			Tile* tile = this->pageIn(index, false);
+			bool bChanged = false;
+			for (int row = r0; row < r1 && !bChanged; row++) {
+				for (int col = c0; col < c1 && !bChanged; col++) {
+					const ControlPoint point = pointAt(row, col);
+					const ControlPoint current = tile ? tile->points[(row - firstRow) * TILE_SIZE + (col - firstCol)] : this->flatPoint(row, col);
+					bChanged = std::memcmp(&point, &current, sizeof(ControlPoint)) != 0;
+				}
+			}
+			if (!bChanged) continue;
+			if (tile == nullptr && (tile = this->pageIn(index, true)) == nullptr) return false;
+			for (int row = r0; row < r1; row++) {
+				for (int col = c0; col < c1; col++) tile->points[(row - firstRow) * TILE_SIZE + (col - firstCol)] = pointAt(row, col);
+			}
+			if (!tile->bDirty) {
+				tile->bDirty = true;
+				this->stats.dirtyTiles++;
+			}
+		}
+	}
+	this->trim();
+	return true;
+}
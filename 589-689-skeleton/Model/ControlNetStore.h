@@ -0,0 +1,115 @@
+#pragma once
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "../JobSystem.h"
+
+struct ControlNetStoreStats {
+	int tileCount = 0;
+	int allocatedTiles = 0;
+	int residentTiles = 0;
+	int dirtyTiles = 0;
+	uint64_t pageIns = 0;
+	uint64_t writeBacks = 0;
+};
+
+// A control net too large for memory, kept in a file of fixed-size tiles that are memory-mapped on demand.
+//
+// The file starts with a header and a tile index, one file offset per tile, padded to the mapping
+// granularity. A tile is TILE_SIZE x TILE_SIZE control points (position and weight), 64KB, and is only
+// written to the file the first time it differs from the flat net; until then its offset is 0 and reads
+// give the flat net. Tiles are mapped when read or written, at most `residentLimit` of them at a time,
+// least recently used ones unmapped first. Writes mark a tile dirty only if they change it, and dirty
+// tiles are written back when they are unmapped or flushed. What is not mapped stays in the OS page cache.
+class ControlNetStore {
+
+public:
+
+	static const int TILE_SIZE = 64;
+
+	ControlNetStore();
+	~ControlNetStore();
+
+	ControlNetStore(const ControlNetStore&) = delete;
+	ControlNetStore& operator=(const ControlNetStore&) = delete;
+
+	// A new flat rows x cols net with control point (i, j) at origin + (i, j) * spacing in x-z;
+	// replaces the file at `path`
+	bool create(const std::string& path, int rows, int cols, const glm::vec2& origin, float spacing);
+	bool open(const std::string& path);
+	// Writes back every dirty tile first
+	void close();
+	bool isOpen() const { return this->file != nullptr; }
+
+	// Reads the P.size() x P[0].size() control points from (rowOrigin, colOrigin) on into P and W
+	bool read(int rowOrigin, int colOrigin, std::vector<std::vector<glm::vec3>>& P, std::vector<std::vector<float>>& W);
+	// Writes `region` of P and W back to the net, P[0][0] being control point (rowOrigin, colOrigin)
+	bool write(int rowOrigin, int colOrigin, const Range2D& region, const std::vector<std::vector<glm::vec3>>& P, const std::vector<std::vector<float>>& W);
+	// Writes back every dirty tile, keeping them mapped
+	void flush();
+	void setResidentLimit(int tiles);
+
+	// Where control point (row, col) of the flat net is
+	glm::vec3 flatPosition(int row, int col) const;
+
+	int getRows() const { return this->rows; }
+	int getCols() const { return this->cols; }
+	const glm::vec2& getOrigin() const { return this->origin; }
+	float getSpacing() const { return this->spacing; }
+	const std::string& getPath() const { return this->path; }
+	const ControlNetStoreStats& getStats() const { return this->stats; }
+
+private:
+
+	struct MappedFile;
+
+	struct ControlPoint {
+		float x, y, z, w;
+	};
+
+	struct Tile {
+		ControlPoint* points = nullptr;
+		bool bDirty = false;
+		std::list<int>::iterator lruEntry;
+	};
+
+	bool mapHeader();
+	// The flat net's control point (row, col)
+	ControlPoint flatPoint(int row, int col) const;
+	// Maps tile `index`, allocating it in the file first if `bAllocate`; nullptr if it is not allocated
+	Tile* pageIn(int index, bool bAllocate);
+	void pageOut(int index);
+	// Unmaps least recently used tiles down to the resident limit
+	void trim();
+
+private:
+
+	std::unique_ptr<MappedFile> file;
+	std::string path;
+	int rows = 0;
+	int cols = 0;
+	glm::vec2 origin = glm::vec2(0.0f);
+	float spacing = 1.0f;
+	int tileRows = 0;
+	int tileCols = 0;
+
+	// Header and index, mapped for as long as the store is open
+	void* headerView = nullptr;
+	size_t headerBytes = 0;
+	uint64_t* tileIndex = nullptr;
+
+	std::unordered_map<int, Tile> resident;
+	// Resident tiles, most recently used first
+	std::list<int> lru;
+	int residentLimit = 64;
+
+	ControlNetStoreStats stats;
+
+};
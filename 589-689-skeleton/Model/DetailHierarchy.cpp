@@ -0,0 +1,111 @@
+#include "DetailHierarchy.h"
+
+#include <cmath>
+
+#include <fmt/format.h>
+
+namespace {
+
+	// Weights of the four uniform cubic B-splines centred on knots -1, 0, 1 and 2 at t in [0, 1)
+	void uniformCubic(float t, float* N) {
+		const float t2 = t * t, t3 = t2 * t;
+		const float s = 1.0f - t;
+		N[0] = s * s * s / 6.0f;
+		N[1] = (3.0f * t3 - 6.0f * t2 + 4.0f) / 6.0f;
+		N[2] = (-3.0f * t3 + 3.0f * t2 + 3.0f * t + 1.0f) / 6.0f;
+		N[3] = t3 / 6.0f;
+	}
+
+	// First control height and count covering [begin, end] with at least one editable height, inside [0, 1]
+	void fitAxis(float begin, float end, float spacing, float& first, int& count) {
+		count = std::max(5, int(std::ceil((end - begin) / spacing - 1e-3f)) + 1);
+		count = std::min(count, int(std::floor(1.0f / spacing + 1e-3f)) + 1);
+		first = 0.5f * (begin + end) - 0.5f * spacing * float(count - 1);
+		first = std::max(0.0f, std::min(first, 1.0f - spacing * float(count - 1)));
+	}
+
+}
+
+int DetailHierarchy::refine(float uBegin, float uEnd, float vBegin, float vEnd, const glm::vec2& baseSpacing) {
+	int level = 1;
+	for (const DetailPatch& patch : this->patches) {
+		if (patch.u0 < uEnd && uBegin < patch.uEnd() && patch.v0 < vEnd && vBegin < patch.vEnd()) level = std::max(level, patch.level + 1);
+	}
+	if (level > MAX_LEVEL) return -1;
+
+	DetailPatch patch;
+	patch.level = level;
+	patch.spacingU = baseSpacing.x / float(1 << level);
+	patch.spacingV = baseSpacing.y / float(1 << level);
+	fitAxis(uBegin, uEnd, patch.spacingU, patch.u0, patch.rows);
+	fitAxis(vBegin, vEnd, patch.spacingV, patch.v0, patch.cols);
+	if (patch.rows < 5 || patch.cols < 5) return -1;
+	patch.heights.assign(size_t(patch.rows) * patch.cols, 0.0f);
+	this->patches.push_back(std::move(patch));
+	return int(this->patches.size()) - 1;
+}
+
+float DetailHierarchy::evaluatePatch(const DetailPatch& patch, float u, float v) {
+	const float x = (u - patch.u0) / patch.spacingU;
+	const float y = (v - patch.v0) / patch.spacingV;
+	if (x <= 0.0f || y <= 0.0f || x >= float(patch.rows - 1) || y >= float(patch.cols - 1)) return 0.0f;
+	const int row = int(x), col = int(y);
+	float Nu[4], Nv[4];
+	uniformCubic(x - float(row), Nu);
+	uniformCubic(y - float(col), Nv);
+	float height = 0.0f;
+	for (int a = 0; a < 4; a++) {
+		const int r = row - 1 + a;
+		if (r < 0 || r >= patch.rows) continue;
+		const float* heights = &patch.heights[size_t(r) * patch.cols];
+		float rowHeight = 0.0f;
+		for (int b = 0; b < 4; b++) {
+			const int c = col - 1 + b;
+			if (c >= 0 && c < patch.cols) rowHeight += Nv[b] * heights[c];
+		}
+		height += Nu[a] * rowHeight;
+	}
+	return height;
+}
+
+void DetailHierarchy::apply(const std::vector<float>& uParams, const std::vector<float>& vParams, const Range2D& samples, std::vector<std::vector<glm::vec3>>& Q) const {
+	// Patches are summed in the same order however the samples are split, so a region matches a full evaluation
+	for (const DetailPatch& patch : this->patches) {
+		const int rowBegin = std::max(samples.rowBegin, int(std::upper_bound(uParams.begin(), uParams.end(), patch.u0) - uParams.begin()));
+		const int rowEnd = std::min(samples.rowEnd, int(std::lower_bound(uParams.begin(), uParams.end(), patch.uEnd()) - uParams.begin()));
+		const int colBegin = std::max(samples.colBegin, int(std::upper_bound(vParams.begin(), vParams.end(), patch.v0) - vParams.begin()));
+		const int colEnd = std::min(samples.colEnd, int(std::lower_bound(vParams.begin(), vParams.end(), patch.vEnd()) - vParams.begin()));
+		if (rowEnd <= rowBegin || colEnd <= colBegin) continue;
+		JobSystem::get().parallelFor(rowBegin, rowEnd, 8, [&](int begin, int end) {
+			for (int i = begin; i < end; i++) {
+				for (int j = colBegin; j < colEnd; j++) Q[i][j].y += evaluatePatch(patch, uParams[i], vParams[j]);
+			}
+		}, "detail evaluation");
+	}
+}
+
+int DetailHierarchy::getMaxLevel() const {
+	int level = 0;
+	for (const DetailPatch& patch : this->patches) level = std::max(level, patch.level);
+	return level;
+}
+
+size_t DetailHierarchy::getControlCount() const {
+	size_t count = 0;
+	for (const DetailPatch& patch : this->patches) count += patch.heights.size();
+	return count;
+}
+
+std::vector<std::string> DetailHierarchy::exportLines() const {
+	std::vector<std::string> lines;
+	for (const DetailPatch& patch : this->patches) {
+		// Shortest round-trip formatting, fine levels have spacings and heights far below std::to_string's six decimals
+		lines.push_back(fmt::format("dl {} {} {} {} {} {} {}", patch.level, patch.u0, patch.v0, patch.spacingU, patch.spacingV, patch.rows, patch.cols));
+		for (int row = 0; row < patch.rows; row++) {
+			std::string line = "dh";
+			for (int col = 0; col < patch.cols; col++) line += fmt::format(" {}", patch.heights[size_t(row) * patch.cols + col]);
+			lines.push_back(std::move(line));
+		}
+	}
+	return lines;
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "../JobSystem.h"
+
+// One refinement: a uniform cubic B-spline of heights over a rectangle of the base surface's (u, v)
+// domain, with control heights `spacingU` x `spacingV` apart from (u0, v0) on. The two outer rings of
+// heights stay zero, so the patch vanishes with its first and second derivatives at its border and
+// adds to the surface below it without a crease.
+struct DetailPatch {
+	// 1 is twice as dense as the base net's knots, every level doubles it again
+	int level = 1;
+	float u0 = 0.0f;
+	float v0 = 0.0f;
+	float spacingU = 1.0f;
+	float spacingV = 1.0f;
+	int rows = 0;
+	int cols = 0;
+	std::vector<float> heights;
+	// Where every control height sits over the base surface (x-z), for the brush
+	std::vector<glm::vec2> positions;
+
+	float uEnd() const { return this->u0 + this->spacingU * float(this->rows - 1); }
+	float vEnd() const { return this->v0 + this->spacingV * float(this->cols - 1); }
+	// Control heights the brush may move, inside the two zero rings
+	bool isEditable(int row, int col) const { return row >= 2 && row < this->rows - 2 && col >= 2 && col < this->cols - 2; }
+};
+
+// Hierarchical B-spline refinement of the surface. Instead of making the whole net denser, a region is
+// refined by laying a finer patch of height offsets over it; the surface is the base NURBS plus the sum
+// of every patch, so detail costs control points, memory and evaluation time only where it is.
+// Patches live in the base surface's parameter domain and therefore follow the net wherever it moves.
+class DetailHierarchy {
+
+public:
+
+	static const int MAX_LEVEL = 6;
+
+	// Lays a patch over the parameter rectangle, one level finer than the finest patch it overlaps.
+	// `baseSpacing` is the knot spacing of the base net. Returns the new patch, or -1 past MAX_LEVEL.
+	int refine(float uBegin, float uEnd, float vBegin, float vEnd, const glm::vec2& baseSpacing);
+	void clear() { this->patches.clear(); }
+	bool empty() const { return this->patches.empty(); }
+
+	// Adds the detail to the samples `samples` of the grid uParams x vParams
+	void apply(const std::vector<float>& uParams, const std::vector<float>& vParams, const Range2D& samples, std::vector<std::vector<glm::vec3>>& Q) const;
+
+	// Calls visit(row, col, offsetX, offsetZ) for every editable control height of `patch` within `radius` of `center` (x-z)
+	template <typename Visitor>
+	static void query(const DetailPatch& patch, const glm::vec2& center, float radius, Visitor&& visit) {
+		if (patch.positions.size() != patch.heights.size() || patch.rows < 5 || patch.cols < 5) return;
+		// Rows run along x and columns along z like the base net, so the window is found on the middle row and column
+		const glm::vec2* middleCol = &patch.positions[patch.cols / 2];
+		const glm::vec2* middleRow = &patch.positions[size_t(patch.rows / 2) * patch.cols];
+		int rowBegin = 0, rowEnd = patch.rows, colBegin = 0, colEnd = patch.cols;
+		while (rowBegin < rowEnd && middleCol[size_t(rowBegin) * patch.cols].x < center.x - radius) rowBegin++;
+		while (rowEnd > rowBegin && middleCol[size_t(rowEnd - 1) * patch.cols].x > center.x + radius) rowEnd--;
+		while (colBegin < colEnd && middleRow[colBegin].y < center.y - radius) colBegin++;
+		while (colEnd > colBegin && middleRow[colEnd - 1].y > center.y + radius) colEnd--;
+		const float radiusSquared = radius * radius;
+		for (int row = std::max(2, rowBegin - 1); row < std::min(patch.rows - 2, rowEnd + 1); row++) {
+			for (int col = std::max(2, colBegin - 1); col < std::min(patch.cols - 2, colEnd + 1); col++) {
+				const glm::vec2 offset = patch.positions[size_t(row) * patch.cols + col] - center;
+				if (glm::dot(offset, offset) <= radiusSquared) visit(row, col, offset.x, offset.y);
+			}
+		}
+	}
+
+	int getMaxLevel() const;
+	size_t getControlCount() const;
+	std::vector<DetailPatch>& getPatches() { return this->patches; }
+	const std::vector<DetailPatch>& getPatches() const { return this->patches; }
+
+	// .nobj Formatting: a "dl" line per patch followed by one "dh" line per row of heights
+	std::vector<std::string> exportLines() const;
+
+private:
+
+	static float evaluatePatch(const DetailPatch& patch, float u, float v);
+
+private:
+
+	std::vector<DetailPatch> patches;
+
+};
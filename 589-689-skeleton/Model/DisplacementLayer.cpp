@@ -0,0 +1,150 @@
+#include "DisplacementLayer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include <fmt/format.h>
+
+// MARK: - Tile Pool
+
+DisplacementTilePool::DisplacementTilePool(size_t blockSize, int blocksPerChunk)
+	: blockSize(blockSize)
+	, blocksPerChunk(blocksPerChunk) {
+}
+
+float* DisplacementTilePool::allocate() {
+	if (this->freeBlocks.empty()) {
+		// Blocks of the new chunk go on the free list last to first, so they are handed out in order
+		this->chunks.push_back(std::make_unique<float[]>(this->blockSize * this->blocksPerChunk));
+		this->freeBlocks.reserve(this->getCapacity());
+		float* chunk = this->chunks.back().get();
+		for (int n = this->blocksPerChunk - 1; n >= 0; n--) this->freeBlocks.push_back(chunk + this->blockSize * n);
+	}
+	float* block = this->freeBlocks.back();
+	this->freeBlocks.pop_back();
+	std::memset(block, 0, this->blockSize * sizeof(float));
+	this->usedBlocks++;
+	return block;
+}
+
+void DisplacementTilePool::release(float* block) {
+	if (block == nullptr) return;
+	this->freeBlocks.push_back(block);
+	this->usedBlocks--;
+}
+
+// MARK: - Displacement Layer
+
+DisplacementLayer::DisplacementLayer()
+	: pool(size_t(TILE_SIZE) * TILE_SIZE, 64)
+	, tiles(size_t(TILES) * TILES, nullptr) {
+}
+
+DisplacementLayer::DisplacementLayer(const DisplacementLayer& other)
+	: DisplacementLayer() {
+	*this = other;
+}
+
+DisplacementLayer& DisplacementLayer::operator=(const DisplacementLayer& other) {
+	if (this == &other) return *this;
+	// Only painted tiles are copied, into this layer's own pool
+	const size_t tileBytes = this->pool.getBlockSize() * sizeof(float);
+	for (size_t t = 0; t < this->tiles.size(); t++) {
+		if (other.tiles[t] != nullptr) {
+			if (this->tiles[t] == nullptr) {
+				this->tiles[t] = this->pool.allocate();
+				this->tileCount++;
+			}
+			std::memcpy(this->tiles[t], other.tiles[t], tileBytes);
+		} else if (this->tiles[t] != nullptr) {
+			this->pool.release(this->tiles[t]);
+			this->tiles[t] = nullptr;
+			this->tileCount--;
+		}
+	}
+	return *this;
+}
+
+DisplacementLayer::~DisplacementLayer() = default;
+
+void DisplacementLayer::clear() {
+	if (this->tileCount == 0) return;
+	for (float*& tile : this->tiles) {
+		this->pool.release(tile);
+		tile = nullptr;
+	}
+	this->tileCount = 0;
+}
+
+float DisplacementLayer::get(int row, int col) const {
+	if (row < 0 || col < 0 || row > RESOLUTION || col > RESOLUTION) return 0.0f;
+	const float* tile = this->tileAt(row, col);
+	return tile ? tile[(row % TILE_SIZE) * TILE_SIZE + col % TILE_SIZE] : 0.0f;
+}
+
+void DisplacementLayer::add(int row, int col, float value) {
+	if (row < 0 || col < 0 || row > RESOLUTION || col > RESOLUTION || value == 0.0f) return;
+	float*& tile = this->tiles[size_t(row / TILE_SIZE) * TILES + col / TILE_SIZE];
+	if (tile == nullptr) {
+		tile = this->pool.allocate();
+		this->tileCount++;
+	}
+	tile[(row % TILE_SIZE) * TILE_SIZE + col % TILE_SIZE] += value;
+}
+
+float DisplacementLayer::sample(float u, float v) const {
+	if (this->tileCount == 0) return 0.0f;
+	const float x = std::max(0.0f, std::min(u, 1.0f)) * float(RESOLUTION);
+	const float y = std::max(0.0f, std::min(v, 1.0f)) * float(RESOLUTION);
+	const int row = std::min(int(x), RESOLUTION - 1);
+	const int col = std::min(int(y), RESOLUTION - 1);
+	const float s = x - float(row), t = y - float(col);
+	const float h0 = (1.0f - t) * this->get(row, col) + t * this->get(row, col + 1);
+	const float h1 = (1.0f - t) * this->get(row + 1, col) + t * this->get(row + 1, col + 1);
+	return (1.0f - s) * h0 + s * h1;
+}
+
+bool DisplacementLayer::overlaps(float uMin, float uMax, float vMin, float vMax) const {
+	if (this->tileCount == 0) return false;
+	// A tile's heights reach one node past it through the bilinear lookup
+	auto tileRange = [](float begin, float end, int& first, int& last) {
+		first = std::max(0, int(std::floor(begin * RESOLUTION)) - 1) / TILE_SIZE;
+		last = std::min(RESOLUTION, int(std::ceil(end * RESOLUTION)) + 1) / TILE_SIZE;
+	};
+	int rowFirst, rowLast, colFirst, colLast;
+	tileRange(uMin, uMax, rowFirst, rowLast);
+	tileRange(vMin, vMax, colFirst, colLast);
+	for (int a = rowFirst; a <= rowLast; a++) {
+		for (int b = colFirst; b <= colLast; b++) {
+			if (this->tiles[size_t(a) * TILES + b] != nullptr) return true;
+		}
+	}
+	return false;
+}
+
+std::vector<std::string> DisplacementLayer::exportLines() const {
+	std::vector<std::string> lines;
+	for (int a = 0; a < TILES; a++) {
+		for (int b = 0; b < TILES; b++) {
+			const float* tile = this->tiles[size_t(a) * TILES + b];
+			if (tile == nullptr) continue;
+			std::string line = "dt " + std::to_string(a) + " " + std::to_string(b);
+			// Round-trip formatting, faint strokes are far below std::to_string's six decimals
+			for (int n = 0; n < TILE_SIZE * TILE_SIZE; n++) line += fmt::format(" {}", tile[n]);
+			lines.push_back(std::move(line));
+		}
+	}
+	return lines;
+}
+
+bool DisplacementLayer::importTile(int tileRow, int tileCol, const std::vector<float>& heights) {
+	if (tileRow < 0 || tileCol < 0 || tileRow >= TILES || tileCol >= TILES || heights.size() != size_t(TILE_SIZE) * TILE_SIZE) return false;
+	float*& tile = this->tiles[size_t(tileRow) * TILES + tileCol];
+	if (tile == nullptr) {
+		tile = this->pool.allocate();
+		this->tileCount++;
+	}
+	std::copy(heights.begin(), heights.end(), tile);
+	return true;
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Fixed-size blocks of floats carved out of chunks of `blocksPerChunk` blocks. Released blocks go
+// on a free list and are handed out again, so once the pool has grown, allocating costs nothing.
+// Chunks are only given back when the pool is destroyed.
+class DisplacementTilePool {
+
+public:
+
+	DisplacementTilePool(size_t blockSize, int blocksPerChunk);
+
+	DisplacementTilePool(const DisplacementTilePool&) = delete;
+	DisplacementTilePool& operator=(const DisplacementTilePool&) = delete;
+
+	// A zeroed block
+	float* allocate();
+	void release(float* block);
+
+	size_t getBlockSize() const { return this->blockSize; }
+	size_t getUsedBlocks() const { return this->usedBlocks; }
+	size_t getCapacity() const { return this->chunks.size() * size_t(this->blocksPerChunk); }
+
+private:
+
+	size_t blockSize;
+	int blocksPerChunk;
+	std::vector<std::unique_ptr<float[]>> chunks;
+	std::vector<float*> freeBlocks;
+	size_t usedBlocks = 0;
+
+};
+
+// Sculpted displacement along the surface normal, too fine for any control net. Heights sit on a
+// grid of (RESOLUTION + 1)^2 nodes over the (u, v) domain, 1 / RESOLUTION apart, which is as dense as
+// the finest tessellation. The grid is cut into TILE_SIZE x TILE_SIZE tiles that only get memory,
+// from the pool, once something is painted on them; everywhere else the displacement is zero.
+class DisplacementLayer {
+
+public:
+
+	static const int TILE_SIZE = 32;
+	static const int RESOLUTION = 2048;
+	static const int TILES = RESOLUTION / TILE_SIZE + 1;
+
+	DisplacementLayer();
+	DisplacementLayer(const DisplacementLayer& other);
+	DisplacementLayer& operator=(const DisplacementLayer& other);
+	~DisplacementLayer();
+
+	// Gives every tile back to the pool
+	void clear();
+	bool empty() const { return this->tileCount == 0; }
+
+	// Bilinear displacement at (u, v)
+	float sample(float u, float v) const;
+	// Whether any painted tile reaches into [uMin, uMax] x [vMin, vMax]
+	bool overlaps(float uMin, float uMax, float vMin, float vMax) const;
+	float get(int row, int col) const;
+	// Adds `value` to node (row, col), allocating its tile on first use
+	void add(int row, int col, float value);
+
+	static float nodeParameter(int index) { return float(index) / float(RESOLUTION); }
+
+	int getTileCount() const { return this->tileCount; }
+	size_t getMemoryBytes() const { return this->pool.getCapacity() * this->pool.getBlockSize() * sizeof(float); }
+
+	// .nobj Formatting: a "dt tileRow tileCol" line per painted tile, followed on the same line by its heights row by row
+	std::vector<std::string> exportLines() const;
+	bool importTile(int tileRow, int tileCol, const std::vector<float>& heights);
+
+private:
+
+	float* tileAt(int row, int col) const { return this->tiles[size_t(row / TILE_SIZE) * TILES + col / TILE_SIZE]; }
+
+private:
+
+	DisplacementTilePool pool;
+	// TILES x TILES, nullptr where nothing is painted
+	std::vector<float*> tiles;
+	int tileCount = 0;
+
+};
@@ -0,0 +1,61 @@
+#include "EditQueue.h"
+
+#include <algorithm>
+#include <limits>
+
+void EditQueue::push(EditCommand command) {
+	if (command.selection.empty()) return;
+	this->commands.push_back(std::move(command));
+}
+
+bool EditQueue::apply(std::vector<std::vector<glm::vec3>>& P, std::vector<std::vector<float>>& W, Range2D& dirtyRegion, UndoJournal* journal) {
+	dirtyRegion.rowBegin = std::numeric_limits<int>::max();
+	dirtyRegion.colBegin = std::numeric_limits<int>::max();
+	dirtyRegion.rowEnd = 0;
+	dirtyRegion.colEnd = 0;
+	for (const EditCommand& command : this->commands) {
+		const SelectionSet& selection = command.selection;
+		// Selected on a net that has since been replaced
+		if (P.empty() || selection.getRows() != int(P.size()) || selection.getCols() != int(P[0].size())) continue;
+		const std::vector<int>& indices = selection.getIndices();
+		const std::vector<float>& blendFactors = selection.getBlendFactors();
+		const int count = int(indices.size());
+		if (journal) {
+			for (int index : indices) {
+				const int row = selection.rowOf(index);
+				const int col = selection.colOf(index);
+				journal->touch(selection.getRows(), selection.getCols(), row, col, P[row][col], W[row][col]);
+			}
+		}
+		// Moves and reweights gather the selected components, update them with one kernel call and scatter them back
+		switch (command.type) {
+		case EditCommandType::Move:
+			this->scratch.resize(count);
+			for (int n = 0; n < count; n++) this->scratch[n] = P[selection.rowOf(indices[n])][selection.colOf(indices[n])].y;
+			BrushKernels::addScaled(this->scratch.data(), blendFactors.data(), command.value, count);
+			for (int n = 0; n < count; n++) P[selection.rowOf(indices[n])][selection.colOf(indices[n])].y = this->scratch[n];
+			break;
+		case EditCommandType::Reweight:
+			this->scratch.resize(count);
+			for (int n = 0; n < count; n++) this->scratch[n] = W[selection.rowOf(indices[n])][selection.colOf(indices[n])];
+			BrushKernels::reweight(this->scratch.data(), command.value, count);
+			for (int n = 0; n < count; n++) W[selection.rowOf(indices[n])][selection.colOf(indices[n])] = this->scratch[n];
+			break;
+		case EditCommandType::ResetPosition:
+			for (int index : indices) P[selection.rowOf(index)][selection.colOf(index)].y = 0.0f;
+			break;
+		case EditCommandType::ResetWeight:
+			for (int index : indices) W[selection.rowOf(index)][selection.colOf(index)] = 1.0f;
+			break;
+		}
+		// Indices are sorted, so the rows span from the first to the last member
+		dirtyRegion.rowBegin = std::min(dirtyRegion.rowBegin, selection.rowOf(indices.front()));
+		dirtyRegion.rowEnd = std::max(dirtyRegion.rowEnd, selection.rowOf(indices.back()) + 1);
+		for (int index : indices) {
+			dirtyRegion.colBegin = std::min(dirtyRegion.colBegin, selection.colOf(index));
+			dirtyRegion.colEnd = std::max(dirtyRegion.colEnd, selection.colOf(index) + 1);
+		}
+	}
+	this->commands.clear();
+	return dirtyRegion.rowEnd > dirtyRegion.rowBegin && dirtyRegion.colEnd > dirtyRegion.colBegin;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "../JobSystem.h"
+#include "SelectionSet.h"
+#include "BrushKernels.h"
+#include "UndoJournal.h"
+
+enum class EditCommandType { Move, Reweight, ResetPosition, ResetWeight };
+
+// The selection is copied when the command is pushed, so the brush may move before the queue is applied.
+// Blend factors scale Move commands.
+struct EditCommand {
+	EditCommandType type = EditCommandType::Move;
+	float value = 0.0f;
+	SelectionSet selection;
+};
+
+// Collects the edits of a frame so they can be applied to the control net in one batch
+// followed by a single surface re-evaluation.
+class EditQueue {
+
+public:
+
+	void push(EditCommand command);
+	void clear() { this->commands.clear(); }
+	bool empty() const { return this->commands.empty(); }
+
+	// Applies every queued command in order and empties the queue. `dirtyRegion` receives the
+	// bounding rectangle of all touched control points. Returns false if nothing was touched.
+	// If `journal` is given, every point's previous value is recorded in its open step.
+	bool apply(std::vector<std::vector<glm::vec3>>& P, std::vector<std::vector<float>>& W, Range2D& dirtyRegion, UndoJournal* journal = nullptr);
+
+private:
+
+	std::vector<EditCommand> commands;
+	// Gathered y components or weights of the command being applied
+	std::vector<float> scratch;
+
+};
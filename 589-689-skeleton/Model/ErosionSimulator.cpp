@@ -0,0 +1,236 @@
+#include "ErosionSimulator.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+
+#include <glm/glm.hpp>
+
+#include "ProceduralTerrain.h"
+
+namespace {
+
+	// Philox counter words telling the draws of different purposes apart
+	const uint32_t DROPLET_STREAM = 0xD201;
+	const uint32_t OFFSET_STREAM = 0x0FF5;
+	const uint32_t EROSION_KEY = 0xE2051011u;
+
+	struct Sample {
+		float height;
+		float gradientX;
+		float gradientZ;
+	};
+
+	// Bilinear height and gradient at (x, z), which must be at least one cell inside the last row and column
+	Sample sampleGrid(const std::vector<float>& grid, int width, float x, float z) {
+		const int col = int(x), row = int(z);
+		const float fx = x - float(col), fz = z - float(row);
+		const float* cell = &grid[size_t(row) * width + col];
+		const float h00 = cell[0], h10 = cell[1], h01 = cell[width], h11 = cell[width + 1];
+		Sample sample;
+		sample.gradientX = (h10 - h00) * (1.0f - fz) + (h11 - h01) * fz;
+		sample.gradientZ = (h01 - h00) * (1.0f - fx) + (h11 - h10) * fx;
+		sample.height = h00 * (1.0f - fx) * (1.0f - fz) + h10 * fx * (1.0f - fz) + h01 * (1.0f - fx) * fz + h11 * fx * fz;
+		return sample;
+	}
+
+	// Adds `amount` to the four cells around (x, z), split by bilinear weights
+	void splat(std::vector<float>& grid, int width, float x, float z, float amount) {
+		const int col = int(x), row = int(z);
+		const float fx = x - float(col), fz = z - float(row);
+		float* cell = &grid[size_t(row) * width + col];
+		cell[0] += amount * (1.0f - fx) * (1.0f - fz);
+		cell[1] += amount * fx * (1.0f - fz);
+		cell[width] += amount * (1.0f - fx) * fz;
+		cell[width + 1] += amount * fx * fz;
+	}
+
+}
+
+ErosionSimulator::~ErosionSimulator() {
+	this->cancel();
+}
+
+void ErosionSimulator::start(const ErosionSettings& settings, std::vector<float> heights, int width, float cellSize) {
+	this->cancel();
+	this->bCancel = false;
+	this->bIsRunning = true;
+	this->progress = 0.0f;
+	this->tasks.run([this, settings, heights = std::move(heights), width, cellSize]() mutable {
+		const bool bCompleted = this->run(settings, heights, width, cellSize);
+		{
+			std::lock_guard<std::mutex> lock(this->mutex);
+			if (bCompleted) {
+				this->finished = std::move(heights);
+				this->bFinished = true;
+			}
+		}
+		this->bIsRunning = false;
+	}, "erosion");
+}
+
+void ErosionSimulator::cancel() {
+	this->bCancel = true;
+	this->tasks.wait();
+	std::lock_guard<std::mutex> lock(this->mutex);
+	this->bFinished = false;
+}
+
+bool ErosionSimulator::hasResult() const {
+	std::lock_guard<std::mutex> lock(this->mutex);
+	return this->bFinished;
+}
+
+bool ErosionSimulator::acquire(std::vector<float>& heights) {
+	std::lock_guard<std::mutex> lock(this->mutex);
+	if (!this->bFinished) return false;
+	this->bFinished = false;
+	std::swap(this->finished, heights);
+	return true;
+}
+
+bool ErosionSimulator::run(const ErosionSettings& settings, std::vector<float>& heights, int width, float cellSize) {
+	if (width < 2 || heights.size() % size_t(width) != 0 || cellSize <= 0.0f) return false;
+	this->width = width;
+	this->height = int(heights.size() / size_t(width));
+	if (this->height < 2) return false;
+	this->grid.resize(heights.size());
+	for (size_t n = 0; n < heights.size(); n++) this->grid[n] = heights[n] / cellSize;
+
+	const float hydraulicShare = settings.thermalIterations > 0 ? (settings.droplets > 0 ? 0.8f : 0.0f) : 1.0f;
+	if (settings.droplets > 0) {
+		const auto start = std::chrono::steady_clock::now();
+		// Spread each round's droplets over the tiles it takes to cover the grid; starts off the grid are dropped
+		const double tilesInGrid = double(this->width) * this->height / (double(TILE_SIZE) * TILE_SIZE);
+		const int dropletsPerTile = std::max(1, int(std::ceil(double(settings.droplets) / ROUNDS / tilesInGrid)));
+		for (int round = 0; round < ROUNDS; round++) {
+			if (this->bCancel) return false;
+			const std::array<uint32_t, 4> bits = Philox::generate({ uint32_t(round), 0, OFFSET_STREAM, 0 }, { settings.seed, EROSION_KEY });
+			this->hydraulic(settings, round, int(bits[0] % TILE_SIZE), int(bits[1] % TILE_SIZE), dropletsPerTile);
+			this->progress = hydraulicShare * float(round + 1) / float(ROUNDS);
+		}
+		const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		this->dropletRate = seconds > 0.0 ? double(dropletsPerTile) * ROUNDS * tilesInGrid / seconds : 0.0;
+	}
+
+	for (int iteration = 0; iteration < settings.thermalIterations; iteration++) {
+		if (this->bCancel) return false;
+		this->thermal(settings);
+		this->progress = hydraulicShare + (1.0f - hydraulicShare) * float(iteration + 1) / float(settings.thermalIterations);
+	}
+
+	for (size_t n = 0; n < heights.size(); n++) heights[n] = this->grid[n] * cellSize;
+	this->progress = 1.0f;
+	return true;
+}
+
+// MARK: - Hydraulic
+
+void ErosionSimulator::hydraulic(const ErosionSettings& settings, int round, int rowOffset, int colOffset, int dropletsPerTile) {
+	// One tile more than the grid needs along each side, so the shifted tiling still covers it
+	const int tilesAcross = (this->width + TILE_SIZE - 1) / TILE_SIZE + 1;
+	const int tilesDown = (this->height + TILE_SIZE - 1) / TILE_SIZE + 1;
+	std::vector<Tile> pass;
+	for (int color = 0; color < 4; color++) {
+		// Tiles of one colour are two tiles apart, further than two halos reach
+		pass.clear();
+		for (int tileRow = color / 2; tileRow < tilesDown; tileRow += 2) {
+			for (int tileCol = color % 2; tileCol < tilesAcross; tileCol += 2) {
+				Tile tile;
+				tile.rowBegin = tileRow * TILE_SIZE - rowOffset;
+				tile.colBegin = tileCol * TILE_SIZE - colOffset;
+				tile.index = tileRow * tilesAcross + tileCol;
+				pass.push_back(tile);
+			}
+		}
+		JobSystem::get().parallelFor(0, int(pass.size()), 1, [&](int begin, int end) {
+			for (int t = begin; t < end; t++) {
+				const Tile& tile = pass[t];
+				// Positions stay one cell short of the last row and column for the bilinear lookups
+				const int lastRow = this->height - 1, lastCol = this->width - 1;
+				const int rowBegin = std::max(0, tile.rowBegin - TILE_HALO), rowEnd = std::min(lastRow, tile.rowBegin + TILE_SIZE + TILE_HALO);
+				const int colBegin = std::max(0, tile.colBegin - TILE_HALO), colEnd = std::min(lastCol, tile.colBegin + TILE_SIZE + TILE_HALO);
+				for (int droplet = 0; droplet < dropletsPerTile; droplet++) {
+					const std::array<uint32_t, 4> bits = Philox::generate({ uint32_t(droplet), uint32_t(tile.index), uint32_t(round), DROPLET_STREAM }, { settings.seed, EROSION_KEY });
+					const float x = float(tile.colBegin) + Philox::toUnitFloat(bits[0]) * TILE_SIZE;
+					const float z = float(tile.rowBegin) + Philox::toUnitFloat(bits[1]) * TILE_SIZE;
+					if (x < 0.0f || z < 0.0f || x >= float(lastCol) || z >= float(lastRow)) continue;
+					this->simulateDroplet(settings, x, z, rowBegin, rowEnd, colBegin, colEnd);
+				}
+			}
+		}, "erosion tiles");
+	}
+}
+
+void ErosionSimulator::simulateDroplet(const ErosionSettings& settings, float x, float z, int rowBegin, int rowEnd, int colBegin, int colEnd) {
+	std::vector<float>& grid = this->grid;
+	const int width = this->width;
+	float directionX = 0.0f, directionZ = 0.0f;
+	float speed = 1.0f, water = 1.0f, sediment = 0.0f;
+	for (int lifetime = 0; lifetime < settings.maxLifetime; lifetime++) {
+		const Sample here = sampleGrid(grid, width, x, z);
+		directionX = directionX * settings.inertia - here.gradientX * (1.0f - settings.inertia);
+		directionZ = directionZ * settings.inertia - here.gradientZ * (1.0f - settings.inertia);
+		const float length = std::sqrt(directionX * directionX + directionZ * directionZ);
+		// On flat ground there is nowhere to flow
+		if (length < 1e-6f) break;
+		directionX /= length;
+		directionZ /= length;
+		const float nextX = x + directionX, nextZ = z + directionZ;
+		// Leaving the tile's area
+		if (nextX < float(colBegin) || nextX >= float(colEnd) || nextZ < float(rowBegin) || nextZ >= float(rowEnd)) break;
+
+		const float deltaHeight = sampleGrid(grid, width, nextX, nextZ).height - here.height;
+		const float capacity = std::max(-deltaHeight * speed * water * settings.sedimentCapacity, settings.minSedimentCapacity);
+		if (sediment > capacity || deltaHeight > 0.0f) {
+			// Uphill it fills the pit behind it, otherwise it drops part of the excess
+			const float amount = deltaHeight > 0.0f ? std::min(deltaHeight, sediment) : (sediment - capacity) * settings.depositSpeed;
+			sediment -= amount;
+			splat(grid, width, x, z, amount);
+		} else {
+			// Never dig deeper than the step it just went down
+			const float amount = std::min((capacity - sediment) * settings.erodeSpeed, -deltaHeight);
+			sediment += amount;
+			splat(grid, width, x, z, -amount);
+		}
+
+		speed = std::sqrt(std::max(0.0f, speed * speed - deltaHeight * settings.gravity));
+		water *= 1.0f - settings.evaporateSpeed;
+		x = nextX;
+		z = nextZ;
+	}
+	// Whatever it still carries settles where it stopped, so no material is lost
+	splat(grid, width, x, z, sediment);
+}
+
+// MARK: - Thermal
+
+void ErosionSimulator::thermal(const ErosionSettings& settings) {
+	const int width = this->width;
+	const int height = this->height;
+	// Heights are in cells, so the talus slope is the tangent of the angle
+	const float talus = std::tan(glm::radians(settings.talusAngle));
+	// Every pair of neighbours exchanges the same amount in opposite directions, so material is conserved;
+	// a cell gives at most half of its excess per step
+	const float rate = settings.thermalRate * 0.125f;
+	this->scratch.resize(this->grid.size());
+	JobSystem::get().parallelFor(0, height, 8, [&](int begin, int end) {
+		for (int row = begin; row < end; row++) {
+			for (int col = 0; col < width; col++) {
+				const float cellHeight = this->grid[size_t(row) * width + col];
+				float change = 0.0f;
+				const int neighbours[4][2] = { { -1, 0 }, { 1, 0 }, { 0, -1 }, { 0, 1 } };
+				for (const auto& neighbour : neighbours) {
+					const int r = row + neighbour[0], c = col + neighbour[1];
+					if (r < 0 || r >= height || c < 0 || c >= width) continue;
+					const float difference = cellHeight - this->grid[size_t(r) * width + c];
+					if (difference > talus) change -= rate * (difference - talus);
+					else if (difference < -talus) change -= rate * (difference + talus);
+				}
+				this->scratch[size_t(row) * width + col] = cellHeight + change;
+			}
+		}
+	}, "thermal erosion");
+	std::swap(this->grid, this->scratch);
+}
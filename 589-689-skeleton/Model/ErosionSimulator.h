@@ -0,0 +1,102 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include "../JobSystem.h"
+
+struct ErosionSettings {
+	uint32_t seed = 1337;
+	// Cells along the longer side of the height grid the surface is sampled onto
+	int resolution = 512;
+
+	// Hydraulic: droplets flowing downhill, picking up and dropping sediment
+	int droplets = 500000;
+	int maxLifetime = 30;
+	// How much a droplet keeps its direction instead of following the slope, 0 to 1
+	float inertia = 0.05f;
+	float sedimentCapacity = 4.0f;
+	float minSedimentCapacity = 0.01f;
+	float erodeSpeed = 0.3f;
+	float depositSpeed = 0.3f;
+	float evaporateSpeed = 0.01f;
+	float gravity = 4.0f;
+
+	// Thermal: material slides down slopes steeper than the talus angle
+	int thermalIterations = 50;
+	float talusAngle = 35.0f;
+	float thermalRate = 0.5f;
+};
+
+// Hydraulic and thermal erosion on a dense height grid, run as a job in the background.
+//
+// Droplets are simulated in tiles: each tile's droplets start inside it and die when they leave a halo
+// around it, and the tiles run in four passes so no two tiles of a pass can reach the same cell. Within a
+// tile droplets run in order, and every droplet's start comes from Philox, keyed on the seed and counted
+// by round, tile and droplet. The result therefore depends on the seed and the settings only, never on
+// how many workers ran it. The tile grid moves every round so no seams build up along tile borders.
+class ErosionSimulator {
+
+public:
+
+	ErosionSimulator() = default;
+	~ErosionSimulator();
+
+	ErosionSimulator(const ErosionSimulator&) = delete;
+	ErosionSimulator& operator=(const ErosionSimulator&) = delete;
+
+	// Starts eroding a grid of heights `width` wide, `cellSize` world units apart, row by row.
+	// Cancels a simulation still running.
+	void start(const ErosionSettings& settings, std::vector<float> heights, int width, float cellSize);
+	void cancel();
+	// Takes the eroded grid once the simulation has finished
+	bool acquire(std::vector<float>& heights);
+
+	bool isRunning() const { return this->bIsRunning.load(); }
+	// A finished grid is waiting to be acquired
+	bool hasResult() const;
+	// 0 to 1 over both stages
+	float getProgress() const { return this->progress.load(); }
+	// Droplets per second of the last hydraulic stage
+	double getDropletRate() const { return this->dropletRate.load(); }
+
+	// The whole simulation on the calling thread (plus the JobSystem); returns false if cancelled
+	bool run(const ErosionSettings& settings, std::vector<float>& heights, int width, float cellSize);
+
+private:
+
+	struct Tile {
+		int rowBegin = 0;
+		int colBegin = 0;
+		int index = 0;
+	};
+
+	void hydraulic(const ErosionSettings& settings, int round, int rowOffset, int colOffset, int dropletsPerTile);
+	void simulateDroplet(const ErosionSettings& settings, float x, float z, int rowBegin, int rowEnd, int colBegin, int colEnd);
+	void thermal(const ErosionSettings& settings);
+
+private:
+
+	static const int TILE_SIZE = 64;
+	// Droplets leave their tile's area once they are this far outside; keeps a pass's tiles apart
+	static const int TILE_HALO = TILE_SIZE / 2 - 2;
+	static const int ROUNDS = 16;
+
+	// Grid being eroded, in cells: heights are divided by the cell size so slopes are true slopes
+	int width = 0;
+	int height = 0;
+	std::vector<float> grid;
+	std::vector<float> scratch;
+
+	TaskGroup tasks;
+	mutable std::mutex mutex;
+	std::vector<float> finished;
+	bool bFinished = false;
+	std::atomic<bool> bIsRunning{ false };
+	std::atomic<bool> bCancel{ false };
+	std::atomic<float> progress{ 0.0f };
+	std::atomic<double> dropletRate{ 0.0 };
+
+};
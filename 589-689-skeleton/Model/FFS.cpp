@@ -1,7 +1,11 @@
 #include "FFS.h"
 
+#include <algorithm>
 #include <random>
-#include <glm/gtc/noise.hpp>
+
+// Height a stroke raises the terrain per second at brush speed 1, i.e. the
+// old fixed 0.1 step per frame at 60 frames per second.
+static const float STROKE_RATE = 6.0f;
 
 FFS::FFS() {
 	this->generatedTerrain.generatedPoints = this->generateControlPoints();
@@ -11,7 +15,11 @@ FFS::FFS() {
 
 void FFS::render() {
 	if (this->terrainSettings.bIsChanging) this->createTerrain();
-	if (this->nurbsSettings.bIsChanging) this->generateTerrain(this->generatedTerrain.generatedPoints, this->generatedTerrain.weights);
+	if (this->nurbsSettings.bIsChanging) this->requestTerrain();
+	// A finished evaluation goes up first, this frame's edits are then patched into it
+	if (this->backgroundEvaluator.acquire(this->acquiredTessellation)) this->uploadTessellation(this->acquiredTessellation);
+	this->flushEdits();
+	this->applyErosionResult();
 	glPointSize(10.0f);
 	if (this->nurbsSettings.bDisplayControlPoints) {
 		this->controlPoints.gpuGeom.bind();
@@ -26,30 +34,14 @@ void FFS::render() {
 		this->selectedArea.gpuGeom.bind();
 		glDrawArrays(GL_POINTS, 0, GLsizei(this->selectedArea.cpuGeom.verts.size()));
 	}
-	this->freeFormSurface.gpuGeom.bind();
-	glDrawArrays(GL_TRIANGLES, 0, GLsizei(this->freeFormSurface.cpuGeom.verts.size()));
-}
-
-// NURBS
-std::vector<float> FFS::generateKnotSequence(int length, int k) {
-	int numControlPoints = length;
-	int order = k;
-	int numKnots = length + k;
-	std::vector<float> U(numKnots);
-	for (int i = 0; i < order; i++) {
-		U[i] = 0.0f;
-	}
-	if (!this->nurbsSettings.bBezier) {
-		for (int i = order; i < numKnots - order; i++) {
-			U[i] = (float)(i - order + 1) / (float)(numControlPoints - order + 1);
-		}
-	}
-	for (int i = numKnots - order; i < numKnots; i++) {
-		U[i] = 1.0f;
+	if (!this->storedArea.cpuGeom.verts.empty()) {
+		this->storedArea.gpuGeom.bind();
+		glDrawArrays(GL_POINTS, 0, GLsizei(this->storedArea.cpuGeom.verts.size()));
 	}
-	return U;
+	this->surfaceTiles.render();
 }
 
+// NURBS
 std::vector<std::vector<float>> FFS::generateWeights(int u_length, int v_length) {
 	std::vector<std::vector<float>> W(u_length, std::vector<float>(v_length));
 	for (int i = 0; i < u_length; i++) {
@@ -59,60 +51,24 @@ std::vector<std::vector<float>> FFS::generateWeights(int u_length, int v_length)
 	}
 	return W;
 }
-int FFS::delta(const std::vector<float>& U, float u, int k, int m) {
-	int i;
-	for (i = 0; i <= m + k - 1; i++) {
-		if (u >= U[i] && u < U[i + 1]) break;
-	}
-	int multiplicity = 0;
-	for (int j = i + 1; j <= m + k; j++) {
-		if (U[j] != U[i]) break;
-		multiplicity++;
-	}
-	return i + multiplicity;
-}
-
-glm::vec3 FFS::FFS_NURBS(const std::vector<std::vector<glm::vec3>>& P, const std::vector<float>& U, const std::vector<float>& V, std::vector<std::vector<float>> W, float u, float v, int k_u, int k_v, int m) {
-	std::vector<glm::vec3> D(k_v), C(k_u);
-	std::vector<float> NV(k_v);
-	int d = delta(U, u, k_u, m);
-	int d_prime = delta(V, v, k_v, m);
-	for (int i = 0; i <= k_u - 1; i++) {
-		for (int j = 0; j <= k_v - 1; j++) {
-			D[j] = P[d - i][d_prime - j] * W[d - i][d_prime - j];
-			NV[j] = W[d - i][d_prime - j];
-		}
-		for (int r = k_v; r >= 2; r--) {
-			int x = d_prime;
-			for (int s = 0; s <= r - 2; s++) {
-				float omega = (v - V[x]) / (V[x + r - 1] - V[x]);
-				D[s] = (omega * D[s]) + ((1.0f - omega) * D[s + 1]);
-				NV[s] = (omega * NV[s]) + ((1.0f - omega) * NV[s + 1]);
-				x = x - 1;
-			}
-		}
-		C[i] = D[0] / NV[0];
-	}
-	for (int r = k_u; r >= 2; r--) {
-		int i = d;
-		for (int s = 0; s <= r - 2; s++) {
-			float omega = (u - U[i]) / (U[i + r - 1] - U[i]);
-			C[s] = (omega * C[s]) + ((1.0f - omega) * C[s + 1]);
-			i = i - 1;
-		}
-	}
-	return C[0];
-}
 
 
 // FFS
 std::vector<std::vector<glm::vec3>> FFS::generateControlPoints() {
-	std::vector<std::vector<glm::vec3>> P(this->terrainSettings.nControlPoints, std::vector<glm::vec3>(this->terrainSettings.nControlPoints));
+	std::vector<std::vector<glm::vec3>> P(this->terrainSettings.nControlPointsU, std::vector<glm::vec3>(this->terrainSettings.nControlPointsV));
 
-	float x_min = -this->terrainSettings.terrainSize;
-	float x_max = this->terrainSettings.terrainSize;
-	float z_min = -this->terrainSettings.terrainSize;
-	float z_max = this->terrainSettings.terrainSize;
+	// A window onto a store keeps the store's positions
+	if (this->netStore.isOpen()) {
+		for (int i = 0; i < int(P.size()); i++) {
+			for (int j = 0; j < int(P[i].size()); j++) P[i][j] = this->netStore.flatPosition(this->storeRow + i, this->storeCol + j);
+		}
+		return P;
+	}
+
+	float x_min = -this->terrainSettings.terrainSizeU;
+	float x_max = this->terrainSettings.terrainSizeU;
+	float z_min = -this->terrainSettings.terrainSizeV;
+	float z_max = this->terrainSettings.terrainSizeV;
 
 	float x_step = (x_max - x_min) / (P.size() - 1);
 	float z_step = (z_max - z_min) / (P[0].size() - 1);
@@ -131,67 +87,103 @@ std::vector<std::vector<glm::vec3>> FFS::generateControlPoints() {
 void FFS::generateRandomTerrain() {
 	this->resetTerrain();
 	this->generatedTerrain.generatedPoints = this->generateControlPoints();
+	// Same seed and settings, same terrain, however many workers fill it
+	const RandomGenerationSettings& settings = this->randomGenerationSettings;
+	ProceduralTerrain generator(settings.noise.seed);
+	generator.fill(settings.noise, settings.skipProbability, settings.minHeight, settings.maxHeight, this->generatedTerrain.generatedPoints);
 	this->generatedTerrain.weights = this->generateWeights(this->generatedTerrain.generatedPoints.size(), this->generatedTerrain.generatedPoints[0].size());
 	this->generateTerrain(this->generatedTerrain.generatedPoints, this->generatedTerrain.weights);
+}
 
-	std::vector<std::vector<glm::vec3>> newPoints(this->generatedTerrain.generatedPoints.size(), std::vector<glm::vec3>(this->generatedTerrain.generatedPoints[0].size()));
-
-	float skipProbability = this->randomGenerationSettings.skipProbability;
+void FFS::randomizeSeed() {
 	std::random_device rd;
-	std::mt19937 gen(rd());
-	std::uniform_real_distribution<float> heightDist(this->randomGenerationSettings.minHeight, this->randomGenerationSettings.maxHeight);
-	std::uniform_real_distribution<float> skipDist(0.0f, 1.f);
-
-	for (size_t i = 0; i < this->generatedTerrain.generatedPoints.size(); ++i) {
-		for (size_t j = 0; j < this->generatedTerrain.generatedPoints[i].size(); ++j) {
-			if ((i == 0 || i == this->generatedTerrain.generatedPoints.size() - 1 || j == 0 || j == this->generatedTerrain.generatedPoints[i].size() - 1)) {
-				newPoints[i][j] = this->generatedTerrain.generatedPoints[i][j];
-				continue;
-			}
-			if (skipDist(gen) < skipProbability) {
-				newPoints[i][j] = this->generatedTerrain.generatedPoints[i][j];
-				continue;
-			}
-			glm::vec3 controlPoint = this->generatedTerrain.generatedPoints[i][j];
-			float perlinValue = glm::perlin(glm::vec2(controlPoint.x, controlPoint.z));
-			float mappedPerlinValue = heightDist(gen) * ((perlinValue + 1) / 2);
-			glm::vec3 newPoint = glm::vec3(controlPoint.x, controlPoint.y + mappedPerlinValue, controlPoint.z);
-			newPoints[i][j] = newPoint;
-		}
-	}
-	this->generatedTerrain.generatedPoints = newPoints;
-	this->generatedTerrain.weights = this->generateWeights(this->generatedTerrain.generatedPoints.size(), this->generatedTerrain.generatedPoints[0].size());
-	this->generateTerrain(this->generatedTerrain.generatedPoints, this->generatedTerrain.weights);
+	this->randomGenerationSettings.noise.seed = rd();
 }
 
 void FFS::generateTerrain(const std::vector<std::vector<glm::vec3>>& P, const std::vector<std::vector<float>>& W) {
-	this->generatedTerrain.Q.clear();
+	// Anything still being evaluated in the background is out of date now
+	this->backgroundEvaluator.cancel();
+	this->writeBackToStore(Range2D{ 0, int(P.size()), 0, P.empty() ? 0 : int(P[0].size()) });
+	this->controlNetIndex.build(P);
+	this->resizeSelections();
+	SurfaceTessellation tessellation;
+	SurfaceEvaluator::tessellate(this->makeEvaluationRequest(P, W), tessellation);
+	this->uploadTessellation(tessellation);
+	this->uploadControlNet(P);
+}
 
-	std::vector<float> U = this->generateKnotSequence(P.size(), this->nurbsSettings.k_u);
-	std::vector<float> V = this->generateKnotSequence(P[0].size(), this->nurbsSettings.k_v);
+void FFS::requestTerrain() {
+	this->controlNetIndex.build(this->generatedTerrain.generatedPoints);
+	this->resizeSelections();
+	this->backgroundEvaluator.submit(this->makeEvaluationRequest(this->generatedTerrain.generatedPoints, this->generatedTerrain.weights));
+	this->uploadControlNet(this->generatedTerrain.generatedPoints);
+}
 
-	int i = 0;
-	for (float u = U[this->nurbsSettings.k_u - 1]; u <= U[P.size() + 1]; u += (1.0f / this->nurbsSettings.resolution)) {
-		this->generatedTerrain.Q.push_back(std::vector<glm::vec3>());
-		for (float v = V[this->nurbsSettings.k_v - 1]; v <= V[P[0].size() + 1]; v += (1.0f / this->nurbsSettings.resolution)) {
-			this->generatedTerrain.Q[i].push_back(this->FFS_NURBS(P, U, V, W, u, v, this->nurbsSettings.k_u, this->nurbsSettings.k_v, P.size()));
-		}
-		i += 1;
-	} 
+bool FFS::canUpdateRegion() const {
+	// Not with a slider evaluation in flight or Bezier knots
+	const std::vector<std::vector<glm::vec3>>& P = this->generatedTerrain.generatedPoints;
+	const SurfaceSampling& sampling = this->surfaceSampling;
+	return !this->backgroundEvaluator.isBusy() && !this->nurbsSettings.bBezier
+		&& sampling.k_u == this->nurbsSettings.k_u && sampling.k_v == this->nurbsSettings.k_v
+		&& sampling.U.size() == P.size() + sampling.k_u && sampling.V.size() == P[0].size() + sampling.k_v
+		&& sampling.uParams.size() == this->generatedTerrain.Q.size();
+}
+
+void FFS::updateTerrainRegion(const Range2D& controlRegion) {
+	const std::vector<std::vector<glm::vec3>>& P = this->generatedTerrain.generatedPoints;
+	if (!this->canUpdateRegion()) {
+		this->generateTerrain(P, this->generatedTerrain.weights);
+		return;
+	}
+
+	this->writeBackToStore(controlRegion);
+	Range2D cells;
+	SurfaceEvaluator::evaluateRegion(P, this->generatedTerrain.weights, this->surfaceSampling, controlRegion, this->generatedTerrain.Q, cells, &this->detailHierarchy);
+	this->surfaceTiles.update(this->generatedTerrain.Q, cells, &this->surfaceSampling, &this->displacementLayer);
+	this->surfacePicker.refit(this->generatedTerrain.Q, cells);
+	this->uploadControlNetRegion(controlRegion);
+}
+
+void FFS::updateDetailRegion(float uMin, float uMax, float vMin, float vMax) {
+	const std::vector<std::vector<glm::vec3>>& P = this->generatedTerrain.generatedPoints;
+	if (!this->canUpdateRegion()) {
+		this->generateTerrain(P, this->generatedTerrain.weights);
+		return;
+	}
+
+	Range2D cells;
+	SurfaceEvaluator::evaluateParameterRegion(P, this->generatedTerrain.weights, this->surfaceSampling, uMin, uMax, vMin, vMax, this->generatedTerrain.Q, cells, &this->detailHierarchy);
+	this->surfaceTiles.update(this->generatedTerrain.Q, cells, &this->surfaceSampling, &this->displacementLayer);
+	this->surfacePicker.refit(this->generatedTerrain.Q, cells);
+}
+
+// Surface Geometry
+SurfaceEvaluationRequest FFS::makeEvaluationRequest(const std::vector<std::vector<glm::vec3>>& P, const std::vector<std::vector<float>>& W) {
+	SurfaceEvaluationRequest request;
+	request.P = P;
+	request.W = W;
+	request.k_u = this->nurbsSettings.k_u;
+	request.k_v = this->nurbsSettings.k_v;
+	request.resolutionU = this->nurbsSettings.resolutionU;
+	request.resolutionV = this->nurbsSettings.resolutionV;
+	request.bBezier = this->nurbsSettings.bBezier;
+	request.detail = this->detailHierarchy;
+	request.displacement = this->displacementLayer;
+	return request;
+}
 
-	std::vector<glm::vec3> surfacePoints = this->generateQuads(this->generatedTerrain.Q);
-	std::vector<glm::vec2> surfaceUVs = this->generateTextureCoord(this->generatedTerrain.Q);
-	std::vector<glm::vec3> surfaceNormals = this->generateNormals(this->generatedTerrain.Q);
-	std::vector<glm::vec3> quadPoints = this->generateQuads(P);
+void FFS::uploadTessellation(SurfaceTessellation& tessellation) {
+	std::swap(this->generatedTerrain.Q, tessellation.Q);
+	std::swap(this->surfaceSampling, tessellation.sampling);
+	this->surfacePicker.build(this->generatedTerrain.Q, this->surfaceSampling.uParams, this->surfaceSampling.vParams);
+	this->placeDetailPatches();
 
 	// Surface
-	this->freeFormSurface.gpuGeom.bind();
-	this->freeFormSurface.cpuGeom.verts = surfacePoints;
-	this->freeFormSurface.cpuGeom.uvs = surfaceUVs;
-	this->freeFormSurface.cpuGeom.normals = surfaceNormals;
-	this->freeFormSurface.gpuGeom.setVerts(this->freeFormSurface.cpuGeom.verts);
-	this->freeFormSurface.gpuGeom.setUVs(this->freeFormSurface.cpuGeom.uvs);
-	this->freeFormSurface.gpuGeom.setNormals(this->freeFormSurface.cpuGeom.normals);
+	this->surfaceTiles.upload(tessellation.tiles);
+}
+
+void FFS::uploadControlNet(const std::vector<std::vector<glm::vec3>>& P) {
+	std::vector<glm::vec3> quadPoints = SurfaceEvaluator::generateQuads(P);
 
 	// Control Points
 	this->controlPoints.gpuGeom.bind();
@@ -207,285 +199,881 @@ void FFS::generateTerrain(const std::vector<std::vector<glm::vec3>>& P, const st
 	this->nurbsLines.gpuGeom.setVerts(this->nurbsLines.cpuGeom.verts);
 	this->nurbsLines.gpuGeom.setCols(this->nurbsLines.cpuGeom.cols);
 
+	this->uploadStoredSelection();
 }
 
-std::vector<glm::vec3> FFS::generateQuads(const std::vector<std::vector<glm::vec3>>& points) {
-	std::vector<glm::vec3> R;
-	for (size_t i = 0; i < points.size() - 1; i++) {
-		for (size_t j = 0; j < points[i].size() - 1; j++) {
-			R.push_back(points[i][j + 1]);
-			R.push_back(points[i][j]);
-			R.push_back(points[i + 1][j]);
-			R.push_back(points[i][j + 1]);
-			R.push_back(points[i + 1][j + 1]);
-			R.push_back(points[i + 1][j]);
-		}
+void FFS::uploadControlNetRegion(const Range2D& controlRegion) {
+	// Only the quads around the changed control points move, and they are whole rows of the quad buffers
+	const std::vector<std::vector<glm::vec3>>& P = this->generatedTerrain.generatedPoints;
+	const int numRows = P.size();
+	const int numCols = P[0].size();
+	const size_t rowStride = size_t(numCols - 1) * 6;
+	if (this->controlPoints.cpuGeom.verts.size() != size_t(numRows - 1) * rowStride) {
+		this->uploadControlNet(P);
+		return;
 	}
-	return R;
+	const int rowBegin = std::max(0, controlRegion.rowBegin - 1);
+	const int rowEnd = std::min(numRows - 1, controlRegion.rowEnd);
+	if (rowEnd <= rowBegin) return;
+	std::vector<glm::vec3>& verts = this->controlPoints.cpuGeom.verts;
+	JobSystem::get().parallelFor(rowBegin, rowEnd, 16, [&](int begin, int end) {
+		for (int i = begin; i < end; i++) {
+			glm::vec3* r = &verts[size_t(i) * rowStride];
+			for (int j = 0; j < numCols - 1; j++) {
+				*r++ = P[i][j + 1];
+				*r++ = P[i][j];
+				*r++ = P[i + 1][j];
+				*r++ = P[i][j + 1];
+				*r++ = P[i + 1][j + 1];
+				*r++ = P[i + 1][j];
+			}
+		}
+	}, "control net region");
+	const size_t first = size_t(rowBegin) * rowStride;
+	const size_t count = size_t(rowEnd - rowBegin) * rowStride;
+	std::copy(verts.begin() + first, verts.begin() + first + count, this->nurbsLines.cpuGeom.verts.begin() + first);
+	this->controlPoints.gpuGeom.bind();
+	this->controlPoints.gpuGeom.updateVerts(verts, first, count);
+	this->nurbsLines.gpuGeom.bind();
+	this->nurbsLines.gpuGeom.updateVerts(this->nurbsLines.cpuGeom.verts, first, count);
+
+	this->uploadStoredSelection();
 }
 
-std::vector<glm::vec2> FFS::generateQuads(const std::vector<std::vector<glm::vec2>>& points) {
-	std::vector<glm::vec2> R;
-	for (size_t i = 0; i < points.size() - 1; i++) {
-		for (size_t j = 0; j < points[i].size() - 1; j++) {
-			R.push_back(points[i][j + 1]);
-			R.push_back(points[i][j]);
-			R.push_back(points[i + 1][j]);
-			R.push_back(points[i][j + 1]);
-			R.push_back(points[i + 1][j + 1]);
-			R.push_back(points[i + 1][j]);
+void FFS::uploadStoredSelection() {
+	const SelectionSet& stored = this->controlPointProperties.storedSelection;
+	this->storedArea.cpuGeom.verts.clear();
+	if (!this->generatedTerrain.generatedPoints.empty() && stored.getRows() == int(this->generatedTerrain.generatedPoints.size())) {
+		for (int index : stored.getIndices()) {
+			this->storedArea.cpuGeom.verts.push_back(this->generatedTerrain.generatedPoints[stored.rowOf(index)][stored.colOf(index)]);
 		}
 	}
-	return R;
+	this->storedArea.cpuGeom.cols.assign(this->storedArea.cpuGeom.verts.size(), glm::vec3(1.0f, 0.65f, 0.0f));
+	this->storedArea.gpuGeom.bind();
+	this->storedArea.gpuGeom.setVerts(this->storedArea.cpuGeom.verts);
+	this->storedArea.gpuGeom.setCols(this->storedArea.cpuGeom.cols);
 }
 
-std::vector<glm::vec2> FFS::generateTextureCoord(const std::vector<std::vector<glm::vec3>>& controlPoints) {
-	std::vector<std::vector<glm::vec2>> textureCoordinates;
-	const int width = controlPoints.size();
-	const int height = controlPoints[0].size();
-	const float maxVal = std::max(width, height);
-	for (int x = 0; x < width; ++x) {
-		std::vector<glm::vec2> row;
-		for (int y = 0; y < height; ++y) {
-			const float u = (x + 0.5f) / maxVal;
-			const float v = (y + 0.5f) / maxVal;
-			row.push_back(glm::vec2(u, v));
-		}
-		textureCoordinates.push_back(row);
-	}
-	std::vector<glm::vec2> T = this->generateQuads(textureCoordinates);
-	return T;
+void FFS::resizeSelections() {
+	// Selections are index based, a new net only has to resize them
+	const int rows = this->generatedTerrain.generatedPoints.size();
+	const int cols = rows > 0 ? int(this->generatedTerrain.generatedPoints[0].size()) : 0;
+	this->controlPointProperties.brushSelection.reset(rows, cols);
+	this->controlPointProperties.storedSelection.resize(rows, cols);
 }
 
-std::vector<glm::vec3> FFS::generateNormals(const std::vector<std::vector<glm::vec3>>& controlPoints) {
-	std::vector<std::vector<glm::vec3>> normals;
-	int numRows = controlPoints.size();
-	int numCols = controlPoints[0].size();
-	normals.resize(numRows);
-	for (int i = 0; i < numRows; i++) {
-		normals[i].resize(numCols);
-	}
-	for (int i = 0; i < numRows; i++) {
-		for (int j = 0; j < numCols; j++) {
-			glm::vec3 normal(0.0f, 0.0f, 0.0f);
-			if (i > 0 && j > 0) {
-				glm::vec3 v1 = controlPoints[i][j] - controlPoints[i][j - 1];
-				glm::vec3 v2 = controlPoints[i][j] - controlPoints[i - 1][j];
-				normal += glm::cross(v1, v2);
-			}
-			if (i > 0 && j < numCols - 1) {
-				glm::vec3 v1 = controlPoints[i][j] - controlPoints[i - 1][j];
-				glm::vec3 v2 = controlPoints[i][j] - controlPoints[i][j + 1];
-				normal += glm::cross(v1, v2);
-			}
-			if (i < numRows - 1 && j < numCols - 1) {
-				glm::vec3 v1 = controlPoints[i][j] - controlPoints[i][j + 1];
-				glm::vec3 v2 = controlPoints[i][j] - controlPoints[i + 1][j];
-				normal += glm::cross(v1, v2);
-			}
-			if (i < numRows - 1 && j > 0) {
-				glm::vec3 v1 = controlPoints[i][j] - controlPoints[i + 1][j];
-				glm::vec3 v2 = controlPoints[i][j] - controlPoints[i][j - 1];
-				normal += glm::cross(v1, v2);
-			}
-			normals[i][j] = glm::normalize(normal);
-		}
-	}
-	std::vector<glm::vec3> N = this->generateQuads(normals);
-	return N;
+// Picking
+SurfacePick FFS::pickSurface(const glm::vec3& rayOrigin, const glm::vec3& rayDirection) const {
+	return this->surfacePicker.pick(this->generatedTerrain.Q, rayOrigin, rayDirection);
 }
 
 // .obj Formatting
 
 std::vector<std::string> FFS::generateObjVertices(const std::vector<std::vector<glm::vec3>>& controlPoints) {
-	std::vector<std::string> vertices;
 	int numRows = controlPoints.size();
 	int numCols = controlPoints[0].size();
-	for (int i = 0; i < numRows; i++) {
-		for (int j = 0; j < numCols; j++) {
-			const glm::vec3& cp = controlPoints[i][j];
-			std::string vertexStr = "v " + std::to_string(cp.x) + " " + std::to_string(cp.y) + " " + std::to_string(cp.z);
-			vertices.push_back(vertexStr);
+	std::vector<std::string> vertices(size_t(numRows) * numCols);
+	JobSystem::get().parallelFor(0, numRows, 16, [&](int begin, int end) {
+		for (int i = begin; i < end; i++) {
+			for (int j = 0; j < numCols; j++) {
+				const glm::vec3& cp = controlPoints[i][j];
+				vertices[size_t(i) * numCols + j] = "v " + std::to_string(cp.x) + " " + std::to_string(cp.y) + " " + std::to_string(cp.z);
+			}
 		}
-	}
+	}, "obj vertices");
 	return vertices;
 }
 
 std::vector<std::string> FFS::generateObjFaces(const std::vector<std::vector<glm::vec3>>& controlPoints) {
-	std::vector<std::string> faces;
 	int numRows = controlPoints.size();
 	int numCols = controlPoints[0].size();
-	for (int i = 0; i < numRows - 1; i++) {
-		for (int j = 0; j < numCols - 1; j++) {
-			int v1 = i * numCols + j + 1;
-			int v2 = i * numCols + j + 2;
-			int v3 = (i + 1) * numCols + j + 1;
+	std::vector<std::string> faces(size_t(numRows - 1) * (numCols - 1) * 2);
+	JobSystem::get().parallelFor(0, numRows - 1, 16, [&](int begin, int end) {
+		for (int i = begin; i < end; i++) {
+			size_t face = size_t(i) * (numCols - 1) * 2;
+			for (int j = 0; j < numCols - 1; j++) {
+				int v1 = i * numCols + j + 1;
+				int v2 = i * numCols + j + 2;
+				int v3 = (i + 1) * numCols + j + 1;
 
-			std::string faceStr = "f " + std::to_string(v1) + " " + std::to_string(v2) + " " + std::to_string(v3);
-			faces.push_back(faceStr);
+				faces[face++] = "f " + std::to_string(v1) + " " + std::to_string(v2) + " " + std::to_string(v3);
 
-			v1 = (i + 1) * numCols + j + 1;
-			v2 = i * numCols + j + 2;
-			v3 = (i + 1) * numCols + j + 2;
+				v1 = (i + 1) * numCols + j + 1;
+				v2 = i * numCols + j + 2;
+				v3 = (i + 1) * numCols + j + 2;
 
-			faceStr = "f " + std::to_string(v1) + " " + std::to_string(v2) + " " + std::to_string(v3);
-			faces.push_back(faceStr);
+				faces[face++] = "f " + std::to_string(v1) + " " + std::to_string(v2) + " " + std::to_string(v3);
+			}
 		}
-	}
+	}, "obj faces");
 	return faces;
 }
 
 std::vector<std::string> FFS::getExportObjFormat() {
-	std::vector<std::string> objs = this->generateObjVertices(this->generatedTerrain.Q);
-	std::vector<std::string> faces = this->generateObjFaces(this->generatedTerrain.Q);
-	std::vector<glm::vec2> surfaceUVs = this->generateTextureCoord(this->generatedTerrain.Q);
-	std::vector<glm::vec3> surfaceNormals = this->generateNormals(this->generatedTerrain.Q);
-	for (const glm::vec2& uv : surfaceUVs) {
-		std::string uvStr = "vt " + std::to_string(uv.x) + " " + std::to_string(uv.y);
-		objs.push_back(uvStr);
-	}
-	for (const glm::vec3& normal : surfaceNormals) {
-		std::string normalStr = "vn " + std::to_string(normal.x) + " " + std::to_string(normal.y) + " " + std::to_string(normal.z);
-		objs.push_back(normalStr);
-	}
-	objs.insert(objs.end(), faces.begin(), faces.end());
+	// The mesh on screen, displacement included
+	const std::vector<std::vector<glm::vec3>>* surface = &this->generatedTerrain.Q;
+	std::vector<std::vector<glm::vec3>> displaced;
+	const int numRows = this->generatedTerrain.Q.size();
+	const int numCols = numRows > 0 ? int(this->generatedTerrain.Q[0].size()) : 0;
+	if (!this->displacementLayer.empty() && this->surfaceSampling.uParams.size() == size_t(numRows) && this->surfaceSampling.vParams.size() == size_t(numCols)) {
+		SurfaceEvaluator::displaceSamples(this->generatedTerrain.Q, this->surfaceSampling, this->displacementLayer, Range2D{ 0, numRows, 0, numCols }, displaced);
+		surface = &displaced;
+	}
+	std::vector<std::string> objs = this->generateObjVertices(*surface);
+	std::vector<std::string> faces = this->generateObjFaces(*surface);
+	std::vector<glm::vec2> surfaceUVs = SurfaceEvaluator::generateTextureCoord(*surface);
+	std::vector<glm::vec3> surfaceNormals = SurfaceEvaluator::generateNormals(*surface);
+	size_t uvOffset = objs.size();
+	size_t normalOffset = uvOffset + surfaceUVs.size();
+	objs.resize(normalOffset + surfaceNormals.size());
+	JobSystem::get().parallelFor(0, int(surfaceUVs.size()), 4096, [&](int begin, int end) {
+		for (int i = begin; i < end; i++) {
+			const glm::vec2& uv = surfaceUVs[i];
+			objs[uvOffset + i] = "vt " + std::to_string(uv.x) + " " + std::to_string(uv.y);
+		}
+	}, "obj uvs");
+	JobSystem::get().parallelFor(0, int(surfaceNormals.size()), 4096, [&](int begin, int end) {
+		for (int i = begin; i < end; i++) {
+			const glm::vec3& normal = surfaceNormals[i];
+			objs[normalOffset + i] = "vn " + std::to_string(normal.x) + " " + std::to_string(normal.y) + " " + std::to_string(normal.z);
+		}
+	}, "obj normals");
+	objs.insert(objs.end(), std::make_move_iterator(faces.begin()), std::make_move_iterator(faces.end()));
 	return objs;
 }
 
 std::vector<std::string> FFS::getExportNObjFormat() {
-	std::vector<std::string> result;
-	for (int i = 0; i < this->generatedTerrain.generatedPoints.size(); ++i) {
-		for (int j = 0; j < this->generatedTerrain.generatedPoints[i].size(); ++j) {
-			const glm::vec3& point = this->generatedTerrain.generatedPoints[i][j];
-			const float& weight = this->generatedTerrain.weights[i][j];
-			std::string controlPointStr = "cp " + std::to_string(point.x) + " " + std::to_string(point.y) + " " + std::to_string(point.z) + " " + std::to_string(weight);
-			result.push_back(controlPointStr);
+	const int numRows = this->generatedTerrain.generatedPoints.size();
+	const int numCols = this->generatedTerrain.generatedPoints[0].size();
+	std::vector<std::string> result(size_t(numRows) * numCols);
+	JobSystem::get().parallelFor(0, numRows, 8, [&](int begin, int end) {
+		for (int i = begin; i < end; ++i) {
+			for (int j = 0; j < numCols; ++j) {
+				const glm::vec3& point = this->generatedTerrain.generatedPoints[i][j];
+				const float& weight = this->generatedTerrain.weights[i][j];
+				result[size_t(i) * numCols + j] = "cp " + std::to_string(point.x) + " " + std::to_string(point.y) + " " + std::to_string(point.z) + " " + std::to_string(weight);
+			}
 		}
-	}
+	}, "nobj control points");
 	std::string kUStr = "ku " + std::to_string(this->nurbsSettings.k_u);
 	std::string kVStr = "kv " + std::to_string(this->nurbsSettings.k_v);
-	std::string resolutionStr = "r " + std::to_string(this->nurbsSettings.resolution);
-	std::string numberOfControlPointsStr = "nCp " + std::to_string(this->terrainSettings.nControlPoints);
-	std::string terrainSizeStr = "tz " + std::to_string(this->terrainSettings.terrainSize);
+	// "r", "nCp" and "tz" are the u values; files without the v lines are square
+	std::string resolutionStr = "r " + std::to_string(this->nurbsSettings.resolutionU);
+	std::string resolutionVStr = "rV " + std::to_string(this->nurbsSettings.resolutionV);
+	std::string numberOfControlPointsStr = "nCp " + std::to_string(numRows);
+	std::string numberOfControlPointsVStr = "nCpV " + std::to_string(numCols);
+	std::string terrainSizeStr = "tz " + std::to_string(this->terrainSettings.terrainSizeU);
+	std::string terrainSizeVStr = "tzV " + std::to_string(this->terrainSettings.terrainSizeV);
 	result.push_back(kUStr);
 	result.push_back(kVStr);
 	result.push_back(resolutionStr);
+	result.push_back(resolutionVStr);
 	result.push_back(numberOfControlPointsStr);
+	result.push_back(numberOfControlPointsVStr);
 	result.push_back(terrainSizeStr);
+	result.push_back(terrainSizeVStr);
+	std::vector<std::string> detailLines = this->detailHierarchy.exportLines();
+	result.insert(result.end(), std::make_move_iterator(detailLines.begin()), std::make_move_iterator(detailLines.end()));
+	std::vector<std::string> displacementLines = this->displacementLayer.exportLines();
+	result.insert(result.end(), std::make_move_iterator(displacementLines.begin()), std::make_move_iterator(displacementLines.end()));
 	return result;
 }
 
 bool FFS::getImportNObjFormat(const ImportNOBJSettings& settings) {
 	if (settings.controlPoints.empty()) return false;
+	const int rows = settings.nControlPointsU;
+	const int cols = settings.nControlPointsV;
+	if (rows < 2 || cols < 2 || settings.controlPoints.size() != size_t(rows) * cols || settings.weights.size() != settings.controlPoints.size()) {
+		Log::error("A {}x{} net needs {} control points and weights, the file has {} and {}", rows, cols, size_t(rows) * cols, settings.controlPoints.size(), settings.weights.size());
+		return false;
+	}
 	this->resetTerrain();
-	int size = settings.controlPoints.size() / settings.nControlPoints;
-	std::vector<std::vector<glm::vec3>> controlPoints(size, std::vector<glm::vec3>(size));
-	std::vector<std::vector<float>> weights(size, std::vector<float>(size));
+	std::vector<std::vector<glm::vec3>> controlPoints(rows, std::vector<glm::vec3>(cols));
+	std::vector<std::vector<float>> weights(rows, std::vector<float>(cols));
 	for (int i = 0; i < settings.controlPoints.size(); ++i)
-		controlPoints[i / size][i % size] = settings.controlPoints[i];
+		controlPoints[i / cols][i % cols] = settings.controlPoints[i];
 	for (int i = 0; i < settings.weights.size(); ++i)
-		weights[i / size][i % size] = settings.weights[i];
-	this->terrainSettings.nControlPoints = settings.nControlPoints;
-	this->terrainSettings.terrainSize = settings.terrainSize;
+		weights[i / cols][i % cols] = settings.weights[i];
+	this->terrainSettings.nControlPointsU = rows;
+	this->terrainSettings.nControlPointsV = cols;
+	this->terrainSettings.terrainSizeU = settings.terrainSizeU;
+	this->terrainSettings.terrainSizeV = settings.terrainSizeV;
 	this->generatedTerrain.generatedPoints = controlPoints;
 	this->generatedTerrain.weights = weights;
 	this->nurbsSettings.k_u = settings.k_u;
 	this->nurbsSettings.k_v = settings.k_v;
-	this->nurbsSettings.resolution = settings.resolution;
+	this->nurbsSettings.resolutionU = settings.resolutionU;
+	this->nurbsSettings.resolutionV = settings.resolutionV;
+	for (const DetailPatch& patch : settings.detailPatches) {
+		if (patch.rows >= 5 && patch.cols >= 5 && patch.heights.size() == size_t(patch.rows) * patch.cols && patch.spacingU > 0.0f && patch.spacingV > 0.0f) this->detailHierarchy.getPatches().push_back(patch);
+	}
+	this->displacementLayer = settings.displacement;
 	this->generateTerrain(this->generatedTerrain.generatedPoints, this->generatedTerrain.weights);
 	return true;
 }
 
+// Heightmap Import
+
+bool FFS::importHeightmap() {
+	if (this->heightmapImportSettings.path.empty()) return false;
+	this->resetTerrain();
+	this->terrainSettings.nControlPointsU = this->heightmapImportSettings.nControlPoints;
+	this->terrainSettings.nControlPointsV = this->heightmapImportSettings.nControlPoints;
+	// The fit is made against the B-spline knots, Bezier knots would evaluate a different surface
+	this->nurbsSettings.bBezier = false;
+	this->generatedTerrain.generatedPoints = this->generateControlPoints();
+	if (!this->heightmapFitter.fit(this->heightmapImportSettings, this->nurbsSettings.k_u, this->nurbsSettings.k_v, this->generatedTerrain.generatedPoints, this->generatedTerrain.weights)) {
+		this->generatedTerrain.weights = this->generateWeights(this->generatedTerrain.generatedPoints.size(), this->generatedTerrain.generatedPoints[0].size());
+	}
+	this->generateTerrain(this->generatedTerrain.generatedPoints, this->generatedTerrain.weights);
+	return this->heightmapFitter.getLastResult().bSucceeded;
+}
+
+bool FFS::importPointCloud() {
+	if (this->pointCloudImportSettings.path.empty()) return false;
+	// A net of the same size keeps its weights and the heights are fitted against them
+	const int n = this->pointCloudImportSettings.nControlPoints;
+	std::vector<std::vector<float>> weights = this->generatedTerrain.weights;
+	if (int(weights.size()) != n || int(weights[0].size()) != n) weights = this->generateWeights(n, n);
+	this->resetTerrain();
+	this->terrainSettings.nControlPointsU = n;
+	this->terrainSettings.nControlPointsV = n;
+	this->nurbsSettings.bBezier = false;
+	this->generatedTerrain.generatedPoints = this->generateControlPoints();
+	this->generatedTerrain.weights = weights;
+	this->pointCloudFitter.fit(this->pointCloudImportSettings, this->nurbsSettings.k_u, this->nurbsSettings.k_v, this->generatedTerrain.generatedPoints, this->generatedTerrain.weights);
+	this->generateTerrain(this->generatedTerrain.generatedPoints, this->generatedTerrain.weights);
+	return this->pointCloudFitter.getLastResult().bSucceeded;
+}
+
 
 void FFS::detectControlPoints(const glm::vec3& mousePosition3D) {
 	if (this->controlPoints.cpuGeom.verts.empty()) return;
-	this->controlPointProperties.selectedControlPoints.clear();
-	this->controlPointProperties.selectedWeights.clear();
+	SelectionSet& selection = this->controlPointProperties.brushSelection;
+	selection.clear();
 	this->selectedArea.cpuGeom.verts.clear();
 	this->selectedArea.cpuGeom.cols.clear();
-	for (size_t i = 0; i < this->generatedTerrain.generatedPoints.size(); i++) {
-		for (size_t j = 0; j < this->generatedTerrain.generatedPoints[i].size(); j++) {
-			const glm::vec3* pointPos = &this->generatedTerrain.generatedPoints[i][j];
-			float distanceXZ = glm::length(glm::vec2(mousePosition3D.x, mousePosition3D.z) - glm::vec2(pointPos->x, pointPos->z));
-			float distanceY = glm::length(glm::vec1(mousePosition3D.y) - glm::vec1(pointPos->y));
-			if (distanceXZ <= this->brushSettings.brushRadius && distanceY <= 1000.0f) {
-				SelectedControlPoint selectedControlPoint;
-				selectedControlPoint.controlPoint = &this->generatedTerrain.generatedPoints[i][j];
-				this->controlPointBlend(mousePosition3D);
-				this->controlPointProperties.selectedControlPoints.push_back(selectedControlPoint);
-				this->controlPointProperties.selectedWeights.push_back(&this->generatedTerrain.weights[i][j]);
-
-			}
-		}
-	}
+	// Gather the points under the brush, then blend them all in one kernel call
+	BrushPoints& points = this->brushPoints;
+	points.clear();
+	this->controlNetIndex.query(glm::vec2(mousePosition3D.x, mousePosition3D.z), this->brushSettings.brushRadius, [&](int i, int j, float) {
+		const glm::vec3& point = this->generatedTerrain.generatedPoints[i][j];
+		if (std::abs(mousePosition3D.y - point.y) > 1000.0f) return;
+		points.push(i, j, point.x - mousePosition3D.x, point.z - mousePosition3D.z);
+		this->selectedArea.cpuGeom.verts.push_back(point);
+	});
+	BrushKernels::evaluateFalloff(this->brushFalloffParams(), points);
+	for (int n = 0; n < points.size(); n++) selection.add(points.rows[n], points.cols[n], points.blend[n]);
 	this->selectedArea.gpuGeom.bind();
-	for (const SelectedControlPoint& sp : this->controlPointProperties.selectedControlPoints) {
-		glm::vec3* p = sp.controlPoint;
-		this->selectedArea.cpuGeom.verts.push_back(*p);
-	}
 	this->selectedArea.cpuGeom.cols.resize(this->selectedArea.cpuGeom.verts.size(), glm::vec3(0.0f, 0.0f, 1.0f));
 	this->selectedArea.gpuGeom.setVerts(this->selectedArea.cpuGeom.verts);
 	this->selectedArea.gpuGeom.setCols(this->selectedArea.cpuGeom.cols);
-	this->controlPointsChangeColor(mousePosition3D, glm::vec3(0.0f, 0.0f, 1.0f));
+	this->controlPointsChangeColor(glm::vec3(0.0f, 0.0f, 1.0f));
 }
 
-void FFS::updateControlPointsPosition(float yValue) {
-	if (this->controlPoints.cpuGeom.verts.empty() || this->controlPointProperties.selectedControlPoints.empty()) return;
-	float brushRateScale = this->brushSettings.brushRateScale;
-	for (SelectedControlPoint& sp : this->controlPointProperties.selectedControlPoints) {
-		glm::vec3* point = sp.controlPoint;
-		*point += glm::vec3(0.0f, yValue * brushRateScale * sp.blendFactor, 0.0f);
+void FFS::flushEdits() {
+	this->applyStrokeStamps();
+	if (!this->editQueue.empty()) {
+		Range2D dirtyRegion;
+		if (this->editQueue.apply(this->generatedTerrain.generatedPoints, this->generatedTerrain.weights, dirtyRegion, &this->undoJournal)) {
+			this->updateTerrainRegion(dirtyRegion);
+		}
+	}
+	// Strokes and drags are one undo step however many frames they last; other edits are one step per frame
+	if (!this->brushStroke.isActive() && !this->surfaceDrag.isActive() && this->undoJournal.hasOpenStep()) {
+		this->undoJournal.commit(this->generatedTerrain.generatedPoints, this->generatedTerrain.weights);
 	}
-	this->generateTerrain(this->generatedTerrain.generatedPoints, this->generatedTerrain.weights);
 }
 
 void FFS::updateControlPointsWeights(float weight) {
-	if (this->controlPoints.cpuGeom.verts.empty() || this->controlPointProperties.selectedWeights.empty()) return;
-	for (float* w : this->controlPointProperties.selectedWeights) {
-		if (*w <= 1.0f && weight < 0.0f) {
-			*w += weight / 20.0f;
-			if (*w <= 0.01f) *w = 0.01f;
-			continue;
-		} else if (*w <= 1.0f && weight > 0.0f) {
-			*w += weight / 20.0f;
-			continue;
+	if (this->controlPoints.cpuGeom.verts.empty() || this->controlPointProperties.brushSelection.empty()) return;
+	this->pushEdit(EditCommandType::Reweight, weight);
+}
+
+BrushFalloffParams FFS::brushFalloffParams() const {
+	BrushFalloffParams params;
+	params.falloff = this->brushSettings.falloff;
+	params.brushRadius = this->brushSettings.brushRadius;
+	params.blendRadius = this->brushSettings.blendRadius;
+	params.maxBlendValue = this->brushSettings.maxBlendValue;
+	params.lut = this->brushSettings.customFalloff;
+	params.lutSize = BRUSH_CUSTOM_LUT_SIZE;
+	return params;
+}
+
+// MARK: - Edits
+
+void FFS::pushEdit(EditCommandType type, float value) {
+	EditCommand command;
+	command.type = type;
+	command.value = value;
+	command.selection = this->editSelection();
+	this->editQueue.push(std::move(command));
+}
+
+SelectionSet FFS::editSelection() const {
+	SelectionSet selection = this->controlPointProperties.brushSelection;
+	if (!this->controlPointProperties.storedSelection.empty()) selection.intersect(this->controlPointProperties.storedSelection);
+	return selection;
+}
+
+void FFS::applyStrokeStamps() {
+	if (this->pendingStamps.empty() || this->generatedTerrain.generatedPoints.empty()) {
+		this->pendingStamps.clear();
+		return;
+	}
+	if (this->displacementSettings.bSculpt) {
+		this->applyDisplacementStamps();
+		return;
+	}
+	if (this->detailSettings.editLevel > 0) {
+		this->applyDetailStamps();
+		return;
+	}
+	const int rows = this->generatedTerrain.generatedPoints.size();
+	const int cols = this->generatedTerrain.generatedPoints[0].size();
+	if (this->strokeDisplacement.size() != size_t(rows) * cols) this->strokeDisplacement.assign(size_t(rows) * cols, 0.0f);
+
+	// Accumulate every stamp of the frame into one displacement field
+	const SelectionSet& stored = this->controlPointProperties.storedSelection;
+	const float direction = this->brushSettings.bIsRising ? 1.0f : -1.0f;
+	SelectionSet touched(rows, cols);
+	for (const BrushStamp& stamp : this->pendingStamps) {
+		const float amount = direction * STROKE_RATE * this->brushSettings.brushRateScale * stamp.seconds;
+		BrushPoints& points = this->brushPoints;
+		points.clear();
+		// A rotated square image reaches out to its corners
+		const float radius = this->bStrokeUsesStamp ? this->strokeStamp.radius * 1.41422f : this->strokeFalloff.brushRadius;
+		this->controlNetIndex.query(glm::vec2(stamp.position.x, stamp.position.z), radius, [&](int i, int j, float) {
+			if (!stored.empty() && !stored.contains(i * cols + j)) return;
+			const glm::vec3& point = this->generatedTerrain.generatedPoints[i][j];
+			points.push(i, j, point.x - stamp.position.x, point.z - stamp.position.z);
+		});
+		if (this->bStrokeUsesStamp) this->stampBrush.evaluate(this->strokeStamp, points);
+		else BrushKernels::evaluateFalloff(this->strokeFalloff, points);
+		BrushKernels::scale(points.blend.data(), amount, points.size());
+		for (int n = 0; n < points.size(); n++) {
+			const int index = points.rows[n] * cols + points.cols[n];
+			this->strokeDisplacement[index] += points.blend[n];
+			touched.add(index);
 		}
-		*w += weight;
 	}
-	this->generateTerrain(this->generatedTerrain.generatedPoints, this->generatedTerrain.weights);
+	this->pendingStamps.clear();
+	if (touched.empty()) return;
+
+	// ...and apply it as a single move whose blend factors are the displacements
+	EditCommand command;
+	command.type = EditCommandType::Move;
+	command.value = 1.0f;
+	command.selection.reset(rows, cols);
+	for (int index : touched.getIndices()) {
+		command.selection.add(index, this->strokeDisplacement[index]);
+		this->strokeDisplacement[index] = 0.0f;
+	}
+	this->editQueue.push(std::move(command));
 }
 
-void FFS::controlPointBlend(const glm::vec3& mousePosition3D) {
-	if (this->controlPoints.cpuGeom.verts.empty() || this->controlPointProperties.selectedControlPoints.empty()) return;
-	for (SelectedControlPoint& sp : this->controlPointProperties.selectedControlPoints) {
-		glm::vec2 mouseXZPos = glm::vec2(mousePosition3D.x, mousePosition3D.z);
-		glm::vec2 cpXZPos = glm::vec2(sp.controlPoint->x, sp.controlPoint->z);
-		float distance = glm::distance(mouseXZPos, cpXZPos);
-		float blend = 1.0f;
-		if (this->brushSettings.items[this->brushSettings.current_item] == "Inverse Distance Squared") {
-			blend = 1.0f / (distance * distance);
-		} else if (this->brushSettings.items[this->brushSettings.current_item] == "Distance Squared") {
-			blend = (distance * distance);
-		} else {
-			blend = 1.0f;
+void FFS::applyDetailStamps() {
+	// Same stamps as on the base net, painted onto the control heights of every patch of the edited level
+	const float direction = this->brushSettings.bIsRising ? 1.0f : -1.0f;
+	const float radius = this->bStrokeUsesStamp ? this->strokeStamp.radius * 1.41422f : this->strokeFalloff.brushRadius;
+	float uMin = std::numeric_limits<float>::max(), uMax = std::numeric_limits<float>::lowest();
+	float vMin = std::numeric_limits<float>::max(), vMax = std::numeric_limits<float>::lowest();
+	for (DetailPatch& patch : this->detailHierarchy.getPatches()) {
+		if (patch.level != this->detailSettings.editLevel) continue;
+		int rowBegin = patch.rows, rowEnd = -1, colBegin = patch.cols, colEnd = -1;
+		for (const BrushStamp& stamp : this->pendingStamps) {
+			const float amount = direction * STROKE_RATE * this->brushSettings.brushRateScale * stamp.seconds;
+			BrushPoints& points = this->brushPoints;
+			points.clear();
+			DetailHierarchy::query(patch, glm::vec2(stamp.position.x, stamp.position.z), radius, [&](int row, int col, float offsetX, float offsetZ) {
+				points.push(row, col, offsetX, offsetZ);
+			});
+			if (this->bStrokeUsesStamp) this->stampBrush.evaluate(this->strokeStamp, points);
+			else BrushKernels::evaluateFalloff(this->strokeFalloff, points);
+			for (int n = 0; n < points.size(); n++) {
+				patch.heights[size_t(points.rows[n]) * patch.cols + points.cols[n]] += amount * points.blend[n];
+				rowBegin = std::min(rowBegin, points.rows[n]);
+				rowEnd = std::max(rowEnd, points.rows[n]);
+				colBegin = std::min(colBegin, points.cols[n]);
+				colEnd = std::max(colEnd, points.cols[n]);
+			}
+		}
+		if (rowEnd < rowBegin) continue;
+		// A control height shapes the surface up to two spacings away
+		uMin = std::min(uMin, patch.u0 + float(rowBegin - 2) * patch.spacingU);
+		uMax = std::max(uMax, patch.u0 + float(rowEnd + 2) * patch.spacingU);
+		vMin = std::min(vMin, patch.v0 + float(colBegin - 2) * patch.spacingV);
+		vMax = std::max(vMax, patch.v0 + float(colEnd + 2) * patch.spacingV);
+	}
+	this->pendingStamps.clear();
+	if (uMax < uMin) return;
+	this->updateDetailRegion(uMin, uMax, vMin, vMax);
+}
+
+void FFS::applyDisplacementStamps() {
+	const std::vector<std::vector<glm::vec3>>& Q = this->generatedTerrain.Q;
+	const std::vector<float>& uParams = this->surfaceSampling.uParams;
+	const std::vector<float>& vParams = this->surfaceSampling.vParams;
+	const int numRows = Q.size();
+	const int numCols = numRows > 0 ? int(Q[0].size()) : 0;
+	if (numRows < 2 || numCols < 2 || uParams.size() != size_t(numRows) || vParams.size() != size_t(numCols)) {
+		this->pendingStamps.clear();
+		return;
+	}
+
+	// Where a node of the layer lies in x-z, interpolated from the (evenly spaced) samples around it
+	const float rowsPerU = float(numRows - 1) / (uParams.back() - uParams.front());
+	const float colsPerV = float(numCols - 1) / (vParams.back() - vParams.front());
+	auto nodePosition = [&](int row, int col) {
+		const float x = std::max(0.0f, std::min((DisplacementLayer::nodeParameter(row) - uParams.front()) * rowsPerU, float(numRows - 1)));
+		const float y = std::max(0.0f, std::min((DisplacementLayer::nodeParameter(col) - vParams.front()) * colsPerV, float(numCols - 1)));
+		const int i = std::min(int(x), numRows - 2), j = std::min(int(y), numCols - 2);
+		const float s = x - float(i), t = y - float(j);
+		const glm::vec3 p = (1.0f - s) * ((1.0f - t) * Q[i][j] + t * Q[i][j + 1]) + s * ((1.0f - t) * Q[i + 1][j] + t * Q[i + 1][j + 1]);
+		return glm::vec2(p.x, p.z);
+	};
+
+	const float direction = this->brushSettings.bIsRising ? 1.0f : -1.0f;
+	const float radius = this->bStrokeUsesStamp ? this->strokeStamp.radius * 1.41422f : this->strokeFalloff.brushRadius;
+	const int middleRow = numRows / 2, middleCol = numCols / 2;
+	int rowMin = DisplacementLayer::RESOLUTION, rowMax = -1, colMin = DisplacementLayer::RESOLUTION, colMax = -1;
+	for (const BrushStamp& stamp : this->pendingStamps) {
+		const float amount = direction * STROKE_RATE * this->brushSettings.brushRateScale * this->displacementSettings.strength * stamp.seconds;
+		// Samples run along x by row and along z by column like the net, so the brush's window is found on the middle row and column
+		const int rowBegin = int(std::lower_bound(Q.begin(), Q.end(), stamp.position.x - radius, [middleCol](const std::vector<glm::vec3>& row, float x) { return row[middleCol].x < x; }) - Q.begin());
+		const int rowEnd = int(std::upper_bound(Q.begin(), Q.end(), stamp.position.x + radius, [middleCol](float x, const std::vector<glm::vec3>& row) { return x < row[middleCol].x; }) - Q.begin());
+		const int colBegin = int(std::lower_bound(Q[middleRow].begin(), Q[middleRow].end(), stamp.position.z - radius, [](const glm::vec3& point, float z) { return point.z < z; }) - Q[middleRow].begin());
+		const int colEnd = int(std::upper_bound(Q[middleRow].begin(), Q[middleRow].end(), stamp.position.z + radius, [](float z, const glm::vec3& point) { return z < point.z; }) - Q[middleRow].begin());
+		const int nodeRowBegin = std::max(0, int(uParams[std::max(0, rowBegin - 1)] * DisplacementLayer::RESOLUTION));
+		const int nodeRowEnd = std::min(DisplacementLayer::RESOLUTION, int(std::ceil(uParams[std::min(numRows - 1, rowEnd)] * DisplacementLayer::RESOLUTION)));
+		const int nodeColBegin = std::max(0, int(vParams[std::max(0, colBegin - 1)] * DisplacementLayer::RESOLUTION));
+		const int nodeColEnd = std::min(DisplacementLayer::RESOLUTION, int(std::ceil(vParams[std::min(numCols - 1, colEnd)] * DisplacementLayer::RESOLUTION)));
+
+		BrushPoints& points = this->brushPoints;
+		points.clear();
+		const float radiusSquared = radius * radius;
+		for (int row = nodeRowBegin; row <= nodeRowEnd; row++) {
+			for (int col = nodeColBegin; col <= nodeColEnd; col++) {
+				const glm::vec2 offset = nodePosition(row, col) - glm::vec2(stamp.position.x, stamp.position.z);
+				if (glm::dot(offset, offset) <= radiusSquared) points.push(row, col, offset.x, offset.y);
+			}
 		}
-		if (distance < this->brushSettings.blendRadius) {
-			if (blend >= this->brushSettings.maxBlendValue) blend = this->brushSettings.maxBlendValue;
-			sp.blendFactor = blend;
+		if (this->bStrokeUsesStamp) this->stampBrush.evaluate(this->strokeStamp, points);
+		else BrushKernels::evaluateFalloff(this->strokeFalloff, points);
+		for (int n = 0; n < points.size(); n++) {
+			if (points.blend[n] == 0.0f) continue;
+			this->displacementLayer.add(points.rows[n], points.cols[n], amount * points.blend[n]);
+			rowMin = std::min(rowMin, points.rows[n]);
+			rowMax = std::max(rowMax, points.rows[n]);
+			colMin = std::min(colMin, points.cols[n]);
+			colMax = std::max(colMax, points.cols[n]);
+		}
+	}
+	this->pendingStamps.clear();
+	if (rowMax < rowMin) return;
+	// A surface still being evaluated was requested with the layer as it was, so it is requested again
+	if (this->backgroundEvaluator.isBusy()) {
+		this->requestTerrain();
+		return;
+	}
+
+	// Q itself doesn't move; the samples within a node of the painted ones are displaced anew, and the quads around them rebuilt
+	const int sampleRowBegin = int(std::lower_bound(uParams.begin(), uParams.end(), DisplacementLayer::nodeParameter(rowMin - 1)) - uParams.begin());
+	const int sampleRowEnd = int(std::upper_bound(uParams.begin(), uParams.end(), DisplacementLayer::nodeParameter(rowMax + 1)) - uParams.begin());
+	const int sampleColBegin = int(std::lower_bound(vParams.begin(), vParams.end(), DisplacementLayer::nodeParameter(colMin - 1)) - vParams.begin());
+	const int sampleColEnd = int(std::upper_bound(vParams.begin(), vParams.end(), DisplacementLayer::nodeParameter(colMax + 1)) - vParams.begin());
+	const Range2D cells{ std::max(0, sampleRowBegin - 2), std::min(numRows - 1, sampleRowEnd + 1), std::max(0, sampleColBegin - 2), std::min(numCols - 1, sampleColEnd + 1) };
+	this->surfaceTiles.update(Q, cells, &this->surfaceSampling, &this->displacementLayer);
+}
+
+// MARK: - Brush Stroke
+
+void FFS::strokeTo(const glm::vec3& mousePosition3D, double time) {
+	if (this->controlPoints.cpuGeom.verts.empty()) return;
+	// The falloff or stamp is picked once per stroke
+	if (!this->brushStroke.isActive()) {
+		this->strokeFalloff = this->brushFalloffParams();
+		this->bStrokeUsesStamp = this->brushSettings.bUseStamp && this->stampBrush.isLoaded();
+		const std::vector<std::vector<glm::vec3>>& P = this->generatedTerrain.generatedPoints;
+		this->strokeStamp.radius = this->brushSettings.brushRadius * this->brushSettings.stampScale;
+		this->strokeStamp.rotation = glm::radians(this->brushSettings.stampRotation);
+		this->strokeStamp.strength = this->brushSettings.stampStrength;
+		this->strokeStamp.pointSpacing = (P.size() > 1) ? glm::length(glm::vec2(P[1][0].x - P[0][0].x, P[1][0].z - P[0][0].z)) : 1.0f;
+	}
+	this->brushStroke.setSpacing(this->brushSettings.brushRadius * this->brushSettings.stampSpacing);
+	this->brushStroke.moveTo(mousePosition3D, time, this->pendingStamps);
+}
+
+void FFS::endStroke() {
+	this->brushStroke.end(this->pendingStamps);
+}
+
+bool FFS::loadStampImage(const std::string& path) {
+	if (path.empty() || !this->stampBrush.load(path.c_str())) return false;
+	this->brushSettings.bUseStamp = true;
+	return true;
+}
+
+// MARK: - Direct Manipulation
+
+void FFS::dragSurface(const glm::vec3& rayOrigin, const glm::vec3& rayDirection) {
+	if (this->controlPoints.cpuGeom.verts.empty()) return;
+	if (!this->surfaceDrag.isActive()) {
+		SurfacePick pick = this->pickSurface(rayOrigin, rayDirection);
+		if (!pick.bHit) return;
+		if (this->surfaceDrag.begin(this->generatedTerrain.generatedPoints, this->generatedTerrain.weights, this->surfaceSampling, pick.uv, this->controlPointProperties.storedSelection)) {
+			this->dragAnchor = this->surfaceDrag.surfacePoint(this->generatedTerrain.generatedPoints);
 		}
+		return;
+	}
+	// Closest point between the cursor ray and the vertical line through the anchor
+	const glm::vec3 offset = this->dragAnchor - rayOrigin;
+	const float b = rayDirection.y;
+	const float c = glm::dot(rayDirection, rayDirection);
+	const float denominator = c - b * b;
+	// Looking straight down the line, the height is undefined
+	if (denominator < 1e-6f) return;
+	const float s = (b * glm::dot(rayDirection, offset) - c * offset.y) / denominator;
+	const float targetHeight = this->dragAnchor.y + s;
+	EditCommand command;
+	if (this->surfaceDrag.solve(targetHeight - this->surfaceDrag.surfacePoint(this->generatedTerrain.generatedPoints).y, command)) this->editQueue.push(std::move(command));
+}
+
+void FFS::endSurfaceDrag() {
+	this->surfaceDrag.end();
+}
+
+// MARK: - Net Operators
+
+void FFS::applyNetOperator() {
+	if (this->controlPoints.cpuGeom.verts.empty()) return;
+	// Whatever is pending becomes its own undo step first
+	this->endStroke();
+	this->flushEdits();
+	Range2D dirtyRegion;
+	if (!this->netOperators.apply(this->netOperatorSettings, this->controlPointProperties.storedSelection, this->generatedTerrain.generatedPoints, this->generatedTerrain.weights, dirtyRegion, &this->undoJournal)) return;
+	this->undoJournal.commit(this->generatedTerrain.generatedPoints, this->generatedTerrain.weights);
+	this->updateTerrainRegion(dirtyRegion);
+}
+
+void FFS::fairSurface() {
+	if (this->controlPoints.cpuGeom.verts.empty()) return;
+	this->endStroke();
+	this->flushEdits();
+	// The stored selection holds its heights, everything else bends as little as possible around it
+	Range2D dirtyRegion;
+	if (!this->fairingSolver.solve(this->controlPointProperties.storedSelection, this->generatedTerrain.generatedPoints, this->generatedTerrain.weights, this->fairingSettings, dirtyRegion, &this->undoJournal)) return;
+	this->undoJournal.commit(this->generatedTerrain.generatedPoints, this->generatedTerrain.weights);
+	this->updateTerrainRegion(dirtyRegion);
+}
+
+void FFS::resetNetOperatorToDefaults() {
+	this->netOperatorSettings = NetOperatorSettings();
+}
+
+// MARK: - Erosion
+
+void FFS::startErosion() {
+	if (this->controlPoints.cpuGeom.verts.empty()) return;
+	if (this->nurbsSettings.bBezier) {
+		Log::warn("Erosion samples the B-spline surface, turn Bezier off first");
+		return;
+	}
+	this->endStroke();
+	this->flushEdits();
+	// Square cells: the resolution goes along the longer side of the net, the shorter side gets as many as fit
+	const std::vector<std::vector<glm::vec3>>& P = this->generatedTerrain.generatedPoints;
+	const float extentX = std::abs(P.back()[0].x - P[0][0].x);
+	const float extentZ = std::abs(P[0].back().z - P[0][0].z);
+	const int resolution = this->erosionSettings.resolution;
+	const float cellSize = std::max(extentX, extentZ) / float(resolution - 1);
+	if (cellSize <= 0.0f) return;
+	const int width = std::max(2, int(std::lround(extentX / cellSize)) + 1);
+	const int height = std::max(2, int(std::lround(extentZ / cellSize)) + 1);
+	std::vector<float> heights;
+	this->heightmapFitter.sample(P, this->generatedTerrain.weights, this->nurbsSettings.k_u, this->nurbsSettings.k_v, width, height, heights);
+	this->erosionNetRows = int(P.size());
+	this->erosionNetCols = int(P[0].size());
+	this->erosionGridWidth = width;
+	this->erosionSimulator.start(this->erosionSettings, std::move(heights), width, cellSize);
+}
+
+void FFS::cancelErosion() {
+	this->erosionSimulator.cancel();
+}
+
+void FFS::applyErosionResult() {
+	std::vector<float> heights;
+	if (!this->erosionSimulator.acquire(heights)) return;
+	std::vector<std::vector<glm::vec3>>& P = this->generatedTerrain.generatedPoints;
+	std::vector<std::vector<float>>& W = this->generatedTerrain.weights;
+	// The net was replaced while eroding
+	if (int(P.size()) != this->erosionNetRows || int(P[0].size()) != this->erosionNetCols) return;
+	this->endStroke();
+	this->flushEdits();
+	// The fit moves every height and resets the weights, all in one undo step
+	const int rows = int(P.size()), cols = int(P[0].size());
+	for (int i = 0; i < rows; i++) {
+		for (int j = 0; j < cols; j++) this->undoJournal.touch(rows, cols, i, j, P[i][j], W[i][j]);
 	}
+	const int width = this->erosionGridWidth;
+	this->heightmapFitter.fit(heights.data(), width, int(heights.size()) / width, this->nurbsSettings.k_u, this->nurbsSettings.k_v, P, W);
+	this->undoJournal.commit(P, W);
+	this->generateTerrain(P, W);
+}
+
+void FFS::resetErosionToDefaults() {
+	// Like the random generation, the seed stays
+	const uint32_t seed = this->erosionSettings.seed;
+	this->erosionSettings = ErosionSettings();
+	this->erosionSettings.seed = seed;
+}
+
+// MARK: - Local Refinement
+
+bool FFS::refineStoredSelection() {
+	const SelectionSet& stored = this->controlPointProperties.storedSelection;
+	if (stored.empty() || this->controlPoints.cpuGeom.verts.empty()) return false;
+	if (this->nurbsSettings.bBezier) {
+		Log::warn("Refinement follows the B-spline knots, turn Bezier off first");
+		return false;
+	}
+	this->endStroke();
+	this->flushEdits();
+	if (!this->canUpdateRegion()) return false;
+
+	int rowBegin = stored.getRows(), rowEnd = -1, colBegin = stored.getCols(), colEnd = -1;
+	for (int index : stored.getIndices()) {
+		rowBegin = std::min(rowBegin, stored.rowOf(index));
+		rowEnd = std::max(rowEnd, stored.rowOf(index));
+		colBegin = std::min(colBegin, stored.colOf(index));
+		colEnd = std::max(colEnd, stored.colOf(index));
+	}
+	// The region the selected control points shape, refined against the base net's knot spacing
+	const SurfaceSampling& sampling = this->surfaceSampling;
+	const glm::vec2 baseSpacing(sampling.U[sampling.k_u] - sampling.U[sampling.k_u - 1], sampling.V[sampling.k_v] - sampling.V[sampling.k_v - 1]);
+	const int index = this->detailHierarchy.refine(sampling.U[rowBegin], sampling.U[rowEnd + sampling.k_u], sampling.V[colBegin], sampling.V[colEnd + sampling.k_v], baseSpacing);
+	if (index < 0) {
+		Log::warn("The selection is already refined {} levels deep", DetailHierarchy::MAX_LEVEL);
+		return false;
+	}
+	// A new patch is flat, the surface does not change until it is painted on
+	this->placeDetailPatches();
+	this->detailSettings.editLevel = this->detailHierarchy.getPatches()[index].level;
+	return true;
+}
+
+void FFS::removeDetail() {
+	if (this->detailHierarchy.empty()) return;
+	this->detailHierarchy.clear();
+	this->detailSettings.editLevel = 0;
+	if (!this->generatedTerrain.generatedPoints.empty()) this->generateTerrain(this->generatedTerrain.generatedPoints, this->generatedTerrain.weights);
+}
+
+void FFS::placeDetailPatches() {
+	const std::vector<std::vector<glm::vec3>>& P = this->generatedTerrain.generatedPoints;
+	const SurfaceSampling& sampling = this->surfaceSampling;
+	if (P.empty() || sampling.U.size() != P.size() + sampling.k_u || sampling.V.size() != P[0].size() + sampling.k_v) return;
+	for (DetailPatch& patch : this->detailHierarchy.getPatches()) {
+		patch.positions.resize(patch.heights.size());
+		JobSystem::get().parallelFor(0, patch.rows, 8, [&](int begin, int end) {
+			for (int row = begin; row < end; row++) {
+				const float u = std::min(patch.u0 + float(row) * patch.spacingU, 1.0f);
+				for (int col = 0; col < patch.cols; col++) {
+					const float v = std::min(patch.v0 + float(col) * patch.spacingV, 1.0f);
+					const glm::vec3 point = SurfaceEvaluator::FFS_NURBS(P, sampling.U, sampling.V, this->generatedTerrain.weights, u, v, sampling.k_u, sampling.k_v, P.size(), P[0].size());
+					patch.positions[size_t(row) * patch.cols + col] = glm::vec2(point.x, point.z);
+				}
+			}
+		}, "detail positions");
+	}
+}
+
+// MARK: - Displacement Sculpting
+
+void FFS::clearDisplacement() {
+	if (this->displacementLayer.empty()) return;
+	this->displacementLayer.clear();
+	const std::vector<std::vector<glm::vec3>>& Q = this->generatedTerrain.Q;
+	if (this->backgroundEvaluator.isBusy()) this->requestTerrain();
+	else if (Q.size() > 1 && Q[0].size() > 1) this->surfaceTiles.update(Q, Range2D{ 0, int(Q.size()) - 1, 0, int(Q[0].size()) - 1 });
+}
+
+// MARK: - Out-of-Core Control Net
+
+bool FFS::createNetStore() {
+	const NetStoreSettings& settings = this->netStoreSettings;
+	if (settings.path.empty()) return false;
+	// Centred on the origin like a generated net
+	const glm::vec2 origin = -0.5f * settings.spacing * glm::vec2(float(settings.rows - 1), float(settings.cols - 1));
+	if (!this->netStore.create(settings.path, settings.rows, settings.cols, origin, settings.spacing)) return false;
+	this->netStore.setResidentLimit(settings.residentTiles);
+	return this->loadStoreWindow((settings.rows - settings.windowSize) / 2, (settings.cols - settings.windowSize) / 2);
+}
+
+bool FFS::openNetStore() {
+	const NetStoreSettings& settings = this->netStoreSettings;
+	if (settings.path.empty() || !this->netStore.open(settings.path)) return false;
+	this->netStore.setResidentLimit(settings.residentTiles);
+	return this->loadStoreWindow((this->netStore.getRows() - settings.windowSize) / 2, (this->netStore.getCols() - settings.windowSize) / 2);
+}
+
+void FFS::closeNetStore() {
+	// The window stays loaded as an ordinary net
+	this->netStore.close();
+}
+
+void FFS::flushNetStore() {
+	this->netStore.flush();
+}
+
+void FFS::followNetStore(const glm::vec3& focus) {
+	const std::vector<std::vector<glm::vec3>>& P = this->generatedTerrain.generatedPoints;
+	if (!this->netStore.isOpen() || P.empty()) return;
+	// The window never moves under an edit in progress
+	if (this->brushStroke.isActive() || this->surfaceDrag.isActive() || this->isEroding()) return;
+	// Window row and column under the focus; one outside the window (a cursor ray into the sky) is ignored
+	const int rows = P.size(), cols = P[0].size();
+	const float row = (focus.x - this->netStore.getOrigin().x) / this->netStore.getSpacing() - float(this->storeRow);
+	const float col = (focus.z - this->netStore.getOrigin().y) / this->netStore.getSpacing() - float(this->storeCol);
+	if (!(row >= 0.0f && row <= float(rows - 1) && col >= 0.0f && col <= float(cols - 1))) return;
+	// Recentred once the focus reaches the outer quarter along either axis
+	const float rowMargin = 0.25f * float(rows - 1);
+	const float colMargin = 0.25f * float(cols - 1);
+	if (row >= rowMargin && row <= float(rows - 1) - rowMargin && col >= colMargin && col <= float(cols - 1) - colMargin) return;
+	const int newRow = std::clamp(this->storeRow + int(std::lround(row - 0.5f * float(rows - 1))), 0, this->netStore.getRows() - rows);
+	const int newCol = std::clamp(this->storeCol + int(std::lround(col - 0.5f * float(cols - 1))), 0, this->netStore.getCols() - cols);
+	// Already against the edge of the store
+	if (newRow == this->storeRow && newCol == this->storeCol) return;
+	// Every edit has been written back as it was made, only queued ones are left
+	this->flushEdits();
+	this->loadStoreWindow(newRow, newCol);
+}
+
+bool FFS::loadStoreWindow(int row, int col) {
+	// Up to windowSize control points along each axis, so a long narrow store gets a long narrow window
+	const int rows = std::min(this->netStoreSettings.windowSize, this->netStore.getRows());
+	const int cols = std::min(this->netStoreSettings.windowSize, this->netStore.getCols());
+	row = std::clamp(row, 0, this->netStore.getRows() - rows);
+	col = std::clamp(col, 0, this->netStore.getCols() - cols);
+	std::vector<std::vector<glm::vec3>> P(rows, std::vector<glm::vec3>(cols));
+	std::vector<std::vector<float>> W(rows, std::vector<float>(cols));
+	if (!this->netStore.read(row, col, P, W)) return false;
+
+	// Queued edits, undo steps and selections all index the old window
+	this->brushStroke.end(this->pendingStamps);
+	this->pendingStamps.clear();
+	this->editQueue.clear();
+	this->strokeDisplacement.clear();
+	this->surfaceDrag.end();
+	this->erosionSimulator.cancel();
+	this->undoJournal.clear();
+	this->controlPointProperties.brushSelection.clear();
+	this->controlPointProperties.storedSelection.clear();
+	this->detailHierarchy.clear();
+	this->detailSettings.editLevel = 0;
+	// The layer lives in the window's (u, v) domain and the store only holds control points
+	if (!this->displacementLayer.empty()) Log::warn("Moving the store window discards the sculpted displacement, {} tiles are not kept in {}", this->displacementLayer.getTileCount(), this->netStore.getPath());
+	this->displacementLayer.clear();
+
+	this->storeRow = row;
+	this->storeCol = col;
+	this->terrainSettings.nControlPointsU = rows;
+	this->terrainSettings.nControlPointsV = cols;
+	this->terrainSettings.terrainSizeU = 0.5f * float(rows - 1) * this->netStore.getSpacing();
+	this->terrainSettings.terrainSizeV = 0.5f * float(cols - 1) * this->netStore.getSpacing();
+	this->generatedTerrain.generatedPoints = std::move(P);
+	this->generatedTerrain.weights = std::move(W);
+	this->generateTerrain(this->generatedTerrain.generatedPoints, this->generatedTerrain.weights);
+	return true;
+}
+
+void FFS::writeBackToStore(const Range2D& controlRegion) {
+	const std::vector<std::vector<glm::vec3>>& P = this->generatedTerrain.generatedPoints;
+	if (!this->netStore.isOpen() || P.empty()) return;
+	if (!this->netStore.write(this->storeRow, this->storeCol, controlRegion, P, this->generatedTerrain.weights)) {
+		Log::warn("Cannot write the edited control points back to {}", this->netStore.getPath());
+	}
+}
+
+// MARK: - Undo
+
+void FFS::undo() {
+	// Finish whatever is still in flight so it becomes the step being undone
+	this->endStroke();
+	this->endSurfaceDrag();
+	this->flushEdits();
+	Range2D dirtyRegion;
+	if (this->undoJournal.undo(this->generatedTerrain.generatedPoints, this->generatedTerrain.weights, dirtyRegion)) this->updateTerrainRegion(dirtyRegion);
+}
+
+void FFS::redo() {
+	this->endStroke();
+	this->endSurfaceDrag();
+	this->flushEdits();
+	Range2D dirtyRegion;
+	if (this->undoJournal.redo(this->generatedTerrain.generatedPoints, this->generatedTerrain.weights, dirtyRegion)) this->updateTerrainRegion(dirtyRegion);
+}
+
+// MARK: - Stored Selection
+
+void FFS::addBrushToStoredSelection() {
+	if (this->controlPointProperties.brushSelection.empty()) return;
+	this->controlPointProperties.storedSelection.unite(this->controlPointProperties.brushSelection);
+	this->uploadStoredSelection();
+}
+
+void FFS::removeBrushFromStoredSelection() {
+	if (this->controlPointProperties.brushSelection.empty()) return;
+	this->controlPointProperties.storedSelection.subtract(this->controlPointProperties.brushSelection);
+	this->uploadStoredSelection();
+}
+
+void FFS::clearStoredSelection() {
+	this->controlPointProperties.storedSelection.clear();
+	this->uploadStoredSelection();
 }
 
 // MARK: - Colors
 
-void FFS::controlPointsChangeColor(const glm::vec3& mousePosition3D, const glm::vec3& color) {
-	for (size_t i = 0; i < this->controlPoints.cpuGeom.verts.size(); i++) {
-		const glm::vec3* pointPos = &this->controlPoints.cpuGeom.verts[i];
-		float distanceXZ = glm::length(glm::vec2(mousePosition3D.x, mousePosition3D.z) - glm::vec2(pointPos->x, pointPos->z));
-		float distanceY = glm::length(glm::vec1(mousePosition3D.y) - glm::vec1(pointPos->y));
-		this->controlPoints.cpuGeom.cols[i] = (distanceXZ <= this->brushSettings.brushRadius && distanceY <= 1000.0f) ? color : glm::vec3(1.0f, 0.0f, 0.0f);
+void FFS::controlPointsChangeColor(const glm::vec3& color) {
+	std::vector<glm::vec3>& cols = this->controlPoints.cpuGeom.cols;
+	// Only the range between the first and last entry that changed colour is re-uploaded
+	int firstChanged = int(cols.size()), lastChanged = -1;
+	for (int index : this->highlightedColors) {
+		if (index >= int(cols.size())) continue;
+		cols[index] = glm::vec3(1.0f, 0.0f, 0.0f);
+		firstChanged = std::min(firstChanged, index);
+		lastChanged = std::max(lastChanged, index);
 	}
-	this->controlPoints.gpuGeom.setCols(this->controlPoints.cpuGeom.cols);
+	this->highlightedColors.clear();
+
+	// Each control point appears in up to six quad vertices, see SurfaceEvaluator::generateQuads
+	const int numRows = this->generatedTerrain.generatedPoints.size();
+	const int numCols = this->generatedTerrain.generatedPoints[0].size();
+	auto highlight = [&](int cellRow, int cellCol, int corner) {
+		if (cellRow < 0 || cellRow >= numRows - 1 || cellCol < 0 || cellCol >= numCols - 1) return;
+		int index = (cellRow * (numCols - 1) + cellCol) * 6 + corner;
+		cols[index] = color;
+		this->highlightedColors.push_back(index);
+		firstChanged = std::min(firstChanged, index);
+		lastChanged = std::max(lastChanged, index);
+	};
+	const SelectionSet& selection = this->controlPointProperties.brushSelection;
+	for (int index : selection.getIndices()) {
+		const int row = selection.rowOf(index);
+		const int col = selection.colOf(index);
+		highlight(row, col - 1, 0);
+		highlight(row, col - 1, 3);
+		highlight(row, col, 1);
+		highlight(row - 1, col, 2);
+		highlight(row - 1, col, 5);
+		highlight(row - 1, col - 1, 4);
+	}
+	if (lastChanged < firstChanged) return;
+	this->controlPoints.gpuGeom.bind();
+	this->controlPoints.gpuGeom.updateCols(cols, firstChanged, lastChanged - firstChanged + 1);
 }
 
 // MARK: - Settings
@@ -496,68 +1084,75 @@ void FFS::createTerrain() {
 	this->resetTerrain();
 	this->generatedTerrain.generatedPoints = this->generateControlPoints();
 	this->generatedTerrain.weights = this->generateWeights(this->generatedTerrain.generatedPoints.size(), this->generatedTerrain.generatedPoints[0].size());
-	this->generateTerrain(this->generatedTerrain.generatedPoints, this->generatedTerrain.weights);
+	this->requestTerrain();
 }
 
 void FFS::resetTerrain() {
+	this->closeNetStore();
 	this->controlPoints.cpuGeom.verts.clear(); this->controlPoints.cpuGeom.verts.shrink_to_fit(); std::vector<glm::vec3>().swap(this->controlPoints.cpuGeom.verts);
 	this->controlPoints.cpuGeom.cols.clear(); this->controlPoints.cpuGeom.cols.shrink_to_fit(); std::vector<glm::vec3>().swap(this->controlPoints.cpuGeom.cols);
-	this->freeFormSurface.cpuGeom.verts.clear(); this->freeFormSurface.cpuGeom.verts.shrink_to_fit(); std::vector<glm::vec3>().swap(this->freeFormSurface.cpuGeom.verts);
-	this->freeFormSurface.cpuGeom.cols.clear(); this->freeFormSurface.cpuGeom.cols.shrink_to_fit(); std::vector<glm::vec3>().swap(this->freeFormSurface.cpuGeom.cols);
 	this->generatedTerrain.generatedPoints.clear(); this->generatedTerrain.generatedPoints.shrink_to_fit(); std::vector<std::vector<glm::vec3>>().swap(this->generatedTerrain.generatedPoints);
 	this->generatedTerrain.weights.clear(); this->generatedTerrain.weights.shrink_to_fit(); std::vector<std::vector<float>>().swap(this->generatedTerrain.weights);
-	this->controlPointProperties.selectedControlPoints.clear(); this->controlPointProperties.selectedControlPoints.shrink_to_fit(); std::vector<SelectedControlPoint>().swap(this->controlPointProperties.selectedControlPoints);
-	this->controlPointProperties.selectedWeights.clear(); this->controlPointProperties.selectedWeights.shrink_to_fit(); std::vector<float*>().swap(this->controlPointProperties.selectedWeights);
+	this->controlPointProperties.brushSelection.clear();
+	this->editQueue.clear();
+	this->pendingStamps.clear();
+	this->strokeDisplacement.clear();
+	this->surfaceDrag.end();
+	this->erosionSimulator.cancel();
+	this->undoJournal.clear();
+	this->controlNetIndex.clear();
+	this->highlightedColors.clear();
+	this->detailHierarchy.clear();
+	this->detailSettings.editLevel = 0;
+	this->displacementLayer.clear();
 	this->controlPoints.gpuGeom.bind();
 	this->controlPoints.gpuGeom.setVerts(this->controlPoints.cpuGeom.verts);
 	this->controlPoints.gpuGeom.setCols(this->controlPoints.cpuGeom.cols);
-	this->freeFormSurface.gpuGeom.bind();
-	this->freeFormSurface.gpuGeom.setVerts(this->freeFormSurface.cpuGeom.verts);
-	this->freeFormSurface.gpuGeom.setCols(this->freeFormSurface.cpuGeom.cols);
 	this->nurbsSettings.k_u = 3;
 	this->nurbsSettings.k_v = 3;
 }
 
 void FFS::resetTerrainToDefaults() {
 	this->resetTerrain();
-	this->terrainSettings.nControlPoints = 20;
-	this->terrainSettings.terrainSize = 10.0f;
+	this->terrainSettings.nControlPointsU = 20;
+	this->terrainSettings.nControlPointsV = 20;
+	this->terrainSettings.terrainSizeU = 10.0f;
+	this->terrainSettings.terrainSizeV = 10.0f;
 	this->terrainSettings.bIsChanging = true;
 }
 
 // NURBS Settings
 
 void FFS::resetSelectedControlPoints() {
-	if (this->controlPointProperties.selectedControlPoints.empty()) return;
-	for (SelectedControlPoint& sp : this->controlPointProperties.selectedControlPoints) {
-		glm::vec3* point = sp.controlPoint;
-		*point = glm::vec3(point->x, 0.0f, point->z);
-	}
-	this->generateTerrain(this->generatedTerrain.generatedPoints, this->generatedTerrain.weights);
+	if (this->controlPointProperties.brushSelection.empty()) return;
+	this->pushEdit(EditCommandType::ResetPosition, 0.0f);
 }
 
 void FFS::resetSelectedWeights() {
-	if (this->controlPointProperties.selectedWeights.empty()) return;
-	for (float* w : this->controlPointProperties.selectedWeights) {
-		*w = 1.0f;
-	}
-	this->generateTerrain(this->generatedTerrain.generatedPoints, this->generatedTerrain.weights);
+	if (this->controlPointProperties.brushSelection.empty()) return;
+	this->pushEdit(EditCommandType::ResetWeight, 0.0f);
 }
 
 void FFS::resetAllControlPoints() {
+	this->undoJournal.clear();
+	this->detailHierarchy.clear();
+	this->detailSettings.editLevel = 0;
+	this->displacementLayer.clear();
 	this->generatedTerrain.generatedPoints = this->generateControlPoints();
 	this->generateTerrain(this->generatedTerrain.generatedPoints, this->generatedTerrain.weights);
 }
 
 void FFS::resetAllWeights() {
-	this->generatedTerrain.weights = this->generateWeights(this->generatedTerrain.generatedPoints.size(), this->generatedTerrain.generatedPoints.size());
+	this->undoJournal.clear();
+	this->generatedTerrain.weights = this->generateWeights(this->generatedTerrain.generatedPoints.size(), this->generatedTerrain.generatedPoints[0].size());
 	this->generateTerrain(this->generatedTerrain.generatedPoints, this->generatedTerrain.weights);
 }
 
 void FFS::resetNURBSToDefaults() {
 	this->nurbsSettings.k_u = 3;
 	this->nurbsSettings.k_v = 3;
-	this->nurbsSettings.resolution = 100.0f;
+	this->nurbsSettings.resolutionU = 100.0f;
+	this->nurbsSettings.resolutionV = 100.0f;
 	this->nurbsSettings.weightRate = 1.0f;
 	this->nurbsSettings.bDisplayControlPoints = false;
 	this->nurbsSettings.bDisplayLineSegments = false;
@@ -572,16 +1167,24 @@ void FFS::resetBurshToDefaults() {
 	this->brushSettings.brushRateScale = 1.0f;
 	this->brushSettings.bIsRising = true;
 	this->brushSettings.bDisplayBrushArea = true;
-	this->brushSettings.current_item = 0;
+	this->brushSettings.falloff = BrushFalloff::Constant;
 	this->brushSettings.blendRadius = 1.5f;
 	this->brushSettings.maxBlendValue = 7.0f;
+	this->brushSettings.stampSpacing = 0.25f;
+	const BrushSettings defaults;
+	std::copy(std::begin(defaults.customFalloff), std::end(defaults.customFalloff), std::begin(this->brushSettings.customFalloff));
+	this->brushSettings.bUseStamp = false;
+	this->brushSettings.stampRotation = 0.0f;
+	this->brushSettings.stampScale = 1.0f;
+	this->brushSettings.stampStrength = 1.0f;
 }
 
 // Random Generation Settings
 void FFS::resetRandomGenerationSettings() {
-	this->randomGenerationSettings.skipProbability = 0.70f;
-	this->randomGenerationSettings.minHeight = 0.0f;
-	this->randomGenerationSettings.maxHeight = 4.0f;
+	// The seed is kept so the current terrain can still be regenerated
+	const uint32_t seed = this->randomGenerationSettings.noise.seed;
+	this->randomGenerationSettings = RandomGenerationSettings();
+	this->randomGenerationSettings.noise.seed = seed;
 }
 
 void FFS::resetAllSettings() {
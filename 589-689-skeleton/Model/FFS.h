@@ -12,6 +12,26 @@
 #include "../GLDebug.h"
 #include "../Log.h"
 
+#include "SurfaceEvaluator.h"
+#include "SurfaceTiles.h"
+#include "EditQueue.h"
+#include "SelectionSet.h"
+#include "BrushStroke.h"
+#include "BrushKernels.h"
+#include "UndoJournal.h"
+#include "SurfacePicker.h"
+#include "ControlNetIndex.h"
+#include "ControlNetOperators.h"
+#include "FairingSolver.h"
+#include "SurfaceDrag.h"
+#include "StampBrush.h"
+#include "ProceduralTerrain.h"
+#include "HeightmapFitter.h"
+#include "PointCloudFitter.h"
+#include "ErosionSimulator.h"
+#include "ControlNetStore.h"
+#include "DetailHierarchy.h"
+
 struct Process { CPU_Geometry cpuGeom; GPU_Geometry gpuGeom; };
 
 struct GeneratedTerrain {
@@ -20,32 +40,36 @@ struct GeneratedTerrain {
 	std::vector<std::vector<glm::vec3>> Q;
 };
 
-struct SelectedControlPoint {
-	glm::vec3* controlPoint = nullptr;
-	float blendFactor = 1.0f;
-};
-
 struct ControlPointProperties {
-	std::vector<SelectedControlPoint> selectedControlPoints;
-	std::vector<float*> selectedWeights;
+	// Points under the brush this frame, with their blend factors
+	SelectionSet brushSelection;
+	// Painted with Shift/Ctrl + LMB; when not empty, edits only affect points inside it
+	SelectionSet storedSelection;
 };
 
+// The net has nControlPointsU rows along x (u) and nControlPointsV columns along z (v), and spans
+// -terrainSizeU to terrainSizeU in x and -terrainSizeV to terrainSizeV in z
 struct TerrainSettings {
-	int nControlPoints = 20;
-	float terrainSize = 10.0f;
+	int nControlPointsU = 20;
+	int nControlPointsV = 20;
+	float terrainSizeU = 10.0f;
+	float terrainSizeV = 10.0f;
 	bool bIsChanging = false;
 };
 
 struct RandomGenerationSettings {
-	float skipProbability = 0.70f;
+	float skipProbability = 0.0f;
 	float minHeight = 0.0f;
 	float maxHeight = 4.0f;
+	NoiseSettings noise;
 };
 
 struct NURBSSettings {
 	int k_u = 3;
 	int k_v = 3;
-	float resolution = 100.0f;
+	// Samples per unit of u and of v
+	float resolutionU = 100.0f;
+	float resolutionV = 100.0f;
 	float weightRate = 1.0f;
 	bool bDisplayControlPoints = false;
 	bool bDisplayLineSegments = false;
@@ -59,19 +83,54 @@ struct BrushSettings {
 	bool bIsRising = true;
 	bool bDisplayBrushArea = true;
 	
-	int current_item = 0;
-	const char* items[3] = { "None", "Inverse Distance Squared", "Distance Squared" };
+	BrushFalloff falloff = BrushFalloff::Constant;
 	float blendRadius = 1.5f;
 	float maxBlendValue = 7.0f;
+	// Distance between stroke stamps, as a fraction of the brush radius
+	float stampSpacing = 0.25f;
+	// Custom falloff from the brush centre to its radius
+	float customFalloff[BRUSH_CUSTOM_LUT_SIZE] = { 1.0f, 0.98f, 0.92f, 0.82f, 0.68f, 0.5f, 0.28f, 0.0f };
+	// Image stamp: replaces the falloff while enabled and an image is loaded
+	bool bUseStamp = false;
+	std::string stampPath = "";
+	float stampRotation = 0.0f;
+	float stampScale = 1.0f;
+	float stampStrength = 1.0f;
+};
+
+struct DetailSettings {
+	// Level the brush paints on; 0 is the base net
+	int editLevel = 0;
+};
+
+struct DisplacementSettings {
+	// The brush paints the displacement layer instead of moving control points
+	bool bSculpt = false;
+	// Displacement per second of brushing, relative to the control point brush
+	float strength = 0.1f;
+};
+
+struct NetStoreSettings {
+	std::string path = "";
+	// Size and control point spacing of a new store
+	int rows = 2048;
+	int cols = 2048;
+	float spacing = 0.25f;
+	// Control points per axis of the window onto the store that is loaded, edited and evaluated
+	int windowSize = 128;
+	// Tiles kept mapped at once
+	int residentTiles = 64;
 };
 
 struct ImportNOBJSettings {
 	std::vector<glm::vec3> controlPoints;
 	std::vector<float> weights;
 	int k_u = 3, k_v = 3;
-	float resolution = 100.0f;
-	int nControlPoints = 20;
-	float terrainSize = 10.0f;
+	float resolutionU = 100.0f, resolutionV = 100.0f;
+	int nControlPointsU = 20, nControlPointsV = 20;
+	float terrainSizeU = 10.0f, terrainSizeV = 10.0f;
+	std::vector<DetailPatch> detailPatches;
+	DisplacementLayer displacement;
 };
 
 class FFS {
@@ -80,9 +139,10 @@ private:
 
 	// Processes
 	Process controlPoints;
-	Process freeFormSurface;
+	SurfaceTiles surfaceTiles;
 	Process nurbsLines;
 	Process selectedArea;
+	Process storedArea;
 
 	// Generated Control Points, Weights & Curve
 	GeneratedTerrain generatedTerrain;
@@ -98,6 +158,77 @@ private:
 	NURBSSettings nurbsSettings;
 	// Brush Settings
 	BrushSettings brushSettings;
+
+	// Background Evaluation
+	BackgroundSurfaceEvaluator backgroundEvaluator;
+	SurfaceTessellation acquiredTessellation;
+	SurfaceSampling surfaceSampling;
+
+	// Edits
+	EditQueue editQueue;
+
+	// Undo
+	UndoJournal undoJournal;
+
+	// Net Operators
+	ControlNetOperators netOperators;
+	NetOperatorSettings netOperatorSettings;
+	FairingSolver fairingSolver;
+	FairingSettings fairingSettings;
+
+	// Erosion
+	ErosionSimulator erosionSimulator;
+	ErosionSettings erosionSettings;
+	// Size of the net the running simulation was sampled from, and width of its height grid
+	int erosionNetRows = 0;
+	int erosionNetCols = 0;
+	int erosionGridWidth = 0;
+
+	// Brush Stroke
+	BrushStroke brushStroke;
+	std::vector<BrushStamp> pendingStamps;
+	// Per control point displacement accumulated from this frame's stamps, zero elsewhere
+	std::vector<float> strokeDisplacement;
+	// Falloff the active stroke started with
+	BrushFalloffParams strokeFalloff;
+	// Image stamp, and whether and how the active stroke uses it
+	StampBrush stampBrush;
+	bool bStrokeUsesStamp = false;
+	StampParams strokeStamp;
+	// Candidates of the current brush query
+	BrushPoints brushPoints;
+
+	// Heightmap Import
+	HeightmapFitter heightmapFitter;
+	HeightmapImportSettings heightmapImportSettings;
+	PointCloudFitter pointCloudFitter;
+	PointCloudImportSettings pointCloudImportSettings;
+
+	// Local Refinement
+	DetailHierarchy detailHierarchy;
+	DetailSettings detailSettings;
+
+	// Displacement Sculpting
+	DisplacementLayer displacementLayer;
+	DisplacementSettings displacementSettings;
+
+	// Out-of-Core Control Net
+	ControlNetStore netStore;
+	NetStoreSettings netStoreSettings;
+	// Store row and column of the window's first control point
+	int storeRow = 0;
+	int storeCol = 0;
+
+	// Direct Manipulation
+	SurfaceDrag surfaceDrag;
+	// Where the surface was grabbed; the drag moves it along the vertical line through here
+	glm::vec3 dragAnchor = glm::vec3(0.0f);
+
+	// Picking
+	SurfacePicker surfacePicker;
+	ControlNetIndex controlNetIndex;
+	// Control point colour entries currently highlighted by the brush
+	std::vector<int> highlightedColors;
 	
 public:
 
@@ -110,20 +241,24 @@ public:
 private:
 
 	// NURBS
-	std::vector<float> generateKnotSequence(int length, int k);
 	std::vector<std::vector<float>> generateWeights(int u_length, int v_length);
-	int delta(const std::vector<float>& U, float u, int k, int m);
-	glm::vec3 FFS_NURBS(const std::vector<std::vector<glm::vec3>>& P, const std::vector<float>& U, const std::vector<float>& V, std::vector<std::vector<float>> W, float u, float v, int k_u, int k_v, int m);
 
 	// FFS
 	std::vector<std::vector<glm::vec3>> generateControlPoints();
 	void generateTerrain(const std::vector<std::vector<glm::vec3>>& P, const std::vector<std::vector<float>>& W);
-
-	// Surface Properties
-	std::vector<glm::vec3> generateQuads(const std::vector<std::vector<glm::vec3>>& points);
-	std::vector<glm::vec2> generateQuads(const std::vector<std::vector<glm::vec2>>& points);
-	std::vector<glm::vec2> generateTextureCoord(const std::vector<std::vector<glm::vec3>>& controlPoints);
-	std::vector<glm::vec3> generateNormals(const std::vector<std::vector<glm::vec3>>& controlPoints);
+	void requestTerrain();
+	void updateTerrainRegion(const Range2D& controlRegion);
+	void updateDetailRegion(float uMin, float uMax, float vMin, float vMax);
+	// The surface on screen matches the current net and settings, so a region of it can be re-evaluated
+	bool canUpdateRegion() const;
+
+	// Surface Geometry
+	SurfaceEvaluationRequest makeEvaluationRequest(const std::vector<std::vector<glm::vec3>>& P, const std::vector<std::vector<float>>& W);
+	void uploadTessellation(SurfaceTessellation& tessellation);
+	void uploadControlNet(const std::vector<std::vector<glm::vec3>>& P);
+	void uploadControlNetRegion(const Range2D& controlRegion);
+	void uploadStoredSelection();
+	void resizeSelections();
 
 	// .obj Formatting
 	std::vector<std::string> generateObjVertices(const std::vector<std::vector<glm::vec3>>& controlPoints);
@@ -132,23 +267,76 @@ private:
 public:
 
 	// Control Point Updates
+	void flushEdits();
 	void detectControlPoints(const glm::vec3& mousePosition3D);
-	void updateControlPointsPosition(float yValue);
 	void updateControlPointsWeights(float weight);
-	void controlPointBlend(const glm::vec3& mousePosition3D);
+	BrushFalloffParams brushFalloffParams() const;
+
+	// Brush Stroke
+	void strokeTo(const glm::vec3& mousePosition3D, double time);
+	void endStroke();
+	bool loadStampImage(const std::string& path);
+	const StampBrush& getStampBrush() const { return this->stampBrush; }
+
+	// Direct Manipulation
+	void dragSurface(const glm::vec3& rayOrigin, const glm::vec3& rayDirection);
+	void endSurfaceDrag();
+	bool isDraggingSurface() const { return this->surfaceDrag.isActive(); }
+
+	// Undo
+	void undo();
+	void redo();
+	bool canUndo() const { return this->undoJournal.canUndo(); }
+	bool canRedo() const { return this->undoJournal.canRedo(); }
+	const UndoJournal& getUndoJournal() const { return this->undoJournal; }
+
+	// Net Operators
+	void applyNetOperator();
+	void resetNetOperatorToDefaults();
+	NetOperatorSettings& getNetOperatorSettings() { return this->netOperatorSettings; }
+	void fairSurface();
+	const FairingSolver& getFairingSolver() const { return this->fairingSolver; }
+
+	// Erosion
+	void startErosion();
+	void cancelErosion();
+	void resetErosionToDefaults();
+	bool isEroding() const { return this->erosionSimulator.isRunning() || this->erosionSimulator.hasResult(); }
+	ErosionSettings& getErosionSettings() { return this->erosionSettings; }
+	const ErosionSimulator& getErosionSimulator() const { return this->erosionSimulator; }
+
+	// Stored Selection
+	void addBrushToStoredSelection();
+	void removeBrushFromStoredSelection();
+	void clearStoredSelection();
 
 
 private:
 
+	// Edits
+	void pushEdit(EditCommandType type, float value);
+	SelectionSet editSelection() const;
+	void applyStrokeStamps();
+	void applyDetailStamps();
+	void applyDisplacementStamps();
+	void applyErosionResult();
+
+	// Local Refinement
+	void placeDetailPatches();
+
+	// Out-of-Core Control Net
+	bool loadStoreWindow(int row, int col);
+	void writeBackToStore(const Range2D& controlRegion);
+
 	// Terrain Settings
-	void controlPointsChangeColor(const glm::vec3& mousePosition3D, const glm::vec3& color);
+	void controlPointsChangeColor(const glm::vec3& color);
 	void resetTerrain();
 
 public:
 
 	// Processes
 	const Process& getControlPoints() const { return this->controlPoints; }
-	const Process& getFreeFormSurface() const { return this->freeFormSurface; }
+	const SurfaceTiles& getSurfaceTiles() const { return this->surfaceTiles; }
 	const Process& getNURBSControlPolygon() const { return this->nurbsLines; }
 
 	// Generated Control Points, Weights & Curve
@@ -157,6 +345,13 @@ public:
 	// Control Point Properties
 	const ControlPointProperties& getControlPointProperties() const { return this->controlPointProperties; }
 
+	// Picking
+	SurfacePick pickSurface(const glm::vec3& rayOrigin, const glm::vec3& rayDirection) const;
+
+	// Background Evaluation
+	bool isEvaluating() const { return this->backgroundEvaluator.isBusy(); }
+	void setSurfaceReadyCallback(std::function<void()> callback) { this->backgroundEvaluator.setOnPublished(callback); }
+
 	// Terrain Settings
 	void createTerrain();
 	void resetTerrainToDefaults();
@@ -181,8 +376,39 @@ public:
 	std::vector<std::string> getExportNObjFormat();
 	bool getImportNObjFormat(const ImportNOBJSettings& settings);
 
+	// Heightmap Import
+	bool importHeightmap();
+	HeightmapImportSettings& getHeightmapImportSettings() { return this->heightmapImportSettings; }
+	const HeightmapFitter& getHeightmapFitter() const { return this->heightmapFitter; }
+	bool importPointCloud();
+	PointCloudImportSettings& getPointCloudImportSettings() { return this->pointCloudImportSettings; }
+	const PointCloudFitter& getPointCloudFitter() const { return this->pointCloudFitter; }
+
+	// Local Refinement
+	bool refineStoredSelection();
+	void removeDetail();
+	DetailSettings& getDetailSettings() { return this->detailSettings; }
+	const DetailHierarchy& getDetailHierarchy() const { return this->detailHierarchy; }
+
+	// Displacement Sculpting
+	void clearDisplacement();
+	DisplacementSettings& getDisplacementSettings() { return this->displacementSettings; }
+	const DisplacementLayer& getDisplacementLayer() const { return this->displacementLayer; }
+
+	// Out-of-Core Control Net
+	bool createNetStore();
+	bool openNetStore();
+	void closeNetStore();
+	void flushNetStore();
+	// Moves the window once `focus` comes close to its edge
+	void followNetStore(const glm::vec3& focus);
+	bool hasNetStore() const { return this->netStore.isOpen(); }
+	NetStoreSettings& getNetStoreSettings() { return this->netStoreSettings; }
+	const ControlNetStore& getNetStore() const { return this->netStore; }
+
 	// Random Generation
 	void generateRandomTerrain();
+	void randomizeSeed();
 	void resetRandomGenerationSettings();
 	RandomGenerationSettings& getRandomGenerationSettings() { return this->randomGenerationSettings; }
 
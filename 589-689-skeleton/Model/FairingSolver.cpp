@@ -0,0 +1,297 @@
+#include "FairingSolver.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "../Log.h"
+
+// Grids at most this many points on a side are factored instead of halved further
+static const int COARSEST_SIZE = 12;
+static const int SMOOTHING_SWEEPS = 2;
+static const double SMOOTHING_DAMPING = 0.6;
+// The umbrella Laplacian is unscaled, so the coarse L^T L is about 4 times the Galerkin operator P^T A P
+static const double COARSE_SCALE = 4.0;
+
+bool FairingSolver::solve(const SelectionSet& pinned, std::vector<std::vector<glm::vec3>>& P, const std::vector<std::vector<float>>& W, const FairingSettings& settings,
+	Range2D& dirtyRegion, UndoJournal* journal) {
+	if (P.empty() || P[0].empty()) return false;
+	if (pinned.empty() || pinned.getRows() != int(P.size()) || pinned.getCols() != int(P[0].size())) {
+		Log::error("Fairing needs pinned control points: store a selection first");
+		return false;
+	}
+	this->prepare(pinned);
+	Level& fine = this->levels[0];
+	const size_t count = size_t(fine.rows) * fine.cols;
+
+	// Right-hand side: -L^T L applied to the pinned heights alone
+	this->heights.assign(count, 0.0);
+	for (int index : pinned.getIndices()) this->heights[index] = P[pinned.rowOf(index)][pinned.colOf(index)].y;
+	this->rhs.resize(count);
+	this->applyLaplacian(fine, this->heights, fine.laplacian);
+	this->applyLaplacianTranspose(fine, fine.laplacian, this->rhs);
+	for (size_t k = 0; k < count; k++) this->rhs[k] = fine.pinnedMask[k] ? 0.0 : -this->rhs[k];
+
+	// Unknowns are the free heights (pinned entries stay 0), warm started from the current net
+	for (int i = 0; i < fine.rows; i++) {
+		for (int j = 0; j < fine.cols; j++) {
+			const size_t k = size_t(i) * fine.cols + j;
+			this->heights[k] = fine.pinnedMask[k] ? 0.0 : double(P[i][j].y);
+		}
+	}
+	this->lastResult = this->conjugateGradient.solve(
+		[&](const std::vector<double>& in, std::vector<double>& out) { this->applyOperator(fine, in, out); },
+		[&](const std::vector<double>& in, std::vector<double>& out) {
+			fine.b = in;
+			this->vCycle(0);
+			out = fine.x;
+		},
+		this->rhs, this->heights, settings.maxIterations, double(settings.tolerance));
+	if (!this->lastResult.bConverged) {
+		Log::warn("Fairing stopped after {} iterations at relative residual {}", this->lastResult.iterations, this->lastResult.relativeResidual);
+	}
+
+	dirtyRegion = Range2D{ 0, fine.rows, 0, fine.cols };
+	for (int i = 0; i < fine.rows; i++) {
+		for (int j = 0; j < fine.cols; j++) {
+			const size_t k = size_t(i) * fine.cols + j;
+			if (fine.pinnedMask[k]) continue;
+			if (journal) journal->touch(fine.rows, fine.cols, i, j, P[i][j], W[i][j]);
+			P[i][j].y = float(this->heights[k]);
+		}
+	}
+	return true;
+}
+
+// MARK: - Hierarchy
+
+void FairingSolver::prepare(const SelectionSet& pinned) {
+	this->levels.clear();
+	Level fine;
+	fine.rows = pinned.getRows();
+	fine.cols = pinned.getCols();
+	fine.pinnedMask.assign(size_t(fine.rows) * fine.cols, 0);
+	for (int index : pinned.getIndices()) fine.pinnedMask[index] = 1;
+	this->levels.push_back(std::move(fine));
+
+	// Coarse point (I, J) sits on fine point (2I, 2J). It is pinned if any fine point its
+	// prolongation reaches is, so coarse corrections never pull on a pinned point.
+	while (std::max(this->levels.back().rows, this->levels.back().cols) > COARSEST_SIZE) {
+		const Level& parent = this->levels.back();
+		Level coarse;
+		coarse.rows = (parent.rows + 1) / 2;
+		coarse.cols = (parent.cols + 1) / 2;
+		coarse.pinnedMask.assign(size_t(coarse.rows) * coarse.cols, 0);
+		for (int i = 0; i < parent.rows; i++) {
+			for (int j = 0; j < parent.cols; j++) {
+				if (!parent.pinnedMask[size_t(i) * parent.cols + j]) continue;
+				for (int I = std::max(0, (i - 1) / 2); I <= std::min(coarse.rows - 1, (i + 1) / 2); I++) {
+					for (int J = std::max(0, (j - 1) / 2); J <= std::min(coarse.cols - 1, (j + 1) / 2); J++) coarse.pinnedMask[size_t(I) * coarse.cols + J] = 1;
+				}
+			}
+		}
+		this->levels.push_back(std::move(coarse));
+	}
+	for (Level& level : this->levels) this->prepareLevel(level);
+	this->factorCoarsest();
+}
+
+void FairingSolver::prepareLevel(Level& level) {
+	const size_t count = size_t(level.rows) * level.cols;
+	level.inverseNeighbours.resize(count);
+	for (int i = 0; i < level.rows; i++) {
+		for (int j = 0; j < level.cols; j++) {
+			const int neighbours = (i > 0) + (i + 1 < level.rows) + (j > 0) + (j + 1 < level.cols);
+			level.inverseNeighbours[size_t(i) * level.cols + j] = neighbours > 0 ? 1.0 / neighbours : 0.0;
+		}
+	}
+	// Column k of L holds -1 on the diagonal and 1/n_i in every neighbour row i
+	level.diagonal.resize(count);
+	for (int i = 0; i < level.rows; i++) {
+		for (int j = 0; j < level.cols; j++) {
+			const size_t k = size_t(i) * level.cols + j;
+			double sum = 1.0;
+			if (i > 0) sum += level.inverseNeighbours[k - level.cols] * level.inverseNeighbours[k - level.cols];
+			if (i + 1 < level.rows) sum += level.inverseNeighbours[k + level.cols] * level.inverseNeighbours[k + level.cols];
+			if (j > 0) sum += level.inverseNeighbours[k - 1] * level.inverseNeighbours[k - 1];
+			if (j + 1 < level.cols) sum += level.inverseNeighbours[k + 1] * level.inverseNeighbours[k + 1];
+			level.diagonal[k] = level.pinnedMask[k] ? 1.0 : sum;
+		}
+	}
+	level.b.assign(count, 0.0);
+	level.x.assign(count, 0.0);
+	level.r.assign(count, 0.0);
+	level.laplacian.assign(count, 0.0);
+}
+
+void FairingSolver::factorCoarsest() {
+	Level& level = this->levels.back();
+	const size_t count = size_t(level.rows) * level.cols;
+	this->coarseFree.clear();
+	for (size_t k = 0; k < count; k++) {
+		if (!level.pinnedMask[k]) this->coarseFree.push_back(int(k));
+	}
+	// Assemble the free block column by column from unit vectors, then factor it in place
+	const int n = int(this->coarseFree.size());
+	this->coarseFactor.assign(size_t(n) * n, 0.0);
+	std::vector<double> unit(count, 0.0), column(count, 0.0);
+	for (int c = 0; c < n; c++) {
+		unit[this->coarseFree[c]] = 1.0;
+		this->applyOperator(level, unit, column);
+		unit[this->coarseFree[c]] = 0.0;
+		for (int r = 0; r < n; r++) this->coarseFactor[size_t(r) * n + c] = column[this->coarseFree[r]];
+	}
+	for (int j = 0; j < n; j++) {
+		double* rowJ = &this->coarseFactor[size_t(j) * n];
+		double d = rowJ[j];
+		for (int k = 0; k < j; k++) d -= rowJ[k] * rowJ[k];
+		rowJ[j] = std::sqrt(std::max(d, 1e-300));
+		for (int i = j + 1; i < n; i++) {
+			double* rowI = &this->coarseFactor[size_t(i) * n];
+			double sum = rowI[j];
+			for (int k = 0; k < j; k++) sum -= rowI[k] * rowJ[k];
+			rowI[j] = sum / rowJ[j];
+		}
+	}
+}
+
+// MARK: - Stencils
+
+void FairingSolver::applyLaplacian(const Level& level, const std::vector<double>& in, std::vector<double>& out) const {
+	out.resize(in.size());
+	const int rows = level.rows;
+	const int cols = level.cols;
+	JobSystem::get().parallelFor(0, rows, 8, [&](int begin, int end) {
+		for (int i = begin; i < end; i++) {
+			for (int j = 0; j < cols; j++) {
+				const size_t k = size_t(i) * cols + j;
+				double sum = 0.0;
+				if (i > 0) sum += in[k - cols];
+				if (i + 1 < rows) sum += in[k + cols];
+				if (j > 0) sum += in[k - 1];
+				if (j + 1 < cols) sum += in[k + 1];
+				out[k] = sum * level.inverseNeighbours[k] - in[k];
+			}
+		}
+	}, "fairing laplacian");
+}
+
+void FairingSolver::applyLaplacianTranspose(const Level& level, const std::vector<double>& in, std::vector<double>& out) const {
+	out.resize(in.size());
+	const int rows = level.rows;
+	const int cols = level.cols;
+	const std::vector<double>& inverseNeighbours = level.inverseNeighbours;
+	JobSystem::get().parallelFor(0, rows, 8, [&](int begin, int end) {
+		for (int i = begin; i < end; i++) {
+			for (int j = 0; j < cols; j++) {
+				const size_t k = size_t(i) * cols + j;
+				double sum = 0.0;
+				if (i > 0) sum += in[k - cols] * inverseNeighbours[k - cols];
+				if (i + 1 < rows) sum += in[k + cols] * inverseNeighbours[k + cols];
+				if (j > 0) sum += in[k - 1] * inverseNeighbours[k - 1];
+				if (j + 1 < cols) sum += in[k + 1] * inverseNeighbours[k + 1];
+				out[k] = sum - in[k];
+			}
+		}
+	}, "fairing laplacian transpose");
+}
+
+void FairingSolver::applyOperator(Level& level, const std::vector<double>& in, std::vector<double>& out) const {
+	// `in` is zero on the pinned points, so they drop out of L^T L
+	this->applyLaplacian(level, in, level.laplacian);
+	this->applyLaplacianTranspose(level, level.laplacian, out);
+	for (size_t k = 0; k < out.size(); k++) {
+		if (level.pinnedMask[k]) out[k] = in[k];
+	}
+}
+
+// MARK: - V-Cycle
+
+void FairingSolver::vCycle(int levelIndex) {
+	Level& level = this->levels[levelIndex];
+	if (levelIndex + 1 == int(this->levels.size())) {
+		this->solveCoarsest(level);
+		return;
+	}
+	// Pre- and post-smoothing match, which keeps the preconditioner symmetric for CG
+	std::fill(level.x.begin(), level.x.end(), 0.0);
+	this->smooth(level, SMOOTHING_SWEEPS);
+	Level& coarse = this->levels[levelIndex + 1];
+	this->restrictResidual(level, coarse);
+	this->vCycle(levelIndex + 1);
+	this->prolongAndCorrect(coarse, level);
+	this->smooth(level, SMOOTHING_SWEEPS);
+}
+
+void FairingSolver::smooth(Level& level, int sweeps) {
+	for (int sweep = 0; sweep < sweeps; sweep++) {
+		this->applyOperator(level, level.x, level.r);
+		for (size_t k = 0; k < level.x.size(); k++) {
+			if (!level.pinnedMask[k]) level.x[k] += SMOOTHING_DAMPING * (level.b[k] - level.r[k]) / level.diagonal[k];
+		}
+	}
+}
+
+void FairingSolver::restrictResidual(Level& fine, Level& coarse) const {
+	// r = b - A x on the fine grid, then P^T r: each coarse point gathers the fine points its
+	// bilinear prolongation reaches, with the same weights
+	this->applyOperator(fine, fine.x, fine.r);
+	for (size_t k = 0; k < fine.r.size(); k++) fine.r[k] = fine.pinnedMask[k] ? 0.0 : fine.b[k] - fine.r[k];
+
+	auto weight = [](int fineIndex, int coarseIndex, int coarseCount) {
+		if (fineIndex == 2 * coarseIndex) return 1.0;
+		// A trailing odd fine point has no coarse point after it and copies the last one
+		if (fineIndex == 2 * coarseIndex + 1 && coarseIndex + 1 == coarseCount) return 1.0;
+		return 0.5;
+	};
+	JobSystem::get().parallelFor(0, coarse.rows, 4, [&](int begin, int end) {
+		for (int I = begin; I < end; I++) {
+			for (int J = 0; J < coarse.cols; J++) {
+				const size_t c = size_t(I) * coarse.cols + J;
+				double sum = 0.0;
+				if (!coarse.pinnedMask[c]) {
+					for (int i = std::max(0, 2 * I - 1); i <= std::min(fine.rows - 1, 2 * I + 1); i++) {
+						for (int j = std::max(0, 2 * J - 1); j <= std::min(fine.cols - 1, 2 * J + 1); j++) {
+							sum += weight(i, I, coarse.rows) * weight(j, J, coarse.cols) * fine.r[size_t(i) * fine.cols + j];
+						}
+					}
+				}
+				coarse.b[c] = COARSE_SCALE * sum;
+			}
+		}
+	}, "fairing restrict");
+}
+
+void FairingSolver::prolongAndCorrect(const Level& coarse, Level& fine) const {
+	JobSystem::get().parallelFor(0, fine.rows, 8, [&](int begin, int end) {
+		for (int i = begin; i < end; i++) {
+			const int I0 = i / 2;
+			const int I1 = (i % 2 == 1 && I0 + 1 < coarse.rows) ? I0 + 1 : I0;
+			for (int j = 0; j < fine.cols; j++) {
+				const size_t k = size_t(i) * fine.cols + j;
+				if (fine.pinnedMask[k]) continue;
+				const int J0 = j / 2;
+				const int J1 = (j % 2 == 1 && J0 + 1 < coarse.cols) ? J0 + 1 : J0;
+				fine.x[k] += 0.25 * (coarse.x[size_t(I0) * coarse.cols + J0] + coarse.x[size_t(I0) * coarse.cols + J1]
+					+ coarse.x[size_t(I1) * coarse.cols + J0] + coarse.x[size_t(I1) * coarse.cols + J1]);
+			}
+		}
+	}, "fairing prolong");
+}
+
+void FairingSolver::solveCoarsest(Level& level) const {
+	std::fill(level.x.begin(), level.x.end(), 0.0);
+	const int n = int(this->coarseFree.size());
+	std::vector<double> y(n);
+	// L y = b, then L^T x = y
+	for (int i = 0; i < n; i++) {
+		double sum = level.b[this->coarseFree[i]];
+		for (int k = 0; k < i; k++) sum -= this->coarseFactor[size_t(i) * n + k] * y[k];
+		y[i] = sum / this->coarseFactor[size_t(i) * n + i];
+	}
+	for (int i = n - 1; i >= 0; i--) {
+		double sum = y[i];
+		for (int k = i + 1; k < n; k++) sum -= this->coarseFactor[size_t(k) * n + i] * y[k];
+		y[i] = sum / this->coarseFactor[size_t(i) * n + i];
+	}
+	for (int i = 0; i < n; i++) level.x[this->coarseFree[i]] = y[i];
+}
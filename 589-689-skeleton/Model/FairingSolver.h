@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "../JobSystem.h"
+#include "ConjugateGradient.h"
+#include "SelectionSet.h"
+#include "UndoJournal.h"
+
+struct FairingSettings {
+	int maxIterations = 200;
+	float tolerance = 1e-5f;
+};
+
+// Fairs the control net heights by minimising the thin-plate bending energy |L h|^2, where L
+// is the umbrella Laplacian of the grid (border points average the neighbours they have).
+// Pinned points keep their height; the rest solve the bi-Laplacian system L^T L h = 0 with
+// the pinned heights moved to the right-hand side. The operator is applied as two stencil
+// passes over the grid rows, never assembled.
+//
+// Plain Jacobi-preconditioned CG needs thousands of iterations on this system at 100x100, so
+// CG is preconditioned with one multigrid V-cycle instead: damped Jacobi smoothing on halved
+// grids down to a level small enough to factor densely.
+class FairingSolver {
+
+public:
+
+	// Needs at least one pinned point, otherwise any plane is equally fair. The solve starts
+	// from the current heights, so refairing after moving a few pins only has to correct the
+	// previous solution. `dirtyRegion` receives the whole net; the free points are touched in
+	// `journal` if given.
+	bool solve(const SelectionSet& pinned, std::vector<std::vector<glm::vec3>>& P, const std::vector<std::vector<float>>& W, const FairingSettings& settings,
+		Range2D& dirtyRegion, UndoJournal* journal = nullptr);
+
+	const ConjugateGradientResult& getLastResult() const { return this->lastResult; }
+
+private:
+
+	struct Level {
+		int rows = 0;
+		int cols = 0;
+		std::vector<uint8_t> pinnedMask;
+		// 1 / (number of grid neighbours) of every point
+		std::vector<double> inverseNeighbours;
+		// Diagonal of L^T L, for the Jacobi smoother
+		std::vector<double> diagonal;
+		// V-cycle right-hand side, solution, residual and stencil scratch
+		std::vector<double> b;
+		std::vector<double> x;
+		std::vector<double> r;
+		std::vector<double> laplacian;
+	};
+
+	void prepare(const SelectionSet& pinned);
+	void prepareLevel(Level& level);
+	void factorCoarsest();
+
+	void applyLaplacian(const Level& level, const std::vector<double>& in, std::vector<double>& out) const;
+	void applyLaplacianTranspose(const Level& level, const std::vector<double>& in, std::vector<double>& out) const;
+	// out = L^T L in on the free points, out = in on the pinned ones
+	void applyOperator(Level& level, const std::vector<double>& in, std::vector<double>& out) const;
+
+	void vCycle(int levelIndex);
+	void smooth(Level& level, int sweeps);
+	void restrictResidual(Level& fine, Level& coarse) const;
+	void prolongAndCorrect(const Level& coarse, Level& fine) const;
+	void solveCoarsest(Level& level) const;
+
+private:
+
+	std::vector<Level> levels;
+	// Dense Cholesky factor of the coarsest level over its free points
+	std::vector<int> coarseFree;
+	std::vector<double> coarseFactor;
+
+	std::vector<double> heights;
+	std::vector<double> rhs;
+
+	ConjugateGradient conjugateGradient;
+	ConjugateGradientResult lastResult;
+
+};
@@ -0,0 +1,339 @@
+#include "HeightmapFitter.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cctype>
+
+#include <stb/stb_image.h>
+
+#include "../Log.h"
+#include "SurfaceEvaluator.h"
+
+namespace {
+
+	bool isRawFile(const std::string& path) {
+		const size_t dot = path.find_last_of('.');
+		if (dot == std::string::npos) return false;
+		std::string extension = path.substr(dot + 1);
+		std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return char(std::tolower(c)); });
+		return extension == "raw" || extension == "r16";
+	}
+
+	// x of the curve through evenly spaced control points, as a fraction of the net's extent
+	float netPosition(const std::vector<float>& U, float u, int k, int nControlPoints, float* N) {
+		const int first = SurfaceEvaluator::basisFunctions(U, u, k, nControlPoints, N) - k + 1;
+		float position = 0.0f;
+		for (int a = 0; a < k; a++) position += N[a] * float(first + a);
+		return position / float(nControlPoints - 1);
+	}
+
+}
+
+// MARK: - Reader
+
+bool HeightmapReader::open(const std::string& path, int rawWidth, int rawHeight) {
+	this->close();
+	this->path = path;
+	if (isRawFile(path)) {
+		this->raw = fopen(path.c_str(), "rb");
+		if (this->raw == NULL) {
+			Log::error("Cannot open heightmap {}", path);
+			return false;
+		}
+		fseek(this->raw, 0, SEEK_END);
+		const long numSamples = ftell(this->raw) / 2;
+		fseek(this->raw, 0, SEEK_SET);
+		if (rawWidth <= 0 || rawHeight <= 0) {
+			rawWidth = rawHeight = int(std::lround(std::sqrt(double(numSamples))));
+			if (long(rawWidth) * rawHeight != numSamples) {
+				Log::error("Cannot infer the size of RAW heightmap {}, set its width and height", path);
+				this->close();
+				return false;
+			}
+		} else if (long(rawWidth) * rawHeight > numSamples) {
+			Log::error("RAW heightmap {} is smaller than {}x{}", path, rawWidth, rawHeight);
+			this->close();
+			return false;
+		}
+		this->imageWidth = rawWidth;
+		this->imageHeight = rawHeight;
+	} else {
+		int width = 0, height = 0, numComponents = 0;
+		if (stbi_is_16_bit(path.c_str())) {
+			stbi_us* data = stbi_load_16(path.c_str(), &width, &height, &numComponents, 1);
+			if (data) {
+				this->decoded.assign(data, data + size_t(width) * height);
+				stbi_image_free(data);
+			}
+		} else {
+			stbi_uc* data = stbi_load(path.c_str(), &width, &height, &numComponents, 1);
+			if (data) {
+				// 255 * 257 = 65535
+				this->decoded.resize(size_t(width) * height);
+				for (size_t n = 0; n < this->decoded.size(); n++) this->decoded[n] = uint16_t(data[n] * 257);
+				stbi_image_free(data);
+			}
+		}
+		if (this->decoded.empty()) {
+			Log::error("Failed to read heightmap {}", path);
+			return false;
+		}
+		this->imageWidth = width;
+		this->imageHeight = height;
+	}
+	this->nextRow = 0;
+	return true;
+}
+
+void HeightmapReader::open(const float* samples, int width, int height) {
+	this->close();
+	this->path = "memory";
+	this->memory = samples;
+	this->imageWidth = width;
+	this->imageHeight = height;
+}
+
+void HeightmapReader::close() {
+	if (this->raw != NULL) fclose(this->raw);
+	this->raw = nullptr;
+	this->memory = nullptr;
+	std::vector<uint16_t>().swap(this->decoded);
+	std::vector<unsigned char>().swap(this->rawBytes);
+	this->imageWidth = 0;
+	this->imageHeight = 0;
+	this->nextRow = 0;
+}
+
+bool HeightmapReader::rewind() {
+	this->nextRow = 0;
+	return this->raw == NULL || fseek(this->raw, 0, SEEK_SET) == 0;
+}
+
+bool HeightmapReader::readRows(int count, float* samples) {
+	if (this->nextRow + count > this->imageHeight) return false;
+	const size_t numSamples = size_t(count) * this->imageWidth;
+	if (this->raw != NULL) {
+		this->rawBytes.resize(numSamples * 2);
+		if (fread(this->rawBytes.data(), 1, this->rawBytes.size(), this->raw) != this->rawBytes.size()) {
+			Log::error("Unexpected end of heightmap {}", this->path);
+			return false;
+		}
+		// Little-endian whatever the host is
+		for (size_t n = 0; n < numSamples; n++) samples[n] = float(this->rawBytes[2 * n] | (this->rawBytes[2 * n + 1] << 8)) / 65535.0f;
+	} else if (this->memory != nullptr) {
+		std::copy(this->memory + size_t(this->nextRow) * this->imageWidth, this->memory + size_t(this->nextRow + count) * this->imageWidth, samples);
+	} else {
+		const uint16_t* source = &this->decoded[size_t(this->nextRow) * this->imageWidth];
+		for (size_t n = 0; n < numSamples; n++) samples[n] = float(source[n]) / 65535.0f;
+	}
+	this->nextRow += count;
+	return true;
+}
+
+// MARK: - Fitting
+
+bool HeightmapFitter::buildAxis(AxisBasis& axis, int samples, int nControlPoints, int k) {
+	const std::vector<float> U = SurfaceEvaluator::generateKnotSequence(nControlPoints, k, false);
+	axis.k = k;
+	axis.count = samples;
+	axis.nControlPoints = nControlPoints;
+	axis.firstIndex.resize(samples);
+	axis.N.resize(size_t(samples) * k);
+
+	// The control points are evenly spaced but the curve through them is not evenly parameterised
+	// near clamped ends, so find the u whose surface point lies over each sample by bisection
+	JobSystem::get().parallelFor(0, samples, 64, [&](int begin, int end) {
+		std::vector<float> N(k);
+		for (int s = begin; s < end; s++) {
+			const float target = samples > 1 ? float(s) / float(samples - 1) : 0.5f;
+			float low = U[k - 1], high = U[nControlPoints];
+			for (int iteration = 0; iteration < 24; iteration++) {
+				const float middle = 0.5f * (low + high);
+				if (netPosition(U, middle, k, nControlPoints, N.data()) < target) low = middle;
+				else high = middle;
+			}
+			const float u = 0.5f * (low + high);
+			axis.firstIndex[s] = SurfaceEvaluator::basisFunctions(U, u, k, nControlPoints, &axis.N[size_t(s) * k]) - k + 1;
+		}
+	}, "heightmap basis");
+
+	// B^T B, with a little ridge so spans the samples don't reach still have a unique solution
+	axis.normal.resize(nControlPoints, k - 1);
+	for (int s = 0; s < samples; s++) {
+		const float* N = &axis.N[size_t(s) * k];
+		const int first = axis.firstIndex[s];
+		for (int a = 0; a < k; a++) {
+			for (int b = 0; b <= a; b++) axis.normal.at(first + a, first + b) += double(N[a]) * N[b];
+		}
+	}
+	const double ridge = 1e-6 * double(samples) / double(nControlPoints);
+	for (int i = 0; i < nControlPoints; i++) axis.normal.at(i, i) += ridge;
+	if (!axis.normal.factor()) {
+		Log::error("Heightmap fit: normal matrix is not positive definite");
+		return false;
+	}
+	return true;
+}
+
+bool HeightmapFitter::fit(const HeightmapImportSettings& settings, int k_u, int k_v, std::vector<std::vector<glm::vec3>>& P, std::vector<std::vector<float>>& W) {
+	this->lastResult = HeightmapFitResult();
+	HeightmapReader reader;
+	if (!reader.open(settings.path, settings.rawWidth, settings.rawHeight)) return false;
+	return this->fitRows(reader, settings.minHeight, settings.maxHeight, k_u, k_v, P, W);
+}
+
+bool HeightmapFitter::fit(const float* heights, int width, int height, int k_u, int k_v, std::vector<std::vector<glm::vec3>>& P, std::vector<std::vector<float>>& W) {
+	this->lastResult = HeightmapFitResult();
+	HeightmapReader reader;
+	reader.open(heights, width, height);
+	return this->fitRows(reader, 0.0f, 1.0f, k_u, k_v, P, W);
+}
+
+bool HeightmapFitter::fitRows(HeightmapReader& reader, float minHeight, float maxHeight, int k_u, int k_v, std::vector<std::vector<glm::vec3>>& P, std::vector<std::vector<float>>& W) {
+	const auto start = std::chrono::steady_clock::now();
+	const int m = int(P.size());
+	const int n = m > 0 ? int(P[0].size()) : 0;
+	if (m < k_u || n < k_v) {
+		Log::error("Heightmap fit: a {}x{} net is too small for order {}, {}", m, n, k_u, k_v);
+		return false;
+	}
+	const int width = reader.width();
+	const int height = reader.height();
+	if (!this->buildAxis(this->axisU, width, m, k_u) || !this->buildAxis(this->axisV, height, n, k_v)) return false;
+
+	// Along u: every image row becomes m coefficients. Rows stream in blocks and are fitted in parallel.
+	std::vector<double> T(size_t(height) * m, 0.0);
+	std::vector<float> samples(size_t(ROW_BLOCK) * width);
+	for (int rowBegin = 0; rowBegin < height; rowBegin += ROW_BLOCK) {
+		const int count = std::min(ROW_BLOCK, height - rowBegin);
+		if (!reader.readRows(count, samples.data())) return false;
+		JobSystem::get().parallelFor(0, count, 8, [&](int begin, int end) {
+			for (int r = begin; r < end; r++) {
+				double* rhs = &T[size_t(rowBegin + r) * m];
+				const float* row = &samples[size_t(r) * width];
+				for (int c = 0; c < width; c++) {
+					const float* N = &this->axisU.N[size_t(c) * k_u];
+					for (int a = 0; a < k_u; a++) rhs[this->axisU.firstIndex[c] + a] += double(N[a]) * row[c];
+				}
+				this->axisU.normal.solve(rhs);
+			}
+		}, "heightmap rows");
+	}
+
+	// Along v: every column of T becomes a column of control point heights
+	std::vector<double> C(size_t(m) * n);
+	JobSystem::get().parallelFor(0, m, 4, [&](int begin, int end) {
+		std::vector<double> rhs(n);
+		for (int i = begin; i < end; i++) {
+			std::fill(rhs.begin(), rhs.end(), 0.0);
+			for (int r = 0; r < height; r++) {
+				const float* N = &this->axisV.N[size_t(r) * k_v];
+				for (int b = 0; b < k_v; b++) rhs[this->axisV.firstIndex[r] + b] += double(N[b]) * T[size_t(r) * m + i];
+			}
+			this->axisV.normal.solve(rhs.data());
+			for (int j = 0; j < n; j++) C[size_t(i) * n + j] = rhs[j];
+		}
+	}, "heightmap columns");
+
+	// The basis sums to one, so mapping the samples to heights maps the coefficients the same way
+	const float range = maxHeight - minHeight;
+	for (int i = 0; i < m; i++) {
+		for (int j = 0; j < n; j++) P[i][j].y = minHeight + range * float(C[size_t(i) * n + j]);
+	}
+	W.assign(m, std::vector<float>(n, 1.0f));
+
+	this->lastResult.width = width;
+	this->lastResult.height = height;
+	this->lastResult.nControlPointsU = m;
+	this->lastResult.nControlPointsV = n;
+	if (!this->measureError(reader, C, minHeight, maxHeight)) return false;
+	this->lastResult.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	this->lastResult.bSucceeded = true;
+	Log::info("Fitted {}x{} height samples to {}x{} control points in {:.2f}s, RMS error {:.4f}, max error {:.4f}",
+		width, height, m, n, this->lastResult.seconds, this->lastResult.rmsError, this->lastResult.maxError);
+	return true;
+}
+
+bool HeightmapFitter::measureError(HeightmapReader& reader, const std::vector<double>& C, float minHeight, float maxHeight) {
+	const int width = reader.width();
+	const int height = reader.height();
+	const int m = this->axisU.nControlPoints;
+	const int n = this->axisV.nControlPoints;
+	const int k_u = this->axisU.k;
+	const int k_v = this->axisV.k;
+	const double range = double(maxHeight) - double(minHeight);
+	if (!reader.rewind()) return false;
+
+	// Per row, summed in order afterwards so the reported error doesn't depend on scheduling
+	std::vector<double> rowSquared(height, 0.0);
+	std::vector<double> rowMax(height, 0.0);
+	std::vector<float> samples(size_t(ROW_BLOCK) * width);
+	for (int rowBegin = 0; rowBegin < height; rowBegin += ROW_BLOCK) {
+		const int count = std::min(ROW_BLOCK, height - rowBegin);
+		if (!reader.readRows(count, samples.data())) return false;
+		JobSystem::get().parallelFor(0, count, 8, [&](int begin, int end) {
+			std::vector<double> curve(m);
+			for (int r = begin; r < end; r++) {
+				// The surface along this row is a curve in u with these coefficients
+				const float* Nv = &this->axisV.N[size_t(rowBegin + r) * k_v];
+				const int firstV = this->axisV.firstIndex[rowBegin + r];
+				for (int i = 0; i < m; i++) {
+					double value = 0.0;
+					for (int b = 0; b < k_v; b++) value += Nv[b] * C[size_t(i) * n + firstV + b];
+					curve[i] = value;
+				}
+				const float* row = &samples[size_t(r) * width];
+				double squared = 0.0, maximum = 0.0;
+				for (int c = 0; c < width; c++) {
+					const float* Nu = &this->axisU.N[size_t(c) * k_u];
+					double value = 0.0;
+					for (int a = 0; a < k_u; a++) value += Nu[a] * curve[this->axisU.firstIndex[c] + a];
+					const double error = std::abs(value - double(row[c])) * range;
+					squared += error * error;
+					maximum = std::max(maximum, error);
+				}
+				rowSquared[rowBegin + r] = squared;
+				rowMax[rowBegin + r] = maximum;
+			}
+		}, "heightmap error");
+	}
+	double squared = 0.0, maximum = 0.0;
+	for (int r = 0; r < height; r++) {
+		squared += rowSquared[r];
+		maximum = std::max(maximum, rowMax[r]);
+	}
+	this->lastResult.rmsError = float(std::sqrt(squared / (double(width) * height)));
+	this->lastResult.maxError = float(maximum);
+	return true;
+}
+
+void HeightmapFitter::sample(const std::vector<std::vector<glm::vec3>>& P, const std::vector<std::vector<float>>& W, int k_u, int k_v, int width, int height, std::vector<float>& heights) {
+	const int m = int(P.size());
+	const int n = m > 0 ? int(P[0].size()) : 0;
+	heights.assign(size_t(width) * height, 0.0f);
+	if (m < k_u || n < k_v || !this->buildAxis(this->axisU, width, m, k_u) || !this->buildAxis(this->axisV, height, n, k_v)) return;
+	JobSystem::get().parallelFor(0, height, 8, [&](int begin, int end) {
+		std::vector<float> curve(m);
+		for (int r = begin; r < end; r++) {
+			// Every row of P projected in v first, the same rational form the surface is evaluated with
+			const float* Nv = &this->axisV.N[size_t(r) * k_v];
+			const int firstV = this->axisV.firstIndex[r];
+			for (int i = 0; i < m; i++) {
+				float numerator = 0.0f, denominator = 0.0f;
+				for (int b = 0; b < k_v; b++) {
+					numerator += Nv[b] * W[i][firstV + b] * P[i][firstV + b].y;
+					denominator += Nv[b] * W[i][firstV + b];
+				}
+				curve[i] = numerator / denominator;
+			}
+			float* row = &heights[size_t(r) * width];
+			for (int c = 0; c < width; c++) {
+				const float* Nu = &this->axisU.N[size_t(c) * k_u];
+				float value = 0.0f;
+				for (int a = 0; a < k_u; a++) value += Nu[a] * curve[this->axisU.firstIndex[c] + a];
+				row[c] = value;
+			}
+		}
+	}, "heightmap sample");
+}
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "../JobSystem.h"
+#include "BandedCholesky.h"
+
+struct HeightmapImportSettings {
+	std::string path = "";
+	// .raw/.r16 files have no header: 16 bit little-endian samples, row by row.
+	// 0 for both assumes a square image and derives the side from the file size.
+	int rawWidth = 0;
+	int rawHeight = 0;
+	// Side of the fitted control net
+	int nControlPoints = 64;
+	// Heights the darkest and brightest samples map to
+	float minHeight = 0.0f;
+	float maxHeight = 10.0f;
+};
+
+struct HeightmapFitResult {
+	int width = 0;
+	int height = 0;
+	int nControlPointsU = 0;
+	int nControlPointsV = 0;
+	// Fitted surface against the samples, in world units
+	float rmsError = 0.0f;
+	float maxError = 0.0f;
+	double seconds = 0.0;
+	bool bSucceeded = false;
+};
+
+// Streams a heightmap a block of rows at a time, as samples in [0, 1]. PNGs and other stb
+// formats are decoded up front (16 bit when the file has it); RAW files are read from disk.
+class HeightmapReader {
+
+public:
+
+	HeightmapReader() = default;
+	~HeightmapReader() { this->close(); }
+
+	HeightmapReader(const HeightmapReader&) = delete;
+	HeightmapReader& operator=(const HeightmapReader&) = delete;
+
+	bool open(const std::string& path, int rawWidth, int rawHeight);
+	// Reads rows of an in-memory grid instead, which must outlive the reader. Samples are passed through as they are.
+	void open(const float* samples, int width, int height);
+	void close();
+	// Back to the first row
+	bool rewind();
+	// Reads the next `count` rows into `samples`, width() per row
+	bool readRows(int count, float* samples);
+
+	int width() const { return this->imageWidth; }
+	int height() const { return this->imageHeight; }
+
+private:
+
+	std::string path;
+	int imageWidth = 0;
+	int imageHeight = 0;
+	int nextRow = 0;
+	// Decoded image, or empty when streaming a RAW file or reading memory
+	std::vector<uint16_t> decoded;
+	const float* memory = nullptr;
+	FILE* raw = nullptr;
+	std::vector<unsigned char> rawBytes;
+
+};
+
+// Least-squares fit of a B-spline control net to a heightmap. The net's surface with unit weights
+// is the tensor product S = Bu C Bv^T, so the fit separates: every image row is first fitted along
+// u, then every column of those coefficients along v. Each direction has one small banded normal
+// matrix, factored once and shared by all rows, which are solved in parallel as they stream in.
+class HeightmapFitter {
+
+public:
+
+	// Fits the heights of P, an m x n net evenly spaced in x and z, for evaluation with clamped uniform
+	// knots of order k_u, k_v. The image is stretched over the whole net, columns along x and rows
+	// along z. W is reset to 1. The result, including the residual error, is kept in getLastResult().
+	bool fit(const HeightmapImportSettings& settings, int k_u, int k_v, std::vector<std::vector<glm::vec3>>& P, std::vector<std::vector<float>>& W);
+
+	// Same, for a width x height grid of heights already in world units
+	bool fit(const float* heights, int width, int height, int k_u, int k_v, std::vector<std::vector<glm::vec3>>& P, std::vector<std::vector<float>>& W);
+
+	// Samples the surface of P and W on the grid a fit of that size reads: evenly spaced in x and z
+	void sample(const std::vector<std::vector<glm::vec3>>& P, const std::vector<std::vector<float>>& W, int k_u, int k_v, int width, int height, std::vector<float>& heights);
+
+	const HeightmapFitResult& getLastResult() const { return this->lastResult; }
+
+private:
+
+	// Non-zero basis functions of one direction at each sample, and the matching normal matrix
+	struct AxisBasis {
+		int k = 0;
+		int count = 0;
+		int nControlPoints = 0;
+		std::vector<int> firstIndex;
+		std::vector<float> N;
+		BandedCholesky normal;
+	};
+
+	bool buildAxis(AxisBasis& axis, int samples, int nControlPoints, int k);
+	bool fitRows(HeightmapReader& reader, float minHeight, float maxHeight, int k_u, int k_v, std::vector<std::vector<glm::vec3>>& P, std::vector<std::vector<float>>& W);
+	bool measureError(HeightmapReader& reader, const std::vector<double>& C, float minHeight, float maxHeight);
+
+private:
+
+	static const int ROW_BLOCK = 256;
+
+	AxisBasis axisU;
+	AxisBasis axisV;
+	HeightmapFitResult lastResult;
+
+};
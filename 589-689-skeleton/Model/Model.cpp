@@ -3,6 +3,7 @@
 
 Model::Model(const std::string& texturePath, const std::string& fileLocation) {
 	this->textureSettings.texturePath = texturePath;
+	this->world = std::make_shared<TerrainWorld>();
 	if (fileLocation.empty()) {
 		this->exportImportSettings.exportFileName.resize(25, '\0');
 		this->terrain = std::make_shared<FFS>();
@@ -19,6 +20,10 @@ Model::Model(const std::string& texturePath, const std::string& fileLocation) {
 }
 
 void Model::render() {
+	if (this->world->isEnabled()) {
+		this->world->render();
+		return;
+	}
 	if (this->terrain) {
 		this->terrain->render();
 		return;
@@ -29,7 +34,7 @@ void Model::render() {
 // Texture Settings
 bool Model::hasTexture() {
 	if (this->terrain) {
-		return !this->terrain->getFreeFormSurface().cpuGeom.uvs.empty() && !this->textureSettings.texturePath.empty();
+		return !this->terrain->getSurfaceTiles().empty() && !this->textureSettings.texturePath.empty();
 	}
 	return !this->process.cpuGeom.uvs.empty() && !this->textureSettings.texturePath.empty();
 }
@@ -138,6 +143,13 @@ bool Model::importFromNObj(const std::string& path) {
 	float resolution = 100.0f;
 	int nControlPoints = 20;
 	float terrainSize = 10.0f;
+	// Files written before nets could be rectangular have no v values; theirs are the u ones
+	float resolutionV = -1.0f;
+	int nControlPointsV = -1;
+	float terrainSizeV = -1.0f;
+	std::vector<DetailPatch> detailPatches;
+	DisplacementLayer displacement;
+	std::vector<float> displacementTile(size_t(DisplacementLayer::TILE_SIZE) * DisplacementLayer::TILE_SIZE);
 	std::string texturePath(200, '\0');
 
 	FILE* file = fopen(path.c_str(), "r");
@@ -164,10 +176,34 @@ bool Model::importFromNObj(const std::string& path) {
 			val = fscanf(file, "%d\n", &k_v);
 		} else if (strcmp(lineHeader, "r") == 0) {
 			val = fscanf(file, "%f\n", &resolution);
+		} else if (strcmp(lineHeader, "rV") == 0) {
+			val = fscanf(file, "%f\n", &resolutionV);
 		} else if (strcmp(lineHeader, "nCp") == 0) {
 			val = fscanf(file, "%d\n", &nControlPoints);
+		} else if (strcmp(lineHeader, "nCpV") == 0) {
+			val = fscanf(file, "%d\n", &nControlPointsV);
 		} else if (strcmp(lineHeader, "tz") == 0) {
 			val = fscanf(file, "%f\n", &terrainSize);
+		} else if (strcmp(lineHeader, "tzV") == 0) {
+			val = fscanf(file, "%f\n", &terrainSizeV);
+		} else if (strcmp(lineHeader, "dl") == 0) {
+			DetailPatch patch;
+			val = fscanf(file, "%d %f %f %f %f %d %d\n", &patch.level, &patch.u0, &patch.v0, &patch.spacingU, &patch.spacingV, &patch.rows, &patch.cols);
+			detailPatches.push_back(patch);
+		} else if (strcmp(lineHeader, "dh") == 0) {
+			// One row of heights of the last patch
+			if (detailPatches.empty()) continue;
+			DetailPatch& patch = detailPatches.back();
+			for (int col = 0; col < patch.cols; col++) {
+				float height = 0.0f;
+				val = fscanf(file, "%f", &height);
+				patch.heights.push_back(height);
+			}
+		} else if (strcmp(lineHeader, "dt") == 0) {
+			int tileRow = -1, tileCol = -1;
+			val = fscanf(file, "%d %d", &tileRow, &tileCol);
+			for (float& height : displacementTile) val = fscanf(file, "%f", &height);
+			if (!displacement.importTile(tileRow, tileCol, displacementTile)) Log::warn("Skipping displacement tile ({}, {})", tileRow, tileCol);
 		} else if (strcmp(lineHeader, "texture") == 0) {
 			fgets(texturePath.data(), texturePath.size(), file);
 			size_t len = strlen(texturePath.data());
@@ -184,9 +220,14 @@ bool Model::importFromNObj(const std::string& path) {
 	settings.weights = weights;
 	settings.k_u = k_u;
 	settings.k_v = k_v;
-	settings.resolution = resolution;
-	settings.nControlPoints = nControlPoints;
-	settings.terrainSize = terrainSize;
+	settings.resolutionU = resolution;
+	settings.resolutionV = resolutionV > 0.0f ? resolutionV : resolution;
+	settings.nControlPointsU = nControlPoints;
+	settings.nControlPointsV = nControlPointsV > 0 ? nControlPointsV : nControlPoints;
+	settings.terrainSizeU = terrainSize;
+	settings.terrainSizeV = terrainSizeV > 0.0f ? terrainSizeV : terrainSize;
+	settings.detailPatches = std::move(detailPatches);
+	settings.displacement = displacement;
 
 	bool success = this->terrain->getImportNObjFormat(settings);
 	if (success) {
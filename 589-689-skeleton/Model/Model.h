@@ -3,6 +3,7 @@
 #include <cstdio>
 
 #include "FFS.h"
+#include "TerrainWorld.h"
 #include "../Texture.h"
 #include "../GeomLoaderForOBJ.h"
 
@@ -40,6 +41,7 @@ private:
 
 	Process process;
 	std::shared_ptr<FFS> terrain = nullptr;
+	std::shared_ptr<TerrainWorld> world = nullptr;
 
 	// Texture Settings
 	TextureSettings textureSettings;
@@ -60,6 +62,8 @@ public:
 
 	// Terrain
 	std::shared_ptr<FFS> getTerrain() { return this->terrain; }
+	// Streamed world, drawn instead of the terrain while enabled
+	std::shared_ptr<TerrainWorld> getWorld() { return this->world; }
 
 	// Texture Settings
 	bool hasTexture();
@@ -0,0 +1,431 @@
+#include "PointCloudFitter.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+#include "../Log.h"
+#include "SurfaceEvaluator.h"
+
+namespace {
+
+	const int LINE_LENGTH = 1024;
+	// Points per partial sum of the residual, fixed so the sum doesn't depend on the thread count
+	const int ERROR_BLOCK = 4096;
+
+	std::string extensionOf(const std::string& path) {
+		const size_t dot = path.find_last_of('.');
+		if (dot == std::string::npos) return "";
+		std::string extension = path.substr(dot + 1);
+		std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return char(std::tolower(c)); });
+		return extension;
+	}
+
+	// Reads up to `count` numbers from `line`, returns how many it found
+	int parseNumbers(const char* line, double* values, int count) {
+		int found = 0;
+		char* end = nullptr;
+		while (found < count) {
+			const double value = std::strtod(line, &end);
+			if (end == line) break;
+			values[found++] = value;
+			line = end;
+		}
+		return found;
+	}
+
+}
+
+// MARK: - Reader
+
+bool PointCloudReader::open(const std::string& path) {
+	this->close();
+	this->path = path;
+	const std::string extension = extensionOf(path);
+	this->format = extension == "ply" ? Format::PLY : (extension == "obj" ? Format::OBJ : Format::XYZ);
+	this->file = fopen(path.c_str(), "r");
+	if (this->file == NULL) {
+		Log::error("Cannot open point cloud {}", path);
+		return false;
+	}
+	if (this->format == Format::PLY && !this->readHeader()) {
+		this->close();
+		return false;
+	}
+	this->dataOffset = ftell(this->file);
+	return true;
+}
+
+void PointCloudReader::close() {
+	if (this->file != NULL) fclose(this->file);
+	this->file = nullptr;
+	this->numVertices = 0;
+	this->verticesRead = 0;
+	this->dataOffset = 0;
+	this->bHasOrigin = false;
+}
+
+bool PointCloudReader::readHeader() {
+	char line[LINE_LENGTH];
+	if (fgets(line, LINE_LENGTH, this->file) == NULL || strncmp(line, "ply", 3) != 0) {
+		Log::error("{} is not a PLY file", this->path);
+		return false;
+	}
+	bool bInVertices = false, bSeenVertices = false;
+	int property = 0;
+	int found[3] = { -1, -1, -1 };
+	while (fgets(line, LINE_LENGTH, this->file) != NULL) {
+		char keyword[64] = "", first[64] = "", second[64] = "";
+		if (sscanf(line, "%63s %63s %63s", keyword, first, second) < 1) continue;
+		if (strcmp(keyword, "format") == 0) {
+			if (strcmp(first, "ascii") != 0) {
+				Log::error("Only ASCII PLY files are supported, {} is {}", this->path, first);
+				return false;
+			}
+		} else if (strcmp(keyword, "element") == 0) {
+			bInVertices = strcmp(first, "vertex") == 0;
+			if (bInVertices) {
+				this->numVertices = size_t(std::strtoull(second, nullptr, 10));
+				bSeenVertices = true;
+			} else if (!bSeenVertices) {
+				Log::error("PLY file {} must list its vertices first", this->path);
+				return false;
+			}
+		} else if (strcmp(keyword, "property") == 0 && bInVertices) {
+			// "property <type> <name>"; lists are never coordinates
+			if (strcmp(first, "list") != 0) {
+				if (strcmp(second, "x") == 0) found[0] = property;
+				else if (strcmp(second, "y") == 0) found[1] = property;
+				else if (strcmp(second, "z") == 0) found[2] = property;
+			}
+			property++;
+		} else if (strcmp(keyword, "end_header") == 0) {
+			if (found[0] < 0 || found[1] < 0 || found[2] < 0) {
+				Log::error("PLY file {} has no x, y and z vertex properties", this->path);
+				return false;
+			}
+			std::copy(found, found + 3, this->columns);
+			return true;
+		}
+	}
+	Log::error("PLY file {} has no end_header", this->path);
+	return false;
+}
+
+bool PointCloudReader::parseLine(const char* line, glm::vec3& point) {
+	while (*line == ' ' || *line == '\t') line++;
+	double values[64];
+	glm::dvec3 position;
+	if (this->format == Format::OBJ) {
+		// Only plain vertices, not vt/vn/vp
+		if (line[0] != 'v' || (line[1] != ' ' && line[1] != '\t') || parseNumbers(line + 1, values, 3) != 3) return false;
+		position = glm::dvec3(values[0], values[1], values[2]);
+	} else if (this->format == Format::PLY) {
+		const int numColumns = std::max(this->columns[0], std::max(this->columns[1], this->columns[2])) + 1;
+		if (numColumns > 64 || parseNumbers(line, values, numColumns) != numColumns) return false;
+		position = glm::dvec3(values[this->columns[0]], values[this->columns[1]], values[this->columns[2]]);
+	} else {
+		// Comments and header lines simply don't parse as three numbers
+		if (parseNumbers(line, values, 3) != 3) return false;
+		position = glm::dvec3(values[0], values[1], values[2]);
+	}
+	// Survey coordinates are millions of units from the origin, more than a float can resolve
+	if (!this->bHasOrigin) {
+		this->origin = position;
+		this->bHasOrigin = true;
+	}
+	point = glm::vec3(position - this->origin);
+	return true;
+}
+
+bool PointCloudReader::rewind() {
+	this->verticesRead = 0;
+	return this->file != NULL && fseek(this->file, this->dataOffset, SEEK_SET) == 0;
+}
+
+bool PointCloudReader::readChunk(size_t maxPoints, std::vector<glm::vec3>& points) {
+	points.clear();
+	if (this->file == NULL) return false;
+	char line[LINE_LENGTH];
+	glm::vec3 point;
+	while (points.size() < maxPoints) {
+		if (this->format == Format::PLY && this->verticesRead >= this->numVertices) break;
+		if (fgets(line, LINE_LENGTH, this->file) == NULL) break;
+		if (this->format == Format::PLY) this->verticesRead++;
+		if (this->parseLine(line, point)) points.push_back(point);
+	}
+	return !points.empty();
+}
+
+// MARK: - Fitting
+
+float PointCloudFitter::AxisMap::parameter(float t) const {
+	const float x = std::min(std::max(t, 0.0f), 1.0f) * float(this->table.size() - 1);
+	const int i = std::min(int(x), int(this->table.size()) - 2);
+	const float f = x - float(i);
+	return this->table[i] + f * (this->table[i + 1] - this->table[i]);
+}
+
+void PointCloudFitter::buildAxis(AxisMap& axis, int nControlPoints, int k) {
+	axis.k = k;
+	axis.U = SurfaceEvaluator::generateKnotSequence(nControlPoints, k, false);
+	axis.table.resize(TABLE_SIZE);
+	// Same inversion as the heightmap import: the u whose surface point lies at fraction t of the net
+	const std::vector<float>& U = axis.U;
+	JobSystem::get().parallelFor(0, TABLE_SIZE, 64, [&](int begin, int end) {
+		std::vector<float> N(k);
+		for (int s = begin; s < end; s++) {
+			const float target = float(s) / float(TABLE_SIZE - 1);
+			float low = U[k - 1], high = U[nControlPoints];
+			for (int iteration = 0; iteration < 24; iteration++) {
+				const float middle = 0.5f * (low + high);
+				const int first = SurfaceEvaluator::basisFunctions(U, middle, k, nControlPoints, N.data()) - k + 1;
+				float position = 0.0f;
+				for (int a = 0; a < k; a++) position += N[a] * float(first + a);
+				if (position / float(nControlPoints - 1) < target) low = middle;
+				else high = middle;
+			}
+			axis.table[s] = 0.5f * (low + high);
+		}
+	}, "point cloud basis");
+}
+
+glm::vec3 PointCloudFitter::orient(const glm::vec3& point) const {
+	return this->bZUp ? glm::vec3(point.x, point.z, point.y) : point;
+}
+
+float PointCloudFitter::basis(const glm::vec3& point, int& firstRow, int& firstCol, float* coefficients) const {
+	const glm::vec3 extent = this->bounds.max - this->bounds.min;
+	const float tx = extent.x > 0.0f ? (point.x - this->bounds.min.x) / extent.x : 0.5f;
+	const float tz = extent.z > 0.0f ? (point.z - this->bounds.min.z) / extent.z : 0.5f;
+	float Nu[MAX_ORDER], Nv[MAX_ORDER];
+	firstRow = SurfaceEvaluator::basisFunctions(this->axisU.U, this->axisU.parameter(tx), this->k_u, this->n, Nu) - this->k_u + 1;
+	firstCol = SurfaceEvaluator::basisFunctions(this->axisV.U, this->axisV.parameter(tz), this->k_v, this->n, Nv) - this->k_v + 1;
+	// Each row is projected in v first, so its weights only normalise within the row
+	const std::vector<std::vector<float>>& W = *this->weights;
+	for (int a = 0; a < this->k_u; a++) {
+		float denominator = 0.0f;
+		for (int b = 0; b < this->k_v; b++) denominator += Nv[b] * W[firstRow + a][firstCol + b];
+		for (int b = 0; b < this->k_v; b++) coefficients[a * this->k_v + b] = Nu[a] * Nv[b] * W[firstRow + a][firstCol + b] / denominator;
+	}
+	return extent.y > 0.0f ? (point.y - this->bounds.min.y) / extent.y : 0.5f;
+}
+
+void PointCloudFitter::accumulate() {
+	const int numPoints = int(this->chunkPoints.size());
+	const int size = this->k_u * this->k_v;
+	this->pointHeights.resize(numPoints);
+	this->pointCoefficients.resize(size_t(numPoints) * size);
+	this->pointCells.resize(numPoints);
+	JobSystem::get().parallelFor(0, numPoints, 1024, [&](int begin, int end) {
+		for (int p = begin; p < end; p++) {
+			int firstRow, firstCol;
+			this->pointHeights[p] = this->basis(this->orient(this->chunkPoints[p]), firstRow, firstCol, &this->pointCoefficients[size_t(p) * size]);
+			this->pointCells[p] = firstRow * this->cellCols + firstCol;
+		}
+	}, "point cloud basis");
+
+	// Counting sort into span cells, stable so every cell sums its points in file order
+	const int numCells = this->cellRows * this->cellCols;
+	this->cellStart.assign(numCells + 1, 0);
+	for (int p = 0; p < numPoints; p++) this->cellStart[this->pointCells[p] + 1]++;
+	for (int c = 0; c < numCells; c++) this->cellStart[c + 1] += this->cellStart[c];
+	this->cellOrder.resize(numPoints);
+	std::vector<int> cursor(this->cellStart.begin(), this->cellStart.end() - 1);
+	for (int p = 0; p < numPoints; p++) this->cellOrder[cursor[this->pointCells[p]]++] = p;
+
+	// Cells own disjoint blocks, so they accumulate in parallel
+	JobSystem::get().parallelFor(0, numCells, 16, [&](int begin, int end) {
+		for (int c = begin; c < end; c++) {
+			double* gram = &this->cellGram[size_t(c) * size * size];
+			double* rhs = &this->cellRhs[size_t(c) * size];
+			for (int o = this->cellStart[c]; o < this->cellStart[c + 1]; o++) {
+				const int p = this->cellOrder[o];
+				const float* coefficients = &this->pointCoefficients[size_t(p) * size];
+				for (int a = 0; a < size; a++) {
+					rhs[a] += double(coefficients[a]) * this->pointHeights[p];
+					for (int b = 0; b < size; b++) gram[a * size + b] += double(coefficients[a]) * coefficients[b];
+				}
+			}
+		}
+	}, "point cloud bins");
+	this->numPoints += size_t(numPoints);
+}
+
+void PointCloudFitter::assemble(float smoothness) {
+	const int n = this->n;
+	const int size = this->k_u * this->k_v;
+	const int stencilSize = this->stencilRows * this->stencilCols;
+	const int centre = (this->k_u - 1) * this->stencilCols + (this->k_v - 1);
+	this->stencil.assign(size_t(n) * n * stencilSize, 0.0);
+	this->rhs.assign(size_t(n) * n, 0.0);
+	for (int cellRow = 0; cellRow < this->cellRows; cellRow++) {
+		for (int cellCol = 0; cellCol < this->cellCols; cellCol++) {
+			const int c = cellRow * this->cellCols + cellCol;
+			const double* gram = &this->cellGram[size_t(c) * size * size];
+			const double* cellRhs = &this->cellRhs[size_t(c) * size];
+			for (int a = 0; a < size; a++) {
+				const int row = cellRow + a / this->k_v, col = cellCol + a % this->k_v;
+				double* entries = &this->stencil[(size_t(row) * n + col) * stencilSize];
+				this->rhs[size_t(row) * n + col] += cellRhs[a];
+				for (int b = 0; b < size; b++) {
+					const int di = b / this->k_v - a / this->k_v, dj = b % this->k_v - a % this->k_v;
+					entries[centre + di * this->stencilCols + dj] += gram[a * size + b];
+				}
+			}
+		}
+	}
+
+	// Membrane between 4-neighbours, scaled with how many points a control point sees on average
+	const double lambda = double(smoothness) * std::max(1.0, double(this->numPoints) / (double(n) * n));
+	for (int i = 0; i < n; i++) {
+		for (int j = 0; j < n; j++) {
+			double* entries = &this->stencil[(size_t(i) * n + j) * stencilSize];
+			const int neighbours[4][2] = { { -1, 0 }, { 1, 0 }, { 0, -1 }, { 0, 1 } };
+			for (const auto& neighbour : neighbours) {
+				const int ni = i + neighbour[0], nj = j + neighbour[1];
+				if (ni < 0 || ni >= n || nj < 0 || nj >= n) continue;
+				entries[centre] += lambda;
+				entries[centre + neighbour[0] * this->stencilCols + neighbour[1]] -= lambda;
+			}
+		}
+	}
+	this->diagonal.resize(size_t(n) * n);
+	for (size_t p = 0; p < this->diagonal.size(); p++) this->diagonal[p] = this->stencil[p * stencilSize + centre];
+}
+
+void PointCloudFitter::applyOperator(const std::vector<double>& in, std::vector<double>& out) const {
+	const int n = this->n;
+	const int stencilSize = this->stencilRows * this->stencilCols;
+	JobSystem::get().parallelFor(0, n, 4, [&](int begin, int end) {
+		for (int i = begin; i < end; i++) {
+			for (int j = 0; j < n; j++) {
+				const double* entries = &this->stencil[(size_t(i) * n + j) * stencilSize];
+				double sum = 0.0;
+				for (int di = -(this->k_u - 1); di <= this->k_u - 1; di++) {
+					if (i + di < 0 || i + di >= n) continue;
+					for (int dj = -(this->k_v - 1); dj <= this->k_v - 1; dj++) {
+						if (j + dj < 0 || j + dj >= n) continue;
+						sum += entries[(di + this->k_u - 1) * this->stencilCols + (dj + this->k_v - 1)] * in[size_t(i + di) * n + (j + dj)];
+					}
+				}
+				out[size_t(i) * n + j] = sum;
+			}
+		}
+	}, "point cloud operator");
+}
+
+bool PointCloudFitter::fit(const PointCloudImportSettings& settings, int k_u, int k_v, std::vector<std::vector<glm::vec3>>& P, const std::vector<std::vector<float>>& W) {
+	const auto start = std::chrono::steady_clock::now();
+	this->lastResult = PointCloudFitResult();
+	const int n = int(P.size());
+	if (n < std::max(k_u, k_v) || n == 0 || int(P[0].size()) != n || W.size() != P.size() || W[0].size() != P[0].size()) {
+		Log::error("Point cloud fit: a {}x{} net is too small for order {}", n, n, std::max(k_u, k_v));
+		return false;
+	}
+	if (std::max(k_u, k_v) > MAX_ORDER) {
+		Log::error("Point cloud fit supports orders up to {}", MAX_ORDER);
+		return false;
+	}
+	this->n = n;
+	this->k_u = k_u;
+	this->k_v = k_v;
+	this->bZUp = settings.bZUp;
+	this->weights = &W;
+
+	PointCloudReader reader;
+	if (!reader.open(settings.path)) return false;
+
+	// First pass: the footprint and height range
+	this->bounds = Bounds();
+	while (reader.readChunk(CHUNK_SIZE, this->chunkPoints)) {
+		for (const glm::vec3& point : this->chunkPoints) {
+			const glm::vec3 oriented = this->orient(point);
+			this->bounds.min = glm::min(this->bounds.min, oriented);
+			this->bounds.max = glm::max(this->bounds.max, oriented);
+		}
+	}
+	if (this->bounds.min.x > this->bounds.max.x) {
+		Log::error("No points found in {}", settings.path);
+		return false;
+	}
+
+	// Second pass: bin the points and accumulate the normal equations of every span cell
+	this->buildAxis(this->axisU, n, k_u);
+	this->buildAxis(this->axisV, n, k_v);
+	const int size = k_u * k_v;
+	this->cellRows = n - k_u + 1;
+	this->cellCols = n - k_v + 1;
+	this->cellGram.assign(size_t(this->cellRows) * this->cellCols * size * size, 0.0);
+	this->cellRhs.assign(size_t(this->cellRows) * this->cellCols * size, 0.0);
+	this->numPoints = 0;
+	if (!reader.rewind()) return false;
+	while (reader.readChunk(CHUNK_SIZE, this->chunkPoints)) this->accumulate();
+
+	this->stencilRows = 2 * k_u - 1;
+	this->stencilCols = 2 * k_v - 1;
+	this->assemble(settings.smoothness);
+	// Scattered data has no grid to keep, only the normal equations
+	std::vector<double>().swap(this->cellGram);
+	std::vector<double>().swap(this->cellRhs);
+
+	// The coefficients of every point sum to one, so a flat net at the mean height is a fair start
+	double meanHeight = 0.0;
+	for (size_t p = 0; p < this->rhs.size(); p++) meanHeight += this->rhs[p];
+	meanHeight /= double(this->numPoints);
+	std::vector<double> heights(size_t(n) * n, meanHeight);
+	this->lastResult.solver = this->solver.solve(
+		[&](const std::vector<double>& in, std::vector<double>& out) { this->applyOperator(in, out); },
+		[&](const std::vector<double>& in, std::vector<double>& out) { for (size_t p = 0; p < in.size(); p++) out[p] = in[p] / this->diagonal[p]; },
+		this->rhs, heights, settings.maxIterations, double(settings.tolerance));
+	if (!this->lastResult.solver.bConverged) Log::warn("Point cloud fit stopped after {} iterations, relative residual {}", this->lastResult.solver.iterations, this->lastResult.solver.relativeResidual);
+
+	const float range = settings.maxHeight - settings.minHeight;
+	for (int i = 0; i < n; i++) {
+		for (int j = 0; j < n; j++) P[i][j].y = settings.minHeight + range * float(heights[size_t(i) * n + j]);
+	}
+
+	// Third pass: how far the points are from the fitted surface
+	if (!reader.rewind()) return false;
+	const double heightScale = double(range);
+	double squared = 0.0, maximum = 0.0;
+	std::vector<double> blockSquared, blockMax;
+	while (reader.readChunk(CHUNK_SIZE, this->chunkPoints)) {
+		const int numPoints = int(this->chunkPoints.size());
+		const int numBlocks = (numPoints + ERROR_BLOCK - 1) / ERROR_BLOCK;
+		blockSquared.assign(numBlocks, 0.0);
+		blockMax.assign(numBlocks, 0.0);
+		JobSystem::get().parallelFor(0, numBlocks, 1, [&](int begin, int end) {
+			float blockCoefficients[MAX_ORDER * MAX_ORDER];
+			for (int block = begin; block < end; block++) {
+				for (int p = block * ERROR_BLOCK; p < std::min(numPoints, (block + 1) * ERROR_BLOCK); p++) {
+					int firstRow, firstCol;
+					const float height = this->basis(this->orient(this->chunkPoints[p]), firstRow, firstCol, blockCoefficients);
+					double surface = 0.0;
+					for (int a = 0; a < size; a++) surface += blockCoefficients[a] * heights[size_t(firstRow + a / k_v) * n + firstCol + a % k_v];
+					const double error = std::abs(surface - double(height)) * heightScale;
+					blockSquared[block] += error * error;
+					blockMax[block] = std::max(blockMax[block], error);
+				}
+			}
+		}, "point cloud error");
+		for (int block = 0; block < numBlocks; block++) {
+			squared += blockSquared[block];
+			maximum = std::max(maximum, blockMax[block]);
+		}
+	}
+	std::vector<glm::vec3>().swap(this->chunkPoints);
+
+	this->lastResult.numPoints = this->numPoints;
+	this->lastResult.nControlPoints = n;
+	this->lastResult.rmsError = float(std::sqrt(squared / double(this->numPoints)));
+	this->lastResult.maxError = float(maximum);
+	this->lastResult.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	this->lastResult.bSucceeded = true;
+	Log::info("Fitted {} points to {}x{} control points in {:.2f}s ({} CG iterations), RMS error {:.4f}, max error {:.4f}",
+		this->numPoints, n, n, this->lastResult.seconds, this->lastResult.solver.iterations, this->lastResult.rmsError, this->lastResult.maxError);
+	return true;
+}
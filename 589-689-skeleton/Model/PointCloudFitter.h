@@ -0,0 +1,162 @@
+#pragma once
+
+#include <cstdio>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "../JobSystem.h"
+#include "ConjugateGradient.h"
+
+struct PointCloudImportSettings {
+	std::string path = "";
+	// Side of the fitted control net
+	int nControlPoints = 64;
+	// Heights the lowest and highest points map to
+	float minHeight = 0.0f;
+	float maxHeight = 10.0f;
+	// Scanner data usually has z up; the terrain has y up
+	bool bZUp = false;
+	// Pull of neighbouring control points towards each other, relative to the data; fills holes
+	float smoothness = 0.01f;
+	int maxIterations = 1000;
+	float tolerance = 1e-6f;
+};
+
+struct PointCloudFitResult {
+	size_t numPoints = 0;
+	int nControlPoints = 0;
+	ConjugateGradientResult solver;
+	// Fitted surface against the points, in world units
+	float rmsError = 0.0f;
+	float maxError = 0.0f;
+	double seconds = 0.0;
+	bool bSucceeded = false;
+};
+
+// Streams the points of an ASCII point cloud a chunk at a time: .ply (ASCII only), the `v` lines
+// of an .obj, or anything else as whitespace separated x y z per line (.xyz, .txt, .pts).
+class PointCloudReader {
+
+public:
+
+	PointCloudReader() = default;
+	~PointCloudReader() { this->close(); }
+
+	PointCloudReader(const PointCloudReader&) = delete;
+	PointCloudReader& operator=(const PointCloudReader&) = delete;
+
+	bool open(const std::string& path);
+	void close();
+	bool rewind();
+	// Replaces `points` with up to `maxPoints` more points, relative to the first point of the file.
+	// False once the file is exhausted.
+	bool readChunk(size_t maxPoints, std::vector<glm::vec3>& points);
+
+private:
+
+	enum class Format { XYZ, OBJ, PLY };
+
+	bool readHeader();
+	bool parseLine(const char* line, glm::vec3& point);
+
+private:
+
+	std::string path;
+	FILE* file = nullptr;
+	Format format = Format::XYZ;
+	// PLY: vertex count, the columns holding x, y and z, and where the vertex lines start
+	size_t numVertices = 0;
+	size_t verticesRead = 0;
+	int columns[3] = { 0, 1, 2 };
+	long dataOffset = 0;
+	glm::dvec3 origin = glm::dvec3(0.0);
+	bool bHasOrigin = false;
+
+};
+
+// Least-squares fit of the heights of a control net to scattered points. The surface is linear in
+// the heights for fixed weights, so any weights can be fitted against. Points stream through in
+// chunks and are binned into the knot span cell they fall in; each cell accumulates its small dense
+// block of the normal equations, so memory depends on the net and not on the number of points.
+// A membrane term ties neighbouring control points together so cells without data stay smooth,
+// and the sparse system is solved with Jacobi-preconditioned conjugate gradient.
+class PointCloudFitter {
+
+public:
+
+	// Fits the heights of P, a square net evenly spaced in x and z, for evaluation with weights W
+	// and clamped uniform knots of order k_u, k_v. The points' footprint is stretched over the net.
+	bool fit(const PointCloudImportSettings& settings, int k_u, int k_v, std::vector<std::vector<glm::vec3>>& P, const std::vector<std::vector<float>>& W);
+
+	const PointCloudFitResult& getLastResult() const { return this->lastResult; }
+
+private:
+
+	// u for an evenly spaced fraction of the net, tabulated and interpolated
+	struct AxisMap {
+		int k = 0;
+		std::vector<float> U;
+		std::vector<float> table;
+		float parameter(float t) const;
+	};
+
+	struct Bounds {
+		glm::vec3 min = glm::vec3(std::numeric_limits<float>::max());
+		glm::vec3 max = glm::vec3(-std::numeric_limits<float>::max());
+	};
+
+	void buildAxis(AxisMap& axis, int nControlPoints, int k);
+	// Point as read from the file turned y up
+	glm::vec3 orient(const glm::vec3& point) const;
+	// Surface basis over an oriented point: the k_u * k_v coefficients of the heights from
+	// (firstRow, firstCol) on. Returns the point's height normalised to [0, 1].
+	float basis(const glm::vec3& point, int& firstRow, int& firstCol, float* coefficients) const;
+	void accumulate();
+	void assemble(float smoothness);
+	void applyOperator(const std::vector<double>& in, std::vector<double>& out) const;
+
+private:
+
+	static const size_t CHUNK_SIZE = 1 << 18;
+	static const int TABLE_SIZE = 4096;
+	// Each span cell holds a (k_u k_v)^2 block, which grows fast with the order
+	static const int MAX_ORDER = 8;
+
+	bool bZUp = false;
+	Bounds bounds;
+	int n = 0;
+	int k_u = 0;
+	int k_v = 0;
+	AxisMap axisU;
+	AxisMap axisV;
+	const std::vector<std::vector<float>>* weights = nullptr;
+
+	// Span cells and the dense Gram block and right-hand side each accumulates
+	int cellRows = 0;
+	int cellCols = 0;
+	std::vector<double> cellGram;
+	std::vector<double> cellRhs;
+	size_t numPoints = 0;
+
+	// Binning scratch, reused between chunks
+	std::vector<glm::vec3> chunkPoints;
+	std::vector<float> pointHeights;
+	std::vector<float> pointCoefficients;
+	std::vector<int> pointCells;
+	std::vector<int> cellStart;
+	std::vector<int> cellOrder;
+
+	// Assembled system, one (2k_u - 1) x (2k_v - 1) stencil per control point
+	int stencilRows = 0;
+	int stencilCols = 0;
+	std::vector<double> stencil;
+	std::vector<double> rhs;
+	std::vector<double> diagonal;
+
+	ConjugateGradient solver;
+	PointCloudFitResult lastResult;
+
+};
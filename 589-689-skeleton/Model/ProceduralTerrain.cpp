@@ -0,0 +1,284 @@
+#include "ProceduralTerrain.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define PROCEDURAL_TERRAIN_SSE 1
+#include <emmintrin.h>
+#endif
+
+// Philox streams, kept apart by the third counter word
+static const uint32_t TABLE_STREAM = 1;
+static const uint32_t OCTAVE_STREAM = 2;
+static const uint32_t SKIP_STREAM = 3;
+
+// Perlin gradient noise with unit gradients peaks at sqrt(1/2); scale it to about [-1, 1]
+static const float NOISE_SCALE = 1.41421356f;
+
+std::array<uint32_t, 4> Philox::generate(std::array<uint32_t, 4> counter, std::array<uint32_t, 2> key) {
+	for (int round = 0; round < 10; round++) {
+		const uint64_t product0 = uint64_t(0xD2511F53u) * counter[0];
+		const uint64_t product1 = uint64_t(0xCD9E8D57u) * counter[2];
+		counter = {
+			uint32_t(product1 >> 32) ^ counter[1] ^ key[0],
+			uint32_t(product1),
+			uint32_t(product0 >> 32) ^ counter[3] ^ key[1],
+			uint32_t(product0)
+		};
+		key[0] += 0x9E3779B9u;
+		key[1] += 0xBB67AE85u;
+	}
+	return counter;
+}
+
+namespace {
+
+	// Four floats processed together. The scalar fallback does the same operations lane by lane,
+	// so both paths round identically.
+	struct Float4 {
+#ifdef PROCEDURAL_TERRAIN_SSE
+		__m128 v;
+		Float4() : v(_mm_setzero_ps()) {}
+		Float4(float s) : v(_mm_set1_ps(s)) {}
+		explicit Float4(__m128 v) : v(v) {}
+		static Float4 load(const float* p) { return Float4(_mm_loadu_ps(p)); }
+		void store(float* p) const { _mm_storeu_ps(p, this->v); }
+		friend Float4 operator+(const Float4& a, const Float4& b) { return Float4(_mm_add_ps(a.v, b.v)); }
+		friend Float4 operator-(const Float4& a, const Float4& b) { return Float4(_mm_sub_ps(a.v, b.v)); }
+		friend Float4 operator*(const Float4& a, const Float4& b) { return Float4(_mm_mul_ps(a.v, b.v)); }
+		friend Float4 operator/(const Float4& a, const Float4& b) { return Float4(_mm_div_ps(a.v, b.v)); }
+#else
+		float v[4];
+		Float4() : v{ 0.0f, 0.0f, 0.0f, 0.0f } {}
+		Float4(float s) : v{ s, s, s, s } {}
+		static Float4 load(const float* p) { Float4 r; for (int k = 0; k < 4; k++) r.v[k] = p[k]; return r; }
+		void store(float* p) const { for (int k = 0; k < 4; k++) p[k] = this->v[k]; }
+		friend Float4 operator+(const Float4& a, const Float4& b) { Float4 r; for (int k = 0; k < 4; k++) r.v[k] = a.v[k] + b.v[k]; return r; }
+		friend Float4 operator-(const Float4& a, const Float4& b) { Float4 r; for (int k = 0; k < 4; k++) r.v[k] = a.v[k] - b.v[k]; return r; }
+		friend Float4 operator*(const Float4& a, const Float4& b) { Float4 r; for (int k = 0; k < 4; k++) r.v[k] = a.v[k] * b.v[k]; return r; }
+		friend Float4 operator/(const Float4& a, const Float4& b) { Float4 r; for (int k = 0; k < 4; k++) r.v[k] = a.v[k] / b.v[k]; return r; }
+#endif
+	};
+
+	inline float floorOf(float x) { return std::floor(x); }
+	inline float absOf(float x) { return std::abs(x); }
+	inline float minOf(float a, float b) { return std::min(a, b); }
+	inline float maxOf(float a, float b) { return std::max(a, b); }
+
+#ifdef PROCEDURAL_TERRAIN_SSE
+	inline Float4 floorOf(const Float4& x) {
+		// Truncate, then step down for negative non-integers
+		const __m128 truncated = _mm_cvtepi32_ps(_mm_cvttps_epi32(x.v));
+		return Float4(_mm_sub_ps(truncated, _mm_and_ps(_mm_cmpgt_ps(truncated, x.v), _mm_set1_ps(1.0f))));
+	}
+	inline Float4 absOf(const Float4& x) { return Float4(_mm_andnot_ps(_mm_set1_ps(-0.0f), x.v)); }
+	inline Float4 minOf(const Float4& a, const Float4& b) { return Float4(_mm_min_ps(a.v, b.v)); }
+	inline Float4 maxOf(const Float4& a, const Float4& b) { return Float4(_mm_max_ps(a.v, b.v)); }
+#else
+	inline Float4 floorOf(const Float4& x) { Float4 r; for (int k = 0; k < 4; k++) r.v[k] = std::floor(x.v[k]); return r; }
+	inline Float4 absOf(const Float4& x) { Float4 r; for (int k = 0; k < 4; k++) r.v[k] = std::abs(x.v[k]); return r; }
+	inline Float4 minOf(const Float4& a, const Float4& b) { Float4 r; for (int k = 0; k < 4; k++) r.v[k] = std::min(a.v[k], b.v[k]); return r; }
+	inline Float4 maxOf(const Float4& a, const Float4& b) { Float4 r; for (int k = 0; k < 4; k++) r.v[k] = std::max(a.v[k], b.v[k]); return r; }
+#endif
+
+	template <typename Real>
+	inline Real fade(const Real& t) {
+		return t * t * t * (t * (t * Real(6.0f) - Real(15.0f)) + Real(10.0f));
+	}
+
+}
+
+ProceduralTerrain::ProceduralTerrain(uint32_t seed) : seed(seed) {
+	const std::array<uint32_t, 2> key = { seed, 0x5EED5EEDu };
+	for (int n = 0; n < TABLE_SIZE; n++) {
+		const std::array<uint32_t, 4> bits = Philox::generate({ uint32_t(n), 0, TABLE_STREAM, 0 }, key);
+		const float angle = 6.28318531f * Philox::toUnitFloat(bits[0]);
+		this->gradientX[n] = std::cos(angle);
+		this->gradientZ[n] = std::sin(angle);
+		this->permutation[n] = n;
+	}
+	// Fisher-Yates, one counter per swap
+	for (int n = TABLE_SIZE - 1; n > 0; n--) {
+		const std::array<uint32_t, 4> bits = Philox::generate({ uint32_t(n), 1, TABLE_STREAM, 0 }, key);
+		std::swap(this->permutation[n], this->permutation[bits[0] % uint32_t(n + 1)]);
+	}
+	for (int n = 0; n < TABLE_SIZE; n++) this->permutation[TABLE_SIZE + n] = this->permutation[n];
+	for (int octave = 0; octave < MAX_OCTAVES; octave++) {
+		const std::array<uint32_t, 4> bits = Philox::generate({ uint32_t(octave), 0, OCTAVE_STREAM, 0 }, key);
+		this->octaveOffsets[octave] = glm::vec2(Philox::toUnitFloat(bits[0]), Philox::toUnitFloat(bits[1])) * float(TABLE_SIZE);
+	}
+}
+
+const char* ProceduralTerrain::modeName(NoiseMode mode) {
+	switch (mode) {
+	case NoiseMode::FBm: return "fBm";
+	case NoiseMode::Ridged: return "Ridged";
+	case NoiseMode::DomainWarp: return "Domain Warp";
+	}
+	return "";
+}
+
+// MARK: - Gradient Noise
+
+template <>
+float ProceduralTerrain::gradientNoise<float>(const float& x, const float& z) const {
+	const float cellX = floorOf(x);
+	const float cellZ = floorOf(z);
+	const float tx = x - cellX;
+	const float tz = z - cellZ;
+	const int ix = int(cellX) & (TABLE_SIZE - 1);
+	const int iz = int(cellZ) & (TABLE_SIZE - 1);
+	const int h00 = this->permutation[this->permutation[ix] + iz];
+	const int h10 = this->permutation[this->permutation[ix + 1] + iz];
+	const int h01 = this->permutation[this->permutation[ix] + iz + 1];
+	const int h11 = this->permutation[this->permutation[ix + 1] + iz + 1];
+	const float n00 = this->gradientX[h00] * tx + this->gradientZ[h00] * tz;
+	const float n10 = this->gradientX[h10] * (tx - 1.0f) + this->gradientZ[h10] * tz;
+	const float n01 = this->gradientX[h01] * tx + this->gradientZ[h01] * (tz - 1.0f);
+	const float n11 = this->gradientX[h11] * (tx - 1.0f) + this->gradientZ[h11] * (tz - 1.0f);
+	const float u = fade(tx);
+	const float w = fade(tz);
+	const float nx0 = n00 + u * (n10 - n00);
+	const float nx1 = n01 + u * (n11 - n01);
+	return (nx0 + w * (nx1 - nx0)) * NOISE_SCALE;
+}
+
+template <>
+Float4 ProceduralTerrain::gradientNoise<Float4>(const Float4& x, const Float4& z) const {
+	const Float4 cellX = floorOf(x);
+	const Float4 cellZ = floorOf(z);
+	const Float4 tx = x - cellX;
+	const Float4 tz = z - cellZ;
+	// No gather in SSE2: hash and fetch the corner gradients lane by lane
+	alignas(16) float lanesX[4], lanesZ[4];
+	alignas(16) float g00x[4], g00z[4], g10x[4], g10z[4], g01x[4], g01z[4], g11x[4], g11z[4];
+	cellX.store(lanesX);
+	cellZ.store(lanesZ);
+	for (int k = 0; k < 4; k++) {
+		const int ix = int(lanesX[k]) & (TABLE_SIZE - 1);
+		const int iz = int(lanesZ[k]) & (TABLE_SIZE - 1);
+		const int h00 = this->permutation[this->permutation[ix] + iz];
+		const int h10 = this->permutation[this->permutation[ix + 1] + iz];
+		const int h01 = this->permutation[this->permutation[ix] + iz + 1];
+		const int h11 = this->permutation[this->permutation[ix + 1] + iz + 1];
+		g00x[k] = this->gradientX[h00]; g00z[k] = this->gradientZ[h00];
+		g10x[k] = this->gradientX[h10]; g10z[k] = this->gradientZ[h10];
+		g01x[k] = this->gradientX[h01]; g01z[k] = this->gradientZ[h01];
+		g11x[k] = this->gradientX[h11]; g11z[k] = this->gradientZ[h11];
+	}
+	const Float4 one(1.0f);
+	const Float4 n00 = Float4::load(g00x) * tx + Float4::load(g00z) * tz;
+	const Float4 n10 = Float4::load(g10x) * (tx - one) + Float4::load(g10z) * tz;
+	const Float4 n01 = Float4::load(g01x) * tx + Float4::load(g01z) * (tz - one);
+	const Float4 n11 = Float4::load(g11x) * (tx - one) + Float4::load(g11z) * (tz - one);
+	const Float4 u = fade(tx);
+	const Float4 w = fade(tz);
+	const Float4 nx0 = n00 + u * (n10 - n00);
+	const Float4 nx1 = n01 + u * (n11 - n01);
+	return (nx0 + w * (nx1 - nx0)) * Float4(NOISE_SCALE);
+}
+
+// MARK: - Fractals
+
+template <typename Real>
+Real ProceduralTerrain::fbm(const NoiseSettings& settings, const Real& x, const Real& z) const {
+	// Signed, about [-1, 1]
+	Real sum(0.0f);
+	float amplitude = 1.0f;
+	float frequency = settings.frequency;
+	float norm = 0.0f;
+	const int octaves = std::max(1, std::min(settings.octaves, MAX_OCTAVES));
+	for (int octave = 0; octave < octaves; octave++) {
+		const glm::vec2& offset = this->octaveOffsets[octave];
+		sum = sum + Real(amplitude) * this->gradientNoise(x * Real(frequency) + Real(offset.x), z * Real(frequency) + Real(offset.y));
+		norm += amplitude;
+		amplitude *= settings.gain;
+		frequency *= settings.lacunarity;
+	}
+	return sum * Real(1.0f / norm);
+}
+
+template <typename Real>
+Real ProceduralTerrain::ridged(const NoiseSettings& settings, const Real& x, const Real& z) const {
+	// Folded octaves form the ridges; each octave is damped where the previous one was low
+	Real sum(0.0f);
+	Real weight(1.0f);
+	float amplitude = 1.0f;
+	float frequency = settings.frequency;
+	float norm = 0.0f;
+	const int octaves = std::max(1, std::min(settings.octaves, MAX_OCTAVES));
+	for (int octave = 0; octave < octaves; octave++) {
+		const glm::vec2& offset = this->octaveOffsets[octave];
+		Real ridge = Real(1.0f) - absOf(this->gradientNoise(x * Real(frequency) + Real(offset.x), z * Real(frequency) + Real(offset.y)));
+		ridge = ridge * ridge * weight;
+		weight = minOf(maxOf(ridge * Real(2.0f), Real(0.0f)), Real(1.0f));
+		sum = sum + Real(amplitude) * ridge;
+		norm += amplitude;
+		amplitude *= settings.gain;
+		frequency *= settings.lacunarity;
+	}
+	return sum * Real(1.0f / norm);
+}
+
+template <typename Real>
+Real ProceduralTerrain::height(const NoiseSettings& settings, const Real& x, const Real& z) const {
+	Real value(0.0f);
+	switch (settings.mode) {
+	case NoiseMode::FBm:
+		value = this->fbm(settings, x, z) * Real(0.5f) + Real(0.5f);
+		break;
+	case NoiseMode::Ridged:
+		value = this->ridged(settings, x, z);
+		break;
+	case NoiseMode::DomainWarp: {
+		// Look the fBm up at a position displaced by two more fBm fields
+		const Real warpX = this->fbm(settings, x + Real(17.3f), z + Real(41.7f));
+		const Real warpZ = this->fbm(settings, x + Real(-29.1f), z + Real(8.9f));
+		const Real strength(settings.warpStrength);
+		value = this->fbm(settings, x + strength * warpX, z + strength * warpZ) * Real(0.5f) + Real(0.5f);
+		break;
+	}
+	}
+	return minOf(maxOf(value, Real(0.0f)), Real(1.0f));
+}
+
+// MARK: - Evaluation
+
+float ProceduralTerrain::evaluate(const NoiseSettings& settings, float x, float z) const {
+	return this->height<float>(settings, x, z);
+}
+
+void ProceduralTerrain::evaluate(const NoiseSettings& settings, const float* x, const float* z, float* heights, int count) const {
+	int n = 0;
+	for (; n + 4 <= count; n += 4) this->height<Float4>(settings, Float4::load(x + n), Float4::load(z + n)).store(heights + n);
+	for (; n < count; n++) heights[n] = this->height<float>(settings, x[n], z[n]);
+}
+
+void ProceduralTerrain::fill(const NoiseSettings& settings, float skipProbability, float minHeight, float maxHeight, std::vector<std::vector<glm::vec3>>& P) const {
+	if (P.size() < 3 || P[0].size() < 3) return;
+	const int rows = int(P.size());
+	const int cols = int(P[0].size());
+	const std::array<uint32_t, 2> key = { this->seed, 0x5EED5EEDu };
+	JobSystem::get().parallelFor(1, rows - 1, 4, [&](int begin, int end) {
+		std::vector<int> columns;
+		std::vector<float> xs, zs, heights;
+		for (int i = begin; i < end; i++) {
+			columns.clear();
+			xs.clear();
+			zs.clear();
+			for (int j = 1; j < cols - 1; j++) {
+				// Skips are drawn per point from its own counter
+				const std::array<uint32_t, 4> bits = Philox::generate({ uint32_t(i), uint32_t(j), SKIP_STREAM, 0 }, key);
+				if (Philox::toUnitFloat(bits[0]) < skipProbability) continue;
+				columns.push_back(j);
+				xs.push_back(P[i][j].x);
+				zs.push_back(P[i][j].z);
+			}
+			// Every lane only depends on its own position, so how points fall into batches doesn't matter
+			heights.resize(columns.size());
+			this->evaluate(settings, xs.data(), zs.data(), heights.data(), int(columns.size()));
+			for (size_t n = 0; n < columns.size(); n++) P[i][columns[n]].y += minHeight + (maxHeight - minHeight) * heights[n];
+		}
+	}, "procedural terrain");
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "../JobSystem.h"
+
+enum class NoiseMode { FBm, Ridged, DomainWarp };
+
+static const int NOISE_MODE_COUNT = 3;
+
+struct NoiseSettings {
+	uint32_t seed = 1337;
+	NoiseMode mode = NoiseMode::FBm;
+	int octaves = 5;
+	// Cycles per world unit of the first octave
+	float frequency = 0.08f;
+	// Frequency and amplitude ratio between successive octaves
+	float lacunarity = 2.0f;
+	float gain = 0.5f;
+	// DomainWarp only: how far the warp field displaces the lookup, in world units
+	float warpStrength = 4.0f;
+};
+
+// Philox4x32-10 counter-based generator: every output block is a pure function of a
+// 128 bit counter and a 64 bit key, so any thread can draw the numbers of any point
+// without sharing state, and the result never depends on scheduling.
+namespace Philox {
+
+	std::array<uint32_t, 4> generate(std::array<uint32_t, 4> counter, std::array<uint32_t, 2> key);
+	// Uniform in [0, 1) from one output word
+	inline float toUnitFloat(uint32_t bits) { return float(bits >> 8) * (1.0f / 16777216.0f); }
+
+};
+
+// Seeded gradient noise for terrain generation. The gradient table, permutation and octave
+// offsets are drawn from Philox once per seed; every height is then a pure function of the
+// seed, the settings and the world position, bit for bit the same however the rows are
+// split across threads. Noise is evaluated four points at a time with SSE where available.
+class ProceduralTerrain {
+
+public:
+
+	explicit ProceduralTerrain(uint32_t seed);
+
+	static const char* modeName(NoiseMode mode);
+
+	// Normalised height in [0, 1] at world position (x, z)
+	float evaluate(const NoiseSettings& settings, float x, float z) const;
+	void evaluate(const NoiseSettings& settings, const float* x, const float* z, float* heights, int count) const;
+
+	// Raises the interior points of P to minHeight + (maxHeight - minHeight) * noise, rows in parallel.
+	// Border points, and interior points skipped with `skipProbability`, keep their height.
+	void fill(const NoiseSettings& settings, float skipProbability, float minHeight, float maxHeight, std::vector<std::vector<glm::vec3>>& P) const;
+
+private:
+
+	template <typename Real> Real gradientNoise(const Real& x, const Real& z) const;
+	template <typename Real> Real fbm(const NoiseSettings& settings, const Real& x, const Real& z) const;
+	template <typename Real> Real ridged(const NoiseSettings& settings, const Real& x, const Real& z) const;
+	template <typename Real> Real height(const NoiseSettings& settings, const Real& x, const Real& z) const;
+
+private:
+
+	static const int TABLE_SIZE = 256;
+	static const int MAX_OCTAVES = 12;
+
+	uint32_t seed;
+	// Doubled so two chained lookups need no wrap
+	std::array<int, TABLE_SIZE * 2> permutation;
+	std::array<float, TABLE_SIZE> gradientX;
+	std::array<float, TABLE_SIZE> gradientZ;
+	// Per-octave lattice offsets so octaves don't line up at the origin
+	std::array<glm::vec2, MAX_OCTAVES> octaveOffsets;
+
+};
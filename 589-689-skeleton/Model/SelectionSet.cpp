@@ -0,0 +1,138 @@
+#include "SelectionSet.h"
+
+#include <algorithm>
+#include <numeric>
+
+void SelectionSet::reset(int rows, int cols) {
+	this->rows = rows;
+	this->cols = cols;
+	this->bits.assign((size_t(rows) * cols + 63) / 64, 0);
+	this->indices.clear();
+	this->blendFactors.clear();
+	this->bSorted = true;
+}
+
+void SelectionSet::resize(int rows, int cols) {
+	if (rows == this->rows && cols == this->cols) return;
+	SelectionSet resized(rows, cols);
+	const std::vector<int>& members = this->getIndices();
+	for (size_t n = 0; n < members.size(); n++) {
+		int row = this->rowOf(members[n]);
+		int col = this->colOf(members[n]);
+		if (row < rows && col < cols) resized.add(row, col, this->blendFactors[n]);
+	}
+	*this = std::move(resized);
+}
+
+void SelectionSet::clear() {
+	// Only touch the words that have bits set
+	for (int index : this->indices) this->bits[index >> 6] = 0;
+	this->indices.clear();
+	this->blendFactors.clear();
+	this->bSorted = true;
+}
+
+void SelectionSet::add(int index, float blendFactor) {
+	if (index < 0 || index >= this->rows * this->cols) return;
+	if (this->contains(index)) {
+		this->blendFactors[this->findMember(index)] = blendFactor;
+		return;
+	}
+	this->bits[index >> 6] |= uint64_t(1) << (index & 63);
+	if (!this->indices.empty() && index < this->indices.back()) this->bSorted = false;
+	this->indices.push_back(index);
+	this->blendFactors.push_back(blendFactor);
+}
+
+void SelectionSet::remove(int index) {
+	if (!this->contains(index)) return;
+	this->bits[index >> 6] &= ~(uint64_t(1) << (index & 63));
+	int member = this->findMember(index);
+	this->indices.erase(this->indices.begin() + member);
+	this->blendFactors.erase(this->blendFactors.begin() + member);
+}
+
+void SelectionSet::unite(const SelectionSet& other) {
+	// Merge of the two sorted member lists
+	this->sort();
+	const std::vector<int>& otherIndices = other.getIndices();
+	const std::vector<float>& otherBlends = other.getBlendFactors();
+	std::vector<int> mergedIndices;
+	std::vector<float> mergedBlends;
+	mergedIndices.reserve(this->indices.size() + otherIndices.size());
+	mergedBlends.reserve(this->indices.size() + otherIndices.size());
+	size_t a = 0, b = 0;
+	while (a < this->indices.size() || b < otherIndices.size()) {
+		const bool bTakeOther = a == this->indices.size() || (b < otherIndices.size() && otherIndices[b] < this->indices[a]);
+		if (bTakeOther) {
+			const int index = otherIndices[b];
+			if (index >= this->rows * this->cols) { b++; continue; }
+			this->bits[index >> 6] |= uint64_t(1) << (index & 63);
+			mergedIndices.push_back(index);
+			mergedBlends.push_back(otherBlends[b++]);
+		} else if (b < otherIndices.size() && otherIndices[b] == this->indices[a]) {
+			mergedIndices.push_back(this->indices[a]);
+			mergedBlends.push_back(std::max(this->blendFactors[a++], otherBlends[b++]));
+		} else {
+			mergedIndices.push_back(this->indices[a]);
+			mergedBlends.push_back(this->blendFactors[a++]);
+		}
+	}
+	this->indices.swap(mergedIndices);
+	this->blendFactors.swap(mergedBlends);
+}
+
+void SelectionSet::intersect(const SelectionSet& other) {
+	this->sort();
+	size_t kept = 0;
+	for (size_t n = 0; n < this->indices.size(); n++) {
+		const int index = this->indices[n];
+		if (!other.contains(index)) {
+			this->bits[index >> 6] &= ~(uint64_t(1) << (index & 63));
+			continue;
+		}
+		this->indices[kept] = index;
+		this->blendFactors[kept] = std::min(this->blendFactors[n], other.blendFactors[other.findMember(index)]);
+		kept++;
+	}
+	this->indices.resize(kept);
+	this->blendFactors.resize(kept);
+}
+
+void SelectionSet::subtract(const SelectionSet& other) {
+	this->sort();
+	size_t kept = 0;
+	for (size_t n = 0; n < this->indices.size(); n++) {
+		const int index = this->indices[n];
+		if (other.contains(index)) {
+			this->bits[index >> 6] &= ~(uint64_t(1) << (index & 63));
+			continue;
+		}
+		this->indices[kept] = index;
+		this->blendFactors[kept] = this->blendFactors[n];
+		kept++;
+	}
+	this->indices.resize(kept);
+	this->blendFactors.resize(kept);
+}
+
+int SelectionSet::findMember(int index) const {
+	this->sort();
+	return int(std::lower_bound(this->indices.begin(), this->indices.end(), index) - this->indices.begin());
+}
+
+void SelectionSet::sort() const {
+	if (this->bSorted) return;
+	std::vector<int> order(this->indices.size());
+	std::iota(order.begin(), order.end(), 0);
+	std::sort(order.begin(), order.end(), [this](int a, int b) { return this->indices[a] < this->indices[b]; });
+	std::vector<int> sortedIndices(order.size());
+	std::vector<float> sortedBlends(order.size());
+	for (size_t n = 0; n < order.size(); n++) {
+		sortedIndices[n] = this->indices[order[n]];
+		sortedBlends[n] = this->blendFactors[order[n]];
+	}
+	this->indices.swap(sortedIndices);
+	this->blendFactors.swap(sortedBlends);
+	this->bSorted = true;
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// A set of control points addressed by flat index (row * cols + col) instead of pointers
+// into the net, so it stays valid across re-tessellation and can be resized with the net.
+// Membership is a bitset; the members are also kept as a sorted index list with a parallel
+// array of per-point blend factors that bulk edits can stream through.
+class SelectionSet {
+
+public:
+
+	SelectionSet() = default;
+	SelectionSet(int rows, int cols) { this->reset(rows, cols); }
+
+	// Empties the set and sizes it for a rows x cols net.
+	void reset(int rows, int cols);
+	// Resizes for a new net, keeping the members whose (row, col) still exists.
+	void resize(int rows, int cols);
+	void clear();
+
+	// Adds a point or, if it's already a member, replaces its blend factor.
+	void add(int index, float blendFactor = 1.0f);
+	void add(int row, int col, float blendFactor = 1.0f) { this->add(this->indexOf(row, col), blendFactor); }
+	void remove(int index);
+	bool contains(int index) const { return index >= 0 && index < this->rows * this->cols && (this->bits[index >> 6] >> (index & 63)) & 1; }
+	bool contains(int row, int col) const { return this->contains(this->indexOf(row, col)); }
+
+	// Union keeps the larger blend factor, intersection the smaller one.
+	void unite(const SelectionSet& other);
+	void intersect(const SelectionSet& other);
+	void subtract(const SelectionSet& other);
+
+	bool empty() const { return this->indices.empty(); }
+	size_t size() const { return this->indices.size(); }
+	int getRows() const { return this->rows; }
+	int getCols() const { return this->cols; }
+	int indexOf(int row, int col) const { return row * this->cols + col; }
+	int rowOf(int index) const { return index / this->cols; }
+	int colOf(int index) const { return index % this->cols; }
+
+	// Sorted member indices and their blend factors, in the same order.
+	const std::vector<int>& getIndices() const { this->sort(); return this->indices; }
+	const std::vector<float>& getBlendFactors() const { this->sort(); return this->blendFactors; }
+
+private:
+
+	int findMember(int index) const;
+	void sort() const;
+
+private:
+
+	int rows = 0;
+	int cols = 0;
+	std::vector<uint64_t> bits;
+	// Appends may arrive out of order; they are sorted lazily on the next read
+	mutable std::vector<int> indices;
+	mutable std::vector<float> blendFactors;
+	mutable bool bSorted = true;
+
+};
@@ -0,0 +1,103 @@
+#include "StampBrush.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include <stb/stb_image.h>
+
+#include "../Log.h"
+
+bool StampBrush::load(const std::string& path) {
+	this->levels.clear();
+	int width = 0, height = 0, numComponents = 0;
+	Level base;
+	if (stbi_is_16_bit(path.c_str())) {
+		stbi_us* data = stbi_load_16(path.c_str(), &width, &height, &numComponents, 1);
+		if (data) {
+			base.texels.resize(size_t(width) * height);
+			for (size_t n = 0; n < base.texels.size(); n++) base.texels[n] = data[n] / 65535.0f;
+			stbi_image_free(data);
+		}
+	} else {
+		stbi_uc* data = stbi_load(path.c_str(), &width, &height, &numComponents, 1);
+		if (data) {
+			base.texels.resize(size_t(width) * height);
+			for (size_t n = 0; n < base.texels.size(); n++) base.texels[n] = data[n] / 255.0f;
+			stbi_image_free(data);
+		}
+	}
+	if (base.texels.empty()) {
+		Log::error("Failed to read stamp image {}", path);
+		return false;
+	}
+	base.width = width;
+	base.height = height;
+	this->levels.push_back(std::move(base));
+
+	// Each level averages 2x2 blocks of the previous one; an odd last row/column is repeated
+	while (this->levels.back().width > 1 || this->levels.back().height > 1) {
+		const Level& fine = this->levels.back();
+		Level coarse;
+		coarse.width = std::max(1, (fine.width + 1) / 2);
+		coarse.height = std::max(1, (fine.height + 1) / 2);
+		coarse.texels.resize(size_t(coarse.width) * coarse.height);
+		for (int y = 0; y < coarse.height; y++) {
+			const int y0 = std::min(2 * y, fine.height - 1);
+			const int y1 = std::min(2 * y + 1, fine.height - 1);
+			for (int x = 0; x < coarse.width; x++) {
+				const int x0 = std::min(2 * x, fine.width - 1);
+				const int x1 = std::min(2 * x + 1, fine.width - 1);
+				coarse.texels[size_t(y) * coarse.width + x] = 0.25f * (fine.texels[size_t(y0) * fine.width + x0] + fine.texels[size_t(y0) * fine.width + x1]
+					+ fine.texels[size_t(y1) * fine.width + x0] + fine.texels[size_t(y1) * fine.width + x1]);
+			}
+		}
+		this->levels.push_back(std::move(coarse));
+	}
+	return true;
+}
+
+void StampBrush::evaluate(const StampParams& params, BrushPoints& points) const {
+	points.blend.resize(points.rows.size());
+	if (!this->isLoaded() || params.radius <= 0.0f) {
+		std::fill(points.blend.begin(), points.blend.end(), 0.0f);
+		return;
+	}
+	// Texels between neighbouring control points on the finest level
+	const float texelsPerPoint = float(std::max(this->getWidth(), this->getHeight())) * params.pointSpacing / (2.0f * params.radius);
+	const float lod = std::log2(std::max(1.0f, texelsPerPoint));
+	// Rotating the stamp by +rotation rotates the offsets by -rotation into image space
+	const float cosine = std::cos(params.rotation);
+	const float sine = std::sin(params.rotation);
+	const float toUV = 0.5f / params.radius;
+	for (int n = 0; n < points.size(); n++) {
+		const glm::vec2 local(cosine * points.dx[n] + sine * points.dz[n], -sine * points.dx[n] + cosine * points.dz[n]);
+		const glm::vec2 uv = local * toUV + glm::vec2(0.5f);
+		const bool bInside = uv.x >= 0.0f && uv.x <= 1.0f && uv.y >= 0.0f && uv.y <= 1.0f;
+		points.blend[n] = bInside ? params.strength * this->sample(uv, lod) : 0.0f;
+	}
+}
+
+float StampBrush::sample(const glm::vec2& uv, float lod) const {
+	if (this->levels.empty()) return 0.0f;
+	lod = std::max(0.0f, std::min(lod, float(this->levels.size() - 1)));
+	const int fine = int(lod);
+	const int coarse = std::min(fine + 1, int(this->levels.size()) - 1);
+	const float blend = lod - float(fine);
+	const float a = this->sampleBilinear(this->levels[fine], uv);
+	if (blend == 0.0f || coarse == fine) return a;
+	return a + blend * (this->sampleBilinear(this->levels[coarse], uv) - a);
+}
+
+float StampBrush::sampleBilinear(const Level& level, const glm::vec2& uv) const {
+	// Texel centres, clamped to the edge
+	const float x = std::max(0.0f, std::min(uv.x * level.width - 0.5f, float(level.width - 1)));
+	const float y = std::max(0.0f, std::min(uv.y * level.height - 0.5f, float(level.height - 1)));
+	const int x0 = int(x), y0 = int(y);
+	const int x1 = std::min(x0 + 1, level.width - 1), y1 = std::min(y0 + 1, level.height - 1);
+	const float fx = x - float(x0), fy = y - float(y0);
+	const float* row0 = &level.texels[size_t(y0) * level.width];
+	const float* row1 = &level.texels[size_t(y1) * level.width];
+	const float top = row0[x0] + fx * (row0[x1] - row0[x0]);
+	const float bottom = row1[x0] + fx * (row1[x1] - row1[x0]);
+	return top + fy * (bottom - top);
+}
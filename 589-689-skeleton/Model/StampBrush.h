@@ -0,0 +1,54 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "BrushKernels.h"
+
+struct StampParams {
+	// Radius of the stamp footprint in world units; the image spans [-radius, radius] on both axes
+	float radius = 1.0f;
+	// Rotation about the y axis, in radians
+	float rotation = 0.0f;
+	float strength = 1.0f;
+	// World distance between neighbouring control points, picks the mip level
+	float pointSpacing = 1.0f;
+};
+
+// A brush that stamps a grayscale heightmap. The image is filtered once into a mip pyramid
+// of box-filtered halvings, so however small the stamp is relative to the image every control
+// point costs the same trilinear lookup: the level whose texels are about one control point
+// apart, blended with the next finer one.
+class StampBrush {
+
+public:
+
+	// Loads through stb_image as one channel, 16 bit if the file has it. Returns false if it can't be read.
+	bool load(const std::string& path);
+	void clear() { this->levels.clear(); }
+	bool isLoaded() const { return !this->levels.empty(); }
+	int getWidth() const { return this->levels.empty() ? 0 : this->levels[0].width; }
+	int getHeight() const { return this->levels.empty() ? 0 : this->levels[0].height; }
+
+	// points.blend[n] = strength * image height (0 to 1) under the offset (dx[n], dz[n]), 0 outside the image
+	void evaluate(const StampParams& params, BrushPoints& points) const;
+	// Trilinear lookup at uv in [0, 1]^2
+	float sample(const glm::vec2& uv, float lod) const;
+
+private:
+
+	struct Level {
+		int width = 0;
+		int height = 0;
+		std::vector<float> texels;
+	};
+
+	float sampleBilinear(const Level& level, const glm::vec2& uv) const;
+
+private:
+
+	std::vector<Level> levels;
+
+};
@@ -0,0 +1,59 @@
+#include "SurfaceDrag.h"
+
+bool SurfaceDrag::begin(const std::vector<std::vector<glm::vec3>>& P, const std::vector<std::vector<float>>& W, const SurfaceSampling& sampling, const glm::vec2& uv, const SelectionSet& allowed) {
+	this->bActive = false;
+	if (P.empty() || P[0].empty()) return false;
+	this->rows = int(P.size());
+	this->cols = int(P[0].size());
+	const int k_u = sampling.k_u;
+	const int k_v = sampling.k_v;
+	// The sampling has to describe this net
+	if (k_u < 1 || k_v < 1 || int(sampling.U.size()) != this->rows + k_u || int(sampling.V.size()) != this->cols + k_v) return false;
+
+	std::vector<float> Nu(k_u), Nv(k_v);
+	const int spanU = SurfaceEvaluator::basisFunctions(sampling.U, uv.x, k_u, this->rows, Nu.data());
+	const int spanV = SurfaceEvaluator::basisFunctions(sampling.V, uv.y, k_v, this->cols, Nv.data());
+
+	// Same form as SurfaceEvaluator::FFS_NURBS: rows are projected in v first, then blended in u
+	this->supportRows.clear();
+	this->supportCols.clear();
+	this->basis.clear();
+	this->movable.clear();
+	this->movableNormSquared = 0.0f;
+	for (int a = 0; a < k_u; a++) {
+		const int row = spanU - k_u + 1 + a;
+		float rowWeight = 0.0f;
+		for (int b = 0; b < k_v; b++) rowWeight += Nv[b] * W[row][spanV - k_v + 1 + b];
+		if (rowWeight == 0.0f) continue;
+		for (int b = 0; b < k_v; b++) {
+			const int col = spanV - k_v + 1 + b;
+			const float value = Nu[a] * Nv[b] * W[row][col] / rowWeight;
+			this->supportRows.push_back(row);
+			this->supportCols.push_back(col);
+			this->basis.push_back(value);
+			const bool bMovable = allowed.empty() || allowed.contains(row, col);
+			this->movable.push_back(bMovable ? value : 0.0f);
+			if (bMovable) this->movableNormSquared += value * value;
+		}
+	}
+	this->bActive = this->movableNormSquared > 0.0f;
+	return this->bActive;
+}
+
+glm::vec3 SurfaceDrag::surfacePoint(const std::vector<std::vector<glm::vec3>>& P) const {
+	glm::vec3 point(0.0f);
+	if (int(P.size()) != this->rows || P.empty() || int(P[0].size()) != this->cols) return point;
+	for (size_t n = 0; n < this->basis.size(); n++) point += this->basis[n] * P[this->supportRows[n]][this->supportCols[n]];
+	return point;
+}
+
+bool SurfaceDrag::solve(float deltaHeight, EditCommand& command) const {
+	if (!this->bActive || deltaHeight == 0.0f) return false;
+	command.type = EditCommandType::Move;
+	command.value = deltaHeight;
+	command.selection.reset(this->rows, this->cols);
+	for (size_t n = 0; n < this->movable.size(); n++) {
+		if (this->movable[n] != 0.0f) command.selection.add(this->supportRows[n], this->supportCols[n], this->movable[n] / this->movableNormSquared);
+	}
+	return !command.selection.empty();
+}
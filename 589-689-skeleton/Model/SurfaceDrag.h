@@ -0,0 +1,44 @@
+#pragma once
+
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "SurfaceEvaluator.h"
+#include "SelectionSet.h"
+#include "EditQueue.h"
+
+// Direct manipulation of a point on the surface. The surface point at a fixed (u, v) is a
+// linear combination S = sum R_ij P_ij of the k_u x k_v control points whose support contains
+// it, so moving it by d along y takes any dP_ij.y with sum R_ij dP_ij.y = d. The minimal-norm
+// one is dP_ij.y = R_ij d / sum R^2: the 1x1 system R R^T lambda = d solved in closed form.
+// R only depends on (u, v), the knots and the weights, so it is computed once when the point
+// is grabbed and every drag update is a single multiply per control point.
+class SurfaceDrag {
+
+public:
+
+	// Grabs the surface at `uv`. If `allowed` is not empty only its members may move.
+	bool begin(const std::vector<std::vector<glm::vec3>>& P, const std::vector<std::vector<float>>& W, const SurfaceSampling& sampling, const glm::vec2& uv, const SelectionSet& allowed);
+	void end() { this->bActive = false; }
+	bool isActive() const { return this->bActive; }
+
+	// Current position of the grabbed surface point
+	glm::vec3 surfacePoint(const std::vector<std::vector<glm::vec3>>& P) const;
+	// Fills `command` with the Move that raises the grabbed point by `deltaHeight`
+	bool solve(float deltaHeight, EditCommand& command) const;
+
+private:
+
+	bool bActive = false;
+	int rows = 0;
+	int cols = 0;
+	// Control points of the support and their basis values at the grabbed (u, v)
+	std::vector<int> supportRows;
+	std::vector<int> supportCols;
+	std::vector<float> basis;
+	// Basis values of the points allowed to move, and the sum of their squares
+	std::vector<float> movable;
+	float movableNormSquared = 0.0f;
+
+};
@@ -0,0 +1,473 @@
+#include "SurfaceEvaluator.h"
+
+#include <algorithm>
+
+namespace {
+	// Rows handed to a single task by the parallel loops below
+	const int ROW_GRAIN = 4;
+
+	template <typename T>
+	std::vector<T> quadsOf(const std::vector<std::vector<T>>& points) {
+		if (points.size() < 2 || points[0].size() < 2) return std::vector<T>();
+		const size_t numCols = points[0].size();
+		const size_t rowStride = (numCols - 1) * 6;
+		std::vector<T> R((points.size() - 1) * rowStride);
+		JobSystem::get().parallelFor(0, int(points.size() - 1), ROW_GRAIN * 8, [&](int begin, int end) {
+			for (size_t i = begin; i < size_t(end); i++) {
+				T* r = &R[i * rowStride];
+				for (size_t j = 0; j < numCols - 1; j++) {
+					*r++ = points[i][j + 1];
+					*r++ = points[i][j];
+					*r++ = points[i + 1][j];
+					*r++ = points[i][j + 1];
+					*r++ = points[i + 1][j + 1];
+					*r++ = points[i + 1][j];
+				}
+			}
+		}, "quads");
+		return R;
+	}
+}
+
+// NURBS
+std::vector<float> SurfaceEvaluator::generateKnotSequence(int length, int k, bool bBezier) {
+	int numControlPoints = length;
+	int order = k;
+	int numKnots = length + k;
+	std::vector<float> U(numKnots);
+	for (int i = 0; i < order; i++) {
+		U[i] = 0.0f;
+	}
+	if (!bBezier) {
+		for (int i = order; i < numKnots - order; i++) {
+			U[i] = (float)(i - order + 1) / (float)(numControlPoints - order + 1);
+		}
+	}
+	for (int i = numKnots - order; i < numKnots; i++) {
+		U[i] = 1.0f;
+	}
+	return U;
+}
+
+int SurfaceEvaluator::delta(const std::vector<float>& U, float u, int k, int m) {
+	// The non-empty span [U[i], U[i + 1]) holding u, found by bisection since a large net has thousands
+	// of knots. Parameters outside the knot vector fall in the first or last span.
+	const int i = int(std::upper_bound(U.begin(), U.begin() + std::min(m + k, int(U.size())), u) - U.begin()) - 1;
+	return std::max(k - 1, std::min(i, m - 1));
+}
+
+int SurfaceEvaluator::basisFunctions(const std::vector<float>& U, float u, int k, int m, float* N) {
+	const int span = std::max(k - 1, std::min(delta(U, u, k, m), m - 1));
+	// Cox-de Boor, raising the order one step at a time
+	std::vector<float> left(k), right(k);
+	N[0] = 1.0f;
+	for (int j = 1; j < k; j++) {
+		left[j] = u - U[span + 1 - j];
+		right[j] = U[span + j] - u;
+		float saved = 0.0f;
+		for (int r = 0; r < j; r++) {
+			const float denominator = right[r + 1] + left[j - r];
+			const float temp = (denominator != 0.0f) ? N[r] / denominator : 0.0f;
+			N[r] = saved + right[r + 1] * temp;
+			saved = left[j - r] * temp;
+		}
+		N[j] = saved;
+	}
+	return span;
+}
+
+glm::vec3 SurfaceEvaluator::FFS_NURBS(const std::vector<std::vector<glm::vec3>>& P, const std::vector<float>& U, const std::vector<float>& V, const std::vector<std::vector<float>>& W, float u, float v, int k_u, int k_v, int m, int n) {
+	std::vector<glm::vec3> D(k_v), C(k_u);
+	std::vector<float> NV(k_v);
+	int d = delta(U, u, k_u, m);
+	int d_prime = delta(V, v, k_v, n);
+	for (int i = 0; i <= k_u - 1; i++) {
+		for (int j = 0; j <= k_v - 1; j++) {
+			D[j] = P[d - i][d_prime - j] * W[d - i][d_prime - j];
+			NV[j] = W[d - i][d_prime - j];
+		}
+		for (int r = k_v; r >= 2; r--) {
+			int x = d_prime;
+			for (int s = 0; s <= r - 2; s++) {
+				float omega = (v - V[x]) / (V[x + r - 1] - V[x]);
+				D[s] = (omega * D[s]) + ((1.0f - omega) * D[s + 1]);
+				NV[s] = (omega * NV[s]) + ((1.0f - omega) * NV[s + 1]);
+				x = x - 1;
+			}
+		}
+		C[i] = D[0] / NV[0];
+	}
+	for (int r = k_u; r >= 2; r--) {
+		int i = d;
+		for (int s = 0; s <= r - 2; s++) {
+			float omega = (u - U[i]) / (U[i + r - 1] - U[i]);
+			C[s] = (omega * C[s]) + ((1.0f - omega) * C[s + 1]);
+			i = i - 1;
+		}
+	}
+	return C[0];
+}
+
+bool SurfaceEvaluator::tessellate(const SurfaceEvaluationRequest& request, SurfaceTessellation& tessellation, const std::atomic<uint64_t>* latestGeneration) {
+	const std::vector<std::vector<glm::vec3>>& P = request.P;
+	tessellation.generation = request.generation;
+
+	SurfaceSampling& sampling = tessellation.sampling;
+	sampling.k_u = request.k_u;
+	sampling.k_v = request.k_v;
+	sampling.U = generateKnotSequence(P.size(), request.k_u, request.bBezier);
+	sampling.V = generateKnotSequence(P[0].size(), request.k_v, request.bBezier);
+	const std::vector<float>& U = sampling.U;
+	const std::vector<float>& V = sampling.V;
+
+	// Sample parameters are accumulated serially so every row sees exactly the same values
+	std::vector<float>& uParams = sampling.uParams;
+	std::vector<float>& vParams = sampling.vParams;
+	uParams.clear();
+	vParams.clear();
+	for (float u = U[request.k_u - 1]; u <= U[P.size() + 1]; u += (1.0f / request.resolutionU)) uParams.push_back(u);
+	for (float v = V[request.k_v - 1]; v <= V[P[0].size() + 1]; v += (1.0f / request.resolutionV)) vParams.push_back(v);
+
+	std::atomic<bool> bCancelled(false);
+	tessellation.Q.resize(uParams.size());
+	JobSystem::get().parallelFor(0, int(uParams.size()), ROW_GRAIN, [&](int begin, int end) {
+		for (int i = begin; i < end; i++) {
+			// Cooperative cancellation: a newer request has been submitted
+			if (bCancelled || (latestGeneration && latestGeneration->load(std::memory_order_relaxed) != request.generation)) {
+				bCancelled = true;
+				return;
+			}
+			std::vector<glm::vec3>& row = tessellation.Q[i];
+			row.resize(vParams.size());
+			for (size_t j = 0; j < vParams.size(); j++) {
+				row[j] = FFS_NURBS(P, U, V, request.W, uParams[i], vParams[j], request.k_u, request.k_v, P.size(), P[0].size());
+			}
+		}
+	}, "surface evaluation");
+	if (bCancelled) return false;
+	request.detail.apply(uParams, vParams, Range2D{ 0, int(uParams.size()), 0, int(vParams.size()) }, tessellation.Q);
+
+	const std::vector<Range2D> layout = tileLayout(sampling, int(P.size()), int(P[0].size()));
+	tessellation.tiles.resize(layout.size());
+	JobSystem::get().parallelFor(0, int(layout.size()), 1, [&](int begin, int end) {
+		for (int t = begin; t < end; t++) {
+			tessellation.tiles[t].cells = layout[t];
+			buildTile(tessellation.Q, tessellation.tiles[t], &sampling, &request.displacement);
+		}
+	}, "surface tiles");
+	return !latestGeneration || latestGeneration->load(std::memory_order_relaxed) == request.generation;
+}
+
+void SurfaceEvaluator::evaluateRegion(const std::vector<std::vector<glm::vec3>>& P, const std::vector<std::vector<float>>& W, const SurfaceSampling& sampling, const Range2D& controlRegion,
+	std::vector<std::vector<glm::vec3>>& Q, Range2D& cellRegion, const DetailHierarchy* detail) {
+	// Control point (i, j) only influences u in [U[i], U[i + k_u]] and v in [V[j], V[j + k_v]]
+	const float uMin = sampling.U[controlRegion.rowBegin];
+	const float uMax = sampling.U[controlRegion.rowEnd - 1 + sampling.k_u];
+	const float vMin = sampling.V[controlRegion.colBegin];
+	const float vMax = sampling.V[controlRegion.colEnd - 1 + sampling.k_v];
+	evaluateParameterRegion(P, W, sampling, uMin, uMax, vMin, vMax, Q, cellRegion, detail);
+}
+
+void SurfaceEvaluator::evaluateParameterRegion(const std::vector<std::vector<glm::vec3>>& P, const std::vector<std::vector<float>>& W, const SurfaceSampling& sampling, float uMin, float uMax, float vMin, float vMax,
+	std::vector<std::vector<glm::vec3>>& Q, Range2D& cellRegion, const DetailHierarchy* detail) {
+	const std::vector<float>& uParams = sampling.uParams;
+	const std::vector<float>& vParams = sampling.vParams;
+	const int numRows = int(uParams.size());
+	const int numCols = int(vParams.size());
+	cellRegion = Range2D();
+	if (numRows < 2 || numCols < 2) return;
+
+	Range2D samples;
+	samples.rowBegin = int(std::lower_bound(uParams.begin(), uParams.end(), uMin) - uParams.begin());
+	samples.rowEnd = int(std::upper_bound(uParams.begin(), uParams.end(), uMax) - uParams.begin());
+	samples.colBegin = int(std::lower_bound(vParams.begin(), vParams.end(), vMin) - vParams.begin());
+	samples.colEnd = int(std::upper_bound(vParams.begin(), vParams.end(), vMax) - vParams.begin());
+	if (samples.rowEnd <= samples.rowBegin || samples.colEnd <= samples.colBegin) return;
+
+	JobSystem::get().parallelFor(samples.rowBegin, samples.rowEnd, ROW_GRAIN, [&](int begin, int end) {
+		for (int i = begin; i < end; i++) {
+			for (int j = samples.colBegin; j < samples.colEnd; j++) {
+				Q[i][j] = FFS_NURBS(P, sampling.U, sampling.V, W, uParams[i], vParams[j], sampling.k_u, sampling.k_v, P.size(), P[0].size());
+			}
+		}
+	}, "surface region evaluation");
+	if (detail) detail->apply(uParams, vParams, samples, Q);
+
+	// Normals average the neighbouring samples, so they change one sample further out,
+	// and every quad that touches one of those normals has to be rewritten.
+	cellRegion.rowBegin = std::max(0, samples.rowBegin - 2);
+	cellRegion.rowEnd = std::min(numRows - 1, samples.rowEnd + 1);
+	cellRegion.colBegin = std::max(0, samples.colBegin - 2);
+	cellRegion.colEnd = std::min(numCols - 1, samples.colEnd + 1);
+}
+
+// Tiles
+std::vector<Range2D> SurfaceEvaluator::tileLayout(const SurfaceSampling& sampling, int numControlRows, int numControlCols) {
+	// First sample of every tile along one axis, and one past the last sample at the end
+	auto breaks = [](const std::vector<float>& knots, const std::vector<float>& params, int k, int m) {
+		std::vector<int> starts(1, 0);
+		int tile = 0;
+		for (int n = 1; n < int(params.size()) - 1; n++) {
+			const int span = delta(knots, params[n], k, m) - (k - 1);
+			if (span / TILE_SPANS != tile || n - starts.back() >= TILE_MAX_SAMPLES) {
+				tile = span / TILE_SPANS;
+				starts.push_back(n);
+			}
+		}
+		starts.push_back(std::max(1, int(params.size()) - 1));
+		return starts;
+	};
+	std::vector<Range2D> tiles;
+	if (sampling.uParams.size() < 2 || sampling.vParams.size() < 2) return tiles;
+	const std::vector<int> rows = breaks(sampling.U, sampling.uParams, sampling.k_u, numControlRows);
+	const std::vector<int> cols = breaks(sampling.V, sampling.vParams, sampling.k_v, numControlCols);
+	for (size_t a = 0; a + 1 < rows.size(); a++) {
+		for (size_t b = 0; b + 1 < cols.size(); b++) {
+			tiles.push_back(Range2D{ rows[a], rows[a + 1], cols[b], cols[b + 1] });
+		}
+	}
+	return tiles;
+}
+
+void SurfaceEvaluator::buildTile(const std::vector<std::vector<glm::vec3>>& Q, SurfaceTileGeometry& tile, const SurfaceSampling* sampling, const DisplacementLayer* displacement) {
+	const Range2D& cells = tile.cells;
+	const int tileCols = cells.colEnd - cells.colBegin;
+	const size_t numVerts = size_t(cells.rowEnd - cells.rowBegin) * tileCols * 6;
+	tile.verts.resize(numVerts);
+	tile.uvs.resize(numVerts);
+	tile.normals.resize(numVerts);
+
+	// With displacement under the tile, its samples and one ring around them (for the normals) are displaced first.
+	// `S` holds the samples from (rowOffset, colOffset) on.
+	const std::vector<std::vector<glm::vec3>>* S = &Q;
+	std::vector<std::vector<glm::vec3>> displaced;
+	int rowOffset = 0, colOffset = 0;
+	if (sampling && displacement && sampling->uParams.size() == Q.size() && sampling->vParams.size() == Q[0].size()) {
+		const Range2D samples{ std::max(0, cells.rowBegin - 1), std::min(int(Q.size()), cells.rowEnd + 2), std::max(0, cells.colBegin - 1), std::min(int(Q[0].size()), cells.colEnd + 2) };
+		if (displacement->overlaps(sampling->uParams[samples.rowBegin], sampling->uParams[samples.rowEnd - 1], sampling->vParams[samples.colBegin], sampling->vParams[samples.colEnd - 1])) {
+			displaceSamples(Q, *sampling, *displacement, samples, displaced);
+			S = &displaced;
+			rowOffset = samples.rowBegin;
+			colOffset = samples.colBegin;
+		}
+	}
+
+	// Normals come from the whole grid, so tiles agree along their borders
+	const int normalCols = tileCols + 1;
+	std::vector<glm::vec3> normals(size_t(cells.rowEnd - cells.rowBegin + 1) * normalCols);
+	for (int i = cells.rowBegin; i <= cells.rowEnd; i++) {
+		for (int j = cells.colBegin; j <= cells.colEnd; j++) {
+			normals[size_t(i - cells.rowBegin) * normalCols + (j - cells.colBegin)] = sampleNormal(*S, i - rowOffset, j - colOffset);
+		}
+	}
+
+	// Same texture coordinates as generateTextureCoord
+	const float maxVal = float(std::max(Q.size(), Q[0].size()));
+	auto uv = [maxVal](int i, int j) { return glm::vec2((i + 0.5f) / maxVal, (j + 0.5f) / maxVal); };
+	size_t first = 0;
+	for (int i = cells.rowBegin; i < cells.rowEnd; i++) {
+		const glm::vec3* n0 = &normals[size_t(i - cells.rowBegin) * normalCols];
+		const glm::vec3* n1 = n0 + normalCols;
+		for (int j = cells.colBegin; j < cells.colEnd; j++, first += 6) {
+			const int c = j - cells.colBegin;
+			const glm::vec3* q0 = &(*S)[i - rowOffset][j - colOffset];
+			const glm::vec3* q1 = &(*S)[i + 1 - rowOffset][j - colOffset];
+			glm::vec3* r = &tile.verts[first];
+			*r++ = q0[1];
+			*r++ = q0[0];
+			*r++ = q1[0];
+			*r++ = q0[1];
+			*r++ = q1[1];
+			*r++ = q1[0];
+			glm::vec3* n = &tile.normals[first];
+			*n++ = n0[c + 1];
+			*n++ = n0[c];
+			*n++ = n1[c];
+			*n++ = n0[c + 1];
+			*n++ = n1[c + 1];
+			*n++ = n1[c];
+			glm::vec2* t = &tile.uvs[first];
+			*t++ = uv(i, j + 1);
+			*t++ = uv(i, j);
+			*t++ = uv(i + 1, j);
+			*t++ = uv(i, j + 1);
+			*t++ = uv(i + 1, j + 1);
+			*t++ = uv(i + 1, j);
+		}
+	}
+}
+
+void SurfaceEvaluator::displaceSamples(const std::vector<std::vector<glm::vec3>>& Q, const SurfaceSampling& sampling, const DisplacementLayer& displacement, const Range2D& samples,
+	std::vector<std::vector<glm::vec3>>& displaced) {
+	// Along the normal of the undisplaced surface, so the result doesn't depend on the order samples are displaced in
+	displaced.resize(samples.rowEnd - samples.rowBegin);
+	for (int i = samples.rowBegin; i < samples.rowEnd; i++) {
+		std::vector<glm::vec3>& row = displaced[i - samples.rowBegin];
+		row.resize(samples.colEnd - samples.colBegin);
+		for (int j = samples.colBegin; j < samples.colEnd; j++) {
+			const float height = displacement.sample(sampling.uParams[i], sampling.vParams[j]);
+			row[j - samples.colBegin] = (height != 0.0f) ? Q[i][j] + height * sampleNormal(Q, i, j) : Q[i][j];
+		}
+	}
+}
+
+// Surface Properties
+std::vector<glm::vec3> SurfaceEvaluator::generateQuads(const std::vector<std::vector<glm::vec3>>& points) {
+	return quadsOf(points);
+}
+
+std::vector<glm::vec2> SurfaceEvaluator::generateQuads(const std::vector<std::vector<glm::vec2>>& points) {
+	return quadsOf(points);
+}
+
+std::vector<glm::vec2> SurfaceEvaluator::generateTextureCoord(const std::vector<std::vector<glm::vec3>>& controlPoints) {
+	const int width = controlPoints.size();
+	const int height = controlPoints[0].size();
+	const float maxVal = std::max(width, height);
+	std::vector<std::vector<glm::vec2>> textureCoordinates(width, std::vector<glm::vec2>(height));
+	JobSystem::get().parallelFor(0, width, ROW_GRAIN * 8, [&](int begin, int end) {
+		for (int x = begin; x < end; ++x) {
+			for (int y = 0; y < height; ++y) {
+				const float u = (x + 0.5f) / maxVal;
+				const float v = (y + 0.5f) / maxVal;
+				textureCoordinates[x][y] = glm::vec2(u, v);
+			}
+		}
+	}, "texture coordinates");
+	std::vector<glm::vec2> T = generateQuads(textureCoordinates);
+	return T;
+}
+
+std::vector<glm::vec3> SurfaceEvaluator::generateNormals(const std::vector<std::vector<glm::vec3>>& controlPoints) {
+	std::vector<std::vector<glm::vec3>> normals;
+	int numRows = controlPoints.size();
+	int numCols = controlPoints[0].size();
+	normals.resize(numRows);
+	for (int i = 0; i < numRows; i++) {
+		normals[i].resize(numCols);
+	}
+	JobSystem::get().parallelFor(0, numRows, ROW_GRAIN * 4, [&](int begin, int end) {
+		for (int i = begin; i < end; i++) {
+			for (int j = 0; j < numCols; j++) normals[i][j] = sampleNormal(controlPoints, i, j);
+		}
+	}, "normals");
+	std::vector<glm::vec3> N = generateQuads(normals);
+	return N;
+}
+
+glm::vec3 SurfaceEvaluator::sampleNormal(const std::vector<std::vector<glm::vec3>>& controlPoints, int i, int j) {
+	const int numRows = controlPoints.size();
+	const int numCols = controlPoints[0].size();
+	glm::vec3 normal(0.0f, 0.0f, 0.0f);
+	if (i > 0 && j > 0) {
+		glm::vec3 v1 = controlPoints[i][j] - controlPoints[i][j - 1];
+		glm::vec3 v2 = controlPoints[i][j] - controlPoints[i - 1][j];
+		normal += glm::cross(v1, v2);
+	}
+	if (i > 0 && j < numCols - 1) {
+		glm::vec3 v1 = controlPoints[i][j] - controlPoints[i - 1][j];
+		glm::vec3 v2 = controlPoints[i][j] - controlPoints[i][j + 1];
+		normal += glm::cross(v1, v2);
+	}
+	if (i < numRows - 1 && j < numCols - 1) {
+		glm::vec3 v1 = controlPoints[i][j] - controlPoints[i][j + 1];
+		glm::vec3 v2 = controlPoints[i][j] - controlPoints[i + 1][j];
+		normal += glm::cross(v1, v2);
+	}
+	if (i < numRows - 1 && j > 0) {
+		glm::vec3 v1 = controlPoints[i][j] - controlPoints[i + 1][j];
+		glm::vec3 v2 = controlPoints[i][j] - controlPoints[i][j - 1];
+		normal += glm::cross(v1, v2);
+	}
+	return glm::normalize(normal);
+}
+
+// MARK: - Background Evaluation
+
+BackgroundSurfaceEvaluator::BackgroundSurfaceEvaluator()
+	: bJobActive(false)
+	, latestGeneration(0)
+	, bIsBusy(false)
+	, bHasPendingRequest(false)
+	, bFrontReady(false)
+	, bStop(false)
+{}
+
+BackgroundSurfaceEvaluator::~BackgroundSurfaceEvaluator() {
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		this->bStop = true;
+		this->bHasPendingRequest = false;
+	}
+	this->latestGeneration++;
+	this->tasks.wait();
+}
+
+void BackgroundSurfaceEvaluator::submit(SurfaceEvaluationRequest request) {
+	bool bStartJob = false;
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		request.generation = ++this->latestGeneration;
+		this->pendingRequest = std::move(request);
+		this->bHasPendingRequest = true;
+		this->bIsBusy = true;
+		bStartJob = !this->bJobActive;
+		this->bJobActive = true;
+	}
+	// At most one evaluation job is alive; it keeps picking up the newest request until none is left
+	if (bStartJob) this->tasks.run([this]() { this->drainRequests(); }, "background surface evaluation");
+}
+
+void BackgroundSurfaceEvaluator::cancel() {
+	std::lock_guard<std::mutex> lock(this->mutex);
+	this->latestGeneration++;
+	this->bHasPendingRequest = false;
+	this->bFrontReady = false;
+}
+
+bool BackgroundSurfaceEvaluator::acquire(SurfaceTessellation& tessellation) {
+	std::lock_guard<std::mutex> lock(this->mutex);
+	if (!this->bFrontReady) return false;
+	this->bFrontReady = false;
+	if (this->front.generation != this->latestGeneration) return false;
+	std::swap(this->front, tessellation);
+	return true;
+}
+
+bool BackgroundSurfaceEvaluator::isBusy() const {
+	std::lock_guard<std::mutex> lock(this->mutex);
+	return this->bIsBusy.load() || this->bFrontReady;
+}
+
+void BackgroundSurfaceEvaluator::setOnPublished(std::function<void()> onPublished) {
+	std::lock_guard<std::mutex> lock(this->mutex);
+	this->onPublished = onPublished;
+}
+
+void BackgroundSurfaceEvaluator::drainRequests() {
+	while (true) {
+		SurfaceEvaluationRequest request;
+		{
+			std::lock_guard<std::mutex> lock(this->mutex);
+			if (this->bStop || !this->bHasPendingRequest) {
+				this->bJobActive = false;
+				this->bIsBusy = false;
+				return;
+			}
+			request = std::move(this->pendingRequest);
+			this->bHasPendingRequest = false;
+		}
+
+		if (!SurfaceEvaluator::tessellate(request, this->back, &this->latestGeneration)) continue;
+
+		std::function<void()> callback;
+		{
+			std::lock_guard<std::mutex> lock(this->mutex);
+			if (request.generation != this->latestGeneration) continue;
+			std::swap(this->back, this->front);
+			this->bFrontReady = true;
+			callback = this->onPublished;
+		}
+		if (callback) callback();
+	}
+}
@@ -0,0 +1,155 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "../JobSystem.h"
+#include "DetailHierarchy.h"
+#include "DisplacementLayer.h"
+
+// Everything the evaluator needs, copied out of the FFS so it can run off the render thread.
+struct SurfaceEvaluationRequest {
+	std::vector<std::vector<glm::vec3>> P;
+	std::vector<std::vector<float>> W;
+	int k_u = 3;
+	int k_v = 3;
+	// Samples per unit of u and of v
+	float resolutionU = 100.0f;
+	float resolutionV = 100.0f;
+	bool bBezier = false;
+	// Refined regions, summed onto the base surface
+	DetailHierarchy detail;
+	// Sculpted displacement, added to the tile geometry only
+	DisplacementLayer displacement;
+	uint64_t generation = 0;
+};
+
+// Knot vectors and sample parameters a tessellation was built with. Kept next to the
+// surface so edits can re-evaluate only the samples a control point influences.
+struct SurfaceSampling {
+	int k_u = 0;
+	int k_v = 0;
+	std::vector<float> U;
+	std::vector<float> V;
+	std::vector<float> uParams;
+	std::vector<float> vParams;
+};
+
+// Triangles of one tile of the tessellated surface: the quads `cells` of Q, in the same
+// vertex order as generateQuads.
+struct SurfaceTileGeometry {
+	Range2D cells;
+	std::vector<glm::vec3> verts;
+	std::vector<glm::vec2> uvs;
+	std::vector<glm::vec3> normals;
+};
+
+struct SurfaceTessellation {
+	uint64_t generation = 0;
+	SurfaceSampling sampling;
+	std::vector<std::vector<glm::vec3>> Q;
+	std::vector<SurfaceTileGeometry> tiles;
+};
+
+namespace SurfaceEvaluator {
+
+	// Knot spans along each side of a surface tile, and the most sample rows or columns one may hold
+	const int TILE_SPANS = 32;
+	const int TILE_MAX_SAMPLES = 128;
+
+	// NURBS
+	std::vector<float> generateKnotSequence(int length, int k, bool bBezier);
+	int delta(const std::vector<float>& U, float u, int k, int m);
+	// The k B-spline basis functions that are non-zero at u: N[r] belongs to control point span - k + 1 + r.
+	// Returns span, clamped so every one of them indexes an existing control point.
+	int basisFunctions(const std::vector<float>& U, float u, int k, int m, float* N);
+	// P is an m x n net: m control points along u (rows), n along v (columns)
+	glm::vec3 FFS_NURBS(const std::vector<std::vector<glm::vec3>>& P, const std::vector<float>& U, const std::vector<float>& V, const std::vector<std::vector<float>>& W, float u, float v, int k_u, int k_v, int m, int n);
+
+	// Evaluates the whole surface. Returns false if `latestGeneration` moved past the
+	// request's generation while evaluating, in which case `tessellation` is incomplete.
+	bool tessellate(const SurfaceEvaluationRequest& request, SurfaceTessellation& tessellation, const std::atomic<uint64_t>* latestGeneration = nullptr);
+
+	// Re-evaluates only the samples influenced by the control points in `controlRegion` and patches
+	// Q in place. `cellRegion` receives the quads whose corners or normals changed.
+	// `sampling` must describe the net P/W were tessellated with, and `detail` is added on top.
+	void evaluateRegion(const std::vector<std::vector<glm::vec3>>& P, const std::vector<std::vector<float>>& W, const SurfaceSampling& sampling, const Range2D& controlRegion,
+		std::vector<std::vector<glm::vec3>>& Q, Range2D& cellRegion, const DetailHierarchy* detail = nullptr);
+	// The same for the samples with parameters in [uMin, uMax] x [vMin, vMax], e.g. under an edited detail patch
+	void evaluateParameterRegion(const std::vector<std::vector<glm::vec3>>& P, const std::vector<std::vector<float>>& W, const SurfaceSampling& sampling, float uMin, float uMax, float vMin, float vMax,
+		std::vector<std::vector<glm::vec3>>& Q, Range2D& cellRegion, const DetailHierarchy* detail = nullptr);
+
+	// Tiles
+	// Splits the quads of Q into tiles of up to TILE_SPANS knot spans a side. Tile (a, b) is shaped by
+	// control rows s0 - k_u + 1 to s1 of its spans [s0, s1], so neighbouring tiles share k_u - 1 rows
+	// (and k_v - 1 columns) of the net and meet exactly where one big surface would.
+	std::vector<Range2D> tileLayout(const SurfaceSampling& sampling, int numControlRows, int numControlCols);
+	// Triangles, texture coordinates and normals of the quads `tile.cells` of Q, displaced by `displacement`
+	// if given; `sampling` must then describe Q
+	void buildTile(const std::vector<std::vector<glm::vec3>>& Q, SurfaceTileGeometry& tile, const SurfaceSampling* sampling = nullptr, const DisplacementLayer* displacement = nullptr);
+	// The samples `samples` of Q moved along their normals by `displacement`, from (samples.rowBegin, samples.colBegin) on
+	void displaceSamples(const std::vector<std::vector<glm::vec3>>& Q, const SurfaceSampling& sampling, const DisplacementLayer& displacement, const Range2D& samples,
+		std::vector<std::vector<glm::vec3>>& displaced);
+
+	// Surface Properties
+	std::vector<glm::vec3> generateQuads(const std::vector<std::vector<glm::vec3>>& points);
+	std::vector<glm::vec2> generateQuads(const std::vector<std::vector<glm::vec2>>& points);
+	std::vector<glm::vec2> generateTextureCoord(const std::vector<std::vector<glm::vec3>>& controlPoints);
+	std::vector<glm::vec3> generateNormals(const std::vector<std::vector<glm::vec3>>& controlPoints);
+	glm::vec3 sampleNormal(const std::vector<std::vector<glm::vec3>>& controlPoints, int i, int j);
+
+};
+
+// Evaluates surfaces as a job on the shared JobSystem. Each submit() supersedes the previous request:
+// the in-flight evaluation notices the newer generation and gives up, so only the latest
+// surface is ever built completely. The worker fills its back buffer and swaps it with
+// the front buffer on completion; the render thread then swaps the front buffer out with acquire().
+class BackgroundSurfaceEvaluator {
+
+public:
+
+	BackgroundSurfaceEvaluator();
+	~BackgroundSurfaceEvaluator();
+
+	BackgroundSurfaceEvaluator(const BackgroundSurfaceEvaluator&) = delete;
+	BackgroundSurfaceEvaluator& operator=(const BackgroundSurfaceEvaluator&) = delete;
+
+	void submit(SurfaceEvaluationRequest request);
+	void cancel();
+	bool acquire(SurfaceTessellation& tessellation);
+	// Also true while a published tessellation waits for acquire(), region edits made before
+	// then would be patched into the surface that is about to be replaced
+	bool isBusy() const;
+
+	// Called from the worker thread whenever a finished tessellation is published.
+	void setOnPublished(std::function<void()> onPublished);
+
+private:
+
+	void drainRequests();
+
+private:
+
+	TaskGroup tasks;
+	mutable std::mutex mutex;
+	bool bJobActive;
+
+	std::atomic<uint64_t> latestGeneration;
+	std::atomic<bool> bIsBusy;
+
+	SurfaceEvaluationRequest pendingRequest;
+	bool bHasPendingRequest;
+
+	SurfaceTessellation back;
+	SurfaceTessellation front;
+	bool bFrontReady;
+
+	bool bStop;
+	std::function<void()> onPublished;
+
+};
@@ -0,0 +1,194 @@
+#include "SurfacePicker.h"
+
+#include <algorithm>
+#include <limits>
+
+void SurfacePicker::build(const std::vector<std::vector<glm::vec3>>& Q, const std::vector<float>& uParams, const std::vector<float>& vParams) {
+	this->clear();
+	if (Q.size() < 2 || Q[0].size() < 2) return;
+	this->cellRows = int(Q.size()) - 1;
+	this->cellCols = int(Q[0].size()) - 1;
+	this->uParams = uParams;
+	this->vParams = vParams;
+
+	Level leaves;
+	leaves.rows = (this->cellRows + LEAF_SIZE - 1) / LEAF_SIZE;
+	leaves.cols = (this->cellCols + LEAF_SIZE - 1) / LEAF_SIZE;
+	leaves.nodes.resize(size_t(leaves.rows) * leaves.cols);
+	this->levels.push_back(std::move(leaves));
+	while (this->levels.back().rows > 1 || this->levels.back().cols > 1) {
+		Level parent;
+		parent.rows = (this->levels.back().rows + 1) / 2;
+		parent.cols = (this->levels.back().cols + 1) / 2;
+		parent.nodes.resize(size_t(parent.rows) * parent.cols);
+		this->levels.push_back(std::move(parent));
+	}
+
+	const Level& base = this->levels[0];
+	JobSystem::get().parallelFor(0, base.rows, 1, [&](int begin, int end) {
+		for (int i = begin; i < end; i++) {
+			for (int j = 0; j < base.cols; j++) this->fitLeaf(Q, i, j);
+		}
+	}, "picker build");
+	for (int level = 1; level < int(this->levels.size()); level++) {
+		for (int i = 0; i < this->levels[level].rows; i++) {
+			for (int j = 0; j < this->levels[level].cols; j++) this->fitParent(level, i, j);
+		}
+	}
+}
+
+void SurfacePicker::refit(const std::vector<std::vector<glm::vec3>>& Q, const Range2D& cellRegion) {
+	if (this->levels.empty() || cellRegion.rowEnd <= cellRegion.rowBegin || cellRegion.colEnd <= cellRegion.colBegin) return;
+	int rowBegin = cellRegion.rowBegin / LEAF_SIZE;
+	int rowEnd = (cellRegion.rowEnd - 1) / LEAF_SIZE + 1;
+	int colBegin = cellRegion.colBegin / LEAF_SIZE;
+	int colEnd = (cellRegion.colEnd - 1) / LEAF_SIZE + 1;
+	for (int i = rowBegin; i < rowEnd; i++) {
+		for (int j = colBegin; j < colEnd; j++) this->fitLeaf(Q, i, j);
+	}
+	// Walk up, halving the dirty node range on every level
+	for (int level = 1; level < int(this->levels.size()); level++) {
+		rowBegin /= 2; colBegin /= 2;
+		rowEnd = (rowEnd + 1) / 2; colEnd = (colEnd + 1) / 2;
+		for (int i = rowBegin; i < rowEnd; i++) {
+			for (int j = colBegin; j < colEnd; j++) this->fitParent(level, i, j);
+		}
+	}
+}
+
+void SurfacePicker::clear() {
+	this->cellRows = 0;
+	this->cellCols = 0;
+	this->uParams.clear();
+	this->vParams.clear();
+	this->levels.clear();
+}
+
+SurfacePick SurfacePicker::pick(const std::vector<std::vector<glm::vec3>>& Q, const glm::vec3& origin, const glm::vec3& direction) const {
+	SurfacePick pick;
+	pick.distance = std::numeric_limits<float>::max();
+	if (this->levels.empty() || int(Q.size()) != this->cellRows + 1) return pick;
+
+	const glm::vec3 inverseDirection = 1.0f / direction;
+	struct Entry { int level, row, col; float entry; };
+	// Depth-first, nearest child first. Each level adds at most 3 siblings to the stack.
+	Entry stack[256];
+	int stackSize = 0;
+	float entry;
+	const int root = int(this->levels.size()) - 1;
+	if (!this->intersectBounds(this->levels[root].nodes[0], origin, inverseDirection, pick.distance, entry)) return pick;
+	stack[stackSize++] = { root, 0, 0, entry };
+
+	while (stackSize > 0) {
+		Entry node = stack[--stackSize];
+		if (node.entry > pick.distance) continue;
+		if (node.level == 0) {
+			this->intersectLeaf(Q, node.row, node.col, origin, direction, pick);
+			continue;
+		}
+		const Level& children = this->levels[node.level - 1];
+		Entry hits[4];
+		int hitCount = 0;
+		for (int i = node.row * 2; i < std::min(children.rows, node.row * 2 + 2); i++) {
+			for (int j = node.col * 2; j < std::min(children.cols, node.col * 2 + 2); j++) {
+				if (this->intersectBounds(children.nodes[size_t(i) * children.cols + j], origin, inverseDirection, pick.distance, entry)) {
+					hits[hitCount++] = { node.level - 1, i, j, entry };
+				}
+			}
+		}
+		// Push the farthest first so the nearest is popped next
+		std::sort(hits, hits + hitCount, [](const Entry& a, const Entry& b) { return a.entry > b.entry; });
+		for (int n = 0; n < hitCount; n++) stack[stackSize++] = hits[n];
+	}
+	if (!pick.bHit) pick.distance = 0.0f;
+	return pick;
+}
+
+void SurfacePicker::fitLeaf(const std::vector<std::vector<glm::vec3>>& Q, int blockRow, int blockCol) {
+	const int rowBegin = blockRow * LEAF_SIZE;
+	const int rowEnd = std::min(this->cellRows, rowBegin + LEAF_SIZE);
+	const int colBegin = blockCol * LEAF_SIZE;
+	const int colEnd = std::min(this->cellCols, colBegin + LEAF_SIZE);
+	Bounds bounds = { Q[rowBegin][colBegin], Q[rowBegin][colBegin] };
+	// A block of cells spans one extra row and column of samples
+	for (int i = rowBegin; i <= rowEnd; i++) {
+		for (int j = colBegin; j <= colEnd; j++) {
+			bounds.min = glm::min(bounds.min, Q[i][j]);
+			bounds.max = glm::max(bounds.max, Q[i][j]);
+		}
+	}
+	this->levels[0].nodes[size_t(blockRow) * this->levels[0].cols + blockCol] = bounds;
+}
+
+void SurfacePicker::fitParent(int level, int row, int col) {
+	const Level& children = this->levels[level - 1];
+	Bounds bounds = children.nodes[size_t(row * 2) * children.cols + col * 2];
+	for (int i = row * 2; i < std::min(children.rows, row * 2 + 2); i++) {
+		for (int j = col * 2; j < std::min(children.cols, col * 2 + 2); j++) {
+			const Bounds& child = children.nodes[size_t(i) * children.cols + j];
+			bounds.min = glm::min(bounds.min, child.min);
+			bounds.max = glm::max(bounds.max, child.max);
+		}
+	}
+	this->levels[level].nodes[size_t(row) * this->levels[level].cols + col] = bounds;
+}
+
+bool SurfacePicker::intersectBounds(const Bounds& bounds, const glm::vec3& origin, const glm::vec3& inverseDirection, float maxDistance, float& entry) const {
+	// Slab test
+	glm::vec3 t0 = (bounds.min - origin) * inverseDirection;
+	glm::vec3 t1 = (bounds.max - origin) * inverseDirection;
+	glm::vec3 tMin = glm::min(t0, t1);
+	glm::vec3 tMax = glm::max(t0, t1);
+	float tNear = std::max(std::max(tMin.x, tMin.y), std::max(tMin.z, 0.0f));
+	float tFar = std::min(std::min(tMax.x, tMax.y), std::min(tMax.z, maxDistance));
+	entry = tNear;
+	return tNear <= tFar;
+}
+
+void SurfacePicker::intersectLeaf(const std::vector<std::vector<glm::vec3>>& Q, int blockRow, int blockCol, const glm::vec3& origin, const glm::vec3& direction, SurfacePick& pick) const {
+	const int rowBegin = blockRow * LEAF_SIZE;
+	const int rowEnd = std::min(this->cellRows, rowBegin + LEAF_SIZE);
+	const int colBegin = blockCol * LEAF_SIZE;
+	const int colEnd = std::min(this->cellCols, colBegin + LEAF_SIZE);
+	for (int i = rowBegin; i < rowEnd; i++) {
+		for (int j = colBegin; j < colEnd; j++) {
+			// Same two triangles as SurfaceEvaluator::generateQuads, as (row, col) offsets
+			const glm::ivec2 corners[2][3] = {
+				{ glm::ivec2(0, 1), glm::ivec2(0, 0), glm::ivec2(1, 0) },
+				{ glm::ivec2(0, 1), glm::ivec2(1, 1), glm::ivec2(1, 0) }
+			};
+			for (int triangle = 0; triangle < 2; triangle++) {
+				const glm::ivec2* c = corners[triangle];
+				const glm::vec3& a = Q[i + c[0].x][j + c[0].y];
+				const glm::vec3& b = Q[i + c[1].x][j + c[1].y];
+				const glm::vec3& d = Q[i + c[2].x][j + c[2].y];
+
+				// Moller-Trumbore
+				glm::vec3 e1 = b - a;
+				glm::vec3 e2 = d - a;
+				glm::vec3 p = glm::cross(direction, e2);
+				float det = glm::dot(e1, p);
+				if (std::abs(det) < 1e-12f) continue;
+				float invDet = 1.0f / det;
+				glm::vec3 s = origin - a;
+				float beta = glm::dot(s, p) * invDet;
+				if (beta < 0.0f || beta > 1.0f) continue;
+				glm::vec3 q = glm::cross(s, e1);
+				float gamma = glm::dot(direction, q) * invDet;
+				if (gamma < 0.0f || beta + gamma > 1.0f) continue;
+				float t = glm::dot(e2, q) * invDet;
+				if (t < 0.0f || t >= pick.distance) continue;
+
+				const float alpha = 1.0f - beta - gamma;
+				pick.bHit = true;
+				pick.distance = t;
+				pick.point = origin + t * direction;
+				pick.uv.x = alpha * this->uParams[i + c[0].x] + beta * this->uParams[i + c[1].x] + gamma * this->uParams[i + c[2].x];
+				pick.uv.y = alpha * this->vParams[j + c[0].y] + beta * this->vParams[j + c[1].y] + gamma * this->vParams[j + c[2].y];
+				pick.row = i;
+				pick.col = j;
+				pick.triangle = triangle;
+			}
+		}
+	}
+}
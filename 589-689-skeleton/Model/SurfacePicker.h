@@ -0,0 +1,65 @@
+#pragma once
+
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "../JobSystem.h"
+
+struct SurfacePick {
+	bool bHit = false;
+	glm::vec3 point = glm::vec3(0.0f);
+	// Surface parameters at the hit point
+	glm::vec2 uv = glm::vec2(0.0f);
+	// Cell (row, col) of the sample grid and which of its two triangles was hit (0 or 1)
+	int row = -1;
+	int col = -1;
+	int triangle = -1;
+	float distance = 0.0f;
+};
+
+// Ray picking against the tessellated surface Q. The grid is split into blocks of
+// LEAF_SIZE x LEAF_SIZE cells, and a quadtree of bounding boxes is stored level by level
+// on top of them. Edits only refit the blocks they touched and their ancestors.
+class SurfacePicker {
+
+public:
+
+	void build(const std::vector<std::vector<glm::vec3>>& Q, const std::vector<float>& uParams, const std::vector<float>& vParams);
+	// `cellRegion` is the range of cells that changed, as returned by SurfaceEvaluator::evaluateRegion
+	void refit(const std::vector<std::vector<glm::vec3>>& Q, const Range2D& cellRegion);
+	void clear();
+
+	SurfacePick pick(const std::vector<std::vector<glm::vec3>>& Q, const glm::vec3& origin, const glm::vec3& direction) const;
+	bool isEmpty() const { return this->levels.empty(); }
+
+private:
+
+	struct Bounds {
+		glm::vec3 min;
+		glm::vec3 max;
+	};
+
+	struct Level {
+		int rows = 0;
+		int cols = 0;
+		std::vector<Bounds> nodes;
+	};
+
+	void fitLeaf(const std::vector<std::vector<glm::vec3>>& Q, int blockRow, int blockCol);
+	void fitParent(int level, int row, int col);
+	bool intersectBounds(const Bounds& bounds, const glm::vec3& origin, const glm::vec3& inverseDirection, float maxDistance, float& entry) const;
+	void intersectLeaf(const std::vector<std::vector<glm::vec3>>& Q, int blockRow, int blockCol, const glm::vec3& origin, const glm::vec3& direction, SurfacePick& pick) const;
+
+private:
+
+	static const int LEAF_SIZE = 8;
+
+	int cellRows = 0;
+	int cellCols = 0;
+	std::vector<float> uParams;
+	std::vector<float> vParams;
+	// levels[0] holds the leaf blocks, levels.back() the single root
+	std::vector<Level> levels;
+
+};
@@ -0,0 +1,49 @@
+#include "SurfaceTiles.h"
+
+void SurfaceTiles::upload(std::vector<SurfaceTileGeometry>& tiles) {
+	// GPU buffers are kept when the layout has as many tiles, setVerts resizes them anyway
+	this->tiles.resize(tiles.size());
+	for (size_t t = 0; t < tiles.size(); t++) {
+		Tile& tile = this->tiles[t];
+		std::swap(tile.geometry, tiles[t]);
+		if (!tile.gpuGeom) tile.gpuGeom = std::make_unique<GPU_Geometry>();
+		tile.gpuGeom->bind();
+		tile.gpuGeom->setVerts(tile.geometry.verts);
+		tile.gpuGeom->setUVs(tile.geometry.uvs);
+		tile.gpuGeom->setNormals(tile.geometry.normals);
+	}
+	this->lastUpdateCount = int(tiles.size());
+}
+
+void SurfaceTiles::update(const std::vector<std::vector<glm::vec3>>& Q, const Range2D& cellRegion, const SurfaceSampling* sampling, const DisplacementLayer* displacement) {
+	// Displaced samples move along normals that depend on their neighbours, so displaced normals reach one sample further
+	Range2D region = cellRegion;
+	if (displacement && !displacement->empty()) region = Range2D{ region.rowBegin - 1, region.rowEnd + 1, region.colBegin - 1, region.colEnd + 1 };
+	std::vector<int> touched;
+	if (region.rowEnd > region.rowBegin && region.colEnd > region.colBegin) {
+		for (int t = 0; t < int(this->tiles.size()); t++) {
+			const Range2D& cells = this->tiles[t].geometry.cells;
+			if (cells.rowBegin < region.rowEnd && region.rowBegin < cells.rowEnd && cells.colBegin < region.colEnd && region.colBegin < cells.colEnd) touched.push_back(t);
+		}
+	}
+	this->lastUpdateCount = int(touched.size());
+	if (touched.empty()) return;
+
+	JobSystem::get().parallelFor(0, int(touched.size()), 1, [&](int begin, int end) {
+		for (int n = begin; n < end; n++) SurfaceEvaluator::buildTile(Q, this->tiles[touched[n]].geometry, sampling, displacement);
+	}, "surface tile update");
+	// A tile's size only depends on its cells, so its buffers are overwritten in place; texture coordinates don't move
+	for (int t : touched) {
+		Tile& tile = this->tiles[t];
+		tile.gpuGeom->bind();
+		tile.gpuGeom->updateVerts(tile.geometry.verts, 0, tile.geometry.verts.size());
+		tile.gpuGeom->updateNormals(tile.geometry.normals, 0, tile.geometry.normals.size());
+	}
+}
+
+void SurfaceTiles::render() {
+	for (const Tile& tile : this->tiles) {
+		tile.gpuGeom->bind();
+		glDrawArrays(GL_TRIANGLES, 0, GLsizei(tile.geometry.verts.size()));
+	}
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "../Geometry.h"
+#include "SurfaceEvaluator.h"
+
+// The tessellated surface split into tiles (see SurfaceEvaluator::tileLayout), each with its own
+// triangles and GPU buffers. An edit rebuilds and re-uploads only the tiles its quads fall in, so
+// the cost of a brush stroke follows the brush and not the size of the net.
+class SurfaceTiles {
+
+public:
+
+	// Takes over the tiles of a fresh tessellation and uploads every one of them
+	void upload(std::vector<SurfaceTileGeometry>& tiles);
+	// Rebuilds the tiles overlapping `cellRegion` from Q, displaced by `displacement` if given, and re-uploads them
+	void update(const std::vector<std::vector<glm::vec3>>& Q, const Range2D& cellRegion, const SurfaceSampling* sampling = nullptr, const DisplacementLayer* displacement = nullptr);
+	void render();
+
+	bool empty() const { return this->tiles.empty(); }
+	int getTileCount() const { return int(this->tiles.size()); }
+	// Tiles the last update() rebuilt
+	int getLastUpdateCount() const { return this->lastUpdateCount; }
+
+private:
+
+	struct Tile {
+		SurfaceTileGeometry geometry;
+		std::unique_ptr<GPU_Geometry> gpuGeom;
+	};
+
+private:
+
+	std::vector<Tile> tiles;
+	int lastUpdateCount = 0;
+
+};
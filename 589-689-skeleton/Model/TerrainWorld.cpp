@@ -0,0 +1,277 @@
+#include "TerrainWorld.h"
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+namespace {
+
+	// Uniform cubic B-spline basis over one knot span and its derivative. Written so that t = 1 and t = 0
+	// round to the same weights on the shared control points, which keeps neighbouring patches' borders equal.
+	void cubicBasis(float t, float N[4], float dN[4]) {
+		const float s = 1.0f - t;
+		N[0] = s * s * s / 6.0f;
+		N[1] = (3.0f * t * t * t - 6.0f * t * t + 4.0f) / 6.0f;
+		N[2] = (-3.0f * t * t * t + 3.0f * t * t + 3.0f * t + 1.0f) / 6.0f;
+		N[3] = t * t * t / 6.0f;
+		dN[0] = -s * s / 2.0f;
+		dN[1] = (3.0f * t * t - 4.0f * t) / 2.0f;
+		dN[2] = (-3.0f * t * t + 2.0f * t + 1.0f) / 2.0f;
+		dN[3] = t * t / 2.0f;
+	}
+
+	// Span and position within it of sample `g` of a patch sampled `resolution` times per `spans` spans;
+	// the last sample stays at the end of the last span rather than the start of the next
+	void spanOf(int g, int resolution, int spans, int& span, float& t) {
+		span = g / resolution;
+		t = float(g % resolution) / float(resolution);
+		if (span == spans) {
+			span = spans - 1;
+			t = 1.0f;
+		}
+	}
+
+}
+
+TerrainWorld::TerrainWorld() {
+	this->procedural = std::make_shared<const ProceduralTerrain>(this->worldSettings.noise.seed);
+}
+
+TerrainWorld::~TerrainWorld() {
+	this->tasks.wait();
+}
+
+void TerrainWorld::update(const glm::vec3& cameraPosition) {
+	if (this->worldSettings.bIsChanging) this->regenerate();
+	this->frame++;
+	const float patchSize = float(this->worldSettings.patchSpans) * this->worldSettings.controlSpacing;
+	const int centerX = int(std::floor(cameraPosition.x / patchSize));
+	const int centerZ = int(std::floor(cameraPosition.z / patchSize));
+	this->uploadPatches();
+	this->requestPatches(centerX, centerZ);
+	this->evictPatches(centerX, centerZ);
+	this->stats.residentPatches = int(this->patches.size());
+	this->stats.pendingPatches = int(this->pending.size());
+}
+
+void TerrainWorld::render() {
+	for (const auto& entry : this->patches) {
+		entry.second->gpuGeom.bind();
+		glDrawArrays(GL_TRIANGLES, 0, entry.second->vertexCount);
+	}
+}
+
+void TerrainWorld::regenerate() {
+	// Patches of the old world still being built are dropped as they come in
+	this->generation++;
+	this->patches.clear();
+	this->pending.clear();
+	this->stats.residentBytes = 0;
+	WorldSettings& settings = this->worldSettings;
+	settings.patchSpans = std::max(settings.patchSpans, 1);
+	settings.patchResolution = std::max(settings.patchResolution, 1);
+	settings.controlSpacing = std::max(settings.controlSpacing, 0.01f);
+	this->procedural = std::make_shared<const ProceduralTerrain>(settings.noise.seed);
+}
+
+void TerrainWorld::resetWorldToDefaults() {
+	// The seed and whether the world is shown are kept
+	const uint32_t seed = this->worldSettings.noise.seed;
+	const bool bEnabled = this->worldSettings.bEnabled;
+	this->worldSettings = WorldSettings();
+	this->worldSettings.noise.seed = seed;
+	this->worldSettings.bEnabled = bEnabled;
+	this->worldSettings.bIsChanging = true;
+}
+
+void TerrainWorld::randomizeSeed() {
+	std::random_device rd;
+	this->worldSettings.noise.seed = rd();
+	this->worldSettings.bIsChanging = true;
+}
+
+bool TerrainWorld::isStreaming() const {
+	// Jobs of a dropped generation count too, new patches are only requested once they have come in
+	if (!this->pending.empty() || this->jobsInFlight > 0) return true;
+	std::lock_guard<std::mutex> lock(this->mutex);
+	return !this->completed.empty();
+}
+
+// MARK: - Streaming
+
+void TerrainWorld::requestPatches(int centerX, int centerZ) {
+	const int radius = std::max(this->worldSettings.viewRadius, 0);
+	std::vector<glm::ivec2> missing;
+	for (int x = centerX - radius; x <= centerX + radius; x++) {
+		for (int z = centerZ - radius; z <= centerZ + radius; z++) {
+			const int64_t key = patchKey(x, z);
+			auto it = this->patches.find(key);
+			if (it != this->patches.end()) {
+				it->second->lastUsedFrame = this->frame;
+			} else if (this->pending.count(key) == 0) {
+				missing.push_back(glm::ivec2(x, z));
+			}
+		}
+	}
+	if (missing.empty()) return;
+
+	// Nearest first, so the ground under the camera fills in before the horizon
+	std::sort(missing.begin(), missing.end(), [centerX, centerZ](const glm::ivec2& a, const glm::ivec2& b) {
+		const int da = (a.x - centerX) * (a.x - centerX) + (a.y - centerZ) * (a.y - centerZ);
+		const int db = (b.x - centerX) * (b.x - centerX) + (b.y - centerZ) * (b.y - centerZ);
+		return da < db;
+	});
+	for (const glm::ivec2& patch : missing) {
+		if (this->jobsInFlight >= std::max(this->worldSettings.maxJobsInFlight, 1)) break;
+		this->pending.insert(patchKey(patch.x, patch.y));
+		this->jobsInFlight++;
+		std::shared_ptr<const ProceduralTerrain> procedural = this->procedural;
+		const WorldSettings settings = this->worldSettings;
+		const uint64_t generation = this->generation;
+		this->tasks.run([this, procedural, settings, generation, patch]() {
+			std::unique_ptr<PatchMesh> mesh = std::make_unique<PatchMesh>();
+			mesh->x = patch.x;
+			mesh->z = patch.y;
+			mesh->generation = generation;
+			buildPatch(*procedural, settings, *mesh);
+			std::lock_guard<std::mutex> lock(this->mutex);
+			this->completed.push_back(std::move(mesh));
+		}, "world patch");
+	}
+}
+
+void TerrainWorld::uploadPatches() {
+	std::vector<std::unique_ptr<PatchMesh>> meshes;
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		// Stale patches cost nothing to drop, so only current ones count against the per-frame uploads
+		int uploads = 0;
+		size_t n = 0;
+		for (; n < this->completed.size(); n++) {
+			if (this->completed[n]->generation == this->generation && uploads++ == std::max(this->worldSettings.maxUploadsPerFrame, 1)) break;
+		}
+		meshes.assign(std::make_move_iterator(this->completed.begin()), std::make_move_iterator(this->completed.begin() + n));
+		this->completed.erase(this->completed.begin(), this->completed.begin() + n);
+	}
+	for (std::unique_ptr<PatchMesh>& mesh : meshes) {
+		this->jobsInFlight--;
+		if (mesh->generation != this->generation) continue;
+		const int64_t key = patchKey(mesh->x, mesh->z);
+		this->pending.erase(key);
+		std::unique_ptr<Patch> patch = std::make_unique<Patch>();
+		patch->gpuGeom.bind();
+		patch->gpuGeom.setVerts(mesh->verts);
+		patch->gpuGeom.setUVs(mesh->uvs);
+		patch->gpuGeom.setNormals(mesh->normals);
+		patch->vertexCount = GLsizei(mesh->verts.size());
+		patch->bytes = mesh->verts.size() * (2 * sizeof(glm::vec3) + sizeof(glm::vec2));
+		patch->lastUsedFrame = this->frame;
+		this->stats.residentBytes += patch->bytes;
+		this->stats.patchesGenerated++;
+		this->patches[key] = std::move(patch);
+	}
+}
+
+void TerrainWorld::evictPatches(int centerX, int centerZ) {
+	const size_t budget = size_t(std::max(this->worldSettings.memoryBudgetMB, 1)) << 20;
+	if (this->stats.residentBytes <= budget) return;
+	// Only patches out of view are candidates; the ones around the camera stay whatever the budget
+	const int radius = std::max(this->worldSettings.viewRadius, 0);
+	std::vector<std::pair<uint64_t, int64_t>> candidates;
+	for (const auto& entry : this->patches) {
+		const int x = int(entry.first >> 32), z = int(int32_t(uint32_t(entry.first)));
+		if (std::abs(x - centerX) <= radius && std::abs(z - centerZ) <= radius) continue;
+		candidates.push_back({ entry.second->lastUsedFrame, entry.first });
+	}
+	std::sort(candidates.begin(), candidates.end());
+	for (const auto& candidate : candidates) {
+		if (this->stats.residentBytes <= budget) break;
+		auto it = this->patches.find(candidate.second);
+		this->stats.residentBytes -= it->second->bytes;
+		this->patches.erase(it);
+		this->stats.patchesEvicted++;
+	}
+}
+
+// MARK: - Patches
+
+void TerrainWorld::controlHeights(const ProceduralTerrain& procedural, const WorldSettings& settings, int firstRow, int firstCol, int count, std::vector<float>& heights) {
+	std::vector<float> xs(size_t(count) * count), zs(size_t(count) * count);
+	for (int i = 0; i < count; i++) {
+		for (int j = 0; j < count; j++) {
+			xs[size_t(i) * count + j] = float(firstRow + i) * settings.controlSpacing;
+			zs[size_t(i) * count + j] = float(firstCol + j) * settings.controlSpacing;
+		}
+	}
+	heights.resize(xs.size());
+	procedural.evaluate(settings.noise, xs.data(), zs.data(), heights.data(), int(heights.size()));
+	for (float& height : heights) height = settings.minHeight + (settings.maxHeight - settings.minHeight) * height;
+}
+
+void TerrainWorld::buildPatch(const ProceduralTerrain& procedural, const WorldSettings& settings, PatchMesh& mesh) {
+	const int spans = settings.patchSpans;
+	const int resolution = settings.patchResolution;
+	// Span s of the patch is shaped by control points s - 1 to s + 2
+	const int count = spans + 3;
+	const int firstRow = mesh.x * spans - 1;
+	const int firstCol = mesh.z * spans - 1;
+	std::vector<float> H;
+	controlHeights(procedural, settings, firstRow, firstCol, count, H);
+
+	// Sample a lies a * spans / resolution spans into the patch along each side
+	const int samples = resolution + 1;
+	std::vector<float> Nu(size_t(samples) * 4), dNu(size_t(samples) * 4);
+	std::vector<int> spanOfSample(samples);
+	for (int a = 0; a < samples; a++) {
+		float t;
+		spanOf(a * spans, resolution, spans, spanOfSample[a], t);
+		cubicBasis(t, &Nu[size_t(a) * 4], &dNu[size_t(a) * 4]);
+	}
+
+	// x and z are linear in the parameters, so only the heights need evaluating
+	std::vector<glm::vec3> points(size_t(samples) * samples);
+	std::vector<glm::vec3> normals(points.size());
+	const double patchOrigin = double(spans) * resolution;
+	for (int a = 0; a < samples; a++) {
+		const float* N_u = &Nu[size_t(a) * 4];
+		const float* dN_u = &dNu[size_t(a) * 4];
+		const int rowSpan = spanOfSample[a];
+		const float x = float((mesh.x * patchOrigin + double(a) * spans) / resolution * settings.controlSpacing);
+		for (int b = 0; b < samples; b++) {
+			const float* N_v = &Nu[size_t(b) * 4];
+			const float* dN_v = &dNu[size_t(b) * 4];
+			const int colSpan = spanOfSample[b];
+			float height = 0.0f, dHdu = 0.0f, dHdv = 0.0f;
+			for (int i = 0; i < 4; i++) {
+				const float* row = &H[size_t(rowSpan + i) * count + colSpan];
+				const float rowHeight = N_v[0] * row[0] + N_v[1] * row[1] + N_v[2] * row[2] + N_v[3] * row[3];
+				const float rowSlope = dN_v[0] * row[0] + dN_v[1] * row[1] + dN_v[2] * row[2] + dN_v[3] * row[3];
+				height += N_u[i] * rowHeight;
+				dHdu += dN_u[i] * rowHeight;
+				dHdv += N_u[i] * rowSlope;
+			}
+			const float z = float((mesh.z * patchOrigin + double(b) * spans) / resolution * settings.controlSpacing);
+			points[size_t(a) * samples + b] = glm::vec3(x, height, z);
+			// One knot span is controlSpacing wide
+			normals[size_t(a) * samples + b] = glm::normalize(glm::vec3(-dHdu / settings.controlSpacing, 1.0f, -dHdv / settings.controlSpacing));
+		}
+	}
+
+	// Same vertex order as the single surface's quads
+	mesh.verts.resize(size_t(resolution) * resolution * 6);
+	mesh.normals.resize(mesh.verts.size());
+	mesh.uvs.resize(mesh.verts.size());
+	const float step = 1.0f / float(resolution);
+	for (int i = 0; i < resolution; i++) {
+		for (int j = 0; j < resolution; j++) {
+			const size_t first = (size_t(i) * resolution + j) * 6;
+			const size_t p00 = size_t(i) * samples + j, p01 = p00 + 1, p10 = p00 + samples, p11 = p10 + 1;
+			const size_t corners[6] = { p01, p00, p10, p01, p11, p10 };
+			for (int c = 0; c < 6; c++) {
+				mesh.verts[first + c] = points[corners[c]];
+				mesh.normals[first + c] = normals[corners[c]];
+				mesh.uvs[first + c] = glm::vec2(float(corners[c] / samples) * step, float(corners[c] % samples) * step);
+			}
+		}
+	}
+}
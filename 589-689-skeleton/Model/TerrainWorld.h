@@ -0,0 +1,124 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "../Geometry.h"
+#include "../JobSystem.h"
+#include "ProceduralTerrain.h"
+
+struct WorldSettings {
+	bool bEnabled = false;
+	NoiseSettings noise;
+	float minHeight = 0.0f;
+	float maxHeight = 10.0f;
+	// Knot spans along each side of a patch, and the world distance between control points
+	int patchSpans = 16;
+	float controlSpacing = 1.0f;
+	// Quads along each side of a patch's mesh
+	int patchResolution = 32;
+	// Patches kept around the camera in every direction
+	int viewRadius = 6;
+	// GPU memory the patch cache may hold; patches out of view are evicted least recently used first
+	int memoryBudgetMB = 128;
+	// Bounds the work a single frame or the workers take on, so the frame loop never waits on a patch
+	int maxJobsInFlight = 8;
+	int maxUploadsPerFrame = 2;
+	bool bIsChanging = false;
+};
+
+struct WorldStats {
+	int residentPatches = 0;
+	int pendingPatches = 0;
+	size_t residentBytes = 0;
+	uint64_t patchesGenerated = 0;
+	uint64_t patchesEvicted = 0;
+};
+
+// Unbounded terrain streamed around the camera as a lattice of patches.
+//
+// The control net is a single infinite lattice, one control point every `controlSpacing` units with
+// its height drawn from seeded noise at that position, so any patch can be built without its
+// neighbours. Every patch is the uniform cubic B-spline (a NURBS with unit weights and uniform knots)
+// over its `patchSpans` x `patchSpans` knot spans of that lattice; neighbouring patches share the
+// three control rows around their common border, so the union is one C2 surface. Border samples
+// are computed from the same control points with the same weights in the same order, so seams match
+// bit for bit. Patches are built on the JobSystem, uploaded a few per frame and evicted when the
+// cache outgrows its budget.
+class TerrainWorld {
+
+public:
+
+	TerrainWorld();
+	~TerrainWorld();
+
+	TerrainWorld(const TerrainWorld&) = delete;
+	TerrainWorld& operator=(const TerrainWorld&) = delete;
+
+	// Requests the patches around the camera, uploads finished ones and evicts over budget. Never waits.
+	void update(const glm::vec3& cameraPosition);
+	void render();
+	// Drops every patch; in-flight patches of the old world are discarded when they arrive
+	void regenerate();
+	void resetWorldToDefaults();
+	void randomizeSeed();
+
+	bool isEnabled() const { return this->worldSettings.bEnabled; }
+	// Patches are still being built or waiting to be uploaded
+	bool isStreaming() const;
+
+	WorldSettings& getWorldSettings() { return this->worldSettings; }
+	const WorldStats& getStats() const { return this->stats; }
+
+private:
+
+	struct PatchMesh {
+		int x = 0;
+		int z = 0;
+		uint64_t generation = 0;
+		std::vector<glm::vec3> verts;
+		std::vector<glm::vec2> uvs;
+		std::vector<glm::vec3> normals;
+	};
+
+	struct Patch {
+		GPU_Geometry gpuGeom;
+		GLsizei vertexCount = 0;
+		size_t bytes = 0;
+		uint64_t lastUsedFrame = 0;
+	};
+
+	static int64_t patchKey(int x, int z) { return int64_t((uint64_t(uint32_t(x)) << 32) | uint32_t(z)); }
+	// Control point heights from lattice point (firstRow, firstCol) on, `count` x `count`
+	static void controlHeights(const ProceduralTerrain& procedural, const WorldSettings& settings, int firstRow, int firstCol, int count, std::vector<float>& heights);
+	static void buildPatch(const ProceduralTerrain& procedural, const WorldSettings& settings, PatchMesh& mesh);
+
+	void requestPatches(int centerX, int centerZ);
+	void uploadPatches();
+	void evictPatches(int centerX, int centerZ);
+
+private:
+
+	WorldSettings worldSettings;
+	WorldStats stats;
+	std::shared_ptr<const ProceduralTerrain> procedural;
+	uint64_t generation = 0;
+	uint64_t frame = 0;
+
+	std::unordered_map<int64_t, std::unique_ptr<Patch>> patches;
+	// Patches submitted for the current generation and not yet uploaded
+	std::unordered_set<int64_t> pending;
+	// Jobs of any generation still running
+	int jobsInFlight = 0;
+
+	TaskGroup tasks;
+	mutable std::mutex mutex;
+	std::vector<std::unique_ptr<PatchMesh>> completed;
+
+};
@@ -0,0 +1,169 @@
+#include "UndoJournal.h"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <numeric>
+
+namespace {
+	uint32_t bitsOf(float value) {
+		uint32_t bits;
+		std::memcpy(&bits, &value, sizeof(bits));
+		return bits;
+	}
+
+	float floatOf(uint32_t bits) {
+		float value;
+		std::memcpy(&value, &bits, sizeof(value));
+		return value;
+	}
+}
+
+UndoJournal::UndoJournal(size_t memoryBudget)
+	: memoryBudget(memoryBudget)
+	, memoryUsage(0)
+	, cursor(0)
+	, openRows(0)
+	, openCols(0)
+{}
+
+void UndoJournal::touch(int rows, int cols, int row, int col, const glm::vec3& point, float weight) {
+	if (rows != this->openRows || cols != this->openCols) {
+		// First touch of a step, or the net changed size underneath an open step
+		this->openRows = rows;
+		this->openCols = cols;
+		this->openTouched.assign((size_t(rows) * cols + 63) / 64, 0);
+		this->openIndices.clear();
+		this->openValues.clear();
+	}
+	const int index = row * cols + col;
+	uint64_t& word = this->openTouched[index >> 6];
+	const uint64_t bit = uint64_t(1) << (index & 63);
+	if (word & bit) return;
+	word |= bit;
+	this->openIndices.push_back(index);
+	this->openValues.push_back(glm::vec4(point, weight));
+}
+
+bool UndoJournal::commit(const std::vector<std::vector<glm::vec3>>& P, const std::vector<std::vector<float>>& W) {
+	if (this->openIndices.empty()) return false;
+	const int rows = this->openRows;
+	const int cols = this->openCols;
+	const bool bSameNet = !P.empty() && int(P.size()) == rows && int(P[0].size()) == cols;
+
+	// Sort the touched points by index so neighbours form runs
+	std::vector<int> order(this->openIndices.size());
+	std::iota(order.begin(), order.end(), 0);
+	std::sort(order.begin(), order.end(), [this](int a, int b) { return this->openIndices[a] < this->openIndices[b]; });
+
+	Record record;
+	record.rows = rows;
+	record.cols = cols;
+	record.region = { std::numeric_limits<int>::max(), 0, std::numeric_limits<int>::max(), 0 };
+	std::vector<int> changed;
+	std::vector<glm::uvec4> xors;
+	for (int n : order) {
+		if (!bSameNet) break;
+		const int index = this->openIndices[n];
+		const int row = index / cols;
+		const int col = index % cols;
+		const glm::vec4& before = this->openValues[n];
+		const glm::vec4 after(P[row][col], W[row][col]);
+		glm::uvec4 x;
+		for (int c = 0; c < 4; c++) x[c] = bitsOf(before[c]) ^ bitsOf(after[c]);
+		if (x == glm::uvec4(0)) continue;
+		for (int c = 0; c < 4; c++) if (x[c]) record.componentMask |= uint8_t(1 << c);
+		changed.push_back(index);
+		xors.push_back(x);
+		record.region.rowBegin = std::min(record.region.rowBegin, row);
+		record.region.rowEnd = std::max(record.region.rowEnd, row + 1);
+		record.region.colBegin = std::min(record.region.colBegin, col);
+		record.region.colEnd = std::max(record.region.colEnd, col + 1);
+	}
+	this->openIndices.clear();
+	this->openValues.clear();
+	this->openRows = 0;
+	this->openCols = 0;
+	if (changed.empty()) return false;
+
+	for (size_t n = 0; n < changed.size(); n++) {
+		if (!record.runs.empty() && record.runs[record.runs.size() - 2] + record.runs.back() == uint32_t(changed[n])) {
+			record.runs.back()++;
+		} else {
+			record.runs.push_back(uint32_t(changed[n]));
+			record.runs.push_back(1);
+		}
+		for (int c = 0; c < 4; c++) {
+			if (record.componentMask & (1 << c)) record.deltas.push_back(xors[n][c]);
+		}
+	}
+	record.runs.shrink_to_fit();
+	record.deltas.shrink_to_fit();
+
+	// A new step discards whatever could have been redone
+	while (this->records.size() > this->cursor) {
+		this->memoryUsage -= this->records.back().bytes();
+		this->records.pop_back();
+	}
+	this->memoryUsage += record.bytes();
+	this->records.push_back(std::move(record));
+	this->cursor = this->records.size();
+	this->evict();
+	return true;
+}
+
+bool UndoJournal::undo(std::vector<std::vector<glm::vec3>>& P, std::vector<std::vector<float>>& W, Range2D& dirtyRegion) {
+	if (!this->canUndo()) return false;
+	if (!this->toggle(this->records[this->cursor - 1], P, W, dirtyRegion)) return false;
+	this->cursor--;
+	return true;
+}
+
+bool UndoJournal::redo(std::vector<std::vector<glm::vec3>>& P, std::vector<std::vector<float>>& W, Range2D& dirtyRegion) {
+	if (!this->canRedo()) return false;
+	if (!this->toggle(this->records[this->cursor], P, W, dirtyRegion)) return false;
+	this->cursor++;
+	return true;
+}
+
+void UndoJournal::clear() {
+	this->records.clear();
+	this->cursor = 0;
+	this->memoryUsage = 0;
+	this->openIndices.clear();
+	this->openValues.clear();
+	this->openRows = 0;
+	this->openCols = 0;
+}
+
+void UndoJournal::setMemoryBudget(size_t memoryBudget) {
+	this->memoryBudget = memoryBudget;
+	this->evict();
+}
+
+bool UndoJournal::toggle(const Record& record, std::vector<std::vector<glm::vec3>>& P, std::vector<std::vector<float>>& W, Range2D& dirtyRegion) {
+	if (P.empty() || int(P.size()) != record.rows || int(P[0].size()) != record.cols) return false;
+	size_t delta = 0;
+	for (size_t r = 0; r < record.runs.size(); r += 2) {
+		for (uint32_t index = record.runs[r]; index < record.runs[r] + record.runs[r + 1]; index++) {
+			glm::vec3& point = P[index / record.cols][index % record.cols];
+			float& weight = W[index / record.cols][index % record.cols];
+			for (int c = 0; c < 3; c++) {
+				if (record.componentMask & (1 << c)) point[c] = floatOf(bitsOf(point[c]) ^ record.deltas[delta++]);
+			}
+			if (record.componentMask & (1 << 3)) weight = floatOf(bitsOf(weight) ^ record.deltas[delta++]);
+		}
+	}
+	dirtyRegion = record.region;
+	return true;
+}
+
+void UndoJournal::evict() {
+	// Drop the oldest undoable steps, but always keep the latest one. Redo steps have to
+	// stay contiguous with the current state, so they are never evicted from the front.
+	while (this->memoryUsage > this->memoryBudget && this->records.size() > 1 && this->cursor > 0) {
+		this->memoryUsage -= this->records.front().bytes();
+		this->records.pop_front();
+		this->cursor--;
+	}
+}
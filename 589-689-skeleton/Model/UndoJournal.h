@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "../JobSystem.h"
+
+// Undo history for control net edits. Instead of snapshots, every step stores only the
+// control points it changed: their indices as run-length encoded runs, and the XOR of
+// the old and new bits of each changed component (x, y, z, weight). Applying the same
+// XOR again turns new back into old and old into new, so one record serves both undo
+// and redo. Records live in a ring bounded by a byte budget; the oldest are dropped first.
+class UndoJournal {
+
+public:
+
+	explicit UndoJournal(size_t memoryBudget = 64 * 1024 * 1024);
+
+	// Remembers the value a point had before the open step first touched it. Call before modifying.
+	void touch(int rows, int cols, int row, int col, const glm::vec3& point, float weight);
+	// Closes the open step against the current net. Returns false if nothing actually changed.
+	bool commit(const std::vector<std::vector<glm::vec3>>& P, const std::vector<std::vector<float>>& W);
+	bool hasOpenStep() const { return !this->openIndices.empty(); }
+
+	// Toggle the most recent / next step on P and W. `dirtyRegion` receives the touched control points.
+	bool undo(std::vector<std::vector<glm::vec3>>& P, std::vector<std::vector<float>>& W, Range2D& dirtyRegion);
+	bool redo(std::vector<std::vector<glm::vec3>>& P, std::vector<std::vector<float>>& W, Range2D& dirtyRegion);
+	bool canUndo() const { return this->cursor > 0; }
+	bool canRedo() const { return this->cursor < this->records.size(); }
+
+	// The net was replaced, nothing recorded so far applies to it any more.
+	void clear();
+
+	size_t getMemoryUsage() const { return this->memoryUsage; }
+	size_t getMemoryBudget() const { return this->memoryBudget; }
+	void setMemoryBudget(size_t memoryBudget);
+
+private:
+
+	struct Record {
+		int rows = 0;
+		int cols = 0;
+		// Bit c set if component c (x, y, z, weight) changed for any point of the step
+		uint8_t componentMask = 0;
+		// (first index, length) pairs
+		std::vector<uint32_t> runs;
+		// For every point of the runs, one word per component in componentMask
+		std::vector<uint32_t> deltas;
+		Range2D region;
+
+		size_t bytes() const { return sizeof(Record) + (this->runs.capacity() + this->deltas.capacity()) * sizeof(uint32_t); }
+	};
+
+	bool toggle(const Record& record, std::vector<std::vector<glm::vec3>>& P, std::vector<std::vector<float>>& W, Range2D& dirtyRegion);
+	void evict();
+
+private:
+
+	size_t memoryBudget;
+	size_t memoryUsage;
+
+	std::deque<Record> records;
+	// records[0, cursor) can be undone, records[cursor, end) redone
+	size_t cursor;
+
+	// Open step: first-touch values, and which indices already have one
+	int openRows;
+	int openCols;
+	std::vector<uint64_t> openTouched;
+	std::vector<int> openIndices;
+	std::vector<glm::vec4> openValues;
+
+};
@@ -38,4 +38,10 @@ void VertexBuffer::uploadData(GLsizeiptr size, const void* data, GLenum usage) {
 		attribArrayEnabled = false;
 	}
 
-}
\ No newline at end of file
+}
+
+void VertexBuffer::updateData(GLintptr offset, GLsizeiptr size, const void* data) {
+	if (size <= 0) return;
+	bind();
+	glBufferSubData(GL_ARRAY_BUFFER, offset, size, data);
+}
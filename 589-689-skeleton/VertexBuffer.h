@@ -20,6 +20,8 @@ public:
 	// Public interface
 	void bind() const { glBindBuffer(GL_ARRAY_BUFFER, bufferID); }
 	void uploadData(GLsizeiptr size, const void* data, GLenum usage);
+	// Overwrites part of the existing storage; the buffer must already hold offset + size bytes.
+	void updateData(GLintptr offset, GLsizeiptr size, const void* data);
 
 private:
 	VertexBufferHandle bufferID;
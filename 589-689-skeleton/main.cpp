@@ -5,27 +5,46 @@
 #include <limits>
 #include <functional>
 #include <unordered_map>
+#include <array>
 
 #include "Window.h"
 #include "ShaderProgram.h"
 #include "Shader.h"
 #include "Camera.h"
+#include "JobSystem.h"
+#include "InputEventRing.h"
+
+#include "argh.h"
 
 #include "glm/glm.hpp"
 #include "glm/gtc/type_ptr.hpp"
 
 #include "Model/Model.h"
 
+// A cursor position recorded by the callbacks, in screen coordinates.
+struct CursorSample {
+	glm::vec2 screenPos;
+	double time;
+};
+
 class InputManager : public CallbackInterface {
 
 private:
 	ShaderProgram& shader;
+	FrameScheduler& frameScheduler;
 
 	glm::ivec2 screenDim;
 	glm::vec2 screenPos;
 
-	std::unordered_map<int, bool> pressedKeys;
-	std::unordered_map<int, bool> heldKeys;
+	// Filled by the GLFW callbacks, drained once per frame by processEvents()
+	InputEventRing events;
+
+	// Indexed by GLFW key or mouse button code
+	std::array<bool, GLFW_KEY_LAST + 1> pressedKeys;
+	std::array<bool, GLFW_KEY_LAST + 1> heldKeys;
+
+	// Every cursor position received since the last frame, oldest first
+	std::vector<CursorSample> cursorSamples;
 
 	Camera camera;
 	double mouseOldX, mouseOldY;
@@ -34,8 +53,9 @@ private:
 	bool bIsScrollingDown;
 
 public:
-	InputManager(ShaderProgram& shader, int screenWidth, int screenHeight) :
+	InputManager(ShaderProgram& shader, FrameScheduler& frameScheduler, int screenWidth, int screenHeight) :
 		shader(shader),
+		frameScheduler(frameScheduler),
 		camera((float)screenWidth / (float)screenHeight, glm::vec3(-13.001894f, 10.81906f, 16.41005f)),
 		screenDim(screenWidth, screenHeight),
 		mouseOldX(-1.0),
@@ -43,85 +63,98 @@ public:
 		bIsScrollingUp(false),
 		bIsScrollingDown(false)
 	{
-		this->pressedKeys = std::unordered_map<int, bool>({
-			{GLFW_KEY_E, false},
-			{GLFW_KEY_R, false}
-		});
-		this->heldKeys = std::unordered_map <int, bool>({
-			{GLFW_KEY_W, false},
-			{GLFW_KEY_A, false},
-			{GLFW_KEY_S, false},
-			{GLFW_KEY_D, false},
-			{GLFW_MOUSE_BUTTON_LEFT, false}
-		});
+		this->pressedKeys.fill(false);
+		this->heldKeys.fill(false);
+		this->cursorSamples.reserve(InputEventRing::capacity());
 	}
 
 	virtual void keyCallback(int key, int scancode, int action, int mods) {
-		if (ImGui::IsWindowHovered(ImGuiHoveredFlags_AnyWindow)) {
-			for (auto& it : this->heldKeys) it.second = false;
-			return;
-		}
-		this->pressedKeys[key] = action == GLFW_PRESS;
-		this->heldKeys[key] = action == GLFW_REPEAT || action == GLFW_PRESS;
+		InputEvent event;
+		event.type = InputEventType::Key;
+		event.code = key;
+		event.action = action;
+		event.mods = mods;
+		this->pushEvent(event);
 	}
 
 	virtual void mouseButtonCallback(int button, int action, int mods) {
-		if (ImGui::IsWindowHovered(ImGuiHoveredFlags_AnyWindow)) {
-			for (auto& it : this->heldKeys) it.second = false;
-			return;
-		}
-		this->pressedKeys[button] = action == GLFW_PRESS;
-		this->heldKeys[button] = action == GLFW_PRESS;
+		InputEvent event;
+		event.type = InputEventType::MouseButton;
+		event.code = button;
+		event.action = action;
+		event.mods = mods;
+		this->pushEvent(event);
 	}	
 
 	virtual void cursorPosCallback(double xpos, double ypos) {
-		if (ImGui::IsWindowHovered(ImGuiHoveredFlags_AnyWindow)) {
-			for (auto& it : this->heldKeys) it.second = false;
-			return;
-		}
-		this->screenPos.x = (float)xpos;
-		this->screenPos.y = (float)ypos;
-		if (this->onKeyHeld(GLFW_MOUSE_BUTTON_RIGHT)) {
-			if (this->camera.getCameraType() == CameraType::panMode) {
-				this->camera.handleRotation(xpos - this->mouseOldX, ypos - this->mouseOldY);
-			} else if (this->camera.getCameraType() == CameraType::rotationalMode) {
-				camera.incrementTheta(ypos - this->mouseOldY);
-				camera.incrementPhi(xpos - this->mouseOldX);
-			}
-		}
-		this->mouseOldX = xpos;
-		this->mouseOldY = ypos;
+		InputEvent event;
+		event.type = InputEventType::CursorPos;
+		event.x = xpos;
+		event.y = ypos;
+		this->pushEvent(event);
 	}
 	virtual void scrollCallback(double xoffset, double yoffset) {
-		if (ImGui::IsWindowHovered(ImGuiHoveredFlags_AnyWindow)) {
-			for (auto& it : this->heldKeys) it.second = false;
-			return;
-		}
-		if (this->camera.getCameraType() == CameraType::rotationalMode) {
-			camera.incrementR(yoffset);
-		}
-		this->bIsScrollingUp = (yoffset > 0);
-		this->bIsScrollingDown = (yoffset < 0);
+		InputEvent event;
+		event.type = InputEventType::Scroll;
+		event.x = xoffset;
+		event.y = yoffset;
+		this->pushEvent(event);
 	}
 
 	virtual void windowSizeCallback(int width, int height) {
 		CallbackInterface::windowSizeCallback(width, height);
+		this->frameScheduler.requestRedraw();
 		this->screenDim = glm::ivec2(width, height);
 		glViewport(0, 0, width, height);
 	}
 
+	// Applies every event recorded since the last frame, in the order they arrived
+	void processEvents() {
+		InputEvent event;
+		while (this->events.pop(event)) {
+			if (event.bOverUI) {
+				this->heldKeys.fill(false);
+				continue;
+			}
+			switch (event.type) {
+			case InputEventType::Key:
+				if (!isValidCode(event.code)) break;
+				this->pressedKeys[event.code] = event.action == GLFW_PRESS;
+				this->heldKeys[event.code] = event.action == GLFW_REPEAT || event.action == GLFW_PRESS;
+				break;
+			case InputEventType::MouseButton:
+				if (!isValidCode(event.code)) break;
+				this->pressedKeys[event.code] = event.action == GLFW_PRESS;
+				this->heldKeys[event.code] = event.action == GLFW_PRESS;
+				break;
+			case InputEventType::CursorPos:
+				this->handleCursor(event.x, event.y);
+				if (this->cursorSamples.size() < this->cursorSamples.capacity()) this->cursorSamples.push_back({ this->screenPos, event.time });
+				break;
+			case InputEventType::Scroll:
+				if (this->camera.getCameraType() == CameraType::rotationalMode) {
+					camera.incrementR(event.y);
+				}
+				this->bIsScrollingUp = (event.y > 0);
+				this->bIsScrollingDown = (event.y < 0);
+				break;
+			}
+		}
+	}
+
 	void refreshInput() {
-		for (auto& it : this->pressedKeys) it.second = false;
+		this->pressedKeys.fill(false);
+		this->cursorSamples.clear();
 		this->bIsScrollingUp = false;
 		this->bIsScrollingDown = false;
 	}
 
-	bool onKeyDown(int key) {
-		return this->pressedKeys[key];
+	bool onKeyDown(int key) const {
+		return isValidCode(key) && this->pressedKeys[key];
 	}
 
-	bool onKeyHeld(int key) {
-		return this->heldKeys[key];
+	bool onKeyHeld(int key) const {
+		return isValidCode(key) && this->heldKeys[key];
 	}
 
 	bool isScrollingUp() const {
@@ -132,6 +165,41 @@ public:
 		return this->bIsScrollingDown;
 	}
 
+	bool isAnimating() const {
+		return this->heldKeys[GLFW_KEY_W] || this->heldKeys[GLFW_KEY_A] || this->heldKeys[GLFW_KEY_S] || this->heldKeys[GLFW_KEY_D] || this->heldKeys[GLFW_MOUSE_BUTTON_LEFT];
+	}
+
+	const std::vector<CursorSample>& getCursorSamples() const { return this->cursorSamples; }
+
+private:
+
+	static bool isValidCode(int code) {
+		return code >= 0 && code <= GLFW_KEY_LAST;
+	}
+
+	void pushEvent(InputEvent& event) {
+		this->frameScheduler.requestRedraw();
+		event.time = glfwGetTime();
+		event.bOverUI = ImGui::IsWindowHovered(ImGuiHoveredFlags_AnyWindow);
+		this->events.push(event);
+	}
+
+	void handleCursor(double xpos, double ypos) {
+		this->screenPos.x = (float)xpos;
+		this->screenPos.y = (float)ypos;
+		if (this->onKeyHeld(GLFW_MOUSE_BUTTON_RIGHT)) {
+			if (this->camera.getCameraType() == CameraType::panMode) {
+				this->camera.handleRotation(xpos - this->mouseOldX, ypos - this->mouseOldY);
+			} else if (this->camera.getCameraType() == CameraType::rotationalMode) {
+				camera.incrementTheta(ypos - this->mouseOldY);
+				camera.incrementPhi(xpos - this->mouseOldX);
+			}
+		}
+		this->mouseOldX = xpos;
+		this->mouseOldY = ypos;
+	}
+
+public:
 
 	void viewPipeline(bool bIdentity = false) {
 		glm::mat4 M = glm::mat4(1.0);
@@ -151,6 +219,10 @@ public:
 		glUniform1i(glGetUniformLocation(this->shader, "texExistence"), (int)model.hasTexture());
 	}
 
+	glm::vec3 getCameraPosition() {
+		return (this->camera.getCameraType() == CameraType::panMode) ? this->camera.getOrientation().position : this->camera.getRotationalCameraPos();
+	}
+
 	glm::vec2 getMousePosition2D() {
 		glm::vec2 startingVec = this->screenPos;
 		glm::vec2 shiftedVec = startingVec + glm::vec2(0.5f, 0.5f);
@@ -160,16 +232,21 @@ public:
 		return finalVec;
 	}
 
-	glm::vec3 getMousePosition3D() {
+	// World space ray through the cursor
+	void getMouseRay(glm::vec3& rayOrigin, glm::vec3& rayDirection) {
+		this->getMouseRay(this->screenPos, rayOrigin, rayDirection);
+	}
+
+	void getMouseRay(const glm::vec2& screenPos, glm::vec3& rayOrigin, glm::vec3& rayDirection) {
 		float width = this->screenDim.x;
 		float height = this->screenDim.y;
 
 		glm::mat4 projectionMatrix = this->camera.getPerspective();
 		glm::mat4 viewMatrix = this->camera.getView();
-		glm::vec3 cameraPosition = (this->camera.getCameraType() == CameraType::panMode) ? this->camera.getOrientation().position : this->camera.getRotationalCameraPos();
+		glm::vec3 cameraPosition = this->getCameraPosition();
 
-		float x = (2.0f * this->screenPos.x) / width - 1.0f;
-		float y = 1.0f - (2.0f * this->screenPos.y) / height;
+		float x = (2.0f * screenPos.x) / width - 1.0f;
+		float y = 1.0f - (2.0f * screenPos.y) / height;
 		float z = 1.0f;
 
 		// Compute the ray in clip space
@@ -182,10 +259,19 @@ public:
 
 		// Compute the ray in world space
 		glm::vec3 ray_wor = glm::vec3(glm::inverse(viewMatrix) * ray_eye);
-		ray_wor = glm::normalize(ray_wor);
+		rayDirection = glm::normalize(ray_wor);
 
 		// Shift the ray origin by the camera position
-		glm::vec3 ray_origin = cameraPosition;
+		rayOrigin = cameraPosition;
+	}
+
+	glm::vec3 getMousePosition3D() {
+		return this->getMousePosition3D(this->screenPos);
+	}
+
+	glm::vec3 getMousePosition3D(const glm::vec2& screenPos) {
+		glm::vec3 ray_origin, ray_wor;
+		this->getMouseRay(screenPos, ray_origin, ray_wor);
 
 		// Compute the intersection point with the x-z plane at y=0
 		float t = -ray_origin.y / ray_wor.y;
@@ -194,36 +280,51 @@ public:
 		return intersection_point;
 	}
 
+	// Where the cursor ray hits the terrain, or the y=0 plane if it misses the surface
+	glm::vec3 getMousePositionOnSurface(const FFS& terrain) {
+		return this->getMousePositionOnSurface(terrain, this->screenPos);
+	}
+
+	glm::vec3 getMousePositionOnSurface(const FFS& terrain, const glm::vec2& screenPos) {
+		glm::vec3 rayOrigin, rayDirection;
+		this->getMouseRay(screenPos, rayOrigin, rayDirection);
+		SurfacePick pick = terrain.pickSurface(rayOrigin, rayDirection);
+		return pick.bHit ? pick.point : this->getMousePosition3D(screenPos);
+	}
+
 	Camera& getCamera() { return this->camera; }
 
 };
 
-int main() {
+int main(int argc, char** argv) {
 	Log::debug("Starting main");
 
+	// Command line: --workers <count> --pin-threads
+	argh::parser cmdl(argc, argv, argh::parser::PREFER_PARAM_FOR_UNREG_OPTION);
+	JobSystemSettings jobSettings;
+	cmdl("workers", jobSettings.workerCount) >> jobSettings.workerCount;
+	jobSettings.bPinThreads = cmdl["pin-threads"];
+	JobSystem::initialize(jobSettings);
+
 	glfwInit();
 	Window window(1920, 1080, "CPSC 589/689 - Project");
 	ShaderProgram shader("shaders/test.vert", "shaders/test.frag");
 
-	std::shared_ptr<InputManager> inputManager = std::make_shared<InputManager>(shader, window.getWidth(), window.getHeight());
+	std::shared_ptr<InputManager> inputManager = std::make_shared<InputManager>(shader, window.getFrameScheduler(), window.getWidth(), window.getHeight());
 	window.setCallbacks(inputManager);
 	window.setupImGui();
 
 	Model model = Model();
+	model.getTerrain()->setSurfaceReadyCallback([&window]() { window.getFrameScheduler().requestRedraw(); });
 
 	shader.use();
 	inputManager->updateShadingUniforms(model);
 
 	while (!window.shouldClose()) {
 
-		// Calculate time since last frame
-		double currentTime = glfwGetTime();
-		window.getFrameRateLimitSettings().deltaTime += currentTime - window.getFrameRateLimitSettings().lastTime;
-		window.getFrameRateLimitSettings().lastTime = currentTime;
-		if (window.getFrameRateLimitSettings().deltaTime < window.getFrameRateLimitSettings().maxPeriod) continue;
-
-		inputManager->refreshInput();
-		glfwPollEvents();
+		// Sleep until the next frame is due and something needs to be redrawn
+		if (!window.getFrameScheduler().waitForNextFrame()) continue;
+		inputManager->processEvents();
 
 		glEnable(GL_LINE_SMOOTH);
 		glEnable(GL_FRAMEBUFFER_SRGB);
@@ -238,27 +339,51 @@ int main() {
 		if (inputManager->onKeyHeld(GLFW_KEY_S)) inputManager->getCamera().handleTranslation(GLFW_KEY_S);
 		if (inputManager->onKeyHeld(GLFW_KEY_D)) inputManager->getCamera().handleTranslation(GLFW_KEY_D);
 
-		if (inputManager->onKeyDown(GLFW_KEY_E)) model.getTerrain()->resetSelectedControlPoints();
-		if (inputManager->onKeyDown(GLFW_KEY_R)) model.getTerrain()->resetSelectedWeights();
-
-		glm::vec3 mousePosition3D = inputManager->getMousePosition3D();
-		model.getTerrain()->detectControlPoints(mousePosition3D);
-
-		if (inputManager->onKeyHeld(GLFW_MOUSE_BUTTON_LEFT)) {
-			float val = (model.getTerrain()->getBrushSettings().bIsRising) ? 0.1f : -0.1f;
-			model.getTerrain()->updateControlPointsPosition(val);
-		}
+		// The world is not editable; editing input goes to the terrain only
+		if (!model.getWorld()->isEnabled()) {
+			if (inputManager->onKeyHeld(GLFW_KEY_LEFT_CONTROL) && inputManager->onKeyDown(GLFW_KEY_Z)) model.getTerrain()->undo();
+			if (inputManager->onKeyHeld(GLFW_KEY_LEFT_CONTROL) && inputManager->onKeyDown(GLFW_KEY_Y)) model.getTerrain()->redo();
+			if (inputManager->onKeyDown(GLFW_KEY_E)) model.getTerrain()->resetSelectedControlPoints();
+			if (inputManager->onKeyDown(GLFW_KEY_R)) model.getTerrain()->resetSelectedWeights();
+
+			glm::vec3 mousePosition3D = inputManager->getMousePositionOnSurface(*model.getTerrain());
+			// A net in a store pages in the window under the brush
+			model.getTerrain()->followNetStore(mousePosition3D);
+			model.getTerrain()->detectControlPoints(mousePosition3D);
+
+			if (inputManager->onKeyHeld(GLFW_MOUSE_BUTTON_LEFT)) {
+				if (inputManager->onKeyHeld(GLFW_KEY_LEFT_SHIFT)) {
+					model.getTerrain()->addBrushToStoredSelection();
+				} else if (inputManager->onKeyHeld(GLFW_KEY_LEFT_CONTROL)) {
+					model.getTerrain()->removeBrushFromStoredSelection();
+				} else if (inputManager->onKeyHeld(GLFW_KEY_LEFT_ALT) || model.getTerrain()->isDraggingSurface()) {
+					glm::vec3 rayOrigin, rayDirection;
+					inputManager->getMouseRay(rayOrigin, rayDirection);
+					model.getTerrain()->dragSurface(rayOrigin, rayDirection);
+				} else {
+					// Stamp along every cursor position received since the last frame, then up to now
+					for (const CursorSample& sample : inputManager->getCursorSamples()) {
+						model.getTerrain()->strokeTo(inputManager->getMousePositionOnSurface(*model.getTerrain(), sample.screenPos), sample.time);
+					}
+					model.getTerrain()->strokeTo(mousePosition3D, glfwGetTime());
+				}
+			} else {
+				model.getTerrain()->endStroke();
+				model.getTerrain()->endSurfaceDrag();
+			}
 
-		if (inputManager->isScrollingUp()) {
-			model.getTerrain()->updateControlPointsWeights(1.0f * model.getTerrain()->getNURBSSettings().weightRate);
-		} else if (inputManager->isScrollingDown()) {
-			model.getTerrain()->updateControlPointsWeights(-1.0f * model.getTerrain()->getNURBSSettings().weightRate);
+			if (inputManager->isScrollingUp()) {
+				model.getTerrain()->updateControlPointsWeights(1.0f * model.getTerrain()->getNURBSSettings().weightRate);
+			} else if (inputManager->isScrollingDown()) {
+				model.getTerrain()->updateControlPointsWeights(-1.0f * model.getTerrain()->getNURBSSettings().weightRate);
+			}
 		}
 
 		// ImGUI
 		model.getPhongLighting().bIsChanging = false;
 		model.getTerrain()->getTerrainSettings().bIsChanging = false;
 		model.getTerrain()->getNURBSSettings().bIsChanging = false;
+		model.getWorld()->getWorldSettings().bIsChanging = false;
 		ImGui_ImplOpenGL3_NewFrame();
 		ImGui_ImplGlfw_NewFrame();
 		ImGui::NewFrame();
@@ -272,8 +397,10 @@ int main() {
 				for (int i = 0; i < 3; i++) ImGui::Spacing();
 				ImGui::Text("Basic Terrain Settings:");
 				for (int i = 0; i < 3; i++) ImGui::Spacing();
-				model.getTerrain()->getTerrainSettings().bIsChanging |= ImGui::SliderInt("Control Points", &model.getTerrain()->getTerrainSettings().nControlPoints, 6, 100);
-				model.getTerrain()->getTerrainSettings().bIsChanging |= ImGui::SliderFloat("Terrain Size", &model.getTerrain()->getTerrainSettings().terrainSize, 10.0f, 100.0f);
+				model.getTerrain()->getTerrainSettings().bIsChanging |= ImGui::SliderInt("Control Points u (x)", &model.getTerrain()->getTerrainSettings().nControlPointsU, 6, 1000, "%d", ImGuiSliderFlags_Logarithmic);
+				model.getTerrain()->getTerrainSettings().bIsChanging |= ImGui::SliderInt("Control Points v (z)", &model.getTerrain()->getTerrainSettings().nControlPointsV, 6, 1000, "%d", ImGuiSliderFlags_Logarithmic);
+				model.getTerrain()->getTerrainSettings().bIsChanging |= ImGui::SliderFloat("Terrain Size u (x)", &model.getTerrain()->getTerrainSettings().terrainSizeU, 10.0f, 500.0f, "%.1f", ImGuiSliderFlags_Logarithmic);
+				model.getTerrain()->getTerrainSettings().bIsChanging |= ImGui::SliderFloat("Terrain Size v (z)", &model.getTerrain()->getTerrainSettings().terrainSizeV, 10.0f, 500.0f, "%.1f", ImGuiSliderFlags_Logarithmic);
 				if (ImGui::Button("Reset to Defaults")) model.getTerrain()->resetTerrainToDefaults();
 				for (int i = 0; i < 3; i++) ImGui::Spacing();
 				ImGui::Text("Random Terrain Generation Settings:");
@@ -281,6 +408,23 @@ int main() {
 				ImGui::SliderFloat("Skip Probability", &model.getTerrain()->getRandomGenerationSettings().skipProbability, 0.0f, 1.0f);
 				ImGui::SliderFloat("Min Height", &model.getTerrain()->getRandomGenerationSettings().minHeight, -10.0f, model.getTerrain()->getRandomGenerationSettings().maxHeight);
 				ImGui::SliderFloat("Max Height", &model.getTerrain()->getRandomGenerationSettings().maxHeight, model.getTerrain()->getRandomGenerationSettings().minHeight, 30.0f);
+				NoiseSettings& noise = model.getTerrain()->getRandomGenerationSettings().noise;
+				if (ImGui::BeginCombo("Noise", ProceduralTerrain::modeName(noise.mode))) {
+					for (int n = 0; n < NOISE_MODE_COUNT; n++) {
+						bool is_selected = (noise.mode == NoiseMode(n));
+						if (ImGui::Selectable(ProceduralTerrain::modeName(NoiseMode(n)), is_selected)) noise.mode = NoiseMode(n);
+						if (is_selected) ImGui::SetItemDefaultFocus();
+					}
+					ImGui::EndCombo();
+				}
+				ImGui::InputScalar("Seed", ImGuiDataType_U32, &noise.seed);
+				ImGui::SameLine();
+				if (ImGui::Button("Randomize")) model.getTerrain()->randomizeSeed();
+				ImGui::SliderInt("Octaves", &noise.octaves, 1, 12);
+				ImGui::SliderFloat("Frequency", &noise.frequency, 0.005f, 1.0f, "%.3f", ImGuiSliderFlags_Logarithmic);
+				ImGui::SliderFloat("Lacunarity", &noise.lacunarity, 1.5f, 3.0f);
+				ImGui::SliderFloat("Gain", &noise.gain, 0.1f, 0.9f);
+				if (noise.mode == NoiseMode::DomainWarp) ImGui::SliderFloat("Warp Strength", &noise.warpStrength, 0.0f, 20.0f);
 				if (ImGui::Button("Random Generation")) model.getTerrain()->generateRandomTerrain();
 				if (ImGui::Button("Reset RNG Settings")) model.getTerrain()->resetRandomGenerationSettings();
 				for (int i = 0; i < 5; i++) ImGui::Spacing();
@@ -290,6 +434,9 @@ int main() {
 				}
 				for (int i = 0; i < 3; i++) ImGui::Spacing();
 				ImGui::Text("Average %.1f ms/frame (%.1f fps)", 1000.0f / ImGui::GetIO().Framerate, ImGui::GetIO().Framerate);
+				ImGui::Text("CPU busy %.1f%% / idle %.1f%% (%.1f frames/s drawn)", window.getFrameScheduler().getStats().busyPercent, window.getFrameScheduler().getStats().idlePercent, window.getFrameScheduler().getStats().framesPerSecond);
+				ImGui::Text("Job workers: %d (%llu tasks, %llu stolen)", JobSystem::get().getWorkerCount(), (unsigned long long)JobSystem::get().getStats().tasksExecuted, (unsigned long long)JobSystem::get().getStats().tasksStolen);
+				ImGui::Checkbox("Redraw On Demand", &window.getFrameScheduler().getSettings().bOnDemand);
 				ImGui::PopItemWidth();
 				ImGui::EndTabItem();
 			}
@@ -298,7 +445,9 @@ int main() {
 				for (int i = 0; i < 3; i++) ImGui::Spacing();
 				model.getTerrain()->getNURBSSettings().bIsChanging |= ImGui::SliderInt("Order u: ", &model.getTerrain()->getNURBSSettings().k_u, 2, model.getTerrain()->getGeneratedTerrain().generatedPoints.size());
 				model.getTerrain()->getNURBSSettings().bIsChanging |= ImGui::SliderInt("Order v: ", &model.getTerrain()->getNURBSSettings().k_v, 2, model.getTerrain()->getGeneratedTerrain().generatedPoints[0].size());
-				model.getTerrain()->getNURBSSettings().bIsChanging |= ImGui::SliderFloat("Resolution: ", &model.getTerrain()->getNURBSSettings().resolution, 10, 200);
+				model.getTerrain()->getNURBSSettings().bIsChanging |= ImGui::SliderFloat("Resolution u: ", &model.getTerrain()->getNURBSSettings().resolutionU, 10, 2000, "%.0f", ImGuiSliderFlags_Logarithmic);
+				model.getTerrain()->getNURBSSettings().bIsChanging |= ImGui::SliderFloat("Resolution v: ", &model.getTerrain()->getNURBSSettings().resolutionV, 10, 2000, "%.0f", ImGuiSliderFlags_Logarithmic);
+				ImGui::Text("Surface tiles: %d (%d updated by the last edit)", model.getTerrain()->getSurfaceTiles().getTileCount(), model.getTerrain()->getSurfaceTiles().getLastUpdateCount());
 				ImGui::SliderFloat("Weight Change Rate: ", &model.getTerrain()->getNURBSSettings().weightRate, 1.0f, 10.0f);
 				ImGui::Checkbox("Display Control Points", &model.getTerrain()->getNURBSSettings().bDisplayControlPoints);
 				ImGui::Checkbox("Display Line Segments", &model.getTerrain()->getNURBSSettings().bDisplayLineSegments);
@@ -306,6 +455,24 @@ int main() {
 				for (int i = 0; i < 3; i++) ImGui::Spacing();
 				if (ImGui::Button("Reset All Control Points")) model.getTerrain()->resetAllControlPoints();
 				if (ImGui::Button("Reset All Weights")) model.getTerrain()->resetAllWeights();
+				for (int i = 0; i < 5; i++) ImGui::Spacing();
+				ImGui::Text("Local Refinement:");
+				ImGui::Text("Adds a finer level of control points over the stored selection only");
+				if (ImGui::Button("Refine Stored Selection")) model.getTerrain()->refineStoredSelection();
+				ImGui::SameLine();
+				if (ImGui::Button("Remove Refinements")) model.getTerrain()->removeDetail();
+				const DetailHierarchy& detailHierarchy = model.getTerrain()->getDetailHierarchy();
+				ImGui::SliderInt("Brush Level", &model.getTerrain()->getDetailSettings().editLevel, 0, detailHierarchy.getMaxLevel());
+				ImGui::Text("%d patches, %zu detail control points", int(detailHierarchy.getPatches().size()), detailHierarchy.getControlCount());
+				for (int i = 0; i < 5; i++) ImGui::Spacing();
+				ImGui::Text("Displacement Sculpting:");
+				ImGui::Text("Paints fine detail along the surface normal, finer than any control net");
+				ImGui::Checkbox("Sculpt Displacement", &model.getTerrain()->getDisplacementSettings().bSculpt);
+				ImGui::SameLine();
+				if (ImGui::Button("Clear Displacement")) model.getTerrain()->clearDisplacement();
+				ImGui::SliderFloat("Displacement Strength", &model.getTerrain()->getDisplacementSettings().strength, 0.01f, 1.0f, "%.2f", ImGuiSliderFlags_Logarithmic);
+				const DisplacementLayer& displacementLayer = model.getTerrain()->getDisplacementLayer();
+				ImGui::Text("%d tiles painted, %.1f MB pooled", displacementLayer.getTileCount(), float(displacementLayer.getMemoryBytes()) / (1024.0f * 1024.0f));
 				for (int i = 0; i < 3; i++) ImGui::Spacing();
 				ImGui::Text("E - Reset Selected Control Points");
 				ImGui::Text("R - Reset Selected Weights");
@@ -319,26 +486,151 @@ int main() {
 				for (int i = 0; i < 3; i++) ImGui::Spacing();
 				ImGui::SliderFloat("Radius of Brush: ", &model.getTerrain()->getBrushSettings().brushRadius, 0.1f, 10.5f);
 				ImGui::SliderFloat("Brush Speed: ", &model.getTerrain()->getBrushSettings().brushRateScale, 0.5f, 10.0f);
+				ImGui::SliderFloat("Stamp Spacing: ", &model.getTerrain()->getBrushSettings().stampSpacing, 0.05f, 1.0f);
 				for (int i = 0; i < 3; i++) ImGui::Spacing();
 				ImGui::Checkbox("Rise/Lower", &model.getTerrain()->getBrushSettings().bIsRising);
 				ImGui::Checkbox("Display Bursh Area", &model.getTerrain()->getBrushSettings().bDisplayBrushArea);
 				for (int i = 0; i < 5; i++) ImGui::Spacing();
 				ImGui::Text("Bursh Blending Settings:");
 				for (int i = 0; i < 3; i++) ImGui::Spacing();
-				if (ImGui::BeginCombo("Blend Function", model.getTerrain()->getBrushSettings().items[model.getTerrain()->getBrushSettings().current_item])) {
-					for (int n = 0; n < 3; n++) {
-						bool is_selected = (model.getTerrain()->getBrushSettings().current_item == n);
-						if (ImGui::Selectable(model.getTerrain()->getBrushSettings().items[n], is_selected))
-							model.getTerrain()->getBrushSettings().current_item = n;
+				if (ImGui::BeginCombo("Blend Function", BrushKernels::falloffName(model.getTerrain()->getBrushSettings().falloff))) {
+					for (int n = 0; n < BRUSH_FALLOFF_COUNT; n++) {
+						bool is_selected = (model.getTerrain()->getBrushSettings().falloff == BrushFalloff(n));
+						if (ImGui::Selectable(BrushKernels::falloffName(BrushFalloff(n)), is_selected))
+							model.getTerrain()->getBrushSettings().falloff = BrushFalloff(n);
 						if (is_selected) ImGui::SetItemDefaultFocus();
 					}
 					ImGui::EndCombo();
 				}
+				if (model.getTerrain()->getBrushSettings().falloff == BrushFalloff::Custom) {
+					for (int i = 0; i < BRUSH_CUSTOM_LUT_SIZE; i++) {
+						if (i > 0) ImGui::SameLine();
+						ImGui::PushID(i);
+						ImGui::VSliderFloat("##falloff", ImVec2(18, 80), &model.getTerrain()->getBrushSettings().customFalloff[i], 0.0f, 1.0f, "");
+						ImGui::PopID();
+					}
+				}
 				for (int i = 0; i < 3; i++) ImGui::Spacing();
 				ImGui::SliderFloat("Blend Radius (from center) ", &model.getTerrain()->getBrushSettings().blendRadius, 0.0f, model.getTerrain()->getBrushSettings().brushRadius);
 				ImGui::SliderFloat("Max Blend Value", &model.getTerrain()->getBrushSettings().maxBlendValue, 3.0f, 10.0f);
 				for (int i = 0; i < 5; i++) ImGui::Spacing();
+				ImGui::Text("Bursh Stamp Settings:");
+				for (int i = 0; i < 3; i++) ImGui::Spacing();
+				ImGui::InputText("Stamp Image", &model.getTerrain()->getBrushSettings().stampPath[0], model.getTerrain()->getBrushSettings().stampPath.size(), ImGuiInputTextFlags_ReadOnly | ImGuiInputTextFlags_EnterReturnsTrue);
+				if (ImGui::IsItemClicked()) {
+					window.openFile(model.getTerrain()->getBrushSettings().stampPath, { { L"Image files", L"*.png;*.jpg;*.bmp;*.tga" } });
+					model.getTerrain()->loadStampImage(model.getTerrain()->getBrushSettings().stampPath);
+				}
+				if (model.getTerrain()->getStampBrush().isLoaded()) {
+					ImGui::Checkbox("Use Stamp", &model.getTerrain()->getBrushSettings().bUseStamp);
+					ImGui::SliderFloat("Stamp Rotation: ", &model.getTerrain()->getBrushSettings().stampRotation, -180.0f, 180.0f);
+					ImGui::SliderFloat("Stamp Scale: ", &model.getTerrain()->getBrushSettings().stampScale, 0.1f, 5.0f);
+					ImGui::SliderFloat("Stamp Strength: ", &model.getTerrain()->getBrushSettings().stampStrength, 0.0f, 5.0f);
+				}
+				for (int i = 0; i < 5; i++) ImGui::Spacing();
 				if (ImGui::Button("Reset to Defaults")) model.getTerrain()->resetBurshToDefaults();
+				ImGui::SameLine();
+				if (ImGui::Button("Clear Stored Selection")) model.getTerrain()->clearStoredSelection();
+				ImGui::PopItemWidth();
+				ImGui::EndTabItem();
+			}
+			if (ImGui::BeginTabItem("Operator Settings")) {
+				ImGui::PushItemWidth(200);
+				for (int i = 0; i < 3; i++) ImGui::Spacing();
+				NetOperatorSettings& operatorSettings = model.getTerrain()->getNetOperatorSettings();
+				if (ImGui::BeginCombo("Operator", ControlNetOperators::operatorName(operatorSettings.type))) {
+					for (int n = 0; n < NET_OPERATOR_COUNT; n++) {
+						bool is_selected = (operatorSettings.type == NetOperatorType(n));
+						if (ImGui::Selectable(ControlNetOperators::operatorName(NetOperatorType(n)), is_selected))
+							operatorSettings.type = NetOperatorType(n);
+						if (is_selected) ImGui::SetItemDefaultFocus();
+					}
+					ImGui::EndCombo();
+				}
+				for (int i = 0; i < 3; i++) ImGui::Spacing();
+				if (operatorSettings.type == NetOperatorType::LaplacianSmooth || operatorSettings.type == NetOperatorType::TaubinSmooth) {
+					ImGui::SliderInt("Iterations: ", &operatorSettings.iterations, 1, 50);
+					ImGui::SliderFloat("Lambda: ", &operatorSettings.lambda, 0.05f, 1.0f);
+					if (operatorSettings.type == NetOperatorType::TaubinSmooth) ImGui::SliderFloat("Mu: ", &operatorSettings.mu, -1.0f, -0.05f);
+				} else {
+					ImGui::SliderFloat("Strength: ", &operatorSettings.strength, 0.0f, 1.0f);
+					if (operatorSettings.type == NetOperatorType::Terrace) ImGui::SliderFloat("Terrace Height: ", &operatorSettings.terraceHeight, 0.05f, 2.0f);
+				}
+				for (int i = 0; i < 3; i++) ImGui::Spacing();
+				ImGui::Text("Applies to the stored selection, or the whole terrain if none");
+				if (ImGui::Button("Apply")) model.getTerrain()->applyNetOperator();
+				for (int i = 0; i < 3; i++) ImGui::Spacing();
+				ImGui::Text("Pins the stored selection and bends the rest as little as possible");
+				if (ImGui::Button("Fair Surface")) model.getTerrain()->fairSurface();
+				const ConjugateGradientResult& fairing = model.getTerrain()->getFairingSolver().getLastResult();
+				if (fairing.iterations > 0) ImGui::Text("Last fairing: %d iterations, residual %.1e", fairing.iterations, fairing.relativeResidual);
+				for (int i = 0; i < 5; i++) ImGui::Spacing();
+				ImGui::Text("Erosion:");
+				ErosionSettings& erosionSettings = model.getTerrain()->getErosionSettings();
+				ImGui::InputScalar("Erosion Seed", ImGuiDataType_U32, &erosionSettings.seed);
+				ImGui::SliderInt("Grid Resolution", &erosionSettings.resolution, 128, 2048);
+				ImGui::SliderInt("Droplets", &erosionSettings.droplets, 0, 5000000);
+				ImGui::SliderInt("Droplet Lifetime", &erosionSettings.maxLifetime, 5, 100);
+				ImGui::SliderFloat("Inertia", &erosionSettings.inertia, 0.0f, 0.95f);
+				ImGui::SliderFloat("Sediment Capacity", &erosionSettings.sedimentCapacity, 0.5f, 16.0f);
+				ImGui::SliderFloat("Erode Speed", &erosionSettings.erodeSpeed, 0.0f, 1.0f);
+				ImGui::SliderFloat("Deposit Speed", &erosionSettings.depositSpeed, 0.0f, 1.0f);
+				ImGui::SliderFloat("Evaporate Speed", &erosionSettings.evaporateSpeed, 0.0f, 0.5f);
+				ImGui::SliderInt("Thermal Iterations", &erosionSettings.thermalIterations, 0, 500);
+				ImGui::SliderFloat("Talus Angle", &erosionSettings.talusAngle, 5.0f, 80.0f);
+				if (model.getTerrain()->getErosionSimulator().isRunning()) {
+					ImGui::ProgressBar(model.getTerrain()->getErosionSimulator().getProgress(), ImVec2(200.0f, 0.0f));
+					ImGui::SameLine();
+					if (ImGui::Button("Cancel")) model.getTerrain()->cancelErosion();
+				} else {
+					if (ImGui::Button("Erode")) model.getTerrain()->startErosion();
+					if (model.getTerrain()->getErosionSimulator().getDropletRate() > 0.0) ImGui::Text("Last erosion: %.0f droplets/s", model.getTerrain()->getErosionSimulator().getDropletRate());
+				}
+				if (ImGui::Button("Reset Erosion to Defaults")) model.getTerrain()->resetErosionToDefaults();
+				for (int i = 0; i < 5; i++) ImGui::Spacing();
+				if (ImGui::Button("Reset to Defaults")) model.getTerrain()->resetNetOperatorToDefaults();
+				ImGui::PopItemWidth();
+				ImGui::EndTabItem();
+			}
+			if (ImGui::BeginTabItem("World Settings")) {
+				ImGui::PushItemWidth(200);
+				for (int i = 0; i < 3; i++) ImGui::Spacing();
+				WorldSettings& worldSettings = model.getWorld()->getWorldSettings();
+				ImGui::Checkbox("Streamed World", &worldSettings.bEnabled);
+				for (int i = 0; i < 3; i++) ImGui::Spacing();
+				ImGui::Text("World Generation:");
+				if (ImGui::BeginCombo("World Noise", ProceduralTerrain::modeName(worldSettings.noise.mode))) {
+					for (int n = 0; n < NOISE_MODE_COUNT; n++) {
+						bool is_selected = (worldSettings.noise.mode == NoiseMode(n));
+						if (ImGui::Selectable(ProceduralTerrain::modeName(NoiseMode(n)), is_selected)) {
+							worldSettings.noise.mode = NoiseMode(n);
+							worldSettings.bIsChanging = true;
+						}
+						if (is_selected) ImGui::SetItemDefaultFocus();
+					}
+					ImGui::EndCombo();
+				}
+				worldSettings.bIsChanging |= ImGui::InputScalar("World Seed", ImGuiDataType_U32, &worldSettings.noise.seed);
+				ImGui::SameLine();
+				if (ImGui::Button("Randomize World")) model.getWorld()->randomizeSeed();
+				worldSettings.bIsChanging |= ImGui::SliderInt("World Octaves", &worldSettings.noise.octaves, 1, 12);
+				worldSettings.bIsChanging |= ImGui::SliderFloat("World Frequency", &worldSettings.noise.frequency, 0.005f, 1.0f, "%.3f", ImGuiSliderFlags_Logarithmic);
+				worldSettings.bIsChanging |= ImGui::SliderFloat("World Min Height", &worldSettings.minHeight, -20.0f, worldSettings.maxHeight);
+				worldSettings.bIsChanging |= ImGui::SliderFloat("World Max Height", &worldSettings.maxHeight, worldSettings.minHeight, 60.0f);
+				worldSettings.bIsChanging |= ImGui::SliderFloat("Control Spacing", &worldSettings.controlSpacing, 0.25f, 8.0f);
+				worldSettings.bIsChanging |= ImGui::SliderInt("Patch Spans", &worldSettings.patchSpans, 4, 64);
+				worldSettings.bIsChanging |= ImGui::SliderInt("Patch Resolution", &worldSettings.patchResolution, 4, 128);
+				for (int i = 0; i < 3; i++) ImGui::Spacing();
+				ImGui::Text("Streaming:");
+				ImGui::SliderInt("View Radius", &worldSettings.viewRadius, 1, 16);
+				ImGui::SliderInt("Memory Budget (MB)", &worldSettings.memoryBudgetMB, 16, 2048);
+				ImGui::SliderInt("Patch Jobs In Flight", &worldSettings.maxJobsInFlight, 1, 64);
+				ImGui::SliderInt("Uploads Per Frame", &worldSettings.maxUploadsPerFrame, 1, 16);
+				const WorldStats& worldStats = model.getWorld()->getStats();
+				ImGui::Text("%d patches resident (%.1f MB), %d pending", worldStats.residentPatches, double(worldStats.residentBytes) / (1024.0 * 1024.0), worldStats.pendingPatches);
+				ImGui::Text("%llu generated, %llu evicted", (unsigned long long)worldStats.patchesGenerated, (unsigned long long)worldStats.patchesEvicted);
+				for (int i = 0; i < 5; i++) ImGui::Spacing();
+				if (ImGui::Button("Reset to Defaults")) model.getWorld()->resetWorldToDefaults();
 				ImGui::PopItemWidth();
 				ImGui::EndTabItem();
 			}
@@ -393,6 +685,72 @@ int main() {
 					window.openFile(model.getExportImportSettings().importFileLocation, { { L"NUBRS files", L"*.nobj" } });
 					model.importFromNObj(model.getExportImportSettings().importFileLocation);
 				}
+				for (int i = 0; i < 5; i++) ImGui::Spacing();
+				ImGui::Text("Heightmap Import:");
+				HeightmapImportSettings& heightmapSettings = model.getTerrain()->getHeightmapImportSettings();
+				ImGui::SliderInt("Heightmap Control Points", &heightmapSettings.nControlPoints, 6, 1000, "%d", ImGuiSliderFlags_Logarithmic);
+				ImGui::SliderFloat("Heightmap Min Height", &heightmapSettings.minHeight, -10.0f, heightmapSettings.maxHeight);
+				ImGui::SliderFloat("Heightmap Max Height", &heightmapSettings.maxHeight, heightmapSettings.minHeight, 30.0f);
+				ImGui::InputInt("RAW Width", &heightmapSettings.rawWidth);
+				ImGui::InputInt("RAW Height", &heightmapSettings.rawHeight);
+				if (ImGui::Button("Import Heightmap")) {
+					window.openFile(heightmapSettings.path, { { L"Heightmaps", L"*.png;*.raw;*.r16" } });
+					model.getTerrain()->importHeightmap();
+				}
+				const HeightmapFitResult& fitResult = model.getTerrain()->getHeightmapFitter().getLastResult();
+				if (fitResult.bSucceeded) {
+					ImGui::Text("%dx%d samples fitted in %.2fs", fitResult.width, fitResult.height, fitResult.seconds);
+					ImGui::Text("RMS error %.4f, max error %.4f", fitResult.rmsError, fitResult.maxError);
+				}
+				for (int i = 0; i < 5; i++) ImGui::Spacing();
+				ImGui::Text("Point Cloud Import:");
+				PointCloudImportSettings& pointCloudSettings = model.getTerrain()->getPointCloudImportSettings();
+				ImGui::SliderInt("Point Cloud Control Points", &pointCloudSettings.nControlPoints, 6, 1000, "%d", ImGuiSliderFlags_Logarithmic);
+				ImGui::SliderFloat("Point Cloud Min Height", &pointCloudSettings.minHeight, -10.0f, pointCloudSettings.maxHeight);
+				ImGui::SliderFloat("Point Cloud Max Height", &pointCloudSettings.maxHeight, pointCloudSettings.minHeight, 30.0f);
+				ImGui::SliderFloat("Smoothness", &pointCloudSettings.smoothness, 0.0001f, 1.0f, "%.4f", ImGuiSliderFlags_Logarithmic);
+				ImGui::Checkbox("Z Up", &pointCloudSettings.bZUp);
+				if (ImGui::Button("Import Point Cloud")) {
+					window.openFile(pointCloudSettings.path, { { L"Point clouds", L"*.xyz;*.txt;*.pts;*.ply;*.obj" } });
+					model.getTerrain()->importPointCloud();
+				}
+				const PointCloudFitResult& cloudResult = model.getTerrain()->getPointCloudFitter().getLastResult();
+				if (cloudResult.bSucceeded) {
+					ImGui::Text("%zu points fitted in %.2fs, %d iterations", cloudResult.numPoints, cloudResult.seconds, cloudResult.solver.iterations);
+					ImGui::Text("RMS error %.4f, max error %.4f", cloudResult.rmsError, cloudResult.maxError);
+				}
+				for (int i = 0; i < 5; i++) ImGui::Spacing();
+				ImGui::Text("Control Net Store:");
+				NetStoreSettings& storeSettings = model.getTerrain()->getNetStoreSettings();
+				ImGui::InputInt("Store Rows", &storeSettings.rows);
+				ImGui::InputInt("Store Columns", &storeSettings.cols);
+				ImGui::SliderFloat("Store Spacing", &storeSettings.spacing, 0.05f, 5.0f, "%.2f", ImGuiSliderFlags_Logarithmic);
+				ImGui::SliderInt("Store Window", &storeSettings.windowSize, 16, 1000, "%d", ImGuiSliderFlags_Logarithmic);
+				ImGui::SliderInt("Resident Tiles", &storeSettings.residentTiles, 9, 1024, "%d", ImGuiSliderFlags_Logarithmic);
+				if (ImGui::Button("Create Store")) {
+					// Saved next to the exports, under the export filename
+					ExportImportSettings& exportSettings = model.getExportImportSettings();
+					if (exportSettings.exportFileLocation.empty()) window.openDirectory(exportSettings.exportFileLocation);
+					if (!exportSettings.exportFileLocation.empty()) {
+						storeSettings.path = std::string(exportSettings.exportFileLocation.c_str()) + "/" + exportSettings.exportFileName.c_str() + ".cnet";
+						model.getTerrain()->createNetStore();
+					}
+				}
+				ImGui::SameLine();
+				if (ImGui::Button("Open Store")) {
+					window.openFile(storeSettings.path, { { L"Control net stores", L"*.cnet" } });
+					model.getTerrain()->openNetStore();
+				}
+				if (model.getTerrain()->hasNetStore()) {
+					ImGui::SameLine();
+					if (ImGui::Button("Flush Store")) model.getTerrain()->flushNetStore();
+					ImGui::SameLine();
+					if (ImGui::Button("Close Store")) model.getTerrain()->closeNetStore();
+					const ControlNetStore& netStore = model.getTerrain()->getNetStore();
+					const ControlNetStoreStats& storeStats = netStore.getStats();
+					ImGui::Text("%dx%d control points, %d of %d tiles written", netStore.getRows(), netStore.getCols(), storeStats.allocatedTiles, storeStats.tileCount);
+					ImGui::Text("%d tiles mapped, %d dirty, %llu paged in, %llu written back", storeStats.residentTiles, storeStats.dirtyTiles, (unsigned long long)storeStats.pageIns, (unsigned long long)storeStats.writeBacks);
+				}
 				ImGui::PopItemWidth();
 				ImGui::EndTabItem();
 			}
@@ -401,12 +759,16 @@ int main() {
 				for (int i = 0; i < 4; i++) ImGui::Spacing();
 				ImGui::Text("Hold RMB --- Pan camera / Rotate camera");
 				ImGui::Text("Hold LMB --- Raise/Lower Terrain");
+				ImGui::Text("Shift + LMB --- Add to stored selection");
+				ImGui::Text("Ctrl + LMB --- Remove from stored selection");
+				ImGui::Text("Alt + LMB --- Drag the surface point under the cursor");
 				ImGui::Text("W --- Move camera up");
 				ImGui::Text("A --- Move camera left");
 				ImGui::Text("S --- Move camera down");
 				ImGui::Text("D --- Move camera right");
 				ImGui::Text("E --- Reset selected control points");
 				ImGui::Text("R --- Reset selected control point weights");
+				ImGui::Text("Ctrl + Z / Ctrl + Y --- Undo / Redo");
 				for (int i = 0; i < 5; i++) ImGui::Spacing();
 				if (ImGui::Button("Tutorial Video")) window.openTutorialVideo();
 				ImGui::PopItemWidth();
@@ -420,13 +782,21 @@ int main() {
 		shader.use();
 		if (model.getPhongLighting().bIsChanging) inputManager->updateShadingUniforms(model);
 		inputManager->viewPipeline();
+		if (model.getWorld()->isEnabled()) model.getWorld()->update(inputManager->getCameraPosition());
 		model.render();
 
 		glDisable(GL_FRAMEBUFFER_SRGB);
 		ImGui::Render();
 		ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
 		window.swapBuffers();
-		window.getFrameRateLimitSettings().deltaTime -= window.getFrameRateLimitSettings().maxPeriod;
+
+		// Keep frames coming while something is animating or a setting changed this frame
+		bool bSettingsChanged = model.getPhongLighting().bIsChanging || model.getTerrain()->getTerrainSettings().bIsChanging || model.getTerrain()->getNURBSSettings().bIsChanging;
+		bool bWorldStreaming = model.getWorld()->isEnabled() && model.getWorld()->isStreaming();
+		if (inputManager->isAnimating() || bSettingsChanged || model.getTerrain()->isEroding() || bWorldStreaming) window.getFrameScheduler().requestRedraw();
+
+		inputManager->refreshInput();
+		window.getFrameScheduler().endFrame();
 	}
 
 	ImGui_ImplOpenGL3_Shutdown();